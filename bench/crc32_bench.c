@@ -0,0 +1,105 @@
+// CRC32 benchmark: throughput of every implementation, checked against zlib
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <zlib.h>
+
+#include "crc32.h"
+
+typedef uint32_t (*crc32_fn)(uint32_t, const unsigned char *, size_t);
+
+static const struct {
+    const char *name;
+    crc32_fn fn;
+} variants[] = {
+    { "bytewise", crc32_bytewise },
+    { "slice8", crc32_slice8 },
+    { "slice16", crc32_slice16 },
+    { "pclmul", crc32_pclmul },
+};
+
+// Function to read a monotonic clock in seconds
+static double now_seconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Function to check every variant against zlib over odd lengths and alignments
+static int verify(const unsigned char *data) {
+    for (size_t v = 0; v < sizeof(variants) / sizeof(variants[0]); v++) {
+        if (variants[v].fn == crc32_pclmul && !crc32_pclmul_supported()) {
+            continue;
+        }
+        for (size_t offset = 0; offset < 16; offset++) {
+            for (size_t len = 0; len < 1000; len += 7) {
+                uint32_t expected = crc32(0, data + offset, len);
+                // Split in two calls to check that a running CRC carries over
+                uint32_t got = variants[v].fn(variants[v].fn(0, data + offset, len / 3),
+                                              data + offset + len / 3, len - len / 3);
+                if (got != expected) {
+                    printf("%s: mismatch at offset %zu length %zu (%08x != %08x)\n",
+                           variants[v].name, offset, len, got, expected);
+                    return 1;
+                }
+            }
+        }
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    size_t sizes[] = { 64, 4096, 65536, 1 << 20, 16 << 20 };
+    double seconds_per_case = argc > 1 ? atof(argv[1]) : 0.2;
+
+    unsigned char *data = malloc((16 << 20) + 16);
+    if (data == NULL) {
+        return 1;
+    }
+    srand(1);
+    for (size_t i = 0; i < (16 << 20) + 16; i++) {
+        data[i] = rand();
+    }
+
+    if (verify(data) != 0) {
+        return 1;
+    }
+
+    crc32_init();
+    printf("calc_crc32() uses: %s\n", crc32_implementation());
+    printf("%-10s", "size");
+    for (size_t v = 0; v < sizeof(variants) / sizeof(variants[0]); v++) {
+        printf(" %10s", variants[v].name);
+    }
+    printf(" %10s   (GB/s)\n", "zlib");
+
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        printf("%-10zu", sizes[s]);
+        for (size_t v = 0; v <= sizeof(variants) / sizeof(variants[0]); v++) {
+            int is_zlib = v == sizeof(variants) / sizeof(variants[0]);
+            if (!is_zlib && variants[v].fn == crc32_pclmul && !crc32_pclmul_supported()) {
+                printf(" %10s", "n/a");
+                continue;
+            }
+
+            // Repeat until the case has run long enough to time reliably
+            volatile uint32_t sink = 0;
+            size_t bytes = 0;
+            double start = now_seconds();
+            double elapsed;
+            do {
+                for (int i = 0; i < 16; i++) {
+                    sink ^= is_zlib ? crc32(0, data, sizes[s]) : variants[v].fn(0, data, sizes[s]);
+                    bytes += sizes[s];
+                }
+                elapsed = now_seconds() - start;
+            } while (elapsed < seconds_per_case);
+            printf(" %10.2f", bytes / elapsed / 1e9);
+        }
+        printf("\n");
+    }
+
+    free(data);
+    return 0;
+}
@@ -0,0 +1,25 @@
+#!/bin/sh
+# I/O engine benchmark: the same workloads against the epoll and io_uring engines
+# Usage: io_bench.sh <bin dir> [seconds per run] [connections]
+set -e
+
+BIN_DIR=${1:-bin}
+SECONDS_PER_RUN=${2:-5}
+CONNECTIONS=${3:-64}
+
+FILES=$(mktemp -d)
+trap 'kill $SERVER 2>/dev/null || true; rm -rf "$FILES"' EXIT
+head -c 1024 /dev/urandom > "$FILES/small.bin"
+head -c 1048576 /dev/urandom > "$FILES/large.bin"
+
+for MODEL in epoll uring; do
+    "$BIN_DIR/http_server" --model=$MODEL --directory "$FILES" --access-log /dev/null --max-requests 1000000000 > "$FILES/server.log" 2>&1 &
+    SERVER=$!
+    sleep 0.5
+    grep "model)" "$FILES/server.log" || grep "unavailable" "$FILES/server.log"
+    for TARGET in /echo/hello /files/small.bin /files/large.bin; do
+        "$BIN_DIR/loadgen" -c "$CONNECTIONS" -d "$SECONDS_PER_RUN" "$TARGET"
+    done
+    kill $SERVER
+    wait $SERVER 2>/dev/null || true
+done
@@ -0,0 +1,526 @@
+// HTTP load generator: keep-alive (or one request per connection) clients over loopback, reporting
+// throughput and latency percentiles
+// Closed loop: each connection sends its next request as soon as the previous response is complete
+// Open loop (-r): requests are scheduled at a fixed rate whether or not the server keeps up, and latency
+// is measured from the scheduled time so a stalled server is not hidden by fewer requests being sent
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+
+#define RESPONSE_HEADER_MAX 8192
+
+// Scheduled requests waiting for a free connection in open-loop mode
+#define BACKLOG_SIZE (1 << 20)
+
+struct client {
+    int fd;
+    int busy;
+    size_t request_sent;
+    char headers[RESPONSE_HEADER_MAX];
+    size_t headers_len;
+    int headers_done;
+    long body_remaining;            // Content-Length bytes still to come, -1 for a chunked body
+    char chunk_tail[5];             // Last bytes seen of a chunked body, to find "0\r\n\r\n" across reads
+    double started;                 // When the request was sent, or was scheduled in open-loop mode
+};
+
+// Command line settings
+static const char *name = NULL;
+static const char *method = "GET";
+static const char *path = NULL;
+static int keep_alive = 1;
+static double rate = 0;             // Requests per second in open-loop mode, 0 for closed loop
+static size_t body_size = 0;
+static pid_t server_pid = 0;
+
+static struct sockaddr_in server_addr;
+static int epoll_fd = -1;
+static char *request = NULL;        // Shared by every connection, headers and body
+static size_t request_len = 0;
+
+static uint32_t *latencies = NULL;
+static size_t latency_count = 0;
+static size_t latency_capacity = 0;
+static unsigned long errors = 0;
+static unsigned long reconnects = 0;
+
+// Open-loop state: connections with nothing to send, and scheduled times nobody could take yet
+static struct client **idle_clients = NULL;
+static int idle_count = 0;
+static double *backlog = NULL;
+static size_t backlog_head = 0;
+static size_t backlog_tail = 0;
+static unsigned long backlog_dropped = 0;
+
+// Function to read a monotonic clock in seconds
+static double now_seconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Function to open a connection, watched in both directions
+static int connect_client(struct client *c) {
+    c->fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (c->fd == -1 || connect(c->fd, (struct sockaddr *)&server_addr, sizeof(server_addr)) == -1) {
+        perror("connect");
+        return -1;
+    }
+    int one = 1;
+    setsockopt(c->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    fcntl(c->fd, F_SETFL, O_NONBLOCK);
+
+    struct epoll_event ev = { .events = EPOLLIN | EPOLLOUT | EPOLLET, .data.ptr = c };
+    return epoll_ctl(epoll_fd, EPOLL_CTL_ADD, c->fd, &ev);
+}
+
+// Function to replace a connection, closed by the server or after each request without keep-alive
+static void reconnect_client(struct client *c) {
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, c->fd, NULL);
+    close(c->fd);
+    if (connect_client(c) == -1) {
+        exit(1);
+    }
+}
+
+// Function to send what is left of the request
+static int send_request(struct client *c) {
+    while (c->request_sent < request_len) {
+        ssize_t sent = send(c->fd, request + c->request_sent, request_len - c->request_sent, MSG_NOSIGNAL);
+        if (sent < 0) {
+            return errno == EAGAIN ? 0 : -1;
+        }
+        c->request_sent += sent;
+    }
+    return 0;
+}
+
+// Function to start a request on a connection, latency counts from started
+static int start_request(struct client *c, double started) {
+    c->busy = 1;
+    c->request_sent = 0;
+    c->headers_len = 0;
+    c->headers_done = 0;
+    memset(c->chunk_tail, 0, sizeof(c->chunk_tail));
+    c->started = started;
+    return send_request(c);
+}
+
+// Function to record a complete response
+static void record_latency(struct client *c) {
+    if (latency_count == latency_capacity) {
+        latency_capacity = latency_capacity ? latency_capacity * 2 : 65536;
+        latencies = realloc(latencies, latency_capacity * sizeof(*latencies));
+        if (latencies == NULL) {
+            exit(1);
+        }
+    }
+    latencies[latency_count++] = (uint32_t)((now_seconds() - c->started) * 1e6);
+}
+
+// Function to account for body bytes, returns 1 once the body is complete
+static int consume_body(struct client *c, const char *data, size_t len) {
+    if (c->body_remaining >= 0) {
+        c->body_remaining -= len;
+        return c->body_remaining <= 0;
+    }
+
+    // Chunked: the body ends with the last chunk "0\r\n\r\n"
+    char window[sizeof(c->chunk_tail) * 2];
+    size_t take = len < sizeof(c->chunk_tail) ? len : sizeof(c->chunk_tail);
+    memcpy(window, c->chunk_tail, sizeof(c->chunk_tail));
+    memcpy(window + sizeof(c->chunk_tail), data + len - take, take);
+    memcpy(c->chunk_tail, window + take, sizeof(c->chunk_tail));
+    return memcmp(c->chunk_tail, "0\r\n\r\n", 5) == 0;
+}
+
+// Function to parse the status line and framing headers once they are buffered
+// Returns the offset of the body, 0 while incomplete and -1 on a malformed response
+static long parse_headers(struct client *c) {
+    char *end = memmem(c->headers, c->headers_len, "\r\n\r\n", 4);
+    if (end == NULL) {
+        return c->headers_len == sizeof(c->headers) ? -1 : 0;
+    }
+    *end = '\0';
+    if (strncmp(c->headers, "HTTP/1.1 2", 10) != 0 && strncmp(c->headers, "HTTP/1.1 3", 10) != 0) {
+        errors++;
+    }
+
+    c->body_remaining = 0;
+    for (char *line = strstr(c->headers, "\r\n"); line != NULL; line = strstr(line + 2, "\r\n")) {
+        if (strncasecmp(line + 2, "Content-Length:", 15) == 0) {
+            c->body_remaining = atol(line + 17);
+        } else if (strncasecmp(line + 2, "Transfer-Encoding: chunked", 26) == 0) {
+            c->body_remaining = -1;
+        }
+    }
+    return end + 4 - c->headers;
+}
+
+// Function to read everything available, returns 1 when a response completed and -1 on error
+static int read_response(struct client *c) {
+    char buffer[65536];
+    while (1) {
+        ssize_t received = recv(c->fd, buffer, sizeof(buffer), 0);
+        if (received < 0) {
+            return errno == EAGAIN ? 0 : -1;
+        }
+        if (received == 0) {
+            return -1;
+        }
+
+        const char *body = buffer;
+        size_t body_len = received;
+        if (!c->headers_done) {
+            size_t take = sizeof(c->headers) - c->headers_len;
+            take = take < (size_t)received ? take : (size_t)received;
+            size_t before = c->headers_len;
+            memcpy(c->headers + c->headers_len, buffer, take);
+            c->headers_len += take;
+            long body_offset = parse_headers(c);
+            if (body_offset < 0) {
+                return -1;
+            }
+            if (body_offset == 0) {
+                continue;
+            }
+            c->headers_done = 1;
+            body = buffer + (body_offset - before);
+            body_len = received - (body_offset - before);
+            if (c->body_remaining == 0) {
+                return 1;
+            }
+        }
+        if (body_len > 0 && consume_body(c, body, body_len)) {
+            return 1;
+        }
+    }
+}
+
+// Function to give a connection whose response just completed its next request
+// Closed loop sends right away, open loop takes the oldest scheduled request or waits idle for one
+static int next_request(struct client *c) {
+    double started = now_seconds();
+    if (!keep_alive) {
+        // The new connection is part of the next request's latency
+        reconnect_client(c);
+    }
+    if (rate == 0) {
+        return start_request(c, started);
+    }
+    if (backlog_head != backlog_tail) {
+        return start_request(c, backlog[backlog_head++ % BACKLOG_SIZE]);
+    }
+    c->busy = 0;
+    idle_clients[idle_count++] = c;
+    return 0;
+}
+
+// Function to move a connection forward after an event
+static void process_client(struct client *c) {
+    if (!c->busy) {
+        return;
+    }
+    int status = send_request(c);
+    while (status == 0 && (status = read_response(c)) == 1) {
+        record_latency(c);
+        status = next_request(c);
+        if (!c->busy) {
+            return;
+        }
+    }
+    if (status < 0) {
+        // Closed by the server (e.g. --max-requests), retry the request on a new connection
+        reconnects++;
+        reconnect_client(c);
+        start_request(c, c->started);
+    }
+}
+
+// Function to hand out every request whose scheduled time has come, queueing those no connection can take
+static void issue_scheduled(double *next_send, double interval) {
+    double now = now_seconds();
+    while (*next_send <= now) {
+        if (idle_count > 0) {
+            struct client *c = idle_clients[--idle_count];
+            if (start_request(c, *next_send) < 0) {
+                process_client(c);
+            }
+        } else if (backlog_tail - backlog_head < BACKLOG_SIZE) {
+            backlog[backlog_tail++ % BACKLOG_SIZE] = *next_send;
+        } else {
+            backlog_dropped++;
+        }
+        *next_send += interval;
+    }
+}
+
+// Function to wake the event loop at the next scheduled send
+static void arm_timer(int timer_fd, double when) {
+    struct itimerspec its;
+    memset(&its, 0, sizeof(its));
+    its.it_value.tv_sec = (time_t)when;
+    its.it_value.tv_nsec = (long)((when - (time_t)when) * 1e9);
+    timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &its, NULL);
+}
+
+// Function to read the user plus system CPU time of the server process in seconds
+static double server_cpu_seconds() {
+    char file[64];
+    snprintf(file, sizeof(file), "/proc/%d/stat", (int)server_pid);
+    FILE *f = fopen(file, "r");
+    if (f == NULL) {
+        return 0;
+    }
+    char line[1024];
+    double seconds = 0;
+    if (fgets(line, sizeof(line), f) != NULL) {
+        // utime and stime are fields 14 and 15, counted from the state after the "(comm)" field
+        char *p = strrchr(line, ')');
+        unsigned long utime, stime;
+        if (p != NULL && sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu", &utime, &stime) == 2) {
+            seconds = (double)(utime + stime) / sysconf(_SC_CLK_TCK);
+        }
+    }
+    fclose(f);
+    return seconds;
+}
+
+// Function to read a memory figure of the server process in kB ("VmRSS", "VmHWM")
+static long server_memory_kb(const char *field) {
+    char file[64];
+    snprintf(file, sizeof(file), "/proc/%d/status", (int)server_pid);
+    FILE *f = fopen(file, "r");
+    if (f == NULL) {
+        return 0;
+    }
+    char line[256];
+    long kb = 0;
+    size_t field_len = strlen(field);
+    while (fgets(line, sizeof(line), f) != NULL) {
+        if (strncmp(line, field, field_len) == 0 && line[field_len] == ':') {
+            kb = atol(line + field_len + 1);
+            break;
+        }
+    }
+    fclose(f);
+    return kb;
+}
+
+// Function to compare latencies for qsort()
+static int compare_latency(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *)a;
+    uint32_t y = *(const uint32_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+// Function to look up a percentile of the sorted latencies
+static uint32_t percentile(double p) {
+    if (latency_count == 0) {
+        return 0;
+    }
+    size_t index = (size_t)(p / 100 * (latency_count - 1));
+    return latencies[index];
+}
+
+// Function to build the request every connection sends, with a body_size byte body for uploads
+static int build_request(const char *extra_headers) {
+    char head[2048];
+    int head_len = snprintf(head, sizeof(head), "%s %s HTTP/1.1\r\nHost: localhost\r\n%s%s", method, path,
+                            keep_alive ? "" : "Connection: close\r\n", extra_headers);
+    if (head_len > 0 && (size_t)head_len < sizeof(head) && body_size > 0) {
+        head_len += snprintf(head + head_len, sizeof(head) - head_len, "Content-Length: %zu\r\n", body_size);
+    }
+    if (head_len < 0 || (size_t)head_len + 2 >= sizeof(head)) {
+        return -1;
+    }
+    memcpy(head + head_len, "\r\n", 2);
+    head_len += 2;
+
+    request_len = head_len + body_size;
+    request = malloc(request_len);
+    if (request == NULL) {
+        return -1;
+    }
+    memcpy(request, head, head_len);
+    for (size_t i = 0; i < body_size; i++) {
+        request[head_len + i] = 'a' + i % 26;
+    }
+    return 0;
+}
+
+static void usage(const char *program) {
+    printf("Usage: %s [-c connections] [-d seconds] [-p port] [-r requests/s] [-m method] [-b body bytes]\n"
+           "       [-H header]... [-k 0|1] [-s server pid] [-n name] [-j] <path>\n", program);
+}
+
+int main(int argc, char *argv[]) {
+    int connections = 32;
+    double duration = 5;
+    int port = 4221;
+    int json = 0;
+    char extra_headers[512] = "";
+    int opt;
+    while ((opt = getopt(argc, argv, "c:d:p:r:m:b:H:k:s:n:j")) != -1) {
+        switch (opt) {
+        case 'c':
+            connections = atoi(optarg);
+            break;
+        case 'd':
+            duration = atof(optarg);
+            break;
+        case 'p':
+            port = atoi(optarg);
+            break;
+        case 'r':
+            rate = atof(optarg);
+            break;
+        case 'm':
+            method = optarg;
+            break;
+        case 'b':
+            body_size = strtoul(optarg, NULL, 10);
+            break;
+        case 'H':
+            if (strlen(extra_headers) + strlen(optarg) + 3 > sizeof(extra_headers)) {
+                usage(argv[0]);
+                return 1;
+            }
+            strcat(extra_headers, optarg);
+            strcat(extra_headers, "\r\n");
+            break;
+        case 'k':
+            keep_alive = atoi(optarg);
+            break;
+        case 's':
+            server_pid = atoi(optarg);
+            break;
+        case 'n':
+            name = optarg;
+            break;
+        case 'j':
+            json = 1;
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (optind != argc - 1 || connections < 1 || rate < 0) {
+        usage(argv[0]);
+        return 1;
+    }
+    path = argv[optind];
+    if (name == NULL) {
+        name = path;
+    }
+    if (build_request(extra_headers) == -1) {
+        printf("Request headers too long\n");
+        return 1;
+    }
+
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_port = htons(port);
+    server_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    int timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    struct client *clients = calloc(connections, sizeof(*clients));
+    idle_clients = calloc(connections, sizeof(*idle_clients));
+    backlog = rate > 0 ? malloc(BACKLOG_SIZE * sizeof(*backlog)) : NULL;
+    if (epoll_fd == -1 || timer_fd == -1 || clients == NULL || idle_clients == NULL || (rate > 0 && backlog == NULL)) {
+        return 1;
+    }
+    struct epoll_event timer_ev = { .events = EPOLLIN, .data.ptr = NULL };
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, timer_fd, &timer_ev);
+
+    for (int i = 0; i < connections; i++) {
+        if (connect_client(&clients[i]) == -1) {
+            return 1;
+        }
+        idle_clients[idle_count++] = &clients[i];
+
+        // Give the server a chance to accept, its listen backlog is short
+        usleep(1000);
+    }
+
+    double cpu_before = server_pid ? server_cpu_seconds() : 0;
+    double start = now_seconds();
+    double end = start + duration;
+    double interval = rate > 0 ? 1 / rate : 0;
+    double next_send = start;
+    if (rate == 0) {
+        while (idle_count > 0) {
+            struct client *c = idle_clients[--idle_count];
+            if (start_request(c, now_seconds()) < 0) {
+                process_client(c);
+            }
+        }
+    }
+
+    struct epoll_event events[256];
+    while (now_seconds() < end) {
+        if (rate > 0) {
+            issue_scheduled(&next_send, interval);
+            arm_timer(timer_fd, next_send);
+        }
+        int count = epoll_wait(epoll_fd, events, 256, 100);
+        for (int i = 0; i < count; i++) {
+            struct client *c = events[i].data.ptr;
+            if (c == NULL) {
+                uint64_t expirations;
+                if (read(timer_fd, &expirations, sizeof(expirations)) < 0) {
+                    // Nothing to drain, the schedule is checked on every pass anyway
+                }
+                continue;
+            }
+            process_client(c);
+        }
+    }
+    double elapsed = now_seconds() - start;
+    double cpu_seconds = server_pid ? server_cpu_seconds() - cpu_before : 0;
+
+    // Scheduled requests that never got a connection, the server fell behind the offered rate
+    unsigned long unsent = backlog_tail - backlog_head + backlog_dropped;
+
+    qsort(latencies, latency_count, sizeof(*latencies), compare_latency);
+    double rps = latency_count / elapsed;
+    double cpu_us_per_request = latency_count ? cpu_seconds * 1e6 / latency_count : 0;
+    long rss_kb = server_pid ? server_memory_kb("VmRSS") : 0;
+    long peak_rss_kb = server_pid ? server_memory_kb("VmHWM") : 0;
+    uint32_t max_us = latency_count ? latencies[latency_count - 1] : 0;
+    if (json) {
+        printf("{\"name\":\"%s\",\"method\":\"%s\",\"path\":\"%s\",\"mode\":\"%s\",\"connections\":%d,"
+               "\"keep_alive\":%s,\"target_rps\":%.0f,\"duration_s\":%.3f,\"requests\":%zu,\"errors\":%lu,"
+               "\"reconnects\":%lu,\"unsent\":%lu,\"rps\":%.1f,"
+               "\"latency_us\":{\"p50\":%u,\"p99\":%u,\"p999\":%u,\"max\":%u},"
+               "\"cpu_us_per_request\":%.2f,\"rss_kb\":%ld,\"peak_rss_kb\":%ld}\n",
+               name, method, path, rate > 0 ? "open" : "closed", connections, keep_alive ? "true" : "false", rate,
+               elapsed, latency_count, errors, reconnects, unsent, rps, percentile(50), percentile(99),
+               percentile(99.9), max_us, cpu_us_per_request, rss_kb, peak_rss_kb);
+        return 0;
+    }
+
+    printf("%-24s requests=%zu rps=%.0f p50_us=%u p99_us=%u p999_us=%u errors=%lu reconnects=%lu", name,
+           latency_count, rps, percentile(50), percentile(99), percentile(99.9), errors, reconnects);
+    if (rate > 0) {
+        printf(" unsent=%lu", unsent);
+    }
+    if (server_pid) {
+        printf(" cpu_us/req=%.2f rss_kb=%ld", cpu_us_per_request, rss_kb);
+    }
+    printf("\n");
+    return 0;
+}
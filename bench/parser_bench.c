@@ -0,0 +1,340 @@
+// Microbenchmark: legacy extract_* helpers vs the incremental parser, in cycles per request
+//
+// The parser runs once with each header scanning implementation (src/http_scan.c), after a check
+// that all of them parse every sample alike, whole and fed byte by byte
+//
+// The legacy functions below are the request helpers the server used before
+// src/http_parser.c, kept verbatim so both approaches do the same work per
+// request: find the path, the method, Accept-Encoding, User-Agent and the body.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <stdint.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "http_parser.h"
+#include "http_scan.h"
+
+// Function to extract the path from an HTTP request
+static char* extract_path(char* request) {
+    static char path[1024];
+    
+    // Initialize path buffer
+    memset(path, 0, sizeof(path));
+    
+    // Check if this is a GET or POST request
+    if (strncmp(request, "GET ", 4) == 0) {
+        // Find the end of the path (marked by space before HTTP version)
+        char* path_end = strchr(request + 4, ' ');
+        if (path_end) {
+            // Calculate the path length
+            int path_length = path_end - (request + 4);
+            // Extract the path
+            strncpy(path, request + 4, path_length);
+            path[path_length] = '\0';
+        }
+    } else if (strncmp(request, "POST ", 5) == 0) {
+        // Find the end of the path (marked by space before HTTP version)
+        char* path_end = strchr(request + 5, ' ');
+        if (path_end) {
+            // Calculate the path length
+            int path_length = path_end - (request + 5);
+            // Extract the path
+            strncpy(path, request + 5, path_length);
+            path[path_length] = '\0';
+        }
+    }
+    
+    return path;
+}
+
+// Function to determine if the request is a POST request
+static int is_post_request(char* request) {
+    return strncmp(request, "POST ", 5) == 0;
+}
+
+// Function to extract a header value from an HTTP request
+static char* extract_header_value(const char* request, const char* header_name) {
+    static char value[1024];
+    memset(value, 0, sizeof(value));
+    
+    // Create the header string to search for (case-insensitive)
+    char search_header[1024];
+    sprintf(search_header, "\r\n%s: ", header_name);
+    
+    // Convert search header to lowercase for case-insensitive search
+    for (int i = 0; search_header[i]; i++) {
+        search_header[i] = tolower(search_header[i]);
+    }
+    
+    // Create lowercase version of request for searching
+    char* lower_request = strdup(request);
+    for (int i = 0; lower_request[i]; i++) {
+        lower_request[i] = tolower(lower_request[i]);
+    }
+    
+    // Look for the header
+    char* header_pos = strstr(lower_request, search_header);
+    if (header_pos) {
+        // Calculate the position in the original request
+        int offset = header_pos - lower_request;
+        
+        // Get position after the header name and colon
+        const char* value_start = request + offset + strlen(search_header);
+        
+        // Find the end of the value (marked by CRLF)
+        const char* value_end = strstr(value_start, "\r\n");
+        if (value_end) {
+            // Calculate the value length
+            int value_length = value_end - value_start;
+            
+            // Extract the value
+            strncpy(value, value_start, value_length);
+            value[value_length] = '\0';
+        }
+    }
+    
+    // Free the temporary lowercase request
+    free(lower_request);
+    
+    return value;
+}
+
+// Function to check if client supports gzip encoding
+static int client_supports_gzip(const char* request) {
+    char* accept_encoding = extract_header_value(request, "Accept-Encoding");
+    
+    // Check if gzip is in the Accept-Encoding header
+    if (strstr(accept_encoding, "gzip") != NULL) {
+        return 1;
+    }
+    
+    return 0;
+}
+
+// Function to extract the request body from an HTTP request
+static char* extract_request_body(char* request, int* body_length) {
+    char* body_start = strstr(request, "\r\n\r\n");
+    if (body_start) {
+        body_start += 4; // Skip the \r\n\r\n
+        
+        // Get the Content-Length header
+        char* content_length_str = extract_header_value(request, "Content-Length");
+        if (content_length_str[0] != '\0') {
+            *body_length = atoi(content_length_str);
+            return body_start;
+        }
+    }
+    
+    *body_length = 0;
+    return NULL;
+}
+
+
+
+// Sample requests, from a bare curl GET to a browser GET, a cookie-heavy GET and a POST with a body
+static const char *samples[][2] = {
+    { "curl",
+      "GET /echo/hello HTTP/1.1\r\n"
+      "Host: localhost:4221\r\n"
+      "User-Agent: curl/7.88.1\r\n"
+      "Accept: */*\r\n"
+      "\r\n" },
+    { "browser",
+      "GET /files/index.html HTTP/1.1\r\n"
+      "Host: localhost:4221\r\n"
+      "Connection: keep-alive\r\n"
+      "Cache-Control: max-age=0\r\n"
+      "sec-ch-ua: \"Chromium\";v=\"124\", \"Google Chrome\";v=\"124\", \"Not-A.Brand\";v=\"99\"\r\n"
+      "sec-ch-ua-mobile: ?0\r\n"
+      "sec-ch-ua-platform: \"Linux\"\r\n"
+      "Upgrade-Insecure-Requests: 1\r\n"
+      "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/124.0.0.0 Safari/537.36\r\n"
+      "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,image/avif,image/webp,*/*;q=0.8\r\n"
+      "Sec-Fetch-Site: none\r\n"
+      "Sec-Fetch-Mode: navigate\r\n"
+      "Sec-Fetch-User: ?1\r\n"
+      "Sec-Fetch-Dest: document\r\n"
+      "Accept-Encoding: gzip, deflate, br, zstd\r\n"
+      "Accept-Language: en-US,en;q=0.9\r\n"
+      "\r\n" },
+    { "cookies",
+      "GET /files/app.js HTTP/1.1\r\n"
+      "Host: shop.example.com\r\n"
+      "Connection: keep-alive\r\n"
+      "sec-ch-ua: \"Chromium\";v=\"124\", \"Google Chrome\";v=\"124\", \"Not-A.Brand\";v=\"99\"\r\n"
+      "User-Agent: Mozilla/5.0 (Macintosh; Intel Mac OS X 10_15_7) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/124.0.0.0 Safari/537.36\r\n"
+      "Accept: */*\r\n"
+      "Referer: https://shop.example.com/products/category/outdoor-equipment?page=3&sort=price_asc&filter=in_stock\r\n"
+      "Accept-Encoding: gzip, deflate, br, zstd\r\n"
+      "Accept-Language: en-GB,en-US;q=0.9,en;q=0.8,de;q=0.7\r\n"
+      "Cookie: _ga=GA1.1.1523178361.1712345678; _gid=GA1.1.987654321.1712345678; _fbp=fb.1.1712345678901.1234567890; "
+      "session_id=s%3AeyJhbGciOiJIUzI1NiIsInR5cCI6IkpXVCJ9.eyJ1c2VyIjoiMTIzNDU2Nzg5MCIsImV4cCI6MTcxMjM0NTY3OH0"
+      ".dGhpcyBpcyBub3QgYSByZWFsIHNpZ25hdHVyZSBidXQgaXQgaXMgbG9uZyBlbm91Z2g; "
+      "cart=%7B%22items%22%3A%5B%7B%22sku%22%3A%22TENT-2P-GRN%22%2C%22qty%22%3A1%7D%2C%7B%22sku%22%3A%22STOVE-CMP"
+      "-01%22%2C%22qty%22%3A2%7D%2C%7B%22sku%22%3A%22LAMP-LED-200%22%2C%22qty%22%3A1%7D%5D%7D; "
+      "consent=%7B%22necessary%22%3Atrue%2C%22analytics%22%3Atrue%2C%22marketing%22%3Afalse%2C%22version%22%3A3%7D; "
+      "_hjSessionUser_123456=eyJpZCI6IjAxMjM0NTY3LTg5YWItY2RlZi0wMTIzLTQ1Njc4OWFiY2RlZiIsImNyZWF0ZWQiOjE3MTIzNDU2Nzh9; "
+      "_hjSession_123456=eyJpZCI6ImZlZGNiYTk4LTc2NTQtMzIxMC1mZWRjLWJhOTg3NjU0MzIxMCIsImMiOjE3MTIzNDU2Nzg5MDEsInMiOjB9; "
+      "recently_viewed=TENT-2P-GRN%2CSTOVE-CMP-01%2CLAMP-LED-200%2CBAG-SLP-20F%2CPAD-INF-REG%2CPOLE-TRK-ALU; "
+      "ab_tests=checkout_v2%3Ab%2Csearch_ranking%3Acontrol%2Cfree_shipping_banner%3Aa%2Cproduct_video%3Ab; "
+      "csrftoken=Zm9vYmFyYmF6cXV4cXV1eGNvcmdlZ3JhdWx0Z2FycGx5d2FsZG9mcmVkcGx1Z2h4eXp6eQ; theme=dark; currency=EUR; "
+      "locale=en_GB; tz=Europe%2FBerlin; last_login=1712345678; remember_me=1; _uetsid=0123456789abcdef0123456789abcdef; "
+      "_uetvid=fedcba9876543210fedcba9876543210; __cf_bm=aBcDeFgHiJkLmNoPqRsTuVwXyZ0123456789-1712345678-0-AbCdEfGhIjKlMnOpQr\r\n"
+      "Sec-Fetch-Site: same-origin\r\n"
+      "Sec-Fetch-Mode: no-cors\r\n"
+      "Sec-Fetch-Dest: script\r\n"
+      "If-None-Match: \"5f3c-18e9b2c4a10\"\r\n"
+      "If-Modified-Since: Fri, 05 Apr 2024 19:34:38 GMT\r\n"
+      "\r\n" },
+    { "post",
+      "POST /files/upload.txt HTTP/1.1\r\n"
+      "Host: localhost:4221\r\n"
+      "User-Agent: curl/7.88.1\r\n"
+      "Accept: */*\r\n"
+      "Content-Type: application/octet-stream\r\n"
+      "Content-Length: 32\r\n"
+      "\r\n"
+      "0123456789abcdef0123456789abcdef" },
+};
+
+// Header scanning implementations, the ones this CPU lacks are skipped
+static const char *implementations[] = { "scalar", "sse42", "avx2" };
+
+#define SAMPLE_COUNT (sizeof(samples) / sizeof(samples[0]))
+#define IMPLEMENTATION_COUNT (sizeof(implementations) / sizeof(implementations[0]))
+
+// Prevents the compiler from dropping the work
+static volatile size_t sink;
+
+// Function to read the time stamp counter, or a nanosecond clock where there is none
+static uint64_t now_cycles() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+}
+
+// What the server did per request before the parser
+static void run_legacy(char *request) {
+    char *path = extract_path(request);
+    int supports_gzip = client_supports_gzip(request);
+    int is_post = is_post_request(request);
+    char *user_agent = extract_header_value(request, "User-Agent");
+    int body_length = 0;
+    char *body = extract_request_body(request, &body_length);
+    sink += path[0] + supports_gzip + is_post + user_agent[0] + (body != NULL) + body_length;
+}
+
+// The same lookups through the parser
+static void run_parser(const char *request, size_t len) {
+    struct http_request req;
+    http_parser_init(&req);
+    if (http_parse_request(&req, request, len) != HTTP_PARSE_DONE) {
+        abort();
+    }
+    const struct http_slice *accept_encoding = http_get_header(&req, HTTP_HEADER_ACCEPT_ENCODING);
+    int supports_gzip = accept_encoding != NULL && http_slice_contains(request, *accept_encoding, "gzip");
+    int is_post = http_slice_equals(request, req.method, "POST");
+    const struct http_slice *user_agent = http_get_header(&req, HTTP_HEADER_USER_AGENT);
+    sink += req.path.length + supports_gzip + is_post + (user_agent ? user_agent->length : 0) + req.content_length;
+}
+
+// Function to parse a request in one call, or fed one byte more per call to exercise resuming
+static int parse_sample(struct http_request *req, const char *request, size_t len, int bytewise) {
+    memset(req, 0, sizeof(*req));
+    http_parser_init(req);
+    int status = HTTP_PARSE_INCOMPLETE;
+    for (size_t end = bytewise ? 1 : len; status == HTTP_PARSE_INCOMPLETE && end <= len; end++) {
+        status = http_parse_request(req, request, end);
+    }
+    return status;
+}
+
+// Function to check that every implementation parses every sample like the scalar one, whole or split
+static int verify() {
+    for (size_t i = 0; i < SAMPLE_COUNT; i++) {
+        size_t len = strlen(samples[i][1]);
+        struct http_request expected;
+        http_scan_select("scalar");
+        if (parse_sample(&expected, samples[i][1], len, 0) != HTTP_PARSE_DONE) {
+            printf("%s: not parsed\n", samples[i][0]);
+            return 1;
+        }
+        for (size_t v = 0; v < IMPLEMENTATION_COUNT; v++) {
+            if (http_scan_select(implementations[v]) == -1) {
+                continue;
+            }
+            for (int bytewise = 0; bytewise <= 1; bytewise++) {
+                struct http_request req;
+                if (parse_sample(&req, samples[i][1], len, bytewise) != HTTP_PARSE_DONE
+                    || memcmp(&req, &expected, sizeof(req)) != 0) {
+                    printf("%s: %s parses it differently%s\n", samples[i][0], implementations[v],
+                           bytewise ? " when fed byte by byte" : "");
+                    return 1;
+                }
+            }
+        }
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    long iterations = argc > 1 ? atol(argv[1]) : 200000;
+
+    if (verify() != 0) {
+        return 1;
+    }
+
+    // Cycles per request: legacy helpers, then the parser with each header scanning implementation
+    printf("%-8s %6s %10s", "request", "bytes", "legacy");
+    for (size_t v = 0; v < IMPLEMENTATION_COUNT; v++) {
+        printf(" %10s", implementations[v]);
+    }
+    printf(" %8s\n", "speedup");
+
+    for (size_t i = 0; i < SAMPLE_COUNT; i++) {
+        char request[4096];
+        size_t len = strlen(samples[i][1]);
+        memcpy(request, samples[i][1], len + 1);
+
+        uint64_t start = now_cycles();
+        for (long n = 0; n < iterations; n++) {
+            run_legacy(request);
+        }
+        printf("%-8s %6zu %10.0f", samples[i][0], len, (double)(now_cycles() - start) / iterations);
+
+        double scalar = 0;
+        double best = 0;
+        for (size_t v = 0; v < IMPLEMENTATION_COUNT; v++) {
+            if (http_scan_select(implementations[v]) == -1) {
+                printf(" %10s", "-");
+                continue;
+            }
+            start = now_cycles();
+            for (long n = 0; n < iterations; n++) {
+                run_parser(request, len);
+            }
+            double cycles = (double)(now_cycles() - start) / iterations;
+            if (v == 0) {
+                scalar = cycles;
+            }
+            best = best == 0 || cycles < best ? cycles : best;
+            printf(" %10.0f", cycles);
+        }
+
+        // Widest kernels against the portable fallback
+        printf(" %7.2fx\n", scalar / best);
+    }
+
+    http_scan_init();
+    printf("Selected at startup: %s\n", http_scan_implementation());
+    return 0;
+}
@@ -0,0 +1,84 @@
+#!/bin/sh
+# Benchmark suite: every route with and without gzip and keep-alive, closed loop plus open-loop runs at a
+# fixed rate, written as a JSON array so results can be compared across commits
+# Usage: run_bench.sh <bin dir> [output file]
+# Environment: BENCH_SECONDS per run (3), BENCH_CONNECTIONS (32), BENCH_RATE for open loop (20000),
+# MODEL of the server (epoll), PORT (4221)
+set -e
+
+BIN_DIR=${1:-bin}
+OUTPUT=${2:-build/bench-$(git rev-parse --short HEAD 2>/dev/null || echo local).json}
+SECONDS_PER_RUN=${BENCH_SECONDS:-3}
+CONNECTIONS=${BENCH_CONNECTIONS:-32}
+RATE=${BENCH_RATE:-20000}
+MODEL=${MODEL:-epoll}
+PORT=${PORT:-4221}
+
+FILES=$(mktemp -d)
+RESULTS="$FILES/results"
+trap 'kill $SERVER 2>/dev/null || true; rm -rf "$FILES"' EXIT
+
+# Text files so gzip has something to compress
+mkdir "$FILES/www"
+yes "The quick brown fox jumps over the lazy dog, benchmark line" | head -c 1024 > "$FILES/www/small.txt"
+yes "The quick brown fox jumps over the lazy dog, benchmark line" | head -c 1048576 > "$FILES/www/large.txt"
+
+"$BIN_DIR/http_server" --model=$MODEL --directory "$FILES/www" --access-log /dev/null \
+    --max-requests 1000000000 --port $PORT > "$FILES/server.log" 2>&1 &
+SERVER=$!
+sleep 0.5
+if ! kill -0 $SERVER 2>/dev/null; then
+    cat "$FILES/server.log"
+    exit 1
+fi
+
+ECHO=/echo/$(yes abcdefghij | head -n 40 | tr -d '\n')
+
+# Function to run one load generator configuration and keep its JSON line
+# Usage: run <name> <loadgen options...> <path>
+run() {
+    RUN_NAME=$1
+    shift
+    "$BIN_DIR/loadgen" -j -s $SERVER -p $PORT -d "$SECONDS_PER_RUN" -n "$RUN_NAME" "$@" >> "$RESULTS"
+    tail -n 1 "$RESULTS" | sed -e 's/.*"name":"\([^"]*\)".*"requests":\([0-9]*\).*"rps":\([0-9.]*\).*"p50":\([0-9]*\),"p99":\([0-9]*\),"p999":\([0-9]*\).*"cpu_us_per_request":\([0-9.]*\),"rss_kb":\([0-9]*\).*/\1 \2 \3 \4 \5 \6 \7 \8/' |
+        awk '{ printf "%-32s requests=%-8s rps=%-9.0f p50_us=%-6s p99_us=%-6s p999_us=%-7s cpu_us/req=%-6s rss_kb=%s\n", $1, $2, $3, $4, $5, $6, $7, $8 }'
+}
+
+: > "$RESULTS"
+for GZIP in off on; do
+    for KEEP_ALIVE in 1 0; do
+        if [ $KEEP_ALIVE = 1 ]; then
+            SUFFIX=keepalive
+            C=$CONNECTIONS
+        else
+            # A new connection per request exhausts ephemeral ports quickly with many clients
+            SUFFIX=close
+            C=4
+        fi
+        if [ $GZIP = on ]; then
+            set -- -H "Accept-Encoding: gzip"
+            SUFFIX=$SUFFIX-gzip
+        else
+            set --
+        fi
+        run root-$SUFFIX -c $C -k $KEEP_ALIVE "$@" /
+        run echo-$SUFFIX -c $C -k $KEEP_ALIVE "$@" "$ECHO"
+        run user-agent-$SUFFIX -c $C -k $KEEP_ALIVE "$@" -H "User-Agent: loadgen/1.0" /user-agent
+        run files-small-$SUFFIX -c $C -k $KEEP_ALIVE "$@" /files/small.txt
+        run files-large-$SUFFIX -c $C -k $KEEP_ALIVE "$@" /files/large.txt
+        run files-post-$SUFFIX -c $C -k $KEEP_ALIVE "$@" -m POST -b 4096 /files/upload.txt
+    done
+done
+
+# Open loop: latency at a fixed offered load, including time spent queued behind a slow server
+run open-echo-keepalive -c $CONNECTIONS -r "$RATE" "$ECHO"
+run open-files-small-keepalive -c $CONNECTIONS -r "$RATE" /files/small.txt
+
+mkdir -p "$(dirname "$OUTPUT")"
+{
+    echo "{\"commit\":\"$(git rev-parse HEAD 2>/dev/null || echo unknown)\",\"model\":\"$MODEL\","
+    echo "\"seconds_per_run\":$SECONDS_PER_RUN,\"runs\":["
+    sed -e '$!s/$/,/' "$RESULTS"
+    echo "]}"
+} > "$OUTPUT"
+echo "Results written to $OUTPUT"
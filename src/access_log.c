@@ -0,0 +1,247 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+#include "access_log.h"
+
+// Logging settings, configured from the command line
+int log_level = LOG_INFO;
+const char* access_log_path = "-";
+
+// Entries per worker, a power of two
+#define ACCESS_LOG_RING 2048
+
+// The writer wakes up at least this often, and as soon as the ring is half full
+#define ACCESS_LOG_FLUSH_MS 100
+
+// Formatted lines collected before each write()
+#define ACCESS_LOG_BATCH 65536
+
+// Single-producer single-consumer ring: the worker's event loop pushes, the writer thread pops
+// The indexes only grow, each on its own cache line so the two threads do not share one
+static struct access_log_entry ring[ACCESS_LOG_RING];
+static _Atomic uint64_t ring_head __attribute__((aligned(64)));    // Next slot to fill, written by the worker
+static _Atomic uint64_t ring_tail __attribute__((aligned(64)));    // Next slot to write, written by the writer
+static _Atomic uint64_t dropped_entries __attribute__((aligned(64)));
+
+static int log_fd = -1;
+static int wake_fd = -1;
+static int worker = 0;
+static pid_t worker_pid;
+
+// Helper to write a whole block, giving up on errors (the log never stalls the server)
+static void write_all(const char* data, size_t len) {
+    while (len > 0) {
+        ssize_t written = write(log_fd, data, len);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return;
+        }
+        data += written;
+        len -= written;
+    }
+}
+
+// Helper to copy a path into a line, escaping bytes that would break the line or the quotes
+static size_t escape_path(char* out, const char* path) {
+    static const char hex[] = "0123456789abcdef";
+    size_t len = 0;
+    for (const unsigned char* p = (const unsigned char*)path; *p; p++) {
+        if (*p < 0x20 || *p >= 0x7f || *p == '"' || *p == '\\') {
+            out[len++] = '\\';
+            out[len++] = 'x';
+            out[len++] = hex[*p >> 4];
+            out[len++] = hex[*p & 15];
+        } else {
+            out[len++] = *p;
+        }
+    }
+    return len;
+}
+
+// Helper to format one entry as a logfmt line
+static size_t format_entry(char* line, const struct access_log_entry* entry) {
+    // Timestamps repeat within a second, gmtime_r() runs once per second
+    static time_t cached_second = -1;
+    static char cached_time[32];
+    if (entry->time.tv_sec != cached_second) {
+        struct tm tm;
+        gmtime_r(&entry->time.tv_sec, &tm);
+        strftime(cached_time, sizeof(cached_time), "%Y-%m-%dT%H:%M:%S", &tm);
+        cached_second = entry->time.tv_sec;
+    }
+
+    char path[ACCESS_LOG_PATH_LEN * 4];
+    size_t path_len = escape_path(path, entry->path);
+    return sprintf(line, "time=%s.%03ldZ worker=%d pid=%d method=%s path=\"%.*s\" status=%d bytes=%lu duration_us=%u\n",
+                   cached_time, entry->time.tv_nsec / 1000000, worker, worker_pid,
+                   entry->method[0] ? entry->method : "-", (int)path_len, path, entry->status,
+                   (unsigned long)entry->bytes, entry->duration_us);
+}
+
+// Helper to format and write everything queued so far, returns the number of entries written
+static size_t drain_ring(void) {
+    static char batch[ACCESS_LOG_BATCH];
+    static uint64_t reported_drops = 0;
+    size_t batch_len = 0;
+
+    uint64_t tail = atomic_load_explicit(&ring_tail, memory_order_relaxed);
+    uint64_t head = atomic_load_explicit(&ring_head, memory_order_acquire);
+    size_t count = head - tail;
+
+    for (; tail != head; tail++) {
+        // Longest line: fixed fields plus a fully escaped path
+        if (batch_len + 256 + ACCESS_LOG_PATH_LEN * 4 > sizeof(batch)) {
+            write_all(batch, batch_len);
+            batch_len = 0;
+        }
+        batch_len += format_entry(batch + batch_len, &ring[tail & (ACCESS_LOG_RING - 1)]);
+
+        // Hand the slot back as soon as it is formatted
+        atomic_store_explicit(&ring_tail, tail + 1, memory_order_release);
+    }
+
+    uint64_t drops = atomic_load_explicit(&dropped_entries, memory_order_relaxed);
+    if (drops != reported_drops) {
+        batch_len += sprintf(batch + batch_len, "access log: worker %d dropped %lu entries\n",
+                             worker, (unsigned long)(drops - reported_drops));
+        reported_drops = drops;
+    }
+
+    write_all(batch, batch_len);
+    return count;
+}
+
+// Function run by the writer thread
+static void* writer_main(void* arg) {
+    (void)arg;
+    struct pollfd pfd = { .fd = wake_fd, .events = POLLIN };
+    while (1) {
+        if (poll(&pfd, 1, ACCESS_LOG_FLUSH_MS) > 0) {
+            uint64_t wakeups;
+            if (read(wake_fd, &wakeups, sizeof(wakeups)) < 0) {
+                // Nothing to clear, the ring is drained either way
+            }
+        }
+        drain_ring();
+    }
+    return NULL;
+}
+
+// Function to open the log for this worker and start its writer thread
+int access_log_start(int worker_id, int background) {
+    worker = worker_id;
+    worker_pid = getpid();
+    if (log_level < LOG_INFO) {
+        return 0;
+    }
+
+    if (strcmp(access_log_path, "-") == 0) {
+        log_fd = STDOUT_FILENO;
+    } else {
+        log_fd = open(access_log_path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        if (log_fd == -1) {
+            printf("Failed to open access log %s: %s\n", access_log_path, strerror(errno));
+            return -1;
+        }
+    }
+
+    if (!background) {
+        return 0;
+    }
+
+    wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (wake_fd == -1) {
+        printf("Failed to create access log eventfd: %s\n", strerror(errno));
+        return -1;
+    }
+
+    pthread_t thread;
+    int error = pthread_create(&thread, NULL, writer_main, NULL);
+    if (error != 0) {
+        printf("Failed to start access log writer: %s\n", strerror(error));
+        close(wake_fd);
+        wake_fd = -1;
+        return -1;
+    }
+    pthread_detach(thread);
+    return 0;
+}
+
+// Function to start an entry when a request is dispatched
+void access_log_begin(struct access_log_entry* entry, const char* method, size_t method_len,
+                      const char* path, size_t path_len) {
+    if (log_level < LOG_INFO) {
+        return;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &entry->start);
+
+    if (method_len >= sizeof(entry->method)) {
+        method_len = sizeof(entry->method) - 1;
+    }
+    memcpy(entry->method, method, method_len);
+    entry->method[method_len] = '\0';
+
+    if (path_len >= sizeof(entry->path)) {
+        path_len = sizeof(entry->path) - 1;
+    }
+    memcpy(entry->path, path, path_len);
+    entry->path[path_len] = '\0';
+}
+
+// Function to complete an entry and push it to the ring
+void access_log_end(struct access_log_entry* entry, int status, uint64_t bytes) {
+    if (log_level < LOG_INFO) {
+        return;
+    }
+
+    // Both clocks come from the vDSO, no syscall on the request path
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    clock_gettime(CLOCK_REALTIME_COARSE, &entry->time);
+    entry->duration_us = (end.tv_sec - entry->start.tv_sec) * 1000000 + (end.tv_nsec - entry->start.tv_nsec) / 1000;
+    entry->status = status;
+    entry->bytes = bytes;
+
+    uint64_t head = atomic_load_explicit(&ring_head, memory_order_relaxed);
+    uint64_t tail = atomic_load_explicit(&ring_tail, memory_order_acquire);
+    if (head - tail == ACCESS_LOG_RING) {
+        if (wake_fd == -1) {
+            // No writer thread in this process, make room ourselves
+            drain_ring();
+        } else {
+            atomic_fetch_add_explicit(&dropped_entries, 1, memory_order_relaxed);
+            return;
+        }
+    }
+
+    ring[head & (ACCESS_LOG_RING - 1)] = *entry;
+    atomic_store_explicit(&ring_head, head + 1, memory_order_release);
+
+    // Wake the writer early once half the ring is queued, otherwise it drains on its timer
+    if (wake_fd != -1 && head + 1 - tail == ACCESS_LOG_RING / 2) {
+        uint64_t one = 1;
+        if (write(wake_fd, &one, sizeof(one)) < 0) {
+            // Counter is already non-zero, the writer is awake anyway
+        }
+    }
+}
+
+// Function to write the queued entries synchronously
+void access_log_flush(void) {
+    if (log_fd == -1 || wake_fd != -1) {
+        return;
+    }
+    worker_pid = getpid();
+    drain_ring();
+}
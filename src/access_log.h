@@ -0,0 +1,51 @@
+#ifndef ACCESS_LOG_H
+#define ACCESS_LOG_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+
+// Verbosity levels, each includes the ones before it
+#define LOG_ERROR 0     // Startup messages and failures only
+#define LOG_INFO 1      // Plus the access log (default)
+#define LOG_DEBUG 2     // Plus a trace of every request, including the raw request
+
+extern int log_level;
+
+// Access log destination, "-" for stdout
+extern const char* access_log_path;
+
+// Per-request trace, compiled in but skipped unless running with --log-level debug
+#define log_debug(...) do { if (log_level >= LOG_DEBUG) printf(__VA_ARGS__); } while (0)
+
+// Longest path kept in an access log entry, longer ones are truncated
+#define ACCESS_LOG_PATH_LEN 128
+
+// One answered request, filled in by the worker and formatted by the writer
+struct access_log_entry {
+    struct timespec start;          // Monotonic time the request was dispatched
+    struct timespec time;           // Wall-clock time the response was complete
+    uint64_t bytes;                 // Response bytes sent, headers included
+    uint32_t duration_us;
+    int status;
+    char method[8];
+    char path[ACCESS_LOG_PATH_LEN];
+};
+
+// Open the log, and start the background writer of the calling worker process when background is set
+// Without a writer (fork-model children inherit the log) entries are written by access_log_flush()
+// Returns -1 when the log cannot be opened or the writer cannot start
+int access_log_start(int worker_id, int background);
+
+// Record the method, path and start time of a request about to be answered
+void access_log_begin(struct access_log_entry* entry, const char* method, size_t method_len,
+                      const char* path, size_t path_len);
+
+// Complete an entry and queue it for the writer, never blocks
+// Entries are dropped (and counted) when the writer falls a whole ring behind
+void access_log_end(struct access_log_entry* entry, int status, uint64_t bytes);
+
+// Write the queued entries from the calling thread, when the process has no writer
+void access_log_flush(void);
+
+#endif
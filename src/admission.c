@@ -0,0 +1,146 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <sys/mman.h>
+
+#include "admission.h"
+#include "http.h"
+#include "workers.h"
+
+int max_connections = 4096;
+int max_connections_per_ip = 256;
+int header_timeout = 10;
+int body_timeout = 30;
+int write_timeout = 30;
+
+// Client addresses are hashed into buckets, addresses sharing a bucket share its limit
+// With this many buckets that takes thousands of distinct clients connected at once
+#define IP_BUCKETS 65536
+
+// No slot, when the per-IP limit is off
+#define NO_SLOT UINT32_MAX
+
+// Open connections, updated atomically by every worker and fork-model child
+struct admission_counters {
+    uint32_t connections;
+    uint32_t per_ip[IP_BUCKETS];
+};
+
+// Counters used until the shared ones are mapped
+static struct admission_counters local_counters;
+static struct admission_counters* counters = &local_counters;
+
+// Refusal sent without reading the request, it costs one send() and no allocation
+static const char service_unavailable[] =
+    "HTTP/1.1 503 Service Unavailable\r\nContent-Length: 0\r\nRetry-After: 1\r\nConnection: close\r\n\r\n";
+
+// Function to look up the limit of a timeout
+int timeout_seconds(int timeout) {
+    switch (timeout) {
+    case TIMEOUT_IDLE:
+        return keep_alive_timeout;
+    case TIMEOUT_HEADER:
+        return header_timeout;
+    case TIMEOUT_BODY:
+        return body_timeout;
+    default:
+        return write_timeout;
+    }
+}
+
+// Function to map the shared counters
+int admission_init() {
+    struct admission_counters* shared = mmap(NULL, sizeof(*shared), PROT_READ | PROT_WRITE,
+                                             MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (shared == MAP_FAILED) {
+        printf("Failed to map connection counters: %s\n", strerror(errno));
+        return -1;
+    }
+    counters = shared;
+    return 0;
+}
+
+// Helper to hash the client address into a bucket, IPv4-mapped IPv6 addresses count as IPv4
+static uint32_t address_bucket(const struct sockaddr* addr) {
+    const unsigned char* bytes = NULL;
+    size_t len = 0;
+    if (addr->sa_family == AF_INET) {
+        bytes = (const unsigned char*)&((const struct sockaddr_in*)addr)->sin_addr;
+        len = 4;
+    } else if (addr->sa_family == AF_INET6) {
+        const struct in6_addr* a6 = &((const struct sockaddr_in6*)addr)->sin6_addr;
+        bytes = a6->s6_addr;
+        len = 16;
+        if (IN6_IS_ADDR_V4MAPPED(a6)) {
+            bytes += 12;
+            len = 4;
+        }
+    }
+
+    // FNV-1a
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        hash = (hash ^ bytes[i]) * 16777619u;
+    }
+    return hash & (IP_BUCKETS - 1);
+}
+
+// Helper to turn a connection away
+static void refuse(int client_fd, int limit) {
+    send(client_fd, service_unavailable, sizeof(service_unavailable) - 1, MSG_DONTWAIT | MSG_NOSIGNAL);
+
+    // Closing with unread bytes resets the connection, which can destroy the 503 before the client reads it
+    char discard[1024];
+    ssize_t drained;
+    do {
+        drained = recv(client_fd, discard, sizeof(discard), MSG_DONTWAIT);
+    } while (drained > 0);
+    close(client_fd);
+    worker_stats->connections_rejected[limit]++;
+}
+
+// Function to count a new connection against the limits
+int admission_admit(int client_fd, const struct sockaddr* addr, socklen_t addr_len, uint32_t* slot) {
+    *slot = NO_SLOT;
+
+    uint32_t total = __atomic_add_fetch(&counters->connections, 1, __ATOMIC_RELAXED);
+    if (max_connections > 0 && total > (uint32_t)max_connections) {
+        __atomic_sub_fetch(&counters->connections, 1, __ATOMIC_RELAXED);
+        refuse(client_fd, LIMIT_GLOBAL);
+        return -1;
+    }
+    if (max_connections_per_ip <= 0) {
+        return 0;
+    }
+
+    struct sockaddr_storage peer;
+    if (addr == NULL || addr_len == 0) {
+        socklen_t peer_len = sizeof(peer);
+        if (getpeername(client_fd, (struct sockaddr*)&peer, &peer_len) == -1) {
+            // Nothing to count it against, the global limit still applies
+            return 0;
+        }
+        addr = (const struct sockaddr*)&peer;
+    }
+
+    uint32_t bucket = address_bucket(addr);
+    uint32_t count = __atomic_add_fetch(&counters->per_ip[bucket], 1, __ATOMIC_RELAXED);
+    if (count > (uint32_t)max_connections_per_ip) {
+        __atomic_sub_fetch(&counters->per_ip[bucket], 1, __ATOMIC_RELAXED);
+        __atomic_sub_fetch(&counters->connections, 1, __ATOMIC_RELAXED);
+        refuse(client_fd, LIMIT_PER_IP);
+        return -1;
+    }
+    *slot = bucket;
+    return 0;
+}
+
+// Function to release an admitted connection
+void admission_release(uint32_t slot) {
+    __atomic_sub_fetch(&counters->connections, 1, __ATOMIC_RELAXED);
+    if (slot != NO_SLOT) {
+        __atomic_sub_fetch(&counters->per_ip[slot], 1, __ATOMIC_RELAXED);
+    }
+}
@@ -0,0 +1,47 @@
+#ifndef ADMISSION_H
+#define ADMISSION_H
+
+#include <stdint.h>
+#include <sys/socket.h>
+
+// Open connections allowed across all workers and from one client address, 0 disables a limit
+extern int max_connections;
+extern int max_connections_per_ip;
+
+// Time limits in seconds, keep_alive_timeout covers a kept-alive connection waiting for its next request
+extern int header_timeout;      // From the first byte of a request until its headers are complete
+extern int body_timeout;        // Between two reads of an upload body
+extern int write_timeout;       // Between two writes of a response
+
+// Timeouts a connection can run into
+enum connection_timeout {
+    TIMEOUT_IDLE,
+    TIMEOUT_HEADER,
+    TIMEOUT_BODY,
+    TIMEOUT_WRITE,
+    TIMEOUT_COUNT
+};
+
+// Limits a connection can be refused for
+enum admission_limit {
+    LIMIT_GLOBAL,
+    LIMIT_PER_IP,
+    LIMIT_COUNT
+};
+
+// Seconds allowed before a timeout fires
+int timeout_seconds(int timeout);
+
+// Map the counters shared by workers and fork-model children, before any of them is forked
+int admission_init();
+
+// Count a freshly accepted connection against the limits, returns 0 when it is admitted
+// A refused connection gets a 503 and is closed here, before anything is allocated for it
+// addr may be NULL, the address is then looked up when the per-IP limit needs it
+// slot is handed back to admission_release() when the connection closes
+int admission_admit(int client_fd, const struct sockaddr* addr, socklen_t addr_len, uint32_t* slot);
+
+// Release an admitted connection
+void admission_release(uint32_t slot);
+
+#endif
@@ -0,0 +1,75 @@
+#include <stdlib.h>
+#include <stddef.h>
+
+#include "arena.h"
+#include "buffer_pool.h"
+#include "workers.h"
+
+#define ARENA_ALIGN _Alignof(max_align_t)
+
+// Header at the start of every pooled block
+struct arena_block {
+    struct arena_block* next;
+};
+
+// Header in front of an oversized allocation
+struct arena_large {
+    struct arena_large* next;
+    max_align_t data[];
+};
+
+// Bytes of a block available for allocations, after the aligned header
+#define BLOCK_HEADER ((sizeof(struct arena_block) + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1))
+#define BLOCK_CAPACITY (IO_BUFFER_SIZE - BLOCK_HEADER)
+
+// Function to start an empty arena
+void arena_init(struct arena* arena) {
+    arena->blocks = NULL;
+    arena->used = 0;
+    arena->large = NULL;
+}
+
+// Function to allocate from the arena
+void* arena_alloc(struct arena* arena, size_t size) {
+    size = (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+
+    if (size > BLOCK_CAPACITY) {
+        struct arena_large* large = malloc(sizeof(*large) + size);
+        if (large == NULL) {
+            return NULL;
+        }
+        large->next = arena->large;
+        arena->large = large;
+        worker_stats->arena_large_allocations++;
+        return large->data;
+    }
+
+    if (arena->blocks == NULL || arena->used + size > BLOCK_CAPACITY) {
+        struct arena_block* block = (struct arena_block*)io_buffer_get();
+        if (block == NULL) {
+            return NULL;
+        }
+        block->next = arena->blocks;
+        arena->blocks = block;
+        arena->used = 0;
+    }
+
+    void* memory = (char*)arena->blocks + BLOCK_HEADER + arena->used;
+    arena->used += size;
+    return memory;
+}
+
+// Function to release everything at once
+void arena_reset(struct arena* arena) {
+    while (arena->blocks != NULL) {
+        struct arena_block* next = arena->blocks->next;
+        io_buffer_put((char*)arena->blocks);
+        arena->blocks = next;
+    }
+    while (arena->large != NULL) {
+        struct arena_large* next = arena->large->next;
+        free(arena->large);
+        arena->large = next;
+    }
+    arena->used = 0;
+}
@@ -0,0 +1,24 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+// Bump allocator for memory that lives as long as one request
+// Blocks come from the I/O buffer pool and all go back on reset, so an idle connection holds none
+// Allocations larger than a block fall back to malloc() and are freed on reset
+struct arena {
+    struct arena_block* blocks;     // Current block first
+    size_t used;                    // Bytes handed out from the current block
+    struct arena_large* large;      // Oversized allocations
+};
+
+// Start an empty arena
+void arena_init(struct arena* arena);
+
+// Allocate size bytes aligned for any type, returns NULL when out of memory
+void* arena_alloc(struct arena* arena, size_t size);
+
+// Release everything allocated since the last reset
+void arena_reset(struct arena* arena);
+
+#endif
@@ -0,0 +1,48 @@
+#include <stdlib.h>
+
+#include "buffer_pool.h"
+#include "workers.h"
+
+// Buffers carved from one malloc() when the pool runs dry, slabs are kept for the life of the process
+#define IO_BUFFERS_PER_SLAB 16
+
+// A free buffer holds the link to the next one
+struct free_buffer {
+    struct free_buffer* next;
+};
+
+// One pool per thread, so taking and returning buffers needs no locking
+static __thread struct free_buffer* free_buffers = NULL;
+
+// Helper to add a fresh slab of buffers to the pool
+static int grow_pool() {
+    char* slab = malloc((size_t)IO_BUFFER_SIZE * IO_BUFFERS_PER_SLAB);
+    if (slab == NULL) {
+        return -1;
+    }
+    for (int i = 0; i < IO_BUFFERS_PER_SLAB; i++) {
+        io_buffer_put(slab + (size_t)i * IO_BUFFER_SIZE);
+    }
+    worker_stats->io_buffer_slabs++;
+    return 0;
+}
+
+// Function to take a buffer from the pool
+char* io_buffer_get() {
+    if (free_buffers == NULL && grow_pool() == -1) {
+        return NULL;
+    }
+    struct free_buffer* buffer = free_buffers;
+    free_buffers = buffer->next;
+    return (char*)buffer;
+}
+
+// Function to return a buffer to the pool
+void io_buffer_put(char* buffer) {
+    if (buffer == NULL) {
+        return;
+    }
+    struct free_buffer* free_buffer = (struct free_buffer*)buffer;
+    free_buffer->next = free_buffers;
+    free_buffers = free_buffer;
+}
@@ -0,0 +1,16 @@
+#ifndef BUFFER_POOL_H
+#define BUFFER_POOL_H
+
+#include <stddef.h>
+
+// Size of every pooled buffer: streamed body pieces, upload reads and arena blocks
+#define IO_BUFFER_SIZE 16384
+
+// Take a buffer from the calling thread's pool, carving a new slab when it is empty
+// Returns NULL when out of memory
+char* io_buffer_get();
+
+// Give a buffer back to the calling thread's pool, NULL is ignored
+void io_buffer_put(char* buffer);
+
+#endif
@@ -0,0 +1,125 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "conditional.h"
+
+// Cache-Control rules, configured from the command line
+#define MAX_CACHE_CONTROL_RULES 32
+#define MAX_CACHE_CONTROL_VALUE 256
+
+static struct {
+    char* prefix;
+    size_t prefix_len;
+    char* value;
+} cache_control_rules[MAX_CACHE_CONTROL_RULES];
+static int cache_control_rule_count;
+
+// Function to build the entity tag of a file version
+void format_etag(const struct stat* st, const char* suffix, char* etag) {
+    // Nanoseconds catch rewrites within the same second that keep the size
+    unsigned long long mtime = (unsigned long long)st->st_mtim.tv_sec * 1000000000ull + st->st_mtim.tv_nsec;
+    snprintf(etag, ETAG_SIZE, "\"%lx-%llx-%llx%s\"", (unsigned long)st->st_ino,
+             (unsigned long long)st->st_size, mtime, suffix);
+}
+
+// Function to format "Sun, 06 Nov 1994 08:49:37 GMT"
+void format_http_date(time_t t, char* date) {
+    struct tm tm;
+    gmtime_r(&t, &tm);
+    strftime(date, HTTP_DATE_SIZE, "%a, %d %b %Y %H:%M:%S GMT", &tm);
+}
+
+// Function to parse "Sun, 06 Nov 1994 08:49:37 GMT"
+time_t parse_http_date(const char* value, size_t len) {
+    char date[64];
+    if (len == 0 || len >= sizeof(date)) {
+        return -1;
+    }
+    memcpy(date, value, len);
+    date[len] = '\0';
+
+    struct tm tm;
+    memset(&tm, 0, sizeof(tm));
+    const char* rest = strptime(date, "%a, %d %b %Y %H:%M:%S GMT", &tm);
+    if (rest == NULL || *rest != '\0') {
+        return -1;
+    }
+    return timegm(&tm);
+}
+
+// Function to look for an entity tag in "*" or a comma-separated list
+int etag_list_matches(const char* value, size_t len, const char* etag, int weak) {
+    const char* p = value;
+    const char* end = value + len;
+    size_t etag_len = strlen(etag);
+
+    while (p < end) {
+        while (p < end && (*p == ' ' || *p == '\t' || *p == ',')) {
+            p++;
+        }
+        if (p == end) {
+            break;
+        }
+        if (*p == '*') {
+            return 1;
+        }
+
+        int is_weak = end - p >= 2 && p[0] == 'W' && p[1] == '/';
+        if (is_weak) {
+            p += 2;
+        }
+        if (p == end || *p != '"') {
+            return 0;
+        }
+        const char* close = memchr(p + 1, '"', end - p - 1);
+        if (close == NULL) {
+            return 0;
+        }
+        size_t tag_len = close + 1 - p;
+        if ((weak || !is_weak) && tag_len == etag_len && memcmp(p, etag, etag_len) == 0) {
+            return 1;
+        }
+        p = close + 1;
+    }
+    return 0;
+}
+
+// Function to add a "<prefix>=<value>" rule
+int add_cache_control_rule(const char* spec) {
+    const char* equals = strchr(spec, '=');
+    if (equals == NULL || equals == spec || equals[1] == '\0' || strlen(equals + 1) > MAX_CACHE_CONTROL_VALUE
+        || strpbrk(equals + 1, "\r\n") != NULL
+        || cache_control_rule_count == MAX_CACHE_CONTROL_RULES) {
+        return -1;
+    }
+
+    int rule = cache_control_rule_count;
+    cache_control_rules[rule].prefix = strndup(spec, equals - spec);
+    cache_control_rules[rule].prefix_len = equals - spec;
+    cache_control_rules[rule].value = strdup(equals + 1);
+    if (cache_control_rules[rule].prefix == NULL || cache_control_rules[rule].value == NULL) {
+        free(cache_control_rules[rule].prefix);
+        free(cache_control_rules[rule].value);
+        return -1;
+    }
+    cache_control_rule_count++;
+    return 0;
+}
+
+// Function to find the Cache-Control value for a path
+const char* cache_control_for(const char* path, size_t len) {
+    const char* value = NULL;
+    size_t best_len = 0;
+    for (int i = 0; i < cache_control_rule_count; i++) {
+        size_t prefix_len = cache_control_rules[i].prefix_len;
+        if (prefix_len <= len && prefix_len >= best_len
+            && memcmp(path, cache_control_rules[i].prefix, prefix_len) == 0) {
+            value = cache_control_rules[i].value;
+            best_len = prefix_len;
+        }
+    }
+    return value;
+}
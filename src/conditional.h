@@ -0,0 +1,32 @@
+#ifndef CONDITIONAL_H
+#define CONDITIONAL_H
+
+#include <stddef.h>
+#include <time.h>
+#include <sys/stat.h>
+
+// Room for a quoted entity tag or an HTTP-date, including the terminator
+#define ETAG_SIZE 64
+#define HTTP_DATE_SIZE 32
+
+// Strong entity tag of a file version, from its inode, size and modification time
+// suffix tells representations of the same version apart (e.g. "-gz"), may be empty
+void format_etag(const struct stat* st, const char* suffix, char* etag);
+
+// Format a time as an HTTP-date (IMF-fixdate)
+void format_http_date(time_t t, char* date);
+
+// Parse an HTTP-date (IMF-fixdate), returns -1 when it is not one
+time_t parse_http_date(const char* value, size_t len);
+
+// Check whether a header value holding "*" or a list of entity tags names etag
+// weak compares without the W/ prefix (If-None-Match), otherwise both tags must be strong (If-Range)
+int etag_list_matches(const char* value, size_t len, const char* etag, int weak);
+
+// Add a Cache-Control rule from "<path prefix>=<value>", returns -1 when malformed or the table is full
+int add_cache_control_rule(const char* spec);
+
+// Cache-Control value of the longest matching prefix, or NULL
+const char* cache_control_for(const char* path, size_t len);
+
+#endif
@@ -0,0 +1,215 @@
+#include <string.h>
+
+#include "crc32.h"
+#include "crc32_table.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define CRC32_HAVE_PCLMUL 1
+#endif
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define CRC32_LITTLE_ENDIAN 1
+#endif
+
+// Helper to advance the CRC register one byte at a time
+static uint32_t crc32_bytes(uint32_t crc, const unsigned char *buf, size_t len) {
+    while (len--) {
+        crc = crc32_table[0][(crc ^ *buf) & 0xFF] ^ (crc >> 8);
+        buf++;
+    }
+    return crc;
+}
+
+// Helper for slicing-by-8 on the raw (non-inverted) register
+static uint32_t crc32_slice8_raw(uint32_t crc, const unsigned char *buf, size_t len) {
+#ifdef CRC32_LITTLE_ENDIAN
+    while (len >= 8) {
+        uint32_t one, two;
+        memcpy(&one, buf, 4);
+        memcpy(&two, buf + 4, 4);
+        one ^= crc;
+        crc = crc32_table[7][one & 0xff] ^ crc32_table[6][(one >> 8) & 0xff]
+            ^ crc32_table[5][(one >> 16) & 0xff] ^ crc32_table[4][one >> 24]
+            ^ crc32_table[3][two & 0xff] ^ crc32_table[2][(two >> 8) & 0xff]
+            ^ crc32_table[1][(two >> 16) & 0xff] ^ crc32_table[0][two >> 24];
+        buf += 8;
+        len -= 8;
+    }
+#endif
+    return crc32_bytes(crc, buf, len);
+}
+
+// Function to calculate CRC32 one byte at a time
+uint32_t crc32_bytewise(uint32_t crc, const unsigned char *buf, size_t len) {
+    return ~crc32_bytes(~crc, buf, len);
+}
+
+// Function to calculate CRC32 eight bytes at a time
+uint32_t crc32_slice8(uint32_t crc, const unsigned char *buf, size_t len) {
+    return ~crc32_slice8_raw(~crc, buf, len);
+}
+
+// Function to calculate CRC32 sixteen bytes at a time
+uint32_t crc32_slice16(uint32_t crc, const unsigned char *buf, size_t len) {
+    crc = ~crc;
+#ifdef CRC32_LITTLE_ENDIAN
+    while (len >= 16) {
+        uint32_t w[4];
+        memcpy(w, buf, 16);
+        w[0] ^= crc;
+        crc = crc32_table[15][w[0] & 0xff] ^ crc32_table[14][(w[0] >> 8) & 0xff]
+            ^ crc32_table[13][(w[0] >> 16) & 0xff] ^ crc32_table[12][w[0] >> 24]
+            ^ crc32_table[11][w[1] & 0xff] ^ crc32_table[10][(w[1] >> 8) & 0xff]
+            ^ crc32_table[9][(w[1] >> 16) & 0xff] ^ crc32_table[8][w[1] >> 24]
+            ^ crc32_table[7][w[2] & 0xff] ^ crc32_table[6][(w[2] >> 8) & 0xff]
+            ^ crc32_table[5][(w[2] >> 16) & 0xff] ^ crc32_table[4][w[2] >> 24]
+            ^ crc32_table[3][w[3] & 0xff] ^ crc32_table[2][(w[3] >> 8) & 0xff]
+            ^ crc32_table[1][(w[3] >> 16) & 0xff] ^ crc32_table[0][w[3] >> 24];
+        buf += 16;
+        len -= 16;
+    }
+#endif
+    return ~crc32_bytes(crc, buf, len);
+}
+
+#ifdef CRC32_HAVE_PCLMUL
+
+// Function to check whether the CPU has carry-less multiply (and SSE4.1 for the final extract)
+int crc32_pclmul_supported() {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("pclmul") && __builtin_cpu_supports("sse4.1");
+}
+
+// Helper to fold 64-byte blocks with carry-less multiplication, len must be a multiple of 16 and >= 64
+// Folding and Barrett constants for the reflected polynomial come from Gopal et al.,
+// "Fast CRC Computation for Generic Polynomials Using PCLMULQDQ Instruction" (Intel, 2009)
+__attribute__((target("pclmul,sse4.1")))
+static uint32_t crc32_fold_pclmul(uint32_t crc, const unsigned char *buf, size_t len) {
+    const __m128i k1k2 = _mm_set_epi64x(0x01c6e41596, 0x0154442bd4);
+    const __m128i k3k4 = _mm_set_epi64x(0x00ccaa009e, 0x01751997d0);
+    const __m128i k5k0 = _mm_set_epi64x(0x0000000000, 0x0163cd6124);
+    const __m128i poly = _mm_set_epi64x(0x01f7011641, 0x01db710641);
+    const __m128i mask32 = _mm_setr_epi32(~0, 0, ~0, 0);
+
+    // Four independent 128-bit accumulators, the CRC register is folded into the first
+    __m128i x1 = _mm_loadu_si128((const __m128i *)(buf + 0x00));
+    __m128i x2 = _mm_loadu_si128((const __m128i *)(buf + 0x10));
+    __m128i x3 = _mm_loadu_si128((const __m128i *)(buf + 0x20));
+    __m128i x4 = _mm_loadu_si128((const __m128i *)(buf + 0x30));
+    x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128(crc));
+    buf += 64;
+    len -= 64;
+
+    // Fold 64 bytes per iteration
+    while (len >= 64) {
+        __m128i x5 = _mm_clmulepi64_si128(x1, k1k2, 0x00);
+        __m128i x6 = _mm_clmulepi64_si128(x2, k1k2, 0x00);
+        __m128i x7 = _mm_clmulepi64_si128(x3, k1k2, 0x00);
+        __m128i x8 = _mm_clmulepi64_si128(x4, k1k2, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, k1k2, 0x11);
+        x2 = _mm_clmulepi64_si128(x2, k1k2, 0x11);
+        x3 = _mm_clmulepi64_si128(x3, k1k2, 0x11);
+        x4 = _mm_clmulepi64_si128(x4, k1k2, 0x11);
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), _mm_loadu_si128((const __m128i *)(buf + 0x00)));
+        x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), _mm_loadu_si128((const __m128i *)(buf + 0x10)));
+        x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), _mm_loadu_si128((const __m128i *)(buf + 0x20)));
+        x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), _mm_loadu_si128((const __m128i *)(buf + 0x30)));
+        buf += 64;
+        len -= 64;
+    }
+
+    // Fold the four accumulators into one
+    __m128i x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+    x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+    x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+
+    // Fold the remaining 16-byte blocks
+    while (len >= 16) {
+        x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, _mm_loadu_si128((const __m128i *)buf)), x5);
+        buf += 16;
+        len -= 16;
+    }
+
+    // Reduce 128 bits to 64
+    x2 = _mm_clmulepi64_si128(x1, k3k4, 0x10);
+    x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), x2);
+    x2 = _mm_srli_si128(x1, 4);
+    x1 = _mm_and_si128(x1, mask32);
+    x1 = _mm_clmulepi64_si128(x1, k5k0, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+
+    // Barrett reduction to 32 bits
+    x2 = _mm_and_si128(x1, mask32);
+    x2 = _mm_clmulepi64_si128(x2, poly, 0x10);
+    x2 = _mm_and_si128(x2, mask32);
+    x2 = _mm_clmulepi64_si128(x2, poly, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+
+    return _mm_extract_epi32(x1, 1);
+}
+
+// Function to calculate CRC32 with PCLMULQDQ folding, short inputs and tails use slicing-by-8
+uint32_t crc32_pclmul(uint32_t crc, const unsigned char *buf, size_t len) {
+    crc = ~crc;
+    if (len >= 64) {
+        size_t folded = len & ~(size_t)15;
+        crc = crc32_fold_pclmul(crc, buf, folded);
+        buf += folded;
+        len -= folded;
+    }
+    return ~crc32_slice8_raw(crc, buf, len);
+}
+
+#else
+
+int crc32_pclmul_supported() {
+    return 0;
+}
+
+uint32_t crc32_pclmul(uint32_t crc, const unsigned char *buf, size_t len) {
+    return crc32_slice16(crc, buf, len);
+}
+
+#endif
+
+static uint32_t crc32_resolve(uint32_t crc, const unsigned char *buf, size_t len);
+
+// Implementation picked by crc32_init(), resolved on first use if init was skipped
+static uint32_t (*crc32_impl)(uint32_t, const unsigned char *, size_t) = crc32_resolve;
+static const char *crc32_impl_name = "none";
+
+// Function to pick the fastest implementation for this CPU
+void crc32_init() {
+    if (crc32_pclmul_supported()) {
+        crc32_impl = crc32_pclmul;
+        crc32_impl_name = "pclmul";
+    } else {
+        crc32_impl = crc32_slice16;
+        crc32_impl_name = "slice16";
+    }
+}
+
+// Helper to pick the implementation on first use
+static uint32_t crc32_resolve(uint32_t crc, const unsigned char *buf, size_t len) {
+    crc32_init();
+    return crc32_impl(crc, buf, len);
+}
+
+// Function to get the name of the selected implementation
+const char *crc32_implementation() {
+    return crc32_impl_name;
+}
+
+// Function to calculate CRC32 for a buffer
+uint32_t calc_crc32(uint32_t crc, const unsigned char *buf, size_t len) {
+    return crc32_impl(crc, buf, len);
+}
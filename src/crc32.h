@@ -0,0 +1,26 @@
+#ifndef CRC32_H
+#define CRC32_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Calculate CRC32 for a buffer with the fastest implementation this CPU supports
+// Pass 0 to start, or the previous result to continue over several buffers
+uint32_t calc_crc32(uint32_t crc, const unsigned char *buf, size_t len);
+
+// Pick the implementation from the CPU features, called once at startup
+void crc32_init();
+
+// Name of the implementation calc_crc32() uses
+const char *crc32_implementation();
+
+// Individual implementations, same contract as calc_crc32()
+uint32_t crc32_bytewise(uint32_t crc, const unsigned char *buf, size_t len);
+uint32_t crc32_slice8(uint32_t crc, const unsigned char *buf, size_t len);
+uint32_t crc32_slice16(uint32_t crc, const unsigned char *buf, size_t len);
+
+// PCLMULQDQ folding, only valid when crc32_pclmul_supported() returns 1
+int crc32_pclmul_supported();
+uint32_t crc32_pclmul(uint32_t crc, const unsigned char *buf, size_t len);
+
+#endif
@@ -0,0 +1,913 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <netinet/in.h>
+
+#include "event_loop.h"
+#include "http.h"
+#include "file_cache.h"
+#include "gzip_cache.h"
+#include "upload.h"
+#include "http_parser.h"
+#include "workers.h"
+#include "access_log.h"
+#include "metrics.h"
+#include "arena.h"
+#include "buffer_pool.h"
+#include "timer_wheel.h"
+#include "admission.h"
+#include "listener.h"
+#include "io_pool.h"
+#include "http2.h"
+
+#define MAX_EVENTS 1024
+#define CONN_BUFFER_SIZE 4096
+
+// Per-connection state machine: read headers -> dispatch -> write response,
+// then back to reading for the next request while the connection is kept alive
+// Uploads stream their body to disk in between: read headers -> upload -> write response
+// Files missing from the cache are opened on the I/O pool first: read headers -> open -> write response
+// A connection that switches to HTTP/2 stays in CONN_HTTP2, its session multiplexes the requests
+enum conn_state {
+    CONN_READING,
+    CONN_OPENING,
+    CONN_UPLOADING,
+    CONN_WRITING,
+    CONN_HTTP2,
+};
+
+struct connection {
+    int fd;
+    enum conn_state state;
+    
+    // Buffer to store the received HTTP request
+    char buffer[CONN_BUFFER_SIZE];
+    size_t buffer_len;
+    
+    // Parser state, kept across reads until the request is complete
+    struct http_request req;
+    
+    // Length of the request being answered, pipelined requests follow it
+    size_t request_len;
+    
+    // Upload whose body is being received, or NULL
+    struct upload *upload;
+    
+    // HTTP/2 session once the client sent the preface or upgraded, or NULL
+    struct h2_session *h2;
+    int keep_alive;
+    int requests_served;
+    
+    // Response being written and how far we got
+    struct http_response res;
+    struct arena arena;             // Memory of the response, released once it is sent
+    size_t bytes_sent;
+    uint64_t response_bytes;        // Everything sent for the response, streamed body included
+    struct access_log_entry log;
+    struct request_metrics metrics;
+    
+    // Piece of the streamed body (file or compressed chunks) waiting to be sent
+    // Taken from the buffer pool for the first piece and given back with the response
+    char *body_buffer;
+    size_t body_buffer_len;
+    size_t body_buffer_sent;
+    
+    // Timeout of the phase the connection waits in, its kind is the enum connection_timeout
+    struct timer timer;
+    uint32_t admission_slot;
+    
+    // Blocking step on the I/O pool, events and timeouts are held back until it completes
+    struct io_job job;
+    int job_pending;
+    int job_done;                   // The step completed, the state machine has not used its result yet
+    ssize_t job_result;
+    uint64_t job_bytes;             // Upload bytes received by the step
+    int woken;                      // Socket events arrived while the step was pending
+    
+    // Blocking steps of a GET /files/ request done on the pool before its response is built,
+    // the results are handed to the caches once done
+    char file_path[1024];
+    char sidecar_path[1028];
+    int open_file;                  // open() and fstat() of the file, missing from the file cache
+    int file_fd;
+    int file_error;
+    struct stat file_stat;
+    int open_sidecar;               // The same for <file>.gz, which --gzip-static may send instead
+    int sidecar_fd;
+    int sidecar_error;
+    struct stat sidecar_stat;
+    int compress_file;              // In-memory compression of a small file the gzip cache is missing
+    int compressed;                 // compress_file_ahead() has a result, gzip_data is NULL when it did not pay
+    char *gzip_data;
+    size_t gzip_len;
+};
+
+// Timeouts of every connection of this worker
+static struct timer_wheel timers;
+
+static void complete_job(struct io_job *job);
+
+// Function to (re)start the timeout of the phase a connection waits in
+// The header timeout runs from the first byte of a request, further reads do not extend it
+static void arm_timeout(struct connection *conn) {
+    // Nothing is expected from the peer while the pool works for the connection
+    if (conn->job_pending) {
+        timer_cancel(&timers, &conn->timer);
+        return;
+    }
+    
+    int timeout;
+    if (conn->state == CONN_READING) {
+        timeout = conn->buffer_len == 0 && conn->requests_served > 0 ? TIMEOUT_IDLE : TIMEOUT_HEADER;
+    } else if (conn->state == CONN_HTTP2) {
+        timeout = h2_session_active(conn->h2) ? TIMEOUT_WRITE : TIMEOUT_IDLE;
+    } else {
+        timeout = conn->state == CONN_UPLOADING ? TIMEOUT_BODY : TIMEOUT_WRITE;
+    }
+    if (timeout == TIMEOUT_HEADER && timer_pending(&conn->timer) && conn->timer.kind == TIMEOUT_HEADER) {
+        return;
+    }
+    timer_set(&timers, &conn->timer, timeout_seconds(timeout) * 1000ULL, timeout);
+}
+
+// Function to switch a descriptor to non-blocking mode
+static int set_nonblocking(int fd) {
+    int flags = fcntl(fd, F_GETFL, 0);
+    if (flags == -1) {
+        return -1;
+    }
+    return fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+// Helper to find the connection a pool job is embedded in
+static struct connection *job_connection(struct io_job *job) {
+    return (struct connection *)((char *)job - offsetof(struct connection, job));
+}
+
+// Function to hand a blocking step of a connection to the I/O pool
+// Returns 1 when it was queued, 0 when the pool is off or full and the caller has to do the step itself
+static int offload(struct connection *conn, void (*run)(struct io_job *)) {
+    conn->job.run = run;
+    conn->job.complete = complete_job;
+    conn->woken = 0;
+    if (io_pool_submit(&conn->job) == -1) {
+        return 0;
+    }
+    conn->job_pending = 1;
+    return 1;
+}
+
+// Function run on the pool to read (and compress) the next piece of a streamed body
+static void read_body_job(struct io_job *job) {
+    struct connection *conn = job_connection(job);
+    conn->job_result = response_read_body(&conn->res, conn->body_buffer, IO_BUFFER_SIZE);
+}
+
+// Helper to open and stat a file on the pool, error is the errno of a failed step
+static void open_on_pool(const char *path, int *fd, int *error, struct stat *st) {
+    *error = 0;
+    *fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (*fd == -1) {
+        *error = errno;
+    } else if (fstat(*fd, st) == -1) {
+        *error = errno;
+        close(*fd);
+        *fd = -1;
+    }
+}
+
+// Function run on the pool to open what the file cache is missing and compress a small file ahead
+static void prepare_file_job(struct io_job *job) {
+    struct connection *conn = job_connection(job);
+    if (conn->open_file) {
+        open_on_pool(conn->file_path, &conn->file_fd, &conn->file_error, &conn->file_stat);
+    }
+    if (conn->open_sidecar) {
+        open_on_pool(conn->sidecar_path, &conn->sidecar_fd, &conn->sidecar_error, &conn->sidecar_stat);
+    }
+    
+    conn->compressed = 0;
+    if (conn->compress_file) {
+        // A cached descriptor belongs to the loop, the file is then read through a private one
+        int fd = conn->file_fd;
+        int error;
+        if (!conn->open_file) {
+            open_on_pool(conn->file_path, &fd, &error, &conn->file_stat);
+        }
+        if (fd != -1) {
+            conn->compressed = compress_file_ahead(conn->buffer, &conn->req, conn->file_path, fd, &conn->file_stat,
+                                                   &conn->gzip_data, &conn->gzip_len);
+            if (!conn->open_file) {
+                close(fd);
+            }
+        }
+    }
+}
+
+// Function to close a connection and release its state
+static void close_connection(struct connection *conn) {
+    timer_cancel(&timers, &conn->timer);
+    admission_release(conn->admission_slot);
+    worker_stats->active_connections--;
+    free_response(&conn->res);
+    arena_reset(&conn->arena);
+    io_buffer_put(conn->body_buffer);
+    if (conn->upload != NULL) {
+        upload_abort(conn->upload);
+    }
+    if (conn->h2 != NULL) {
+        h2_session_free(conn->h2);
+    }
+    close(conn->fd);
+    free(conn);
+}
+
+// Function to push as much of the response as the socket accepts
+// Returns 1 when the response is fully sent, 0 on EAGAIN and -1 on error
+static int write_response(struct connection *conn) {
+    struct http_response *res = &conn->res;
+    
+    // Headers and in-memory body in one sendmsg(), a small response leaves as a single segment
+    while (conn->bytes_sent < res->headers_len + res->body_len) {
+        struct iovec iov[2];
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = response_iovec(res, conn->bytes_sent, iov);
+        
+        // Let the kernel coalesce the headers with the file that follows
+        int flags = MSG_NOSIGNAL | (res->file_fd != -1 ? MSG_MORE : 0);
+        ssize_t sent = sendmsg(conn->fd, &msg, flags);
+        if (sent < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return 0;
+            }
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        conn->bytes_sent += sent;
+        conn->response_bytes += sent;
+        worker_stats->bytes_sent += sent;
+    }
+    
+    // Identity file body, straight from the page cache to the socket
+    while (response_is_zero_copy(res)) {
+        ssize_t sent = response_send_file(res, conn->fd);
+        if (sent < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return 0;
+            }
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        if (sent == 0) {
+            free_response(res);
+            break;
+        }
+        conn->response_bytes += sent;
+        worker_stats->bytes_sent += sent;
+    }
+    
+    // Streamed body, one buffer at a time
+    while (res->file_fd != -1) {
+        if (conn->body_buffer_sent == conn->body_buffer_len) {
+            ssize_t bytes_read;
+            if (conn->job_done) {
+                // Read on the pool
+                conn->job_done = 0;
+                bytes_read = conn->job_result;
+            } else {
+                if (conn->body_buffer == NULL && (conn->body_buffer = io_buffer_get()) == NULL) {
+                    return -1;
+                }
+                if (offload(conn, read_body_job)) {
+                    return 0;
+                }
+                bytes_read = response_read_body(res, conn->body_buffer, IO_BUFFER_SIZE);
+            }
+            if (bytes_read < 0) {
+                return -1;
+            }
+            if (bytes_read == 0) {
+                free_response(res);
+                break;
+            }
+            conn->body_buffer_len = bytes_read;
+            conn->body_buffer_sent = 0;
+        }
+        
+        ssize_t sent = send(conn->fd, conn->body_buffer + conn->body_buffer_sent,
+                            conn->body_buffer_len - conn->body_buffer_sent, MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return 0;
+            }
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        conn->body_buffer_sent += sent;
+        conn->response_bytes += sent;
+        worker_stats->bytes_sent += sent;
+    }
+    
+    return 1;
+}
+
+// Function to check whether the buffered request can be dispatched
+static int request_ready(struct connection *conn) {
+    if (conn->buffer_len > 0) {
+        metrics_request_started(&conn->metrics);
+    }
+    
+    // A HTTP/2 client with prior knowledge opens with the preface instead of a request
+    if (http2_enabled && conn->requests_served == 0) {
+        int preface = h2_preface_match(conn->buffer, conn->buffer_len);
+        if (preface >= 0) {
+            return preface;
+        }
+    }
+    
+    int status = http_parse_request(&conn->req, conn->buffer, conn->buffer_len);
+    if (status == HTTP_PARSE_ERROR) {
+        return 1;
+    }
+    if (status == HTTP_PARSE_DONE && conn->buffer_len >= http_request_length(&conn->req)) {
+        return 1;
+    }
+    
+    // Upload bodies are streamed, chunked ones have no known length
+    if (status == HTTP_PARSE_DONE && (conn->req.chunked || request_is_upload(conn->buffer, &conn->req))) {
+        return 1;
+    }
+    
+    // Buffer is full, handle what we have
+    return conn->buffer_len == sizeof(conn->buffer);
+}
+
+// Function to read everything available on a connection
+// Returns 1 when the request is ready for dispatch, 0 on EAGAIN and -1 when the peer is gone
+static int read_request(struct connection *conn) {
+    while (1) {
+        ssize_t bytes_read = recv(conn->fd, conn->buffer + conn->buffer_len,
+                                  sizeof(conn->buffer) - conn->buffer_len, 0);
+        if (bytes_read < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return 0;
+            }
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        if (bytes_read == 0) {
+            return -1;
+        }
+        
+        // The parser resumes where it stopped on the previous read
+        conn->buffer_len += bytes_read;
+        worker_stats->bytes_received += bytes_read;
+        if (request_ready(conn)) {
+            return 1;
+        }
+    }
+}
+
+// Function to start receiving an upload, the body bytes read with the headers go first
+static void begin_upload(struct connection *conn) {
+    conn->keep_alive = request_wants_keep_alive(conn->buffer, &conn->req)
+                       && conn->requests_served < max_keep_alive_requests;
+    
+    int send_continue;
+    conn->upload = start_upload(conn->buffer, &conn->req, &send_continue, &conn->res);
+    if (conn->upload == NULL) {
+        // Refused before the body was read, answer and close
+        conn->keep_alive = 0;
+        conn->request_len = conn->buffer_len;
+        conn->state = CONN_WRITING;
+        metrics_handled(&conn->metrics);
+        return;
+    }
+    
+    size_t header_length = conn->req.header_length;
+    if (send_continue && conn->buffer_len == header_length) {
+        // The previous response is fully written by now, so the interim response fits the socket buffer
+        send(conn->fd, "HTTP/1.1 100 Continue\r\n\r\n", 25, MSG_NOSIGNAL);
+    }
+    
+    // Drop the headers and whatever body came with them, only bytes of the next request remain
+    size_t used = header_length + upload_feed(conn->upload, conn->buffer + header_length,
+                                              conn->buffer_len - header_length);
+    conn->buffer_len -= used;
+    memmove(conn->buffer, conn->buffer + used, conn->buffer_len);
+    conn->request_len = 0;
+    conn->state = CONN_UPLOADING;
+}
+
+// Function to build the response to the request at the start of the buffer
+static void respond(struct connection *conn) {
+    conn->request_len = respond_to_request(conn->buffer, conn->buffer_len, &conn->req, conn->requests_served,
+                                           &conn->keep_alive, &conn->res);
+    metrics_handled(&conn->metrics);
+    conn->state = CONN_WRITING;
+}
+
+// Function to dispatch the request at the start of the buffer
+static void dispatch_request(struct connection *conn) {
+    // The headers are in, the header timeout is over
+    timer_cancel(&timers, &conn->timer);
+    conn->requests_served++;
+    worker_stats->requests_handled++;
+    
+    conn->bytes_sent = 0;
+    conn->response_bytes = 0;
+    conn->body_buffer_len = 0;
+    conn->body_buffer_sent = 0;
+    
+    // Requests that could not be parsed are logged without a method or path
+    int parsed = http_parse_request(&conn->req, conn->buffer, conn->buffer_len) == HTTP_PARSE_DONE;
+    struct http_slice method = conn->req.method;
+    struct http_slice path = conn->req.path;
+    access_log_begin(&conn->log, conn->buffer + method.offset, parsed ? method.length : 0,
+                     conn->buffer + path.offset, parsed ? path.length : 0);
+    metrics_dispatched(&conn->metrics, conn->buffer, &conn->req, parsed);
+    
+    if (parsed && request_is_upload(conn->buffer, &conn->req)) {
+        begin_upload(conn);
+        return;
+    }
+    
+    // Files missing from the file cache are opened and stat'ed on the pool, and a small file the gzip cache
+    // is missing is compressed there; the response then finds the results in the caches
+    // With the pool full, respond_to_request() does these steps itself
+    if (parsed && request_file_path(conn->buffer, &conn->req, conn->file_path, sizeof(conn->file_path))) {
+        struct stat cached_stat;
+        struct stat sidecar_stat;
+        int cached = file_cache_peek(conn->file_path, &cached_stat);
+        snprintf(conn->sidecar_path, sizeof(conn->sidecar_path), "%s.gz", conn->file_path);
+        conn->open_file = cached == -1;
+        conn->open_sidecar = gzip_static && client_supports_gzip(conn->buffer, &conn->req)
+                             && file_cache_peek(conn->sidecar_path, &sidecar_stat) == -1;
+        conn->compress_file = cached != 0 && request_compresses_file(conn->buffer, &conn->req, conn->file_path,
+                                                                    cached == 1 ? &cached_stat : NULL);
+        if (conn->open_file || conn->open_sidecar || conn->compress_file) {
+            conn->state = CONN_OPENING;
+            if (offload(conn, prepare_file_job)) {
+                return;
+            }
+        }
+    }
+    
+    respond(conn);
+}
+
+// Function to move what the socket holds of the upload body to disk
+// Returns 1 once the body is complete, 0 on EAGAIN and -1 when the peer is gone
+// May run on the pool, so received bytes are counted in job_bytes for the loop to add up
+static int drain_upload(struct connection *conn) {
+    struct upload *up = conn->upload;
+    
+    while (!up->done) {
+        ssize_t received;
+        if (upload_wants_socket(up)) {
+            received = upload_receive(up, conn->fd);
+        } else {
+            // Chunked bodies are decoded from the connection buffer, bytes past their end stay for the next request
+            received = recv(conn->fd, conn->buffer, sizeof(conn->buffer), 0);
+            if (received > 0) {
+                size_t used = upload_feed(up, conn->buffer, received);
+                conn->buffer_len = received - used;
+                memmove(conn->buffer, conn->buffer + used, conn->buffer_len);
+            }
+        }
+        
+        if (received == 0) {
+            return -1;
+        }
+        if (received < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return 0;
+            }
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        conn->job_bytes += received;
+    }
+    return 1;
+}
+
+// Function run on the pool to write the upload body that has arrived
+static void upload_job(struct io_job *job) {
+    struct connection *conn = job_connection(job);
+    conn->job_result = drain_upload(conn);
+}
+
+// Function to receive the upload body, on the pool when it has room
+// Returns 1 once the body is complete, 0 on EAGAIN or while the pool works on it and -1 when the peer is gone
+static int receive_upload(struct connection *conn) {
+    struct upload *up = conn->upload;
+    int status;
+    do {
+        if (conn->job_done) {
+            conn->job_done = 0;
+            status = conn->job_result;
+        } else {
+            conn->job_bytes = 0;
+            if (!up->done && offload(conn, upload_job)) {
+                return 0;
+            }
+            status = drain_upload(conn);
+        }
+        worker_stats->bytes_received += conn->job_bytes;
+        conn->job_bytes = 0;
+        
+        // The edge of data that arrived after the pool saw EAGAIN is not repeated, go again
+    } while (status == 0 && conn->woken);
+    if (status <= 0) {
+        return status;
+    }
+    
+    finish_upload(up, &conn->keep_alive, &conn->res);
+    metrics_handled(&conn->metrics);
+    conn->upload = NULL;
+    conn->state = CONN_WRITING;
+    return 1;
+}
+
+// Function to drop the answered request and get ready for the next one
+static void finish_request(struct connection *conn) {
+    free_response(&conn->res);
+    arena_reset(&conn->arena);
+    io_buffer_put(conn->body_buffer);
+    conn->body_buffer = NULL;
+    
+    // Keep pipelined bytes that arrived behind the request
+    conn->buffer_len -= conn->request_len;
+    memmove(conn->buffer, conn->buffer + conn->request_len, conn->buffer_len);
+    conn->request_len = 0;
+    http_parser_init(&conn->req);
+    conn->state = CONN_READING;
+}
+
+// Function to exchange HTTP/2 frames until the socket blocks
+// Returns 0 to wait for the next event and -1 once the session is over
+static int process_http2(struct connection *conn) {
+    while (1) {
+        // Frames of every stream, interleaved by the session within the flow-control windows
+        const char *output;
+        size_t len;
+        int blocked = 0;
+        while (!blocked && (output = h2_session_output(conn->h2, &len)) != NULL) {
+            ssize_t sent = send(conn->fd, output, len, MSG_NOSIGNAL);
+            if (sent < 0) {
+                if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                    blocked = 1;
+                    continue;
+                }
+                if (errno == EINTR) {
+                    continue;
+                }
+                return -1;
+            }
+            h2_session_sent(conn->h2, sent);
+            worker_stats->bytes_sent += sent;
+        }
+        if (!blocked && h2_session_finished(conn->h2)) {
+            return -1;
+        }
+        
+        // Keep reading while the socket is full, window updates and resets still matter,
+        // unless the client sends faster than it takes the answers
+        if (blocked && !h2_session_wants_input(conn->h2)) {
+            return 0;
+        }
+        
+        ssize_t bytes_read = recv(conn->fd, conn->buffer, sizeof(conn->buffer), 0);
+        if (bytes_read < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return 0;
+            }
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        if (bytes_read == 0) {
+            return -1;
+        }
+        worker_stats->bytes_received += bytes_read;
+        h2_session_feed(conn->h2, conn->buffer, bytes_read);
+    }
+}
+
+// Function to switch a connection to HTTP/2, after the preface or a request with Upgrade: h2c
+// Returns -1 when the session cannot start
+static int start_http2(struct connection *conn) {
+    size_t used = 0;
+    if (h2_preface_match(conn->buffer, conn->buffer_len) == 1) {
+        // The session reads the preface itself
+        conn->h2 = h2_session_new(NULL, 0);
+    } else {
+        // The upgraded request is answered on stream 1, after the 101 that ends HTTP/1.1
+        static const char switching[] = "HTTP/1.1 101 Switching Protocols\r\nConnection: Upgrade\r\n"
+                                        "Upgrade: h2c\r\n\r\n";
+        used = conn->req.header_length;
+        conn->h2 = h2_session_new(conn->buffer, used);
+        if (conn->h2 == NULL || send(conn->fd, switching, sizeof(switching) - 1, MSG_NOSIGNAL)
+                                != (ssize_t)sizeof(switching) - 1) {
+            return -1;
+        }
+        worker_stats->bytes_sent += sizeof(switching) - 1;
+    }
+    if (conn->h2 == NULL) {
+        return -1;
+    }
+    
+    // Streams keep their own request state, the connection only carries the frames
+    timer_cancel(&timers, &conn->timer);
+    memset(&conn->metrics, 0, sizeof(conn->metrics));
+    conn->state = CONN_HTTP2;
+    h2_session_feed(conn->h2, conn->buffer + used, conn->buffer_len - used);
+    conn->buffer_len = 0;
+    return 0;
+}
+
+// Function to drive a connection through its state machine
+// Returns -1 when the connection should be closed
+static int process_connection(struct connection *conn) {
+    while (1) {
+        if (conn->state == CONN_HTTP2) {
+            return process_http2(conn);
+        }
+        
+        if (conn->state == CONN_READING) {
+            // Pipelined requests may already be buffered
+            if (!request_ready(conn)) {
+                int status = read_request(conn);
+                if (status <= 0) {
+                    return status;
+                }
+            }
+            if (http2_enabled && conn->requests_served == 0
+                && (h2_preface_match(conn->buffer, conn->buffer_len) == 1
+                    || (http_parse_request(&conn->req, conn->buffer, conn->buffer_len) == HTTP_PARSE_DONE
+                        && h2_upgrade_requested(conn->buffer, &conn->req)))) {
+                if (start_http2(conn) == -1) {
+                    return -1;
+                }
+                continue;
+            }
+            dispatch_request(conn);
+            if (conn->job_pending) {
+                return 0;
+            }
+        }
+        
+        if (conn->state == CONN_OPENING) {
+            // Prepared on the pool, what the caches cannot keep is held for this response only
+            conn->job_done = 0;
+            if (conn->open_file) {
+                file_cache_hand_over(conn->file_path, conn->file_fd, conn->file_error, &conn->file_stat);
+            }
+            if (conn->open_sidecar) {
+                file_cache_hand_over(conn->sidecar_path, conn->sidecar_fd, conn->sidecar_error, &conn->sidecar_stat);
+            }
+            if (conn->compressed) {
+                gzip_cache_prefill(conn->file_path, "gzip", &conn->file_stat, conn->gzip_data, conn->gzip_len,
+                                   conn->gzip_data != NULL);
+            }
+            respond(conn);
+            file_cache_drop_handovers();
+        }
+        
+        if (conn->state == CONN_UPLOADING) {
+            int status = receive_upload(conn);
+            if (status <= 0) {
+                return status;
+            }
+        }
+        
+        int status = write_response(conn);
+        if (status == 0) {
+            // Wait for EPOLLOUT
+            return 0;
+        }
+        access_log_end(&conn->log, response_status(&conn->res), conn->response_bytes);
+        metrics_request_done(&conn->metrics, response_status(&conn->res));
+        if (status < 0 || !conn->keep_alive) {
+            // Response failed or was the last one, close the connection
+            return -1;
+        }
+        finish_request(conn);
+    }
+}
+
+// Function to pick a connection up again once its step on the pool completed
+static void complete_job(struct io_job *job) {
+    struct connection *conn = job_connection(job);
+    conn->job_pending = 0;
+    conn->job_done = 1;
+    if (process_connection(conn) < 0) {
+        close_connection(conn);
+    } else {
+        arm_timeout(conn);
+    }
+}
+
+// Function to close a connection whose timeout fired
+static void expire_connection(struct timer *timer) {
+    struct connection *conn = (struct connection *)((char *)timer - offsetof(struct connection, timer));
+    log_debug("Closing connection after timeout %d - fd %d\n", timer->kind, conn->fd);
+    worker_stats->timeouts[timer->kind]++;
+    close_connection(conn);
+}
+
+// Function to accept the pending connections on the listening socket, up to the accept batch
+// Returns 1 when the batch ran out before the queue did, the listener then has to be revisited
+// without waiting for another edge-triggered wakeup
+static int accept_connections(int epoll_fd, int server_fd) {
+    int accepted = 0;
+    while (1) {
+        if (listener_config.accept_batch > 0 && accepted == listener_config.accept_batch) {
+            return 1;
+        }
+        
+        // Non-blocking and close-on-exec are set by accept4() itself, no fcntl() round trips
+        struct sockaddr_storage client_addr;
+        socklen_t client_addr_len;
+        int client_fd = accept_client(server_fd, &client_addr, &client_addr_len, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (client_fd < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return 0;
+            }
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            printf("Accept failed: %s \n", strerror(errno));
+            return 0;
+        }
+        accepted++;
+        
+        // Shed load before anything is allocated for the connection
+        uint32_t admission_slot;
+        if (admission_admit(client_fd, (struct sockaddr *) &client_addr, client_addr_len, &admission_slot) == -1) {
+            continue;
+        }
+        
+        struct connection *conn = calloc(1, sizeof(*conn));
+        if (conn == NULL) {
+            printf("Failed to allocate connection state\n");
+            admission_release(admission_slot);
+            close(client_fd);
+            continue;
+        }
+        conn->fd = client_fd;
+        conn->state = CONN_READING;
+        conn->admission_slot = admission_slot;
+        http_parser_init(&conn->req);
+        timer_init(&conn->timer);
+        arm_timeout(conn);
+        worker_stats->connections_accepted++;
+        worker_stats->active_connections++;
+        conn->res.file_fd = -1;
+        conn->res.splice_pipe[0] = -1;
+        conn->res.splice_pipe[1] = -1;
+        arena_init(&conn->arena);
+        conn->res.arena = &conn->arena;
+        
+        // Register for both directions once, edge-triggered
+        struct epoll_event ev = { .events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET, .data.ptr = conn };
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, client_fd, &ev) == -1) {
+            printf("epoll_ctl failed: %s\n", strerror(errno));
+            close_connection(conn);
+            continue;
+        }
+        
+        log_debug("Client connected - fd %d\n", client_fd);
+    }
+}
+
+// Function to run the event loop on the listening socket
+int run_event_loop(int server_fd) {
+    if (set_nonblocking(server_fd) == -1) {
+        printf("Failed to make server socket non-blocking: %s\n", strerror(errno));
+        return 1;
+    }
+    
+    int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd == -1) {
+        printf("epoll_create1 failed: %s\n", strerror(errno));
+        return 1;
+    }
+    
+    // The listening socket is identified by a NULL data pointer
+    struct epoll_event ev = { .events = EPOLLIN | EPOLLET, .data.ptr = NULL };
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, server_fd, &ev) == -1) {
+        printf("epoll_ctl failed: %s\n", strerror(errno));
+        close(epoll_fd);
+        return 1;
+    }
+    
+    // Change notifications for the files directory invalidate the file cache
+    int watch_fd = file_cache_watch(files_directory);
+    if (watch_fd != -1) {
+        ev.events = EPOLLIN;
+        ev.data.ptr = &watch_fd;
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, watch_fd, &ev) == -1) {
+            printf("epoll_ctl failed: %s\n", strerror(errno));
+        }
+    }
+    
+    // Blocking file-system steps and compression run on this worker's own pool, it reports on an eventfd
+    int pool_fd = io_pool_start();
+    if (pool_fd != -1) {
+        ev.events = EPOLLIN;
+        ev.data.ptr = &pool_fd;
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, pool_fd, &ev) == -1) {
+            printf("epoll_ctl failed: %s\n", strerror(errno));
+        }
+    }
+    
+    timer_wheel_init(&timers, monotonic_ms());
+    
+    struct epoll_event events[MAX_EVENTS];
+    int accept_pending = 0;
+    int jobs_completed = 0;
+    while (1) {
+        // Sleep until the next tick of the timer wheel while any timeout is running
+        // Connections left over by the accept batch only need a poll of the ready sockets
+        int timeout = accept_pending ? 0 : timer_wheel_wait_ms(&timers, monotonic_ms());
+        int count = epoll_wait(epoll_fd, events, MAX_EVENTS, timeout);
+        
+        // An idle wheel only has its clock brought forward here, so timeouts set while handling
+        // the events count from the current tick; with timers pending the wheel never sleeps
+        // past its next tick, and firing them now could free a connection the batch points to
+        if (timers.pending == 0) {
+            timer_wheel_advance(&timers, monotonic_ms(), expire_connection);
+        }
+        if (count < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            printf("epoll_wait failed: %s\n", strerror(errno));
+            close(epoll_fd);
+            return 1;
+        }
+        
+        for (int i = 0; i < count; i++) {
+            struct connection *conn = events[i].data.ptr;
+            if (conn == NULL) {
+                accept_pending = 1;
+                continue;
+            }
+            if (events[i].data.ptr == &watch_fd) {
+                file_cache_handle_events();
+                continue;
+            }
+            if (events[i].data.ptr == &pool_fd) {
+                jobs_completed = 1;
+                continue;
+            }
+            if (conn->job_pending) {
+                // Handled once the step completes
+                conn->woken = 1;
+                continue;
+            }
+            
+            if ((events[i].events & (EPOLLERR | EPOLLHUP)) || process_connection(conn) < 0) {
+                close_connection(conn);
+            } else {
+                arm_timeout(conn);
+            }
+        }
+        
+        // Completions may close connections, so they run once nothing else of this batch refers to one
+        if (jobs_completed) {
+            jobs_completed = 0;
+            io_pool_complete();
+        }
+        
+        // Timeouts fire once nothing of this batch refers to a connection they may close
+        timer_wheel_advance(&timers, monotonic_ms(), expire_connection);
+        
+        // New connections are taken after the ready ones are served, so a burst of connects
+        // cannot hold back requests already waiting
+        if (accept_pending) {
+            accept_pending = accept_connections(epoll_fd, server_fd);
+        }
+    }
+}
@@ -0,0 +1,7 @@
+#ifndef EVENT_LOOP_H
+#define EVENT_LOOP_H
+
+// Run the edge-triggered epoll engine on a listening socket, never returns on success
+int run_event_loop(int server_fd);
+
+#endif
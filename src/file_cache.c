@@ -0,0 +1,405 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+
+#include "file_cache.h"
+#include "workers.h"
+
+// Cache settings, configured from the command line
+int file_cache_ttl = 2;
+int file_cache_max_entries = 1024;
+
+#define FILE_CACHE_BUCKETS 1024
+
+// Per-process table, descriptors cannot be shared between workers
+static struct file_cache_entry* buckets[FILE_CACHE_BUCKETS];
+static struct file_cache_entry* lru_head;   // Most recently used
+static struct file_cache_entry* lru_tail;
+static int entry_count;
+
+// Open results handed over that could not be cached, each answers the next open of its path only
+#define HANDOVER_SLOTS 2
+struct handover {
+    char* path;                     // NULL for a free slot
+    int fd;
+    int error;
+    struct stat st;
+};
+static struct handover handovers[HANDOVER_SLOTS];
+
+// Watched directory, notifications name files relative to it
+static int watch_fd = -1;
+static char watch_directory[1024];
+
+// Helper to hash a path (FNV-1a)
+static uint32_t hash_path(const char* path) {
+    uint32_t hash = 2166136261u;
+    for (const char* p = path; *p; p++) {
+        hash = (hash ^ (unsigned char)*p) * 16777619u;
+    }
+    return hash;
+}
+
+// Helper to find the entry of a path
+static struct file_cache_entry* find_entry(const char* path) {
+    struct file_cache_entry* entry = buckets[hash_path(path) % FILE_CACHE_BUCKETS];
+    while (entry != NULL && strcmp(entry->path, path) != 0) {
+        entry = entry->hash_next;
+    }
+    return entry;
+}
+
+// Helper to free an entry once nothing references it
+static void free_entry(struct file_cache_entry* entry) {
+    if (entry->fd != -1) {
+        close(entry->fd);
+    }
+    free(entry->path);
+    free(entry);
+}
+
+// Helper to move an entry to the front of the LRU list
+static void lru_push_front(struct file_cache_entry* entry) {
+    entry->lru_prev = NULL;
+    entry->lru_next = lru_head;
+    if (lru_head != NULL) {
+        lru_head->lru_prev = entry;
+    }
+    lru_head = entry;
+    if (lru_tail == NULL) {
+        lru_tail = entry;
+    }
+}
+
+// Helper to take an entry out of the LRU list
+static void lru_unlink(struct file_cache_entry* entry) {
+    if (entry->lru_prev != NULL) {
+        entry->lru_prev->lru_next = entry->lru_next;
+    } else {
+        lru_head = entry->lru_next;
+    }
+    if (entry->lru_next != NULL) {
+        entry->lru_next->lru_prev = entry->lru_prev;
+    } else {
+        lru_tail = entry->lru_prev;
+    }
+    entry->lru_prev = NULL;
+    entry->lru_next = NULL;
+}
+
+// Helper to remove an entry from the table, it is freed when the last response lets go
+static void remove_entry(struct file_cache_entry* entry) {
+    struct file_cache_entry** link = &buckets[hash_path(entry->path) % FILE_CACHE_BUCKETS];
+    while (*link != entry) {
+        link = &(*link)->hash_next;
+    }
+    *link = entry->hash_next;
+    lru_unlink(entry);
+    entry_count--;
+
+    entry->cached = 0;
+    if (entry->refs == 0) {
+        free_entry(entry);
+    }
+}
+
+// Helper to read the coarse monotonic clock, served from the vDSO without a syscall
+static struct timespec coarse_now() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &now);
+    return now;
+}
+
+// Helper to check whether an entry is past its TTL
+static int entry_expired(const struct file_cache_entry* entry, struct timespec now) {
+    return now.tv_sec > entry->expires.tv_sec
+           || (now.tv_sec == entry->expires.tv_sec && now.tv_nsec >= entry->expires.tv_nsec);
+}
+
+// Helper to answer from an entry, positive or negative
+static int use_entry(struct file_cache_entry* entry, struct stat* st, struct file_cache_entry** ref) {
+    if (entry->fd == -1) {
+        *ref = NULL;
+        errno = entry->error;
+        return -1;
+    }
+    entry->refs++;
+    *ref = entry;
+    *st = entry->st;
+    return entry->fd;
+}
+
+// Helper to check whether open() results are cached at all
+static int cache_enabled() {
+    return file_cache_ttl > 0 && file_cache_max_entries > 0;
+}
+
+// Helper to check whether a failed open() will fail the same way next time
+static int error_is_cacheable(int error) {
+    return error == ENOENT || error == ENOTDIR || error == EACCES;
+}
+
+// Helper to add the result of an open() to the table, evicting the least recently used entries
+// Returns NULL when the entry cannot be allocated, the caller keeps the descriptor then
+static struct file_cache_entry* insert_entry(const char* path, int fd, int error, const struct stat* st,
+                                             struct timespec now) {
+    struct file_cache_entry* entry = calloc(1, sizeof(*entry));
+    if (entry == NULL || (entry->path = strdup(path)) == NULL) {
+        free(entry);
+        return NULL;
+    }
+    entry->fd = fd;
+    entry->error = error;
+    if (fd != -1) {
+        entry->st = *st;
+    }
+    entry->expires = now;
+    entry->expires.tv_sec += file_cache_ttl;
+
+    while (entry_count >= file_cache_max_entries && lru_tail != NULL) {
+        remove_entry(lru_tail);
+    }
+
+    struct file_cache_entry** bucket = &buckets[hash_path(path) % FILE_CACHE_BUCKETS];
+    entry->hash_next = *bucket;
+    *bucket = entry;
+    lru_push_front(entry);
+    entry->cached = 1;
+    entry_count++;
+    return entry;
+}
+
+// Helper to take the handed-over result of a path, returns 1 with fd or errno set when there is one
+static int take_handover(const char* path, struct stat* st, int* fd) {
+    for (int i = 0; i < HANDOVER_SLOTS; i++) {
+        struct handover* h = &handovers[i];
+        if (h->path != NULL && strcmp(h->path, path) == 0) {
+            *fd = h->fd;
+            if (h->fd != -1) {
+                *st = h->st;
+            }
+            errno = h->error;
+            free(h->path);
+            h->path = NULL;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Function to open a file, from the cache when a fresh entry exists
+int file_cache_open(const char* path, struct stat* st, struct file_cache_entry** ref) {
+    *ref = NULL;
+    struct timespec now = coarse_now();
+
+    // Opened ahead on the I/O pool for this very response, the descriptor is private
+    int handed_fd;
+    if (take_handover(path, st, &handed_fd)) {
+        return handed_fd;
+    }
+
+    if (cache_enabled()) {
+        struct file_cache_entry* entry = find_entry(path);
+        if (entry != NULL && entry_expired(entry, now)) {
+            remove_entry(entry);
+            entry = NULL;
+        }
+        if (entry != NULL) {
+            if (entry->handed_over) {
+                entry->handed_over = 0;
+            } else {
+                worker_stats->file_cache_hits++;
+            }
+            lru_unlink(entry);
+            lru_push_front(entry);
+            return use_entry(entry, st, ref);
+        }
+        worker_stats->file_cache_misses++;
+    }
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    int error = errno;
+    if (fd != -1 && fstat(fd, st) == -1) {
+        error = errno;
+        close(fd);
+        fd = -1;
+    }
+
+    // Only misses that will repeat identically are worth remembering
+    struct file_cache_entry* entry = NULL;
+    if (cache_enabled() && (fd != -1 || error_is_cacheable(error))) {
+        entry = insert_entry(path, fd, error, st, now);
+    }
+    if (entry == NULL) {
+        errno = error;
+        return fd;
+    }
+    return use_entry(entry, st, ref);
+}
+
+// Function to check for a fresh entry without counting a hit or a miss
+int file_cache_contains(const char* path) {
+    if (!cache_enabled()) {
+        return 0;
+    }
+    struct file_cache_entry* entry = find_entry(path);
+    return entry != NULL && !entry_expired(entry, coarse_now());
+}
+
+// Function to read the stat of a fresh entry without counting a hit or a miss
+int file_cache_peek(const char* path, struct stat* st) {
+    if (!cache_enabled()) {
+        return -1;
+    }
+    struct file_cache_entry* entry = find_entry(path);
+    if (entry == NULL || entry_expired(entry, coarse_now())) {
+        return -1;
+    }
+    if (entry->fd == -1) {
+        return 0;
+    }
+    *st = entry->st;
+    return 1;
+}
+
+// Function to cache the result of an open() made elsewhere
+void file_cache_insert(const char* path, int fd, int error, const struct stat* st) {
+    struct file_cache_entry* entry = NULL;
+    if (cache_enabled() && (fd != -1 || error_is_cacheable(error))) {
+        file_cache_invalidate(path);
+        entry = insert_entry(path, fd, error, st, coarse_now());
+    }
+    if (entry == NULL && fd != -1) {
+        close(fd);
+    }
+}
+
+// Function to cache the result of an open() made ahead of the response, or hold it for that response
+void file_cache_hand_over(const char* path, int fd, int error, const struct stat* st) {
+    if (cache_enabled() && (fd != -1 || error_is_cacheable(error))) {
+        worker_stats->file_cache_misses++;
+        file_cache_invalidate(path);
+        struct file_cache_entry* entry = insert_entry(path, fd, error, st, coarse_now());
+        if (entry != NULL) {
+            entry->handed_over = 1;
+            return;
+        }
+    }
+
+    for (int i = 0; i < HANDOVER_SLOTS; i++) {
+        struct handover* h = &handovers[i];
+        if (h->path == NULL && (h->path = strdup(path)) != NULL) {
+            h->fd = fd;
+            h->error = error;
+            if (fd != -1) {
+                h->st = *st;
+            }
+            return;
+        }
+    }
+    if (fd != -1) {
+        close(fd);
+    }
+}
+
+// Function to close what was handed over and not opened, the file may change before another response
+void file_cache_drop_handovers(void) {
+    for (int i = 0; i < HANDOVER_SLOTS; i++) {
+        struct handover* h = &handovers[i];
+        if (h->path != NULL) {
+            if (h->fd != -1) {
+                close(h->fd);
+            }
+            free(h->path);
+            h->path = NULL;
+        }
+    }
+}
+
+// Function to give back a descriptor
+void file_cache_close(int fd, struct file_cache_entry* entry) {
+    if (entry == NULL) {
+        close(fd);
+        return;
+    }
+    entry->refs--;
+    if (entry->refs == 0 && !entry->cached) {
+        free_entry(entry);
+    }
+}
+
+// Function to drop the entry of a path
+void file_cache_invalidate(const char* path) {
+    struct file_cache_entry* entry = find_entry(path);
+    if (entry != NULL) {
+        remove_entry(entry);
+    }
+}
+
+// Function to start watching the files directory
+int file_cache_watch(const char* directory) {
+    if (directory == NULL || file_cache_ttl == 0 || file_cache_max_entries == 0) {
+        return -1;
+    }
+
+    watch_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (watch_fd == -1) {
+        printf("PID %d: inotify unavailable (%s), file cache relies on its %d s TTL\n",
+               getpid(), strerror(errno), file_cache_ttl);
+        return -1;
+    }
+
+    // Anything that can change what open() or fstat() would return for a name
+    uint32_t mask = IN_ATTRIB | IN_MODIFY | IN_CLOSE_WRITE | IN_CREATE | IN_DELETE
+                    | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF;
+    if (inotify_add_watch(watch_fd, directory, mask) == -1) {
+        printf("PID %d: Cannot watch %s (%s), file cache relies on its %d s TTL\n",
+               getpid(), directory, strerror(errno), file_cache_ttl);
+        close(watch_fd);
+        watch_fd = -1;
+        return -1;
+    }
+
+    snprintf(watch_directory, sizeof(watch_directory), "%s", directory);
+    return watch_fd;
+}
+
+// Helper to drop every entry
+static void flush_entries() {
+    while (lru_tail != NULL) {
+        remove_entry(lru_tail);
+    }
+}
+
+// Function to apply pending change notifications
+void file_cache_handle_events(void) {
+    char events[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+
+    while (watch_fd != -1) {
+        ssize_t len = read(watch_fd, events, sizeof(events));
+        if (len <= 0) {
+            break;
+        }
+
+        for (char* p = events; p < events + len; ) {
+            struct inotify_event* event = (struct inotify_event*)p;
+            p += sizeof(*event) + event->len;
+
+            if (event->mask & (IN_Q_OVERFLOW | IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED)) {
+                // Lost track of what changed
+                flush_entries();
+            } else if (event->len > 0) {
+                // Entries are keyed by the path the request handler builds
+                char path[2048];
+                snprintf(path, sizeof(path), "%s/%s", watch_directory, event->name);
+                file_cache_invalidate(path);
+            }
+        }
+    }
+}
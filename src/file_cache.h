@@ -0,0 +1,66 @@
+#ifndef FILE_CACHE_H
+#define FILE_CACHE_H
+
+#include <sys/stat.h>
+
+// Seconds an entry is trusted without a change notification, 0 disables the cache
+extern int file_cache_ttl;
+
+// Open descriptors and negative entries kept per process
+extern int file_cache_max_entries;
+
+// Result of opening one path, shared by every response that sends the file
+// The descriptor stays open while a response holds a reference, even after invalidation
+struct file_cache_entry {
+    char* path;
+    int fd;                         // -1 for a negative entry
+    int error;                      // errno of the failed open() for a negative entry
+    struct stat st;
+    struct timespec expires;
+    int handed_over;                // Opened ahead of its first use, which then counts as the miss
+
+    int refs;
+    int cached;                     // Still reachable from the table
+    struct file_cache_entry* hash_next;
+    struct file_cache_entry* lru_prev;
+    struct file_cache_entry* lru_next;
+};
+
+// Open a file read-only through the cache, filling in st
+// Returns a descriptor, or -1 with errno set (repeated misses answer from a negative entry)
+// *entry receives the reference to pass to file_cache_close(), NULL when the descriptor is private
+// Shared descriptors must be read with pread(), sendfile() or splice() at an explicit offset
+int file_cache_open(const char* path, struct stat* st, struct file_cache_entry** entry);
+
+// Whether path has a fresh entry, so file_cache_open() would not touch the filesystem
+int file_cache_contains(const char* path);
+
+// Look at a fresh entry without counting a hit or a miss
+// Returns -1 when there is none, 0 for a remembered miss and 1 with st filled in for an open file
+int file_cache_peek(const char* path, struct stat* st);
+
+// Cache the result of an open() and fstat() made by the caller (e.g. through io_uring)
+// Takes over fd, which is closed when it cannot be cached; error is the errno of a failed open()
+void file_cache_insert(const char* path, int fd, int error, const struct stat* st);
+
+// Like file_cache_insert() for an open() made ahead of the response that needs it (on the I/O pool)
+// A result the cache cannot keep, because it is off or full or the error does not repeat, is held instead
+// and answers the next file_cache_open() of path only, with a private descriptor
+void file_cache_hand_over(const char* path, int fd, int error, const struct stat* st);
+
+// Close what was handed over and not opened by the response it was meant for
+void file_cache_drop_handovers(void);
+
+// Release a descriptor returned by file_cache_open()
+void file_cache_close(int fd, struct file_cache_entry* entry);
+
+// Forget a path after the server changed it itself
+void file_cache_invalidate(const char* path);
+
+// Watch the directory with inotify, returns a non-blocking descriptor to poll, or -1
+int file_cache_watch(const char* directory);
+
+// Drain pending change notifications and drop the affected entries
+void file_cache_handle_events(void);
+
+#endif
@@ -0,0 +1,230 @@
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+
+#include "gzip.h"
+#include "crc32.h"
+#include "workers.h"
+
+// Compression settings, configured from the command line
+int gzip_level = 6;
+unsigned long gzip_min_size = 256;
+
+// Upper bound of the gzip stream for source_len input bytes
+unsigned long gzip_bound(unsigned long source_len) {
+    // Deflate worst case plus the 10-byte header and 8-byte footer
+    return compressBound(source_len) + 18;
+}
+
+// Function to check whether a body is worth compressing before doing the work
+int gzip_worthwhile(unsigned long source_len) {
+    return source_len >= gzip_min_size;
+}
+
+// Function to check whether compression saved enough to send the compressed body
+int gzip_pays_off(unsigned long source_len, unsigned long compressed_len) {
+    // Require at least ~6% savings, otherwise the client pays for inflating for nothing
+    return compressed_len > 0 && compressed_len < source_len - source_len / 16;
+}
+
+// Function to estimate with a fast deflate whether a sample of the data compresses
+int gzip_probe(const char* sample, unsigned long sample_len) {
+    uLongf probe_len = compressBound(sample_len);
+    unsigned char* probe = malloc(probe_len);
+    if (probe == NULL) {
+        return 1;
+    }
+    
+    int worthwhile = compress2(probe, &probe_len, (const unsigned char*)sample, sample_len, 1) == Z_OK
+                     && gzip_pays_off(sample_len, probe_len);
+    free(probe);
+    return worthwhile;
+}
+
+// Deflater reused by simple_gzip(), set up on first use in each thread
+// deflateInit2() allocates ~270 KB of state, deflateReset() keeps it for the next body
+static __thread z_stream deflater;
+static __thread int deflater_ready = 0;
+
+// Function to compress a buffer into a gzip stream in memory
+// The deflate data is produced by zlib (raw, no zlib wrapper), header and footer are written here
+// Returns the size of the gzipped data, or 0 when it does not fit dest_len
+unsigned long simple_gzip(char* dest, unsigned long dest_len, const char* source, unsigned long source_len) {
+    unsigned char *d = (unsigned char*)dest;
+    const unsigned char *s = (const unsigned char*)source;
+    
+    if (dest_len < 18) {
+        return 0;
+    }
+    
+    // Calculate CRC32 and length
+    uint32_t crc = calc_crc32(0, s, source_len);
+    uint32_t len = source_len;
+    
+    // Gzip header (10 bytes)
+    // Magic number (ID1, ID2)
+    *d++ = 0x1f;
+    *d++ = 0x8b;
+    // Compression method (8 = deflate)
+    *d++ = 8;
+    // Flags (0 = no extra fields)
+    *d++ = 0;
+    // Modification time (4 bytes, set to 0)
+    *d++ = 0;
+    *d++ = 0;
+    *d++ = 0;
+    *d++ = 0;
+    // Extra flags (2 = max compression, 4 = fastest)
+    *d++ = gzip_level >= 9 ? 2 : (gzip_level == 1 ? 4 : 0);
+    // Operating system (255 = unknown)
+    *d++ = 255;
+    
+    // Raw deflate stream, split into as many blocks as zlib needs
+    if (!deflater_ready) {
+        memset(&deflater, 0, sizeof(deflater));
+        if (deflateInit2(&deflater, gzip_level, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+            return 0;
+        }
+        deflater_ready = 1;
+    } else if (deflateReset(&deflater) != Z_OK) {
+        return 0;
+    }
+    z_stream* strm = &deflater;
+    
+    // The previous body may have left input or output space behind
+    strm->avail_in = 0;
+    strm->avail_out = 0;
+    strm->next_out = d;
+    unsigned long out_space = dest_len - 18;
+    unsigned long in_left = source_len;
+    strm->next_in = (unsigned char*)s;
+    
+    int status;
+    do {
+        // avail_in/avail_out are 32-bit, feed huge buffers in slices
+        if (strm->avail_in == 0 && in_left > 0) {
+            strm->avail_in = in_left > UINT32_MAX ? UINT32_MAX : in_left;
+            in_left -= strm->avail_in;
+        }
+        if (strm->avail_out == 0 && out_space > 0) {
+            strm->avail_out = out_space > UINT32_MAX ? UINT32_MAX : out_space;
+            out_space -= strm->avail_out;
+        }
+        status = deflate(strm, in_left == 0 ? Z_FINISH : Z_NO_FLUSH);
+    } while (status == Z_OK && (strm->avail_out > 0 || out_space > 0));
+    
+    d = strm->next_out;
+    if (status != Z_STREAM_END) {
+        // Output did not fit
+        return 0;
+    }
+    
+    // Gzip footer (8 bytes)
+    // CRC32 (4 bytes)
+    *d++ = crc & 0xff;
+    *d++ = (crc >> 8) & 0xff;
+    *d++ = (crc >> 16) & 0xff;
+    *d++ = (crc >> 24) & 0xff;
+    
+    // Input size modulo 2^32 (4 bytes)
+    *d++ = len & 0xff;
+    *d++ = (len >> 8) & 0xff;
+    *d++ = (len >> 16) & 0xff;
+    *d++ = (len >> 24) & 0xff;
+    
+    // Atomic, streams are also compressed on the I/O pool threads
+    __atomic_fetch_add(&worker_stats->gzip_input_bytes, source_len, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&worker_stats->gzip_output_bytes, d - (unsigned char*)dest, __ATOMIC_RELAXED);
+    
+    // Return total size
+    return (d - (unsigned char*)dest);
+}
+
+// Helper to write the 10-byte gzip header
+static void write_gzip_header(unsigned char *d) {
+    // Magic number, deflate method, no flags, no modification time
+    d[0] = 0x1f;
+    d[1] = 0x8b;
+    d[2] = 8;
+    d[3] = 0;
+    d[4] = 0;
+    d[5] = 0;
+    d[6] = 0;
+    d[7] = 0;
+    // Extra flags (2 = max compression, 4 = fastest)
+    d[8] = gzip_level >= 9 ? 2 : (gzip_level == 1 ? 4 : 0);
+    // Operating system (255 = unknown)
+    d[9] = 255;
+}
+
+// Function to start a streaming compressor
+int gzip_stream_init(struct gzip_stream* gz) {
+    memset(gz, 0, sizeof(*gz));
+    
+    if (deflateInit2(&gz->strm, gzip_level, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        return -1;
+    }
+    return 0;
+}
+
+// Function to compress the next piece of a stream
+size_t gzip_stream_deflate(struct gzip_stream* gz, const char* in, size_t in_len, size_t* consumed,
+                           int finish, char* out, size_t out_len) {
+    unsigned char *d = (unsigned char*)out;
+    unsigned char *end = d + out_len;
+    *consumed = 0;
+    
+    // The header goes out with the first piece so the client sees bytes right away
+    if (!gz->header_written) {
+        if (out_len < 10) {
+            return 0;
+        }
+        write_gzip_header(d);
+        d += 10;
+        gz->header_written = 1;
+    }
+    
+    if (!gz->deflate_done && d < end) {
+        gz->strm.next_in = (unsigned char*)in;
+        gz->strm.avail_in = in_len > UINT32_MAX ? UINT32_MAX : in_len;
+        gz->strm.next_out = d;
+        gz->strm.avail_out = (end - d) > UINT32_MAX ? UINT32_MAX : (end - d);
+        
+        int last = finish && gz->strm.avail_in == in_len;
+        int status = deflate(&gz->strm, last ? Z_FINISH : Z_NO_FLUSH);
+        
+        *consumed = in_len > UINT32_MAX ? UINT32_MAX - gz->strm.avail_in : in_len - gz->strm.avail_in;
+        gz->crc = calc_crc32(gz->crc, (const unsigned char*)in, *consumed);
+        gz->input_size += *consumed;
+        d = gz->strm.next_out;
+        
+        if (status == Z_STREAM_END) {
+            gz->deflate_done = 1;
+        }
+    }
+    
+    // Gzip footer: CRC32 and input size modulo 2^32
+    if (gz->deflate_done && !gz->done && end - d >= 8) {
+        uint32_t crc = gz->crc;
+        uint32_t len = gz->input_size;
+        *d++ = crc & 0xff;
+        *d++ = (crc >> 8) & 0xff;
+        *d++ = (crc >> 16) & 0xff;
+        *d++ = (crc >> 24) & 0xff;
+        *d++ = len & 0xff;
+        *d++ = (len >> 8) & 0xff;
+        *d++ = (len >> 16) & 0xff;
+        *d++ = (len >> 24) & 0xff;
+        gz->done = 1;
+    }
+    
+    // May run on an I/O pool thread next to the loop counting its own compression
+    __atomic_fetch_add(&worker_stats->gzip_input_bytes, *consumed, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&worker_stats->gzip_output_bytes, d - (unsigned char*)out, __ATOMIC_RELAXED);
+    return d - (unsigned char*)out;
+}
+
+// Function to release a streaming compressor
+void gzip_stream_end(struct gzip_stream* gz) {
+    deflateEnd(&gz->strm);
+}
@@ -0,0 +1,51 @@
+#ifndef GZIP_H
+#define GZIP_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <zlib.h>
+
+// Deflate level (0-9) used for responses
+extern int gzip_level;
+
+// Bodies smaller than this are sent uncompressed
+extern unsigned long gzip_min_size;
+
+// Largest gzip stream simple_gzip() can produce for source_len bytes
+unsigned long gzip_bound(unsigned long source_len);
+
+// Check before compressing whether a body is large enough to bother
+int gzip_worthwhile(unsigned long source_len);
+
+// Check after compressing whether the result is worth sending
+int gzip_pays_off(unsigned long source_len, unsigned long compressed_len);
+
+// Check with a fast deflate of a sample whether a streamed body is worth compressing
+int gzip_probe(const char* sample, unsigned long sample_len);
+
+// Compress into a gzip stream in memory, returns the size of the gzipped data or 0 on failure
+unsigned long simple_gzip(char* dest, unsigned long dest_len, const char* source, unsigned long source_len);
+
+// Streaming gzip compressor for bodies that are produced window by window
+struct gzip_stream {
+    z_stream strm;
+    uint32_t crc;
+    uint32_t input_size;
+    int header_written;
+    int deflate_done;       // Deflate data complete, footer still to write
+    int done;               // Footer written, stream complete
+};
+
+// Start a stream at the configured level, returns 0 on success
+int gzip_stream_init(struct gzip_stream* gz);
+
+// Compress up to in_len bytes into out, setting *consumed to the input used
+// With finish set the stream is completed once all input is consumed
+// Returns the number of bytes written to out (may be 0 while zlib buffers input)
+size_t gzip_stream_deflate(struct gzip_stream* gz, const char* in, size_t in_len, size_t* consumed,
+                           int finish, char* out, size_t out_len);
+
+// Release the zlib state of a stream
+void gzip_stream_end(struct gzip_stream* gz);
+
+#endif
@@ -0,0 +1,251 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "gzip_cache.h"
+#include "workers.h"
+
+// Cache settings, configured from the command line
+size_t gzip_cache_budget = 64 * 1024 * 1024;
+int gzip_static = 0;
+
+#define GZIP_CACHE_BUCKETS 1024
+
+// Per-process table, workers do not share entries
+static struct gzip_cache_entry* buckets[GZIP_CACHE_BUCKETS];
+static struct gzip_cache_entry* lru_head;   // Most recently used
+static struct gzip_cache_entry* lru_tail;
+static size_t cache_bytes;
+
+// Body prefilled for a response that the cache did not admit, kept for the next lookup of its version
+static struct gzip_cache_entry* held;
+
+// Helper to hash the path and encoding of an entry (FNV-1a)
+static uint32_t hash_key(const char* path, const char* encoding) {
+    uint32_t hash = 2166136261u;
+    for (const char* p = path; *p; p++) {
+        hash = (hash ^ (unsigned char)*p) * 16777619u;
+    }
+    hash = (hash ^ '\n') * 16777619u;
+    for (const char* p = encoding; *p; p++) {
+        hash = (hash ^ (unsigned char)*p) * 16777619u;
+    }
+    return hash;
+}
+
+// Helper to check that an entry was built from the file version described by st
+static int entry_is_fresh(const struct gzip_cache_entry* entry, const struct stat* st) {
+    return entry->size == st->st_size
+           && entry->mtime.tv_sec == st->st_mtim.tv_sec
+           && entry->mtime.tv_nsec == st->st_mtim.tv_nsec;
+}
+
+// Helper to find the entry of a path and encoding, whatever file version it holds
+static struct gzip_cache_entry* find_entry(const char* path, const char* encoding) {
+    struct gzip_cache_entry* entry = buckets[hash_key(path, encoding) % GZIP_CACHE_BUCKETS];
+    while (entry != NULL && (strcmp(entry->path, path) != 0 || strcmp(entry->encoding, encoding) != 0)) {
+        entry = entry->hash_next;
+    }
+    return entry;
+}
+
+// Helper to free an entry once nothing references it
+static void free_entry(struct gzip_cache_entry* entry) {
+    free(entry->data);
+    free(entry->path);
+    free(entry);
+}
+
+// Helper to move an entry to the front of the LRU list
+static void lru_push_front(struct gzip_cache_entry* entry) {
+    entry->lru_prev = NULL;
+    entry->lru_next = lru_head;
+    if (lru_head != NULL) {
+        lru_head->lru_prev = entry;
+    }
+    lru_head = entry;
+    if (lru_tail == NULL) {
+        lru_tail = entry;
+    }
+}
+
+// Helper to take an entry out of the LRU list
+static void lru_unlink(struct gzip_cache_entry* entry) {
+    if (entry->lru_prev != NULL) {
+        entry->lru_prev->lru_next = entry->lru_next;
+    } else {
+        lru_head = entry->lru_next;
+    }
+    if (entry->lru_next != NULL) {
+        entry->lru_next->lru_prev = entry->lru_prev;
+    } else {
+        lru_tail = entry->lru_prev;
+    }
+    entry->lru_prev = NULL;
+    entry->lru_next = NULL;
+}
+
+// Helper to remove an entry from the table, it is freed when the last response lets go
+static void remove_entry(struct gzip_cache_entry* entry) {
+    struct gzip_cache_entry** link = &buckets[hash_key(entry->path, entry->encoding) % GZIP_CACHE_BUCKETS];
+    while (*link != entry) {
+        link = &(*link)->hash_next;
+    }
+    *link = entry->hash_next;
+    lru_unlink(entry);
+
+    cache_bytes -= entry->charge;
+    worker_stats->gzip_cache_bytes = cache_bytes;
+    entry->cached = 0;
+    if (entry->refs == 0) {
+        free_entry(entry);
+    }
+}
+
+// Helper to check whether the held body is the one of a path and encoding
+static int held_matches(const char* path, const char* encoding) {
+    return held != NULL && strcmp(held->path, path) == 0 && strcmp(held->encoding, encoding) == 0;
+}
+
+// Function to look up the compressed representation of a file
+struct gzip_cache_entry* gzip_cache_lookup(const char* path, const char* encoding, const struct stat* st) {
+    // The miss of a body that was encoded ahead was counted by gzip_cache_prefill()
+    if (held_matches(path, encoding)) {
+        struct gzip_cache_entry* entry = held;
+        held = NULL;
+        if (entry_is_fresh(entry, st)) {
+            return entry;
+        }
+        gzip_cache_release(entry);
+    }
+    if (gzip_cache_budget == 0) {
+        return NULL;
+    }
+
+    struct gzip_cache_entry* entry = find_entry(path, encoding);
+    if (entry != NULL && !entry_is_fresh(entry, st)) {
+        // The file changed since it was compressed
+        remove_entry(entry);
+        entry = NULL;
+    }
+
+    if (entry == NULL) {
+        worker_stats->gzip_cache_misses++;
+        return NULL;
+    }
+
+    if (entry->prefilled) {
+        entry->prefilled = 0;
+    } else {
+        worker_stats->gzip_cache_hits++;
+    }
+    lru_unlink(entry);
+    lru_push_front(entry);
+    entry->refs++;
+    return entry;
+}
+
+// Function to check whether a body of this size may enter the cache
+int gzip_cache_admits(size_t data_len) {
+    // One file may not take more than a quarter of the budget
+    return gzip_cache_budget > 0 && data_len <= gzip_cache_budget / 4;
+}
+
+// Helper to allocate an entry outside the table, owning data once it succeeded
+static struct gzip_cache_entry* new_entry(const char* path, const char* encoding, const struct stat* st,
+                                          char* data, size_t data_len, int compressible) {
+    size_t path_len = strlen(path);
+    struct gzip_cache_entry* entry = calloc(1, sizeof(*entry));
+    if (entry == NULL) {
+        return NULL;
+    }
+    entry->path = malloc(path_len + 1);
+    if (entry->path == NULL) {
+        free(entry);
+        return NULL;
+    }
+    memcpy(entry->path, path, path_len + 1);
+    entry->encoding = encoding;
+    entry->mtime = st->st_mtim;
+    entry->size = st->st_size;
+    entry->data = data;
+    entry->data_len = data_len;
+    entry->compressible = compressible;
+    return entry;
+}
+
+// Function to add a compressed representation, evicting the least recently used entries
+struct gzip_cache_entry* gzip_cache_insert(const char* path, const char* encoding, const struct stat* st,
+                                           char* data, size_t data_len, int compressible) {
+    size_t charge = sizeof(struct gzip_cache_entry) + strlen(path) + 1 + data_len;
+    if (!gzip_cache_admits(charge)) {
+        return NULL;
+    }
+
+    struct gzip_cache_entry* entry = new_entry(path, encoding, st, data, data_len, compressible);
+    if (entry == NULL) {
+        return NULL;
+    }
+    entry->charge = charge;
+
+    // Another download of the same file may have filled it first, keep the newer copy
+    struct gzip_cache_entry* old = find_entry(path, encoding);
+    if (old != NULL) {
+        remove_entry(old);
+    }
+
+    while (cache_bytes + charge > gzip_cache_budget && lru_tail != NULL) {
+        remove_entry(lru_tail);
+        worker_stats->gzip_cache_evictions++;
+    }
+
+    struct gzip_cache_entry** bucket = &buckets[hash_key(path, encoding) % GZIP_CACHE_BUCKETS];
+    entry->hash_next = *bucket;
+    *bucket = entry;
+    lru_push_front(entry);
+    entry->cached = 1;
+    entry->refs = 1;
+
+    cache_bytes += charge;
+    worker_stats->gzip_cache_bytes = cache_bytes;
+    return entry;
+}
+
+// Function to drop a reference to an entry
+void gzip_cache_release(struct gzip_cache_entry* entry) {
+    entry->refs--;
+    if (entry->refs == 0 && !entry->cached) {
+        free_entry(entry);
+    }
+}
+
+// Function to store a body encoded ahead of the response that needs it
+void gzip_cache_prefill(const char* path, const char* encoding, const struct stat* st, char* data, size_t data_len,
+                        int compressible) {
+    if (gzip_cache_budget > 0) {
+        worker_stats->gzip_cache_misses++;
+    }
+    struct gzip_cache_entry* entry = gzip_cache_insert(path, encoding, st, data, data_len, compressible);
+    if (entry != NULL) {
+        entry->prefilled = 1;
+        gzip_cache_release(entry);
+        return;
+    }
+
+    // Not admitted, the response it was made for still takes it
+    entry = new_entry(path, encoding, st, data, data_len, compressible);
+    if (entry == NULL) {
+        free(data);
+        return;
+    }
+    entry->refs = 1;
+    if (held != NULL) {
+        gzip_cache_release(held);
+    }
+    held = entry;
+}
+
+// Function to check for an entry of any version without counting a hit or a miss
+int gzip_cache_contains(const char* path, const char* encoding) {
+    return held_matches(path, encoding) || (gzip_cache_budget > 0 && find_entry(path, encoding) != NULL);
+}
@@ -0,0 +1,57 @@
+#ifndef GZIP_CACHE_H
+#define GZIP_CACHE_H
+
+#include <stddef.h>
+#include <sys/stat.h>
+
+// Byte budget of the compressed-response cache of each process, 0 disables it
+extern size_t gzip_cache_budget;
+
+// Serve <name>.gz from the files directory when it is at least as new as <name>
+extern int gzip_static;
+
+// Compressed representation of one version of a file
+// An entry stays valid while a response holds a reference, even after it is evicted
+struct gzip_cache_entry {
+    char* path;
+    const char* encoding;
+    struct timespec mtime;          // Version of the source file the entry was built from
+    off_t size;
+
+    char* data;                     // Encoded body, NULL when the file does not compress
+    size_t data_len;
+    int compressible;
+    int prefilled;                  // Encoded ahead of its first lookup, which then counts as the miss
+
+    size_t charge;                  // Bytes counted against the budget
+    int refs;
+    int cached;                     // Still reachable from the table
+    struct gzip_cache_entry* hash_next;
+    struct gzip_cache_entry* lru_prev;
+    struct gzip_cache_entry* lru_next;
+};
+
+// Find the encoding of the file version described by st, counting a hit or a miss
+// Returns a referenced entry or NULL, stale versions of the file are dropped
+struct gzip_cache_entry* gzip_cache_lookup(const char* path, const char* encoding, const struct stat* st);
+
+// Store an encoded body (data may be NULL to remember that the file does not compress)
+// Returns a referenced entry owning data, or NULL when it is not admitted and data stays with the caller
+struct gzip_cache_entry* gzip_cache_insert(const char* path, const char* encoding, const struct stat* st,
+                                           char* data, size_t data_len, int compressible);
+
+// Store a body encoded ahead of the response that needs it (on the I/O pool), counting the miss
+// When the cache does not admit it, it is held for the next gzip_cache_lookup() of that file version
+void gzip_cache_prefill(const char* path, const char* encoding, const struct stat* st, char* data, size_t data_len,
+                        int compressible);
+
+// Check for an entry of the path in any version, without counting a hit or a miss
+int gzip_cache_contains(const char* path, const char* encoding);
+
+// Check whether a body of this size could be admitted at all
+int gzip_cache_admits(size_t data_len);
+
+// Drop a reference returned by gzip_cache_lookup() or gzip_cache_insert()
+void gzip_cache_release(struct gzip_cache_entry* entry);
+
+#endif
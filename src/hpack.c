@@ -0,0 +1,498 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "hpack.h"
+
+// Static table of RFC 7541 Appendix A, index 1 is the first entry
+struct static_field {
+    const char* name;
+    const char* value;
+};
+
+static const struct static_field static_table[] = {
+    {"", ""},
+    {":authority", ""},
+    {":method", "GET"},
+    {":method", "POST"},
+    {":path", "/"},
+    {":path", "/index.html"},
+    {":scheme", "http"},
+    {":scheme", "https"},
+    {":status", "200"},
+    {":status", "204"},
+    {":status", "206"},
+    {":status", "304"},
+    {":status", "400"},
+    {":status", "404"},
+    {":status", "500"},
+    {"accept-charset", ""},
+    {"accept-encoding", "gzip, deflate"},
+    {"accept-language", ""},
+    {"accept-ranges", ""},
+    {"accept", ""},
+    {"access-control-allow-origin", ""},
+    {"age", ""},
+    {"allow", ""},
+    {"authorization", ""},
+    {"cache-control", ""},
+    {"content-disposition", ""},
+    {"content-encoding", ""},
+    {"content-language", ""},
+    {"content-length", ""},
+    {"content-location", ""},
+    {"content-range", ""},
+    {"content-type", ""},
+    {"cookie", ""},
+    {"date", ""},
+    {"etag", ""},
+    {"expect", ""},
+    {"expires", ""},
+    {"from", ""},
+    {"host", ""},
+    {"if-match", ""},
+    {"if-modified-since", ""},
+    {"if-none-match", ""},
+    {"if-range", ""},
+    {"if-unmodified-since", ""},
+    {"last-modified", ""},
+    {"link", ""},
+    {"location", ""},
+    {"max-forwards", ""},
+    {"proxy-authenticate", ""},
+    {"proxy-authorization", ""},
+    {"range", ""},
+    {"referer", ""},
+    {"refresh", ""},
+    {"retry-after", ""},
+    {"server", ""},
+    {"set-cookie", ""},
+    {"strict-transport-security", ""},
+    {"transfer-encoding", ""},
+    {"user-agent", ""},
+    {"vary", ""},
+    {"via", ""},
+    {"www-authenticate", ""},
+};
+
+#define STATIC_COUNT 61
+
+// Huffman code lengths of RFC 7541 Appendix B, symbol 256 is EOS
+// The code is canonical, so the codes themselves follow from the lengths
+static const uint8_t huffman_lengths[257] = {
+    13, 23, 28, 28, 28, 28, 28, 28, 28, 24, 30, 28, 28, 30, 28, 28,
+    28, 28, 28, 28, 28, 28, 30, 28, 28, 28, 28, 28, 28, 28, 28, 28,
+    6, 10, 10, 12, 13, 6, 8, 11, 10, 10, 8, 11, 8, 6, 6, 6,
+    5, 5, 5, 6, 6, 6, 6, 6, 6, 6, 7, 8, 15, 6, 12, 10,
+    13, 6, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+    7, 7, 7, 7, 7, 7, 7, 7, 8, 7, 8, 13, 19, 13, 14, 6,
+    15, 5, 6, 5, 6, 5, 6, 6, 6, 5, 7, 7, 6, 6, 6, 5,
+    6, 7, 6, 5, 5, 6, 7, 7, 7, 7, 7, 15, 11, 14, 13, 28,
+    20, 22, 20, 20, 22, 22, 22, 23, 22, 23, 23, 23, 23, 23, 24, 23,
+    24, 24, 22, 23, 24, 23, 23, 23, 23, 21, 22, 23, 22, 23, 23, 24,
+    22, 21, 20, 22, 22, 23, 23, 21, 23, 22, 22, 24, 21, 22, 23, 23,
+    21, 21, 22, 21, 23, 22, 23, 23, 20, 22, 22, 22, 23, 22, 22, 23,
+    26, 26, 20, 19, 22, 23, 22, 25, 26, 26, 26, 27, 27, 26, 24, 25,
+    19, 21, 26, 27, 27, 26, 27, 24, 21, 21, 26, 26, 28, 27, 27, 27,
+    20, 24, 20, 21, 22, 21, 21, 23, 22, 22, 25, 25, 24, 24, 26, 23,
+    26, 27, 26, 26, 27, 27, 27, 27, 27, 28, 27, 27, 27, 27, 27, 26,
+    30,
+};
+
+#define HUFFMAN_MAX_LENGTH 30
+
+// Code of every symbol, for encoding
+static uint32_t huffman_codes[257];
+
+// Symbols ordered by code, with the first code and the position of every length, for decoding
+static uint16_t huffman_symbols[257];
+static uint32_t huffman_first_code[HUFFMAN_MAX_LENGTH + 1];
+static uint16_t huffman_first_symbol[HUFFMAN_MAX_LENGTH + 1];
+static uint16_t huffman_count[HUFFMAN_MAX_LENGTH + 1];
+
+// Function to build the canonical Huffman code from the lengths
+void hpack_init() {
+    int n = 0;
+    uint32_t code = 0;
+    for (int length = 1; length <= HUFFMAN_MAX_LENGTH; length++) {
+        huffman_first_code[length] = code;
+        huffman_first_symbol[length] = n;
+        for (int symbol = 0; symbol < 257; symbol++) {
+            if (huffman_lengths[symbol] == length) {
+                huffman_codes[symbol] = code++;
+                huffman_symbols[n++] = symbol;
+            }
+        }
+        huffman_count[length] = n - huffman_first_symbol[length];
+        code <<= 1;
+    }
+}
+
+// Helper to decode a Huffman string into out, returns its length or -1 when invalid or too long
+static long huffman_decode(const uint8_t* in, size_t len, char* out, size_t space) {
+    size_t n = 0;
+    uint32_t code = 0;
+    int length = 0;
+    for (size_t i = 0; i < len; i++) {
+        for (int bit = 7; bit >= 0; bit--) {
+            code = (code << 1) | ((in[i] >> bit) & 1);
+            length++;
+            uint32_t offset = code - huffman_first_code[length];
+            if (offset < huffman_count[length]) {
+                int symbol = huffman_symbols[huffman_first_symbol[length] + offset];
+                if (symbol == 256 || n == space) {
+                    return -1;
+                }
+                out[n++] = symbol;
+                code = 0;
+                length = 0;
+            } else if (length == HUFFMAN_MAX_LENGTH) {
+                return -1;
+            }
+        }
+    }
+
+    // Padding is the most significant bits of EOS, all ones and shorter than a byte
+    if (length > 7 || code != (1u << length) - 1) {
+        return -1;
+    }
+    return n;
+}
+
+// Helper to get the Huffman-encoded length of a string in bytes
+static size_t huffman_length(const char* s, size_t len) {
+    uint64_t bits = 0;
+    for (size_t i = 0; i < len; i++) {
+        bits += huffman_lengths[(uint8_t)s[i]];
+    }
+    return (bits + 7) / 8;
+}
+
+// Helper to Huffman-encode a string, padding the last byte with ones
+static size_t huffman_encode(const char* s, size_t len, uint8_t* out) {
+    uint64_t bits = 0;
+    int count = 0;
+    size_t n = 0;
+    for (size_t i = 0; i < len; i++) {
+        uint8_t symbol = s[i];
+        bits = (bits << huffman_lengths[symbol]) | huffman_codes[symbol];
+        count += huffman_lengths[symbol];
+        while (count >= 8) {
+            count -= 8;
+            out[n++] = bits >> count;
+        }
+    }
+    if (count > 0) {
+        out[n++] = (bits << (8 - count)) | (0xff >> count);
+    }
+    return n;
+}
+
+// Helper to decode an integer with a prefix of the given bits, returns -1 when truncated or too large
+static int decode_integer(const uint8_t** p, const uint8_t* end, int prefix, size_t* value) {
+    if (*p >= end) {
+        return -1;
+    }
+    size_t max = (1u << prefix) - 1;
+    size_t v = **p & max;
+    (*p)++;
+    if (v < max) {
+        *value = v;
+        return 0;
+    }
+
+    // Continuation bytes, capped well below anything a header block could need
+    for (int shift = 0; shift <= 21; shift += 7) {
+        if (*p >= end) {
+            return -1;
+        }
+        uint8_t b = **p;
+        (*p)++;
+        v += (size_t)(b & 0x7f) << shift;
+        if ((b & 0x80) == 0) {
+            *value = v;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+// Helper to encode an integer after the flag bits already set in first
+static size_t encode_integer(uint8_t* out, uint8_t first, int prefix, size_t value) {
+    size_t max = (1u << prefix) - 1;
+    if (value < max) {
+        out[0] = first | value;
+        return 1;
+    }
+    out[0] = first | max;
+    value -= max;
+    size_t n = 1;
+    while (value >= 128) {
+        out[n++] = (value & 0x7f) | 0x80;
+        value >>= 7;
+    }
+    out[n++] = value;
+    return n;
+}
+
+// Helper to decode a string literal, pointing into the block or into the scratch buffer when Huffman-coded
+static int decode_string(const uint8_t** p, const uint8_t* end, char* scratch, size_t* scratch_used,
+                         const char** s, size_t* len) {
+    if (*p >= end) {
+        return -1;
+    }
+    int huffman = **p & 0x80;
+    size_t length;
+    if (decode_integer(p, end, 7, &length) == -1 || length > (size_t)(end - *p)) {
+        return -1;
+    }
+    if (!huffman) {
+        *s = (const char*)*p;
+        *len = length;
+    } else {
+        long decoded = huffman_decode(*p, length, scratch + *scratch_used, HPACK_SCRATCH_SIZE - *scratch_used);
+        if (decoded < 0) {
+            return -1;
+        }
+        *s = scratch + *scratch_used;
+        *len = decoded;
+        *scratch_used += decoded;
+    }
+    *p += length;
+    return 0;
+}
+
+// Helper to drop the oldest entries until the table fits in size
+static void table_evict(struct hpack_table* t, size_t size) {
+    while (t->size > size && t->count > 0) {
+        struct hpack_entry* e = &t->entries[(t->first + t->count - 1) % HPACK_MAX_ENTRIES];
+        t->size -= e->name_len + e->value_len + 32;
+        free(e->name);
+        e->name = NULL;
+        t->count--;
+    }
+}
+
+// Helper to insert a field as the newest entry, an entry larger than the table empties it
+static void table_add(struct hpack_table* t, const char* name, size_t name_len, const char* value, size_t value_len) {
+    size_t size = name_len + value_len + 32;
+    if (size > t->max_size) {
+        table_evict(t, 0);
+        return;
+    }
+
+    // Copy before evicting, name may point into the entry that makes room
+    char* data = malloc(name_len + value_len + 1);
+    if (data == NULL) {
+        // Keeping the table consistent with the peer's is not optional, forget every entry instead
+        table_evict(t, 0);
+        return;
+    }
+    memcpy(data, name, name_len);
+    memcpy(data + name_len, value, value_len);
+    table_evict(t, t->max_size - size);
+
+    t->first = (t->first + HPACK_MAX_ENTRIES - 1) % HPACK_MAX_ENTRIES;
+    struct hpack_entry* e = &t->entries[t->first];
+    e->name = data;
+    e->name_len = name_len;
+    e->value = data + name_len;
+    e->value_len = value_len;
+    t->count++;
+    t->size += size;
+}
+
+// Helper to look up an index of the static table followed by the dynamic one
+static int table_get(const struct hpack_table* t, size_t index, const char** name, size_t* name_len,
+                     const char** value, size_t* value_len) {
+    if (index == 0) {
+        return -1;
+    }
+    if (index <= STATIC_COUNT) {
+        *name = static_table[index].name;
+        *name_len = strlen(*name);
+        *value = static_table[index].value;
+        *value_len = strlen(*value);
+        return 0;
+    }
+    index -= STATIC_COUNT + 1;
+    if (index >= (size_t)t->count) {
+        return -1;
+    }
+    const struct hpack_entry* e = &t->entries[(t->first + index) % HPACK_MAX_ENTRIES];
+    *name = e->name;
+    *name_len = e->name_len;
+    *value = e->value;
+    *value_len = e->value_len;
+    return 0;
+}
+
+static void table_init(struct hpack_table* t) {
+    memset(t, 0, sizeof(*t));
+    t->max_size = HPACK_TABLE_SIZE;
+}
+
+void hpack_decoder_init(struct hpack_decoder* d) {
+    table_init(&d->table);
+}
+
+void hpack_encoder_init(struct hpack_encoder* e) {
+    table_init(&e->table);
+    e->pending_max = 0;
+    e->update_pending = 0;
+}
+
+void hpack_decoder_free(struct hpack_decoder* d) {
+    table_evict(&d->table, 0);
+}
+
+void hpack_encoder_free(struct hpack_encoder* e) {
+    table_evict(&e->table, 0);
+}
+
+// Function to decode a header block, calling cb for every field in order
+int hpack_decode(struct hpack_decoder* d, const uint8_t* block, size_t len, hpack_field_cb cb, void* ctx) {
+    const uint8_t* p = block;
+    const uint8_t* end = block + len;
+    int fields = 0;
+    while (p < end) {
+        size_t scratch_used = 0;
+        const char* name;
+        const char* value;
+        size_t name_len;
+        size_t value_len;
+        size_t index;
+        uint8_t b = *p;
+
+        if (b & 0x80) {
+            // Indexed field
+            if (decode_integer(&p, end, 7, &index) == -1 ||
+                table_get(&d->table, index, &name, &name_len, &value, &value_len) == -1) {
+                return -1;
+            }
+        } else if ((b & 0xe0) == 0x20) {
+            // Table size update, only before the first field and never above what we announced
+            if (fields > 0 || decode_integer(&p, end, 5, &index) == -1 || index > HPACK_TABLE_SIZE) {
+                return -1;
+            }
+            d->table.max_size = index;
+            table_evict(&d->table, index);
+            continue;
+        } else {
+            // Literal field, with incremental indexing (01), without indexing (0000) or never indexed (0001)
+            int add = (b & 0xc0) == 0x40;
+            if (decode_integer(&p, end, add ? 6 : 4, &index) == -1) {
+                return -1;
+            }
+            if (index > 0) {
+                const char* unused;
+                size_t unused_len;
+                if (table_get(&d->table, index, &name, &name_len, &unused, &unused_len) == -1) {
+                    return -1;
+                }
+            } else if (decode_string(&p, end, d->scratch, &scratch_used, &name, &name_len) == -1) {
+                return -1;
+            }
+            if (decode_string(&p, end, d->scratch, &scratch_used, &value, &value_len) == -1) {
+                return -1;
+            }
+
+            // The callback sees the field before the insert, which may evict the entry name points into
+            if (cb(ctx, name, name_len, value, value_len) == -1) {
+                return -1;
+            }
+            if (add) {
+                table_add(&d->table, name, name_len, value, value_len);
+            }
+            fields++;
+            continue;
+        }
+
+        if (cb(ctx, name, name_len, value, value_len) == -1) {
+            return -1;
+        }
+        fields++;
+    }
+    return 0;
+}
+
+// Function to follow a new SETTINGS_HEADER_TABLE_SIZE of the client
+void hpack_encoder_set_max(struct hpack_encoder* e, size_t max_size) {
+    if (max_size > HPACK_TABLE_SIZE) {
+        max_size = HPACK_TABLE_SIZE;
+    }
+    if (max_size == e->table.max_size && !e->update_pending) {
+        return;
+    }
+
+    // The lowest size since the last block must be announced, so the client evicts what we evicted
+    if (!e->update_pending || max_size < e->pending_max) {
+        e->pending_max = max_size;
+    }
+    e->update_pending = 1;
+    e->table.max_size = max_size;
+    table_evict(&e->table, max_size);
+}
+
+size_t hpack_encode_begin(struct hpack_encoder* e, uint8_t* out) {
+    if (!e->update_pending) {
+        return 0;
+    }
+    e->update_pending = 0;
+    size_t n = encode_integer(out, 0x20, 5, e->pending_max);
+    if (e->pending_max != e->table.max_size) {
+        n += encode_integer(out + n, 0x20, 5, e->table.max_size);
+    }
+    return n;
+}
+
+// Helper to write a string literal, Huffman-coded when that is shorter
+static size_t encode_string(uint8_t* out, const char* s, size_t len) {
+    size_t huffman = huffman_length(s, len);
+    if (huffman < len) {
+        size_t n = encode_integer(out, 0x80, 7, huffman);
+        return n + huffman_encode(s, len, out + n);
+    }
+    size_t n = encode_integer(out, 0x00, 7, len);
+    memcpy(out + n, s, len);
+    return n + len;
+}
+
+// Function to encode one response field, preferring a full match, then a name match, then literals
+size_t hpack_encode_field(struct hpack_encoder* e, uint8_t* out, const char* name, size_t name_len,
+                          const char* value, size_t value_len, int add) {
+    size_t name_index = 0;
+    for (size_t i = 1; i <= STATIC_COUNT; i++) {
+        const struct static_field* f = &static_table[i];
+        if (strlen(f->name) != name_len || memcmp(f->name, name, name_len) != 0) {
+            continue;
+        }
+        if (strlen(f->value) == value_len && memcmp(f->value, value, value_len) == 0) {
+            return encode_integer(out, 0x80, 7, i);
+        }
+        if (name_index == 0) {
+            name_index = i;
+        }
+    }
+    for (int i = 0; i < e->table.count; i++) {
+        const struct hpack_entry* entry = &e->table.entries[(e->table.first + i) % HPACK_MAX_ENTRIES];
+        if (entry->name_len != name_len || memcmp(entry->name, name, name_len) != 0) {
+            continue;
+        }
+        if (entry->value_len == value_len && memcmp(entry->value, value, value_len) == 0) {
+            return encode_integer(out, 0x80, 7, STATIC_COUNT + 1 + i);
+        }
+        if (name_index == 0) {
+            name_index = STATIC_COUNT + 1 + i;
+        }
+    }
+
+    size_t n = add ? encode_integer(out, 0x40, 6, name_index) : encode_integer(out, 0x00, 4, name_index);
+    if (name_index == 0) {
+        n += encode_string(out + n, name, name_len);
+    }
+    n += encode_string(out + n, value, value_len);
+    if (add) {
+        table_add(&e->table, name, name_len, value, value_len);
+    }
+    return n;
+}
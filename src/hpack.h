@@ -0,0 +1,74 @@
+#ifndef HPACK_H
+#define HPACK_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Dynamic table size both directions start with (SETTINGS_HEADER_TABLE_SIZE default)
+// The server never announces a larger one and never uses more for its own responses
+#define HPACK_TABLE_SIZE 4096
+
+// Most entries a table of HPACK_TABLE_SIZE holds, each costs its name and value plus 32 bytes
+#define HPACK_MAX_ENTRIES (HPACK_TABLE_SIZE / 32)
+
+// Huffman-decoded strings of one header block are collected here, longer ones fail the block
+#define HPACK_SCRATCH_SIZE 16384
+
+// Field of a dynamic table, name and value share one allocation
+struct hpack_entry {
+    char* name;
+    size_t name_len;
+    char* value;
+    size_t value_len;
+};
+
+// Dynamic table of one direction of a connection, a ring with the newest entry at first
+struct hpack_table {
+    struct hpack_entry entries[HPACK_MAX_ENTRIES];
+    int first;
+    int count;
+    size_t size;                    // Sum of the entry sizes as defined by RFC 7541 (name + value + 32)
+    size_t max_size;
+};
+
+// Request headers of a connection, decoded with the table the client builds up
+struct hpack_decoder {
+    struct hpack_table table;
+    char scratch[HPACK_SCRATCH_SIZE];
+};
+
+// Response headers of a connection, encoded against the table the client mirrors
+struct hpack_encoder {
+    struct hpack_table table;
+    size_t pending_max;             // Size update to announce at the start of the next block
+    int update_pending;
+};
+
+// Called for every decoded field, name and value are only valid during the call
+// Returning -1 stops decoding
+typedef int (*hpack_field_cb)(void* ctx, const char* name, size_t name_len, const char* value, size_t value_len);
+
+// Build the Huffman code tables, called once at startup
+void hpack_init();
+
+void hpack_decoder_init(struct hpack_decoder* d);
+void hpack_encoder_init(struct hpack_encoder* e);
+void hpack_decoder_free(struct hpack_decoder* d);
+void hpack_encoder_free(struct hpack_encoder* e);
+
+// Decode a complete header block, returns 0 or -1 on a compression error (the connection is then unusable)
+int hpack_decode(struct hpack_decoder* d, const uint8_t* block, size_t len, hpack_field_cb cb, void* ctx);
+
+// Apply the client's SETTINGS_HEADER_TABLE_SIZE to the table the encoder may use
+void hpack_encoder_set_max(struct hpack_encoder* e, size_t max_size);
+
+// Start a header block, writing a pending table size update, returns the bytes written (at most 6)
+size_t hpack_encode_begin(struct hpack_encoder* e, uint8_t* out);
+
+// Encode one field with a lowercase name, indexed when the static or dynamic table has it
+// With add set the field enters the dynamic table, for values that repeat across responses
+// out needs room for name_len + value_len + 16 bytes, returns the bytes written
+size_t hpack_encode_field(struct hpack_encoder* e, uint8_t* out, const char* name, size_t name_len,
+                          const char* value, size_t value_len, int add);
+
+#endif
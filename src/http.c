@@ -0,0 +1,1330 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/random.h>
+#include <time.h>
+
+#include "http.h"
+#include "gzip.h"
+#include "gzip_cache.h"
+#include "file_cache.h"
+#include "upload.h"
+#include "range.h"
+#include "conditional.h"
+#include "http_parser.h"
+#include "workers.h"
+#include "access_log.h"
+#include "metrics.h"
+#include "router.h"
+#include "arena.h"
+
+// Global variable to store the directory path
+char *files_directory = NULL;
+
+// Files are compressed in windows of this size when streamed
+#define GZIP_STREAM_WINDOW 65536
+
+// Chunk size line reserved in front of every chunk: 6 hex digits and CRLF
+#define CHUNK_HEADER_SIZE 8
+
+// Largest piece handed to sendfile()/splice() at once, so one download cannot monopolize a worker
+#define ZERO_COPY_CHUNK (1024 * 1024)
+
+// State of a file compressed while it is sent
+struct gzip_file_stream {
+    struct gzip_stream gz;
+    char window[GZIP_STREAM_WINDOW];
+    size_t window_len;
+    size_t window_pos;
+    int eof;
+    int last_chunk_sent;
+    
+    // Compressed output collected for the cache, NULL once the file turns out too large
+    char* cache_fill;
+    size_t cache_fill_len;
+    size_t cache_fill_cap;
+    char* cache_path;
+    struct stat cache_stat;
+};
+
+// State of a multipart/byteranges body, every part is a header block followed by file bytes
+struct multipart_ranges {
+    struct byte_range ranges[MAX_BYTE_RANGES];
+    int count;
+    int part;               // Part whose framing is in framing, count once it holds the closing boundary
+    off_t complete_length;
+    char boundary[24];
+    char framing[192];
+    size_t framing_len;
+    size_t framing_sent;
+};
+
+// Keep-alive settings shared by both server models
+int keep_alive_timeout = 5;
+int max_keep_alive_requests = 100;
+
+// Identity file bodies skip the user-space copy unless disabled with --no-sendfile
+int zero_copy_files = 1;
+
+// Helper to reset a response before it is filled in
+static void init_response(struct http_response* res) {
+    struct arena* arena = res->arena;
+    int http2 = res->http2;
+    memset(res, 0, sizeof(*res));
+    res->arena = arena;
+    res->http2 = http2;
+    res->file_fd = -1;
+    res->splice_pipe[0] = -1;
+    res->splice_pipe[1] = -1;
+}
+
+// Function to check if client supports gzip encoding
+int client_supports_gzip(const char* buffer, const struct http_request* req) {
+    const struct http_slice* accept_encoding = http_get_header(req, HTTP_HEADER_ACCEPT_ENCODING);
+    
+    // Check if gzip is in the Accept-Encoding header
+    return accept_encoding != NULL && http_slice_contains(buffer, *accept_encoding, "gzip");
+}
+
+// Function to check whether the client wants the connection kept open
+int request_wants_keep_alive(const char* buffer, const struct http_request* req) {
+    const struct http_slice* connection = http_get_header(req, HTTP_HEADER_CONNECTION);
+    
+    if (connection != NULL && http_slice_contains(buffer, *connection, "close")) {
+        return 0;
+    }
+    
+    // HTTP/1.0 closes by default unless the client asks otherwise
+    if (req->version_minor == 0) {
+        return connection != NULL && http_slice_contains(buffer, *connection, "keep-alive");
+    }
+    
+    return 1;
+}
+
+// Helper to append bytes to the header block being built
+// Headers built here stay far below the buffer size, anything that would overflow it is dropped
+static void append_header_bytes(struct http_response* res, const char* data, size_t len) {
+    if (res->headers_len + len > sizeof(res->headers)) {
+        return;
+    }
+    memcpy(res->headers + res->headers_len, data, len);
+    res->headers_len += len;
+}
+
+// Header text known at compile time, so is its length
+#define APPEND_LITERAL(res, literal) append_header_bytes(res, literal, sizeof(literal) - 1)
+
+// Helper to append a decimal number to the header block, without going through printf
+static void append_header_number(struct http_response* res, long long value) {
+    char digits[24];
+    size_t pos = sizeof(digits);
+    unsigned long long remaining = value < 0 ? 0 : (unsigned long long)value;
+    do {
+        digits[--pos] = '0' + remaining % 10;
+        remaining /= 10;
+    } while (remaining > 0);
+    append_header_bytes(res, digits + pos, sizeof(digits) - pos);
+}
+
+// Helper to finish the header block with Content-Length and the blank line
+static void end_headers(struct http_response* res, long long content_length) {
+    APPEND_LITERAL(res, "Content-Length: ");
+    append_header_number(res, content_length);
+    APPEND_LITERAL(res, "\r\n\r\n");
+}
+
+// Helper to set the headers of a response with a body: a constant status line and headers, then the length
+static void set_headers(struct http_response* res, const char* fixed, size_t fixed_len, long long content_length) {
+    res->headers_len = 0;
+    append_header_bytes(res, fixed, fixed_len);
+    end_headers(res, content_length);
+}
+
+#define SET_HEADERS(res, literal, content_length) set_headers(res, literal, sizeof(literal) - 1, content_length)
+
+// Helper to append a header line to a response whose headers are already terminated
+static void add_response_header(struct http_response* res, const char* name, size_t name_len, const char* value,
+                                size_t value_len) {
+    // Drop the blank line, add the header and terminate again, or leave the headers as they are
+    if (res->headers_len < 2 || res->headers_len + name_len + value_len + 2 > sizeof(res->headers)) {
+        return;
+    }
+    res->headers_len -= 2;
+    append_header_bytes(res, name, name_len);
+    append_header_bytes(res, value, value_len);
+    APPEND_LITERAL(res, "\r\n\r\n");
+}
+
+#define ADD_HEADER(res, name, value) add_response_header(res, name, sizeof(name) - 1, value, strlen(value))
+#define ADD_HEADER_LITERAL(res, line) add_response_header(res, line, sizeof(line) - 1, "", 0)
+
+// Responses without a body, serialized at compile time so answering them is a single copy
+// An empty body still needs a length so the connection can be reused
+struct static_response {
+    int status;
+    const char* data;
+    size_t len;
+};
+
+#define STATIC_RESPONSE(status, line) \
+    { status, line "\r\nContent-Length: 0\r\n\r\n", sizeof(line "\r\nContent-Length: 0\r\n\r\n") - 1 }
+
+static const struct static_response static_responses[] = {
+    STATIC_RESPONSE(200, "HTTP/1.1 200 OK"),
+    STATIC_RESPONSE(201, "HTTP/1.1 201 Created"),
+    STATIC_RESPONSE(400, "HTTP/1.1 400 Bad Request"),
+    STATIC_RESPONSE(404, "HTTP/1.1 404 Not Found"),
+    STATIC_RESPONSE(405, "HTTP/1.1 405 Method Not Allowed"),
+    STATIC_RESPONSE(413, "HTTP/1.1 413 Content Too Large"),
+    STATIC_RESPONSE(417, "HTTP/1.1 417 Expectation Failed"),
+    STATIC_RESPONSE(431, "HTTP/1.1 431 Request Header Fields Too Large"),
+    STATIC_RESPONSE(500, "HTTP/1.1 500 Internal Server Error"),   // Also stands in for unknown statuses
+};
+
+#define STATIC_RESPONSE_COUNT (sizeof(static_responses) / sizeof(static_responses[0]))
+
+// Helper to set a fixed response without a body
+static void set_simple_response(struct http_response* res, int status) {
+    const struct static_response* response = &static_responses[STATIC_RESPONSE_COUNT - 1];
+    for (size_t i = 0; i < STATIC_RESPONSE_COUNT; i++) {
+        if (static_responses[i].status == status) {
+            response = &static_responses[i];
+            break;
+        }
+    }
+    memcpy(res->headers, response->data, response->len);
+    res->headers_len = response->len;
+}
+
+// Helper to set a text/plain response, gzip-compressed when supported
+static void set_text_response(struct http_response* res, const char* text, int text_len, int supports_gzip, const char* what) {
+    if (supports_gzip && gzip_worthwhile(text_len)) {
+        // Prepare buffers for compression - allocate the worst case
+        unsigned long compressed_bound = gzip_bound(text_len);
+        char* compressed_data = arena_alloc(res->arena, compressed_bound);
+        
+        if (compressed_data == NULL) {
+            // Failed to allocate memory
+            set_simple_response(res, 500);
+            printf("PID %d: Failed to allocate memory for compression\n", getpid());
+            return;
+        }
+        
+        // Compress the text
+        unsigned long compressed_size = simple_gzip(compressed_data, compressed_bound, text, text_len);
+        
+        if (gzip_pays_off(text_len, compressed_size)) {
+            // Create response with Content-Type, Content-Encoding, and correct Content-Length headers
+            SET_HEADERS(res, "HTTP/1.1 200 OK\r\nContent-Type: text/plain\r\nContent-Encoding: gzip\r\n",
+                        compressed_size);
+            res->body = compressed_data;
+            res->body_len = compressed_size;
+            ADD_HEADER_LITERAL(res, "Vary: Accept-Encoding");
+            
+            log_debug("PID %d: Sent gzip-compressed %s response: %.*s (original size: %d, compressed: %lu)\n", 
+                   getpid(), what, text_len, text, text_len, compressed_size);
+            return;
+        }
+        
+        // Compression failed or did not shrink the body, fallback to uncompressed
+        log_debug("PID %d: Compression did not pay off, sending uncompressed %s response\n", getpid(), what);
+    }
+    
+    // Standard response without compression
+    char* body = arena_alloc(res->arena, text_len + 1);
+    if (body == NULL) {
+        set_simple_response(res, 500);
+        printf("PID %d: Failed to allocate memory for %s response\n", getpid(), what);
+        return;
+    }
+    memcpy(body, text, text_len);
+    
+    SET_HEADERS(res, "HTTP/1.1 200 OK\r\nContent-Type: text/plain\r\n", text_len);
+    res->body = body;
+    res->body_len = text_len;
+    if (gzip_worthwhile(text_len)) {
+        // A client accepting gzip would have got another body, shared caches must tell them apart
+        ADD_HEADER_LITERAL(res, "Vary: Accept-Encoding");
+    }
+    log_debug("PID %d: Sent %s response: %.*s\n", getpid(), what, text_len, text);
+}
+
+// Function to check whether a file is already compressed, judging by its extension
+static int is_compressed_format(const char* filename) {
+    static const char* extensions[] = {
+        ".gz", ".tgz", ".zip", ".bz2", ".xz", ".zst", ".br", ".7z",
+        ".png", ".jpg", ".jpeg", ".gif", ".webp", ".avif",
+        ".mp3", ".mp4", ".mkv", ".webm", ".woff2",
+    };
+    
+    const char* dot = strrchr(filename, '.');
+    if (dot == NULL) {
+        return 0;
+    }
+    for (size_t i = 0; i < sizeof(extensions) / sizeof(extensions[0]); i++) {
+        if (strcasecmp(dot, extensions[i]) == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Helper to check that a <name>.gz sidecar is a regular file at least as new as <name>
+// A sidecar older than the file would serve stale content
+static int sidecar_is_fresh(const struct stat* sidecar_stat, const struct stat* file_stat) {
+    return S_ISREG(sidecar_stat->st_mode)
+           && (sidecar_stat->st_mtim.tv_sec > file_stat->st_mtim.tv_sec
+               || (sidecar_stat->st_mtim.tv_sec == file_stat->st_mtim.tv_sec
+                   && sidecar_stat->st_mtim.tv_nsec >= file_stat->st_mtim.tv_nsec));
+}
+
+// Helper to answer with <name>.gz when it is at least as new as the file, returns 1 when it did
+static int serve_gzip_sidecar(const char* filename, const char* filepath, const struct stat* file_stat,
+                              struct http_response* res) {
+    char sidecar_path[2064];
+    snprintf(sidecar_path, sizeof(sidecar_path), "%s.gz", filepath);
+    
+    // Missing sidecars are remembered by the file cache, so most files cost no syscall here
+    struct stat sidecar_stat;
+    struct file_cache_entry* entry;
+    int fd = file_cache_open(sidecar_path, &sidecar_stat, &entry);
+    if (fd == -1) {
+        return 0;
+    }
+    
+    if (!sidecar_is_fresh(&sidecar_stat, file_stat)) {
+        file_cache_close(fd, entry);
+        return 0;
+    }
+    
+    SET_HEADERS(res, "HTTP/1.1 200 OK\r\nContent-Type: application/octet-stream\r\nContent-Encoding: gzip\r\n",
+                sidecar_stat.st_size);
+    res->file_fd = fd;
+    res->file_entry = entry;
+    res->file_size = sidecar_stat.st_size;
+    worker_stats->gzip_static_hits++;
+    
+    log_debug("PID %d: Sent precompressed file: %s.gz (original size: %ld, compressed: %ld)\n", 
+           getpid(), filename, file_stat->st_size, sidecar_stat.st_size);
+    return 1;
+}
+
+// Helper to cache that a file does not compress, so later requests skip the attempt
+static void remember_incompressible(const char* filepath, const struct stat* file_stat) {
+    struct gzip_cache_entry* entry = gzip_cache_insert(filepath, "gzip", file_stat, NULL, 0, 0);
+    if (entry != NULL) {
+        gzip_cache_release(entry);
+    }
+}
+
+// Helper to stop collecting a streamed file for the cache
+static void abandon_cache_fill(struct gzip_file_stream* stream) {
+    free(stream->cache_fill);
+    free(stream->cache_path);
+    stream->cache_fill = NULL;
+    stream->cache_path = NULL;
+}
+
+// Helper to collect streamed compressed output, giving up once the file is too large to cache
+static void collect_for_cache(struct gzip_file_stream* stream, const char* data, size_t len) {
+    if (stream->cache_path == NULL) {
+        return;
+    }
+    if (!gzip_cache_admits(stream->cache_fill_len + len)) {
+        abandon_cache_fill(stream);
+        return;
+    }
+    
+    if (stream->cache_fill_len + len > stream->cache_fill_cap) {
+        size_t capacity = stream->cache_fill_cap ? stream->cache_fill_cap * 2 : GZIP_STREAM_WINDOW;
+        while (capacity < stream->cache_fill_len + len) {
+            capacity *= 2;
+        }
+        char* grown = realloc(stream->cache_fill, capacity);
+        if (grown == NULL) {
+            abandon_cache_fill(stream);
+            return;
+        }
+        stream->cache_fill = grown;
+        stream->cache_fill_cap = capacity;
+    }
+    memcpy(stream->cache_fill + stream->cache_fill_len, data, len);
+    stream->cache_fill_len += len;
+}
+
+// Helper to write the framing in front of a part, or the closing boundary after the last one
+static size_t format_part_framing(const struct multipart_ranges* mp, int part, char* buf, size_t size) {
+    if (part == mp->count) {
+        return snprintf(buf, size, "\r\n--%s--\r\n", mp->boundary);
+    }
+    return snprintf(buf, size, "\r\n--%s\r\nContent-Type: application/octet-stream\r\nContent-Range: bytes %ld-%ld/%ld\r\n\r\n",
+                    mp->boundary, mp->ranges[part].start, mp->ranges[part].end - 1, mp->complete_length);
+}
+
+// Helper to move to the next part once the framing and file bytes of the current one are out
+static void advance_multipart(struct http_response* res) {
+    struct multipart_ranges* mp = res->ranges;
+    if (mp->framing_sent < mp->framing_len || res->file_offset < res->file_size || res->splice_pending > 0
+        || mp->part == mp->count) {
+        return;
+    }
+    
+    mp->part++;
+    mp->framing_len = format_part_framing(mp, mp->part, mp->framing, sizeof(mp->framing));
+    mp->framing_sent = 0;
+    if (mp->part < mp->count) {
+        res->file_offset = mp->ranges[mp->part].start;
+        res->file_size = mp->ranges[mp->part].end;
+    }
+}
+
+// Representation of a file response, which decides the validators sent with it
+#define FILE_ERROR 0
+#define FILE_IDENTITY 1
+#define FILE_GZIP 2
+
+// Helper to check If-Range, a Range for another version of the file gets the whole file
+static int if_range_matches(const char* buffer, const struct http_request* req, const struct stat* file_stat,
+                            const char* etag) {
+    const struct http_slice* if_range = http_get_header(req, HTTP_HEADER_IF_RANGE);
+    if (if_range == NULL) {
+        return 1;
+    }
+    
+    // Either the strong entity tag of the identity coding, or the exact Last-Modified date
+    const char* value = buffer + if_range->offset;
+    if (if_range->length > 0 && (value[0] == '"' || value[0] == 'W')) {
+        return etag_list_matches(value, if_range->length, etag, 0);
+    }
+    time_t date = parse_http_date(value, if_range->length);
+    return date != -1 && date == file_stat->st_mtime;
+}
+
+// Helper to evaluate If-None-Match, or If-Modified-Since when there is none
+// other_etag is the tag of the other coding, NULL when the client does not accept that coding
+// Returns the entity tag to answer 304 with, NULL when the body has to be sent
+static const char* check_not_modified(const char* buffer, const struct http_request* req, const struct stat* file_stat,
+                                      const char* etag, const char* other_etag) {
+    if (!http_slice_equals(buffer, req->method, "GET")) {
+        return NULL;
+    }
+    
+    const struct http_slice* if_none_match = http_get_header(req, HTTP_HEADER_IF_NONE_MATCH);
+    if (if_none_match != NULL) {
+        // A copy in the other coding is just as current
+        if (etag_list_matches(buffer + if_none_match->offset, if_none_match->length, etag, 1)) {
+            return etag;
+        }
+        if (other_etag != NULL
+            && etag_list_matches(buffer + if_none_match->offset, if_none_match->length, other_etag, 1)) {
+            return other_etag;
+        }
+        return NULL;
+    }
+    
+    const struct http_slice* if_modified_since = http_get_header(req, HTTP_HEADER_IF_MODIFIED_SINCE);
+    if (if_modified_since != NULL) {
+        time_t since = parse_http_date(buffer + if_modified_since->offset, if_modified_since->length);
+        if (since != -1 && file_stat->st_mtime <= since) {
+            return etag;
+        }
+    }
+    return NULL;
+}
+
+// Helper to answer a Range request from the file as is
+// Takes over the descriptor and returns the representation sent when it answers, -1 when it does not
+static int serve_byte_ranges(const char* buffer, const struct http_request* req, const char* filename,
+                             int fd, struct file_cache_entry* file_entry, const struct stat* file_stat,
+                             const char* etag, struct http_response* res) {
+    const struct http_slice* range = http_get_header(req, HTTP_HEADER_RANGE);
+    if (range == NULL || !S_ISREG(file_stat->st_mode) || !http_slice_equals(buffer, req->method, "GET")
+        || !if_range_matches(buffer, req, file_stat, etag)) {
+        return -1;
+    }
+    
+    struct byte_range ranges[MAX_BYTE_RANGES];
+    off_t file_size = file_stat->st_size;
+    int count = parse_byte_ranges(buffer + range->offset, range->length, file_size, ranges, MAX_BYTE_RANGES);
+    if (count < 0) {
+        // Not a range set we honour, the whole file is a valid answer
+        return -1;
+    }
+    
+    if (count == 0) {
+        file_cache_close(fd, file_entry);
+        res->headers_len = 0;
+        APPEND_LITERAL(res, "HTTP/1.1 416 Range Not Satisfiable\r\nContent-Range: bytes */");
+        append_header_number(res, file_size);
+        APPEND_LITERAL(res, "\r\n");
+        end_headers(res, 0);
+        log_debug("PID %d: Sent 416 Range Not Satisfiable for file: %s (size: %ld bytes)\n", getpid(), filename, file_size);
+        return FILE_ERROR;
+    }
+    
+    if (count == 1) {
+        // One range is the file body with different bounds, it keeps the zero-copy path
+        res->headers_len = 0;
+        APPEND_LITERAL(res, "HTTP/1.1 206 Partial Content\r\nContent-Type: application/octet-stream\r\nContent-Range: bytes ");
+        append_header_number(res, ranges[0].start);
+        APPEND_LITERAL(res, "-");
+        append_header_number(res, ranges[0].end - 1);
+        APPEND_LITERAL(res, "/");
+        append_header_number(res, file_size);
+        APPEND_LITERAL(res, "\r\n");
+        end_headers(res, ranges[0].end - ranges[0].start);
+        res->file_fd = fd;
+        res->file_entry = file_entry;
+        res->file_offset = ranges[0].start;
+        res->file_size = ranges[0].end;
+        
+        log_debug("PID %d: Sent byte range %ld-%ld of file: %s (size: %ld bytes)\n", 
+               getpid(), ranges[0].start, ranges[0].end - 1, filename, file_size);
+        return FILE_IDENTITY;
+    }
+    
+    struct multipart_ranges* mp = arena_alloc(res->arena, sizeof(*mp));
+    if (mp == NULL) {
+        set_simple_response(res, 500);
+        printf("PID %d: Failed to allocate memory for byte ranges\n", getpid());
+        file_cache_close(fd, file_entry);
+        return FILE_ERROR;
+    }
+    memcpy(mp->ranges, ranges, count * sizeof(ranges[0]));
+    mp->count = count;
+    mp->complete_length = file_size;
+    
+    // The boundary must not show up in the file bytes, random digits make that vanishingly unlikely
+    unsigned long long nonce;
+    if (getrandom(&nonce, sizeof(nonce), GRND_NONBLOCK) != sizeof(nonce)) {
+        nonce = ((unsigned long long)getpid() << 32) ^ (unsigned long long)time(NULL);
+    }
+    snprintf(mp->boundary, sizeof(mp->boundary), "%016llx", nonce);
+    
+    // Every part's framing is known up front, so the body still has a Content-Length
+    char framing[sizeof(mp->framing)];
+    off_t content_length = 0;
+    for (int part = 0; part <= count; part++) {
+        content_length += format_part_framing(mp, part, framing, sizeof(framing));
+        if (part < count) {
+            content_length += ranges[part].end - ranges[part].start;
+        }
+    }
+    
+    mp->part = 0;
+    mp->framing_len = format_part_framing(mp, 0, mp->framing, sizeof(mp->framing));
+    mp->framing_sent = 0;
+    
+    res->headers_len = 0;
+    APPEND_LITERAL(res, "HTTP/1.1 206 Partial Content\r\nContent-Type: multipart/byteranges; boundary=");
+    append_header_bytes(res, mp->boundary, strlen(mp->boundary));
+    APPEND_LITERAL(res, "\r\n");
+    end_headers(res, content_length);
+    res->file_fd = fd;
+    res->file_entry = file_entry;
+    res->file_offset = ranges[0].start;
+    res->file_size = ranges[0].end;
+    res->ranges = mp;
+    
+    log_debug("PID %d: Sent %d byte ranges of file: %s (size: %ld bytes)\n", getpid(), count, filename, file_size);
+    return FILE_IDENTITY;
+}
+
+// Helper to answer with the whole file, compressed when it is worthwhile and pays off
+// Takes over the descriptor, returns the representation sent or FILE_ERROR for an error response
+static int send_whole_file(const char* filename, const char* filepath, int fd, struct file_cache_entry* file_entry,
+                           const struct stat* file_stat, int supports_gzip, int compress, int chunked_allowed,
+                           struct http_response* res) {
+    off_t file_size = file_stat->st_size;
+    
+    // A fresh precompressed sidecar beats compressing at all
+    if (supports_gzip && gzip_static && !is_compressed_format(filename)
+        && serve_gzip_sidecar(filename, filepath, file_stat, res)) {
+        file_cache_close(fd, file_entry);
+        return FILE_GZIP;
+    }
+    
+    if (compress) {
+        struct gzip_cache_entry* entry = gzip_cache_lookup(filepath, "gzip", file_stat);
+        if (entry != NULL && entry->compressible) {
+            // Compressed earlier, the cached copy has a known length even for HTTP/1.0
+            file_cache_close(fd, file_entry);
+            SET_HEADERS(res, "HTTP/1.1 200 OK\r\nContent-Type: application/octet-stream\r\nContent-Encoding: gzip\r\n",
+                        entry->data_len);
+            res->body = entry->data;
+            res->body_len = entry->data_len;
+            res->cache_entry = entry;
+            
+            log_debug("PID %d: Sent cached gzip-compressed file: %s (original size: %ld, compressed: %zu)\n", 
+                   getpid(), filename, file_size, entry->data_len);
+            return FILE_GZIP;
+        }
+        if (entry != NULL) {
+            // Known not to compress, skip straight to the identity response
+            gzip_cache_release(entry);
+            compress = 0;
+        }
+    }
+    
+    if (compress && file_size > GZIP_STREAM_WINDOW && chunked_allowed) {
+        // Large file: compress window by window while sending, memory stays bounded
+        struct gzip_file_stream* stream = arena_alloc(res->arena, sizeof(*stream));
+        if (stream == NULL) {
+            set_simple_response(res, 500);
+            printf("PID %d: Failed to allocate memory for compression\n", getpid());
+            file_cache_close(fd, file_entry);
+            return FILE_ERROR;
+        }
+        
+        // The first window decides whether the file compresses at all, it is then fed to the stream
+        ssize_t bytes_read = pread(fd, stream->window, sizeof(stream->window), 0);
+        if (bytes_read > 0 && gzip_probe(stream->window, bytes_read) && gzip_stream_init(&stream->gz) == 0) {
+            stream->window_len = bytes_read;
+            stream->window_pos = 0;
+            stream->eof = 0;
+            stream->last_chunk_sent = 0;
+            stream->cache_fill = NULL;
+            stream->cache_fill_len = 0;
+            stream->cache_fill_cap = 0;
+            stream->cache_path = gzip_cache_admits(0) ? strdup(filepath) : NULL;
+            stream->cache_stat = *file_stat;
+            
+            res->headers_len = 0;
+            APPEND_LITERAL(res, "HTTP/1.1 200 OK\r\nContent-Type: application/octet-stream\r\nContent-Encoding: gzip\r\n"
+                                "Transfer-Encoding: chunked\r\n\r\n");
+            res->file_fd = fd;
+            res->file_entry = file_entry;
+            res->file_size = file_size;
+            res->file_offset = bytes_read;
+            res->gzip_file = stream;
+            
+            log_debug("PID %d: Streaming gzip-compressed file: %s (original size: %ld)\n", getpid(), filename, file_size);
+            return FILE_GZIP;
+        }
+        
+        // Incompressible (or unreadable), send it as is from the start
+        if (bytes_read > 0) {
+            remember_incompressible(filepath, file_stat);
+        }
+        compress = 0;
+    }
+    
+    if (compress && file_size <= GZIP_STREAM_WINDOW) {
+        // Small file: compress in memory so the response has a Content-Length
+        // Read the file content into memory
+        char* file_content = arena_alloc(res->arena, file_size);
+        if (file_content == NULL) {
+            // Failed to allocate memory
+            set_simple_response(res, 500);
+            printf("PID %d: Failed to allocate memory for file: %s\n", getpid(), filename);
+            file_cache_close(fd, file_entry);
+            return FILE_ERROR;
+        }
+        
+        // Read file content
+        ssize_t bytes_read = pread(fd, file_content, file_size, 0);
+        file_cache_close(fd, file_entry);
+        
+        if (bytes_read != file_size) {
+            // Failed to read the entire file
+            set_simple_response(res, 500);
+            printf("PID %d: Failed to read entire file: %s\n", getpid(), filename);
+            return FILE_ERROR;
+        }
+        
+        // Prepare buffers for compression
+        unsigned long compressed_bound = gzip_bound(file_size);
+        char* compressed_data = malloc(compressed_bound);
+        
+        if (compressed_data == NULL) {
+            // Failed to allocate memory for compression
+            set_simple_response(res, 500);
+            printf("PID %d: Failed to allocate memory for compression\n", getpid());
+            return FILE_ERROR;
+        }
+        
+        // Compress the file content
+        unsigned long compressed_size = simple_gzip(compressed_data, compressed_bound, file_content, file_size);
+        
+        if (gzip_pays_off(file_size, compressed_size)) {
+            // Create response with Content-Type, Content-Encoding, and correct Content-Length headers
+            SET_HEADERS(res, "HTTP/1.1 200 OK\r\nContent-Type: application/octet-stream\r\nContent-Encoding: gzip\r\n",
+                        compressed_size);
+            res->body = compressed_data;
+            res->body_len = compressed_size;
+            res->body_allocated = 1;
+            
+            // Keep it for the next request, trimmed to what deflate produced
+            char* trimmed = realloc(compressed_data, compressed_size);
+            if (trimmed != NULL) {
+                res->body = trimmed;
+                res->cache_entry = gzip_cache_insert(filepath, "gzip", file_stat, trimmed, compressed_size, 1);
+                res->body_allocated = res->cache_entry == NULL;
+            }
+            
+            log_debug("PID %d: Sent gzip-compressed file: %s (original size: %ld, compressed: %lu)\n", 
+                   getpid(), filename, file_size, compressed_size);
+            return FILE_GZIP;
+        } else {
+            // Compression failed or did not shrink the file, fallback to uncompressed
+            SET_HEADERS(res, "HTTP/1.1 200 OK\r\nContent-Type: application/octet-stream\r\nAccept-Ranges: bytes\r\n",
+                        file_size);
+            res->body = file_content;
+            res->body_len = file_size;
+            free(compressed_data);
+            remember_incompressible(filepath, file_stat);
+            
+            log_debug("PID %d: Compression did not pay off, sent uncompressed file: %s (size: %ld bytes)\n", 
+                   getpid(), filename, file_size);
+        }
+    } else {
+        // Standard response without compression, the file is streamed by the sender
+        SET_HEADERS(res, "HTTP/1.1 200 OK\r\nContent-Type: application/octet-stream\r\nAccept-Ranges: bytes\r\n",
+                    file_size);
+        res->file_fd = fd;
+        res->file_entry = file_entry;
+        res->file_size = file_size;
+        
+        log_debug("PID %d: Sent file: %s (size: %ld bytes)\n", getpid(), filename, file_size);
+    }
+    return FILE_IDENTITY;
+}
+
+// Function to check, on the loop, whether compressing a file ahead of its response may pay
+// file_stat is NULL when the file is not open yet, the pool then decides once it has the size
+int request_compresses_file(const char* buffer, const struct http_request* req, const char* filepath,
+                            const struct stat* file_stat) {
+    if (!client_supports_gzip(buffer, req) || is_compressed_format(filepath)
+        || http_get_header(req, HTTP_HEADER_RANGE) != NULL || gzip_cache_contains(filepath, "gzip")) {
+        return 0;
+    }
+    return file_stat == NULL
+           || (S_ISREG(file_stat->st_mode) && gzip_worthwhile(file_stat->st_size)
+               && file_stat->st_size <= GZIP_STREAM_WINDOW);
+}
+
+// Function to compress a small file the way its response would, ahead of it on the I/O pool
+// Only reads the request, the file and its sidecar, the caches are left to the loop
+int compress_file_ahead(const char* buffer, const struct http_request* req, const char* filepath, int fd,
+                        const struct stat* file_stat, char** data, size_t* data_len) {
+    off_t file_size = file_stat->st_size;
+    if (!S_ISREG(file_stat->st_mode) || !gzip_worthwhile(file_size) || file_size > GZIP_STREAM_WINDOW) {
+        return 0;
+    }
+    
+    // A conditional GET answered with 304 never reads the file
+    char etag[ETAG_SIZE];
+    char gzip_etag[ETAG_SIZE];
+    format_etag(file_stat, "", etag);
+    format_etag(file_stat, "-gz", gzip_etag);
+    if (check_not_modified(buffer, req, file_stat, gzip_etag, etag) != NULL) {
+        return 0;
+    }
+    
+    // A fresh sidecar is sent instead
+    char sidecar_path[2064];
+    struct stat sidecar_stat;
+    snprintf(sidecar_path, sizeof(sidecar_path), "%s.gz", filepath);
+    if (gzip_static && stat(sidecar_path, &sidecar_stat) == 0 && sidecar_is_fresh(&sidecar_stat, file_stat)) {
+        return 0;
+    }
+    
+    char* file_content = malloc(file_size);
+    unsigned long compressed_bound = gzip_bound(file_size);
+    char* compressed_data = malloc(compressed_bound);
+    if (file_content == NULL || compressed_data == NULL || pread(fd, file_content, file_size, 0) != file_size) {
+        free(file_content);
+        free(compressed_data);
+        return 0;
+    }
+    unsigned long compressed_size = simple_gzip(compressed_data, compressed_bound, file_content, file_size);
+    free(file_content);
+    
+    // Kept trimmed to what deflate produced, or dropped to remember that the file does not compress
+    *data = NULL;
+    *data_len = 0;
+    if (gzip_pays_off(file_size, compressed_size)) {
+        char* trimmed = realloc(compressed_data, compressed_size);
+        *data = trimmed != NULL ? trimmed : compressed_data;
+        *data_len = compressed_size;
+    } else {
+        free(compressed_data);
+    }
+    return 1;
+}
+
+// Handler for GET /files/<name>
+static void handle_file_get(const char* buffer, const struct http_request* req, const char* filename,
+                            const char* filepath, int supports_gzip, struct http_response* res) {
+    // Open and stat through the cache, hot files and repeated misses skip the path walk
+    // The descriptor may be shared with other responses, so it is only read at explicit offsets
+    struct stat file_stat;
+    struct file_cache_entry* file_entry;
+    int fd = file_cache_open(filepath, &file_stat, &file_entry);
+    if (fd == -1) {
+        // File not found - return 404
+        set_simple_response(res, 404);
+        log_debug("PID %d: Sent 404 Not Found response for file: %s\n", getpid(), filename);
+        return;
+    }
+    
+    off_t file_size = file_stat.st_size;
+    
+    // Validators of both codings of this version, a conditional GET naming either one gets 304
+    int compress = supports_gzip && gzip_worthwhile(file_size) && !is_compressed_format(filename);
+    char etag[ETAG_SIZE];
+    char gzip_etag[ETAG_SIZE];
+    char last_modified[HTTP_DATE_SIZE];
+    format_etag(&file_stat, "", etag);
+    format_etag(&file_stat, "-gz", gzip_etag);
+    format_http_date(file_stat.st_mtime, last_modified);
+    
+    // The gzip copy only counts as current for a client that accepts gzip
+    const char* current_etag = check_not_modified(buffer, req, &file_stat, compress ? gzip_etag : etag,
+                                                  compress ? etag : supports_gzip ? gzip_etag : NULL);
+    
+    // Whether Accept-Encoding picks the representation, caches then have to key on it
+    int negotiated = !is_compressed_format(filename) && (gzip_worthwhile(file_size) || gzip_static);
+    if (current_etag != NULL) {
+        // The client's copy is current, the body is never read
+        file_cache_close(fd, file_entry);
+        res->headers_len = 0;
+        APPEND_LITERAL(res, "HTTP/1.1 304 Not Modified\r\nETag: ");
+        append_header_bytes(res, current_etag, strlen(current_etag));
+        APPEND_LITERAL(res, "\r\nLast-Modified: ");
+        append_header_bytes(res, last_modified, strlen(last_modified));
+        APPEND_LITERAL(res, "\r\n\r\n");
+        if (negotiated) {
+            ADD_HEADER_LITERAL(res, "Vary: Accept-Encoding");
+        }
+        log_debug("PID %d: Sent 304 Not Modified for file: %s\n", getpid(), filename);
+        return;
+    }
+    
+    // Ranges are served from the file as is, never compressed
+    int representation = serve_byte_ranges(buffer, req, filename, fd, file_entry, &file_stat, etag, res);
+    if (representation == -1) {
+        representation = send_whole_file(filename, filepath, fd, file_entry, &file_stat, supports_gzip, compress,
+                                          req->version_minor >= 1, res);
+    }
+    
+    if (representation != FILE_ERROR) {
+        ADD_HEADER(res, "ETag: ", representation == FILE_GZIP ? gzip_etag : etag);
+        ADD_HEADER(res, "Last-Modified: ", last_modified);
+        if (negotiated) {
+            ADD_HEADER_LITERAL(res, "Vary: Accept-Encoding");
+        }
+    }
+}
+
+// Helper to map the <name> of /files/<name> to the file name and its path under the files directory
+static void build_file_path(const char* buffer, struct http_slice name, char* filename, size_t filename_size,
+                            char* filepath, size_t filepath_size) {
+    snprintf(filename, filename_size, "%.*s", (int)name.length, buffer + name.offset);
+    
+    // Create the full file path
+    snprintf(filepath, filepath_size, "%s/%s", files_directory, filename);
+}
+
+// Function to find the file a GET request will serve
+int request_file_path(const char* buffer, const struct http_request* req, char* filepath, size_t filepath_size) {
+    struct route_match match;
+    route_request(buffer, req, &match);
+    if (files_directory == NULL || match.route != ROUTE_FILES_GET) {
+        return 0;
+    }
+    char filename[1024];
+    build_file_path(buffer, match.param, filename, sizeof(filename), filepath, filepath_size);
+    return 1;
+}
+
+// Function to build the /metrics response
+static void set_metrics_response(struct http_response* res) {
+    size_t len;
+    char* body = metrics_render(&len);
+    if (body == NULL) {
+        set_simple_response(res, 500);
+        printf("PID %d: Failed to allocate memory for metrics response\n", getpid());
+        return;
+    }
+    SET_HEADERS(res, "HTTP/1.1 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\n", len);
+    res->body = body;
+    res->body_len = len;
+    res->body_allocated = 1;
+}
+
+// Function to route a request and build the response
+void handle_request(const char* buffer, const struct http_request* req, int keep_alive,
+                    struct http_response* res) {
+    init_response(res);
+    
+    struct http_slice path = req->path;
+    log_debug("Extracted path: %.*s\n", (int)path.length, buffer + path.offset);
+    
+    // Check if client supports gzip
+    int supports_gzip = client_supports_gzip(buffer, req);
+    log_debug("Client supports gzip: %s\n", supports_gzip ? "Yes" : "No");
+    
+    // Determine the appropriate response from the route table
+    struct route_match match;
+    route_request(buffer, req, &match);
+    switch (match.route) {
+    case ROUTE_ROOT:
+        // Root path - return 200 OK
+        set_simple_response(res, 200);
+        log_debug("PID %d: Sent 200 OK response for root path\n", getpid());
+        break;
+    case ROUTE_ECHO:
+        // Echo endpoint, the string is the rest of the path
+        set_text_response(res, buffer + match.param.offset, match.param.length, supports_gzip, "echo");
+        break;
+    case ROUTE_USER_AGENT: {
+        // User-Agent endpoint
+        const struct http_slice* user_agent = http_get_header(req, HTTP_HEADER_USER_AGENT);
+        if (user_agent != NULL) {
+            set_text_response(res, buffer + user_agent->offset, user_agent->length, supports_gzip, "user-agent");
+        } else {
+            set_text_response(res, "", 0, supports_gzip, "user-agent");
+        }
+        break;
+    }
+    case ROUTE_METRICS:
+        // Counters of every worker, summed now rather than on the request path
+        set_metrics_response(res);
+        break;
+    case ROUTE_FILES_GET:
+        // Files endpoint, uploads never get here as their bodies are streamed by start_upload()
+        if (files_directory != NULL) {
+            char filename[1024];
+            char filepath[2048];
+            build_file_path(buffer, match.param, filename, sizeof(filename), filepath, sizeof(filepath));
+            handle_file_get(buffer, req, filename, filepath, supports_gzip, res);
+            break;
+        }
+        set_simple_response(res, 404);
+        break;
+    default:
+        if (match.status == 405) {
+            // Known path, but not for this method
+            set_simple_response(res, 405);
+            ADD_HEADER(res, "Allow: ", match.allow);
+            log_debug("PID %d: Sent 405 Method Not Allowed response\n", getpid());
+            break;
+        }
+        // Any other path - return 404 Not Found
+        set_simple_response(res, 404);
+        log_debug("PID %d: Sent 404 Not Found response\n", getpid());
+        break;
+    }
+    
+    // Cache-Control configured for the path prefix, on responses a cache may keep
+    const char* cache_control = cache_control_for(buffer + path.offset, path.length);
+    int status = response_status(res);
+    if (cache_control != NULL && (status == 200 || status == 206 || status == 304)) {
+        ADD_HEADER(res, "Cache-Control: ", cache_control);
+    }
+    
+    // Tell the client whether the connection stays open
+    if (keep_alive) {
+        ADD_HEADER_LITERAL(res, "Connection: keep-alive");
+    } else {
+        ADD_HEADER_LITERAL(res, "Connection: close");
+    }
+}
+
+// Function to answer a request that could not be parsed, the connection is closed afterwards
+void handle_request_error(int status, struct http_response* res) {
+    init_response(res);
+    
+    set_simple_response(res, status);
+    ADD_HEADER_LITERAL(res, "Connection: close");
+    log_debug("PID %d: Rejected request with %d\n", getpid(), status);
+}
+
+// Function to answer the request at the start of the buffer
+size_t respond_to_request(const char* buffer, size_t len, struct http_request* req, int requests_served,
+                          int* keep_alive, struct http_response* res) {
+    int status = http_parse_request(req, buffer, len);
+    if (status == HTTP_PARSE_ERROR) {
+        handle_request_error(400, res);
+        *keep_alive = 0;
+        return len;
+    }
+    if (status == HTTP_PARSE_INCOMPLETE) {
+        // The buffer filled up before the headers ended
+        handle_request_error(431, res);
+        *keep_alive = 0;
+        return len;
+    }
+    
+    size_t request_len = http_request_length(req);
+    *keep_alive = request_wants_keep_alive(buffer, req) && requests_served < max_keep_alive_requests;
+    if (request_len > len) {
+        // The body did not fit the buffer, answer what we have and close
+        request_len = len;
+        *keep_alive = 0;
+    }
+    
+    if (req->chunked) {
+        // Only uploads decode chunked bodies, the rest of this one cannot be skipped
+        *keep_alive = 0;
+    }
+    
+    log_debug("Received request:\n%.*s\n", (int)request_len, buffer);
+    handle_request(buffer, req, *keep_alive, res);
+    return request_len;
+}
+
+// Function to check whether a request uploads a file
+int request_is_upload(const char* buffer, const struct http_request* req) {
+    if (files_directory == NULL) {
+        return 0;
+    }
+    struct route_match match;
+    route_request(buffer, req, &match);
+    return match.route == ROUTE_FILES_POST;
+}
+
+// Function to start streaming the body of POST /files/<name> to disk
+struct upload* start_upload(const char* buffer, const struct http_request* req, int* send_continue,
+                            struct http_response* res) {
+    init_response(res);
+    *send_continue = 0;
+    log_debug("Received upload request:\n%.*s\n", (int)req->header_length, buffer);
+    
+    // Only 100-continue is an expectation we can meet
+    const struct http_slice* expect = http_get_header(req, HTTP_HEADER_EXPECT);
+    if (expect != NULL && req->version_minor >= 1) {
+        if (expect->length != 12 || strncasecmp(buffer + expect->offset, "100-continue", 12) != 0) {
+            handle_request_error(417, res);
+            return NULL;
+        }
+        *send_continue = 1;
+    }
+    
+    if (!req->chunked && (http_get_header(req, HTTP_HEADER_CONTENT_LENGTH) == NULL || req->content_length == 0)) {
+        // Bad request - missing or empty body
+        handle_request_error(400, res);
+        return NULL;
+    }
+    
+    char filename[1024];
+    char filepath[2048];
+    struct route_match match;
+    route_request(buffer, req, &match);
+    build_file_path(buffer, match.param, filename, sizeof(filename), filepath, sizeof(filepath));
+    
+    int status;
+    struct upload* up = upload_begin(filepath, req->chunked, req->content_length, &status);
+    if (up == NULL) {
+        handle_request_error(status == 413 ? 413 : 500, res);
+        return NULL;
+    }
+    
+    log_debug("PID %d: Receiving file: %s (%s)\n", getpid(), filename, req->chunked ? "chunked" : "Content-Length");
+    return up;
+}
+
+// Function to answer a finished upload
+void finish_upload(struct upload* up, int* keep_alive, struct http_response* res) {
+    // An empty chunked body creates nothing, like an empty Content-Length body
+    if (up->status == 0 && up->received == 0) {
+        up->status = 400;
+    }
+    
+    // Same size as the path start_upload() built, upload_finish() frees the original
+    char path[2048];
+    snprintf(path, sizeof(path), "%s", up->path);
+    size_t received = up->received;
+    int status = upload_finish(up);
+    
+    if (status == 0) {
+        // The new file replaced any cached descriptor of the old one
+        file_cache_invalidate(path);
+        set_simple_response(res, 201);
+        log_debug("PID %d: Created file: %s (size: %zu bytes)\n", getpid(), path, received);
+    } else {
+        // What is left of the body was not read, so the connection cannot be reused
+        *keep_alive = 0;
+        set_simple_response(res, status == 413 || status == 400 ? status : 500);
+        printf("PID %d: Upload to %s failed with status %d\n", getpid(), path, status);
+    }
+    
+    if (*keep_alive) {
+        ADD_HEADER_LITERAL(res, "Connection: keep-alive");
+    } else {
+        ADD_HEADER_LITERAL(res, "Connection: close");
+    }
+}
+
+// Function to produce the next chunk of a file compressed on the fly
+static ssize_t read_gzip_chunk(struct http_response* res, char* buf, size_t len) {
+    struct gzip_file_stream* stream = res->gzip_file;
+    if (stream->last_chunk_sent) {
+        return 0;
+    }
+    
+    // HTTP/2 frames the body itself, the payload then fills the whole buffer
+    size_t framing = res->http2 ? 0 : CHUNK_HEADER_SIZE;
+    if (len < framing + 32) {
+        return -1;
+    }
+    
+    // Compress into the space between the chunk size line and the trailing CRLF
+    char* payload = buf + framing;
+    size_t payload_space = len - framing - (res->http2 ? 0 : 2);
+    if (payload_space > 0xffffff) {
+        payload_space = 0xffffff;
+    }
+    size_t produced = 0;
+    
+    // Keep going until zlib hands out data, it may swallow several windows first
+    while (produced == 0 && !stream->gz.done) {
+        if (stream->window_pos == stream->window_len && !stream->eof) {
+            ssize_t bytes_read = pread(res->file_fd, stream->window, sizeof(stream->window), res->file_offset);
+            if (bytes_read < 0) {
+                return -1;
+            }
+            res->file_offset += bytes_read;
+            stream->window_len = bytes_read;
+            stream->window_pos = 0;
+            stream->eof = bytes_read == 0;
+        }
+        
+        size_t consumed;
+        produced = gzip_stream_deflate(&stream->gz, stream->window + stream->window_pos,
+                                       stream->window_len - stream->window_pos, &consumed,
+                                       stream->eof, payload, payload_space);
+        stream->window_pos += consumed;
+    }
+    
+    if (produced == 0) {
+        // Stream complete, send the last chunk, free_response() then caches the stream
+        stream->last_chunk_sent = 1;
+        if (res->http2) {
+            return 0;
+        }
+        memcpy(buf, "0\r\n\r\n", 5);
+        return 5;
+    }
+    
+    collect_for_cache(stream, payload, produced);
+    if (res->http2) {
+        return produced;
+    }
+    
+    // Fixed-width chunk size, leading zeros are allowed and avoid moving the payload
+    char size_line[32];
+    snprintf(size_line, sizeof(size_line), "%06zx\r\n", produced);
+    memcpy(buf, size_line, CHUNK_HEADER_SIZE);
+    memcpy(payload + produced, "\r\n", 2);
+    return CHUNK_HEADER_SIZE + produced + 2;
+}
+
+// Function to read the next piece of the streamed body
+ssize_t response_read_body(struct http_response* res, char* buf, size_t len) {
+    if (res->file_fd == -1) {
+        return 0;
+    }
+    if (res->gzip_file != NULL) {
+        return read_gzip_chunk(res, buf, len);
+    }
+    
+    if (res->ranges != NULL) {
+        advance_multipart(res);
+        struct multipart_ranges* mp = res->ranges;
+        if (mp->framing_sent < mp->framing_len) {
+            size_t framing_len = mp->framing_len - mp->framing_sent;
+            if (framing_len > len) {
+                framing_len = len;
+            }
+            memcpy(buf, mp->framing + mp->framing_sent, framing_len);
+            mp->framing_sent += framing_len;
+            return framing_len;
+        }
+    }
+    
+    // Never past the end of the body, a range may stop before the end of the file
+    size_t remaining = res->file_size - res->file_offset;
+    if (len > remaining) {
+        len = remaining;
+    }
+    if (len == 0) {
+        return 0;
+    }
+    ssize_t bytes_read = pread(res->file_fd, buf, len, res->file_offset);
+    if (bytes_read > 0) {
+        res->file_offset += bytes_read;
+    }
+    return bytes_read;
+}
+
+// Function to describe the unsent part of the headers and in-memory body
+int response_iovec(const struct http_response* res, size_t sent, struct iovec iov[2]) {
+    int count = 0;
+    if (sent < res->headers_len) {
+        iov[count].iov_base = (char*)res->headers + sent;
+        iov[count++].iov_len = res->headers_len - sent;
+    }
+    if (res->body_len > 0) {
+        size_t body_sent = sent > res->headers_len ? sent - res->headers_len : 0;
+        iov[count].iov_base = res->body + body_sent;
+        iov[count++].iov_len = res->body_len - body_sent;
+    }
+    return count;
+}
+
+// Function to check whether the body can be sent with sendfile()/splice()
+int response_is_zero_copy(const struct http_response* res) {
+    return zero_copy_files && res->file_fd != -1 && res->gzip_file == NULL;
+}
+
+// Helper to move file bytes to the socket through a pipe, for when sendfile() refuses the descriptors
+static ssize_t splice_file(struct http_response* res, int socket_fd, size_t remaining) {
+    if (res->splice_pipe[0] == -1 && pipe2(res->splice_pipe, O_CLOEXEC | O_NONBLOCK) == -1) {
+        return -1;
+    }
+    
+    // Refill the pipe once the socket has taken everything in it
+    if (res->splice_pending == 0) {
+        if (remaining == 0) {
+            return 0;
+        }
+        ssize_t filled = splice(res->file_fd, &res->file_offset, res->splice_pipe[1], NULL,
+                                remaining, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (filled <= 0) {
+            // The file shrank under us, the promised Content-Length can no longer be met
+            if (filled == 0) {
+                errno = EIO;
+            }
+            return -1;
+        }
+        res->splice_pending = filled;
+    }
+    
+    ssize_t sent = splice(res->splice_pipe[0], NULL, socket_fd, NULL, res->splice_pending,
+                          SPLICE_F_MOVE | SPLICE_F_NONBLOCK | SPLICE_F_MORE);
+    if (sent > 0) {
+        res->splice_pending -= sent;
+    }
+    return sent;
+}
+
+// Function to send the next piece of the file body without copying it through user space
+ssize_t response_send_file(struct http_response* res, int socket_fd) {
+    if (res->ranges != NULL) {
+        // Part framing is small and sent from memory between the file pieces
+        advance_multipart(res);
+        struct multipart_ranges* mp = res->ranges;
+        if (mp->framing_sent < mp->framing_len) {
+            int more = mp->part < mp->count ? MSG_MORE : 0;
+            ssize_t sent = send(socket_fd, mp->framing + mp->framing_sent, mp->framing_len - mp->framing_sent,
+                                MSG_NOSIGNAL | more);
+            if (sent > 0) {
+                mp->framing_sent += sent;
+            }
+            return sent;
+        }
+    }
+    
+    size_t remaining = res->file_size - res->file_offset;
+    if (remaining > ZERO_COPY_CHUNK) {
+        remaining = ZERO_COPY_CHUNK;
+    }
+    
+    if (res->splice_pipe[0] == -1) {
+        if (remaining == 0) {
+            return 0;
+        }
+        ssize_t sent = sendfile(socket_fd, res->file_fd, &res->file_offset, remaining);
+        if (sent > 0) {
+            return sent;
+        }
+        if (sent == 0) {
+            errno = EIO;
+            return -1;
+        }
+        if (errno != EINVAL && errno != ENOSYS) {
+            return -1;
+        }
+        printf("PID %d: sendfile() not supported, falling back to splice()\n", getpid());
+    }
+    
+    return splice_file(res, socket_fd, remaining);
+}
+
+// Function to read the status code back from the response headers
+int response_status(const struct http_response* res) {
+    return res->headers_len > 12 ? atoi(res->headers + 9) : 0;
+}
+
+// Helper to cache a fully streamed compressed file, unless the file changed while it was read
+// Runs when the response is released, as the chunks may have been compressed on an I/O pool thread
+static void store_streamed_file(struct http_response* res) {
+    struct gzip_file_stream* stream = res->gzip_file;
+    struct stat file_stat;
+    if (!stream->last_chunk_sent || stream->cache_path == NULL || fstat(res->file_fd, &file_stat) != 0
+        || file_stat.st_size != stream->cache_stat.st_size
+        || file_stat.st_mtim.tv_sec != stream->cache_stat.st_mtim.tv_sec
+        || file_stat.st_mtim.tv_nsec != stream->cache_stat.st_mtim.tv_nsec) {
+        return;
+    }
+    
+    char* trimmed = realloc(stream->cache_fill, stream->cache_fill_len);
+    if (trimmed != NULL) {
+        stream->cache_fill = trimmed;
+    }
+    struct gzip_cache_entry* entry = gzip_cache_insert(stream->cache_path, "gzip", &stream->cache_stat,
+                                                       stream->cache_fill, stream->cache_fill_len, 1);
+    if (entry != NULL) {
+        gzip_cache_release(entry);
+        stream->cache_fill = NULL;
+    }
+}
+
+// Function to release the resources held by a response
+void free_response(struct http_response* res) {
+    if (res->body_allocated) {
+        free(res->body);
+    }
+    res->body = NULL;
+    res->body_allocated = 0;
+    
+    if (res->cache_entry != NULL) {
+        gzip_cache_release(res->cache_entry);
+        res->cache_entry = NULL;
+    }
+    
+    if (res->gzip_file != NULL) {
+        // The stream itself lives in the arena, only what it points to is freed here
+        store_streamed_file(res);
+        gzip_stream_end(&res->gzip_file->gz);
+        free(res->gzip_file->cache_fill);
+        free(res->gzip_file->cache_path);
+        res->gzip_file = NULL;
+    }
+    res->ranges = NULL;
+    
+    if (res->file_fd != -1) {
+        file_cache_close(res->file_fd, res->file_entry);
+        res->file_fd = -1;
+        res->file_entry = NULL;
+    }
+    
+    if (res->splice_pipe[0] != -1) {
+        close(res->splice_pipe[0]);
+        close(res->splice_pipe[1]);
+        res->splice_pipe[0] = -1;
+        res->splice_pipe[1] = -1;
+    }
+    res->splice_pending = 0;
+}
@@ -0,0 +1,119 @@
+#ifndef HTTP_H
+#define HTTP_H
+
+#include <stddef.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+// Global variable to store the directory path
+extern char *files_directory;
+
+// Seconds an idle keep-alive connection is kept open
+extern int keep_alive_timeout;
+
+// Requests served on one connection before it is closed
+extern int max_keep_alive_requests;
+
+// Send identity file bodies with sendfile()/splice() instead of read()/send()
+extern int zero_copy_files;
+
+struct gzip_file_stream;
+struct gzip_cache_entry;
+struct file_cache_entry;
+struct multipart_ranges;
+
+// Response produced by handle_request(), sent by either server model
+struct http_response {
+    char headers[1024];     // Status line and headers, including the blank line
+    size_t headers_len;
+    char *body;             // In-memory body sent after the headers (may be NULL)
+    size_t body_len;
+    int body_allocated;     // Set when body was malloc'd and must be freed
+    int file_fd;            // File streamed after the body, or -1
+    struct file_cache_entry* file_entry;   // Owner of file_fd when it is shared through the file cache
+    off_t file_size;        // Where the file body ends, before the end of the file when a range was asked for
+    off_t file_offset;      // Next file byte to send or read, the descriptor's own offset is never used
+    int splice_pipe[2];     // Pipe used when sendfile() is not supported, or -1
+    size_t splice_pending;  // Bytes spliced into the pipe but not yet sent
+    struct gzip_file_stream* gzip_file;    // Set when file_fd is compressed on the fly and sent chunked
+    struct gzip_cache_entry* cache_entry;  // Cached compressed file the body points into
+    struct multipart_ranges* ranges;       // Set when several ranges of file_fd are sent as multipart/byteranges
+    struct arena* arena;    // Per-connection memory for the body and streaming state, set by the engine
+    int http2;              // Set by the engine on HTTP/2 streams, a streamed body is then never chunk-framed
+};
+
+struct http_request;
+
+// Check the Accept-Encoding header for gzip
+int client_supports_gzip(const char* buffer, const struct http_request* req);
+
+// Check the request version and Connection header for keep-alive
+int request_wants_keep_alive(const char* buffer, const struct http_request* req);
+
+// Route a parsed request and fill in the response, announcing whether the connection stays open
+void handle_request(const char* buffer, const struct http_request* req, int keep_alive,
+                    struct http_response* res);
+
+// Parse and answer the request at the start of the buffer, returns the bytes it used
+// Answers 400/431 when the request cannot be parsed, keep_alive tells whether to read another request
+size_t respond_to_request(const char* buffer, size_t len, struct http_request* req, int requests_served,
+                          int* keep_alive, struct http_response* res);
+
+// Check whether a parsed request is a GET for /files/<name>, filling in the path it will open
+int request_file_path(const char* buffer, const struct http_request* req, char* filepath, size_t filepath_size);
+
+struct stat;
+
+// Check, on the event loop, whether a GET of this file would compress it in memory when the gzip cache
+// does not have it yet; file_stat is NULL when the file is not open yet
+int request_compresses_file(const char* buffer, const struct http_request* req, const char* filepath,
+                            const struct stat* file_stat);
+
+// Compress a small file as its response would, ahead of it on the I/O pool (thread-safe, no cache is touched)
+// Returns 1 with the body to pass to gzip_cache_prefill() in *data, NULL when the file does not compress,
+// and 0 when the response would not compress the file in memory
+int compress_file_ahead(const char* buffer, const struct http_request* req, const char* filepath, int fd,
+                        const struct stat* file_stat, char** data, size_t* data_len);
+
+struct upload;
+
+// Check whether a parsed request uploads a file, its body is then streamed to disk instead of buffered
+int request_is_upload(const char* buffer, const struct http_request* req);
+
+// Start receiving the body of an upload request once its headers are parsed
+// Returns NULL with an error response in res when the upload is refused, the body is then left unread
+// send_continue is set when the client waits for "100 Continue" before sending the body
+struct upload* start_upload(const char* buffer, const struct http_request* req, int* send_continue,
+                            struct http_response* res);
+
+// Publish a fully received (or failed) upload, fill in the response and release the upload
+// keep_alive is cleared when the rest of the body was left unread
+void finish_upload(struct upload* up, int* keep_alive, struct http_response* res);
+
+// Fill in an error response with the given status for a request that could not be parsed
+void handle_request_error(int status, struct http_response* res);
+
+// Fill buf with the next piece of the streamed body (file bytes, multipart framing, or chunks of the compressed file)
+// Returns the number of bytes, 0 once the body is complete and -1 on error
+ssize_t response_read_body(struct http_response* res, char* buf, size_t len);
+
+// Fill iov with what is left of the headers and in-memory body after sent bytes, returns the count (0-2)
+// Both go out in one sendmsg()/writev() so a small response is a single segment
+int response_iovec(const struct http_response* res, size_t sent, struct iovec iov[2]);
+
+// Whether the streamed body can go straight from the file to the socket
+int response_is_zero_copy(const struct http_response* res);
+
+// Send the next piece of the file body with sendfile(), or splice() through a pipe when
+// sendfile() is not supported for the descriptors
+// Returns the number of bytes sent, 0 once the file is complete and -1 with errno set
+// (EAGAIN when a non-blocking socket is full)
+ssize_t response_send_file(struct http_response* res, int socket_fd);
+
+// Status code of a filled-in response, kept after free_response() for the access log
+int response_status(const struct http_response* res);
+
+// Release the body and file held by a response
+void free_response(struct http_response* res);
+
+#endif
@@ -0,0 +1,1262 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "http2.h"
+#include "hpack.h"
+#include "http.h"
+#include "http_parser.h"
+#include "upload.h"
+#include "arena.h"
+#include "buffer_pool.h"
+#include "access_log.h"
+#include "metrics.h"
+#include "workers.h"
+
+int http2_enabled = 1;
+
+static const char preface[H2_PREFACE_LEN] = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+
+#define FRAME_HEADER_SIZE 9
+#define MAX_FRAME_SIZE 16384            // Largest frame accepted, the SETTINGS_MAX_FRAME_SIZE default
+#define MAX_STREAMS 100                 // SETTINGS_MAX_CONCURRENT_STREAMS announced to clients
+#define DEFAULT_WINDOW 65535            // Flow-control window before SETTINGS say otherwise
+#define STREAM_WINDOW (1 << 20)         // Receive window of every stream, announced in SETTINGS
+#define CONNECTION_WINDOW (16 << 20)    // Receive window of the connection, opened up with the first WINDOW_UPDATE
+#define MAX_WINDOW 0x7fffffff
+#define HEADER_BLOCK_MAX 65536          // HEADERS and CONTINUATION payload of one request
+#define REQUEST_MAX 4096                // Rebuilt request, the limit of a HTTP/1.1 request
+#define OUTPUT_HIGH_WATER 65536         // DATA frames are queued until this much waits for the socket
+#define OUTPUT_INPUT_LIMIT (4 * OUTPUT_HIGH_WATER)    // Input is left unread while more output than this waits
+
+enum frame_type {
+    FRAME_DATA,
+    FRAME_HEADERS,
+    FRAME_PRIORITY,
+    FRAME_RST_STREAM,
+    FRAME_SETTINGS,
+    FRAME_PUSH_PROMISE,
+    FRAME_PING,
+    FRAME_GOAWAY,
+    FRAME_WINDOW_UPDATE,
+    FRAME_CONTINUATION,
+};
+
+#define FLAG_END_STREAM 0x1
+#define FLAG_ACK 0x1
+#define FLAG_END_HEADERS 0x4
+#define FLAG_PADDED 0x8
+#define FLAG_PRIORITY 0x20
+
+enum settings_id {
+    SETTINGS_HEADER_TABLE_SIZE = 1,
+    SETTINGS_ENABLE_PUSH = 2,
+    SETTINGS_MAX_CONCURRENT_STREAMS = 3,
+    SETTINGS_INITIAL_WINDOW_SIZE = 4,
+    SETTINGS_MAX_FRAME_SIZE = 5,
+};
+
+enum error_code {
+    NO_ERROR,
+    PROTOCOL_ERROR,
+    INTERNAL_ERROR,
+    FLOW_CONTROL_ERROR,
+    SETTINGS_TIMEOUT,
+    STREAM_CLOSED,
+    FRAME_SIZE_ERROR,
+    REFUSED_STREAM,
+    CANCEL,
+    COMPRESSION_ERROR,
+    CONNECT_ERROR,
+    ENHANCE_YOUR_CALM,
+};
+
+// One request of the connection, answered by the same handlers as a HTTP/1.1 request
+struct h2_stream {
+    uint32_t id;
+    struct h2_stream* next;
+    int remote_closed;              // END_STREAM received, nothing more comes from the client
+    int responding;                 // Response headers sent, DATA follows as the windows allow
+    int64_t send_window;
+    int64_t recv_window;
+
+    // Request rebuilt as HTTP/1.1 text, the parser and handlers see what a HTTP/1.1 client would send
+    char request[REQUEST_MAX];
+    size_t request_len;
+    struct http_request req;
+    struct upload* upload;          // Body of POST /files/ being written, or NULL
+    int body_chunked;               // No content-length, DATA is framed as chunks for the upload decoder
+
+    struct http_response res;
+    struct arena arena;
+    size_t body_sent;               // In-memory body bytes sent
+    char* body_buffer;              // Piece of the streamed body, from the buffer pool
+    size_t body_buffer_len;
+    size_t body_buffer_sent;
+    uint64_t response_bytes;
+    struct access_log_entry log;
+    struct request_metrics metrics;
+};
+
+struct h2_session {
+    // Received bytes of a frame that is not complete yet
+    char input[FRAME_HEADER_SIZE + MAX_FRAME_SIZE];
+    size_t input_len;
+    int preface_received;
+
+    // Frames waiting for the socket
+    char* output;
+    size_t output_len;
+    size_t output_sent;
+    size_t output_cap;
+    int failed;                     // Out of memory, the connection is dropped
+
+    struct hpack_decoder decoder;
+    struct hpack_encoder encoder;
+
+    // Open streams, the next to queue DATA for first
+    struct h2_stream* streams;
+    int stream_count;
+    uint32_t last_stream_id;
+
+    uint32_t peer_initial_window;
+    uint32_t peer_max_frame;
+    int64_t send_window;
+    int64_t recv_window;
+
+    // Header block spread over HEADERS and CONTINUATION frames
+    uint8_t* header_block;
+    size_t header_block_len;
+    uint32_t header_stream;         // 0 when no block is open
+    int header_flags;               // Flags of the HEADERS frame that opened it
+    int header_new_stream;
+
+    int goaway_sent;                // After a connection error, input is ignored from then on
+    int goaway_received;
+};
+
+// Helper to read a big-endian 32-bit value
+static uint32_t read_u32(const uint8_t* p) {
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+static void write_u32(uint8_t* p, uint32_t v) {
+    p[0] = v >> 24;
+    p[1] = v >> 16;
+    p[2] = v >> 8;
+    p[3] = v;
+}
+
+// Helper to make room for n more output bytes, returns where they go or NULL when out of memory
+static uint8_t* reserve_output(struct h2_session* s, size_t n) {
+    if (s->failed) {
+        return NULL;
+    }
+    if (s->output_sent > 0 && s->output_len + n > s->output_cap) {
+        memmove(s->output, s->output + s->output_sent, s->output_len - s->output_sent);
+        s->output_len -= s->output_sent;
+        s->output_sent = 0;
+    }
+    if (s->output_len + n > s->output_cap) {
+        size_t cap = s->output_cap * 2;
+        while (cap < s->output_len + n) {
+            cap *= 2;
+        }
+        char* output = realloc(s->output, cap);
+        if (output == NULL) {
+            s->failed = 1;
+            return NULL;
+        }
+        s->output = output;
+        s->output_cap = cap;
+    }
+    return (uint8_t*)s->output + s->output_len;
+}
+
+static void write_frame_header(uint8_t* p, size_t len, int type, int flags, uint32_t stream_id) {
+    p[0] = len >> 16;
+    p[1] = len >> 8;
+    p[2] = len;
+    p[3] = type;
+    p[4] = flags;
+    write_u32(p + 5, stream_id);
+}
+
+// Helper to queue a frame with a small payload
+static void queue_frame(struct h2_session* s, int type, int flags, uint32_t stream_id, const uint8_t* payload,
+                        size_t len) {
+    uint8_t* p = reserve_output(s, FRAME_HEADER_SIZE + len);
+    if (p == NULL) {
+        return;
+    }
+    write_frame_header(p, len, type, flags, stream_id);
+    if (len > 0) {
+        memcpy(p + FRAME_HEADER_SIZE, payload, len);
+    }
+    s->output_len += FRAME_HEADER_SIZE + len;
+}
+
+static void queue_u32_frame(struct h2_session* s, int type, uint32_t stream_id, uint32_t value) {
+    uint8_t payload[4];
+    write_u32(payload, value);
+    queue_frame(s, type, 0, stream_id, payload, sizeof(payload));
+}
+
+// Function to end the connection: tell the client which streams were seen and stop reading
+static void connection_error(struct h2_session* s, int code) {
+    if (s->goaway_sent) {
+        return;
+    }
+    uint8_t payload[8];
+    write_u32(payload, s->last_stream_id);
+    write_u32(payload + 4, code);
+    queue_frame(s, FRAME_GOAWAY, 0, 0, payload, sizeof(payload));
+    s->goaway_sent = 1;
+    if (code != NO_ERROR) {
+        log_debug("HTTP/2 connection error %d\n", code);
+    }
+}
+
+static struct h2_stream* find_stream(struct h2_session* s, uint32_t id) {
+    for (struct h2_stream* st = s->streams; st != NULL; st = st->next) {
+        if (st->id == id) {
+            return st;
+        }
+    }
+    return NULL;
+}
+
+static void unlink_stream(struct h2_session* s, struct h2_stream* st) {
+    struct h2_stream** link = &s->streams;
+    while (*link != st) {
+        link = &(*link)->next;
+    }
+    *link = st->next;
+    st->next = NULL;
+}
+
+static void append_stream(struct h2_session* s, struct h2_stream* st) {
+    struct h2_stream** link = &s->streams;
+    while (*link != NULL) {
+        link = &(*link)->next;
+    }
+    *link = st;
+}
+
+// Function to open a stream for a new request, returns NULL when out of memory
+static struct h2_stream* open_stream(struct h2_session* s, uint32_t id) {
+    struct h2_stream* st = calloc(1, sizeof(*st));
+    if (st == NULL) {
+        return NULL;
+    }
+    st->id = id;
+    st->send_window = s->peer_initial_window;
+    st->recv_window = STREAM_WINDOW;
+    arena_init(&st->arena);
+    st->res.arena = &st->arena;
+    st->res.http2 = 1;
+    st->res.file_fd = -1;
+    st->res.splice_pipe[0] = -1;
+    st->res.splice_pipe[1] = -1;
+    append_stream(s, st);
+    s->stream_count++;
+    return st;
+}
+
+// Function to release a stream, whether it was answered or reset
+static void close_stream(struct h2_session* s, struct h2_stream* st) {
+    unlink_stream(s, st);
+    s->stream_count--;
+    if (st->upload != NULL) {
+        upload_abort(st->upload);
+    }
+    free_response(&st->res);
+    arena_reset(&st->arena);
+    io_buffer_put(st->body_buffer);
+    free(st);
+}
+
+// Function to abandon a stream with RST_STREAM
+static void reset_stream(struct h2_session* s, struct h2_stream* st, int code) {
+    queue_u32_frame(s, FRAME_RST_STREAM, st->id, code);
+    close_stream(s, st);
+}
+
+// Function to log a stream whose response went out completely and release it
+static void complete_stream(struct h2_session* s, struct h2_stream* st) {
+    int status = response_status(&st->res);
+    access_log_end(&st->log, status, st->response_bytes);
+    metrics_request_done(&st->metrics, status);
+
+    // A request body the response did not wait for is not wanted anymore
+    if (!st->remote_closed) {
+        queue_u32_frame(s, FRAME_RST_STREAM, st->id, NO_ERROR);
+    }
+    close_stream(s, st);
+}
+
+// Helper to tell whether a response header is specific to a HTTP/1.1 connection, HTTP/2 forbids those
+static int connection_specific(const char* name, size_t len) {
+    static const char* const names[] = { "connection", "keep-alive", "proxy-connection", "transfer-encoding",
+                                         "upgrade" };
+    for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+        if (strlen(names[i]) == len && memcmp(names[i], name, len) == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Helper to tell whether a response header changes from one response to the next
+// Those are not added to the dynamic table, where they would only evict the ones that repeat
+static int varies_per_response(const char* name, size_t len) {
+    static const char* const names[] = { "content-length", "content-range", "etag", "last-modified", "date",
+                                         "location" };
+    for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+        if (strlen(names[i]) == len && memcmp(names[i], name, len) == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Function to send a HEADERS frame converted from the HTTP/1.1 status line and headers the handlers built
+static void queue_headers(struct h2_session* s, struct h2_stream* st, const char* headers, size_t len,
+                          int end_stream) {
+    if (len < 12) {
+        return;
+    }
+
+    // Every field costs at most its name and value plus 16 bytes, and takes at least 4 bytes of text
+    uint8_t* frame = reserve_output(s, FRAME_HEADER_SIZE + len * 5 + 64);
+    if (frame == NULL) {
+        return;
+    }
+    uint8_t* out = frame + FRAME_HEADER_SIZE;
+    size_t n = hpack_encode_begin(&s->encoder, out);
+    n += hpack_encode_field(&s->encoder, out + n, ":status", 7, headers + 9, 3, 0);
+
+    const char* line = memchr(headers, '\n', len);
+    const char* end = headers + len;
+    while (line != NULL && ++line < end) {
+        const char* line_end = memchr(line, '\n', end - line);
+        if (line_end == NULL) {
+            break;
+        }
+        const char* value_end = line_end > line && line_end[-1] == '\r' ? line_end - 1 : line_end;
+        const char* colon = memchr(line, ':', value_end - line);
+        size_t name_len = colon != NULL ? (size_t)(colon - line) : 0;
+        char name[64];
+        if (name_len > 0 && name_len < sizeof(name)) {
+            for (size_t i = 0; i < name_len; i++) {
+                char c = line[i];
+                name[i] = c >= 'A' && c <= 'Z' ? c + 32 : c;
+            }
+            const char* value = colon + 1;
+            while (value < value_end && *value == ' ') {
+                value++;
+            }
+            if (!connection_specific(name, name_len)) {
+                n += hpack_encode_field(&s->encoder, out + n, name, name_len, value, value_end - value,
+                                        !varies_per_response(name, name_len));
+            }
+        }
+        line = line_end;
+    }
+
+    write_frame_header(frame, n, FRAME_HEADERS, FLAG_END_HEADERS | (end_stream ? FLAG_END_STREAM : 0), st->id);
+    s->output_len += FRAME_HEADER_SIZE + n;
+    st->response_bytes += FRAME_HEADER_SIZE + n;
+}
+
+// Function to start sending the response the handlers filled in
+// A response without a body is complete with its HEADERS frame
+static void send_response(struct h2_session* s, struct h2_stream* st) {
+    struct http_response* res = &st->res;
+    int end_stream = res->body_len == 0 && res->file_fd == -1;
+    queue_headers(s, st, res->headers, res->headers_len, end_stream);
+    st->responding = 1;
+    if (end_stream) {
+        complete_stream(s, st);
+    }
+}
+
+// Function to queue the next DATA frame of a stream, as far as the windows allow
+// Returns 1 when a frame was queued (or the stream ended), 0 when the stream is waiting for a window
+static int queue_stream_data(struct h2_session* s, struct h2_stream* st) {
+    struct http_response* res = &st->res;
+    const char* data;
+    size_t available;
+    if (st->body_sent < res->body_len) {
+        data = res->body + st->body_sent;
+        available = res->body_len - st->body_sent;
+    } else {
+        // Streamed body, read a piece at a time once the previous one went out
+        if (st->body_buffer_sent == st->body_buffer_len && res->file_fd != -1) {
+            if (st->body_buffer == NULL && (st->body_buffer = io_buffer_get()) == NULL) {
+                reset_stream(s, st, INTERNAL_ERROR);
+                return 1;
+            }
+            ssize_t bytes_read = response_read_body(res, st->body_buffer, IO_BUFFER_SIZE);
+            if (bytes_read < 0) {
+                reset_stream(s, st, INTERNAL_ERROR);
+                return 1;
+            }
+            if (bytes_read == 0) {
+                free_response(res);
+            }
+            st->body_buffer_len = bytes_read;
+            st->body_buffer_sent = 0;
+        }
+        data = st->body_buffer + st->body_buffer_sent;
+        available = st->body_buffer_len - st->body_buffer_sent;
+    }
+    int last_piece = st->body_sent + available >= res->body_len && res->file_fd == -1;
+
+    int64_t window = s->send_window < st->send_window ? s->send_window : st->send_window;
+    size_t len = available < s->peer_max_frame ? available : s->peer_max_frame;
+    if ((int64_t)len > window) {
+        len = window > 0 ? window : 0;
+    }
+    if (len == 0 && !(last_piece && available == 0)) {
+        return 0;
+    }
+
+    // The body ends with the last piece, an empty frame carries END_STREAM when a streamed body runs out
+    int end_stream = last_piece && len == available;
+    uint8_t* frame = reserve_output(s, FRAME_HEADER_SIZE + len);
+    if (frame == NULL) {
+        return 0;
+    }
+    write_frame_header(frame, len, FRAME_DATA, end_stream ? FLAG_END_STREAM : 0, st->id);
+    if (len > 0) {
+        memcpy(frame + FRAME_HEADER_SIZE, data, len);
+    }
+    s->output_len += FRAME_HEADER_SIZE + len;
+    if (st->body_sent < res->body_len) {
+        st->body_sent += len;
+    } else {
+        st->body_buffer_sent += len;
+    }
+    s->send_window -= len;
+    st->send_window -= len;
+    st->response_bytes += FRAME_HEADER_SIZE + len;
+
+    if (end_stream) {
+        complete_stream(s, st);
+    }
+    return 1;
+}
+
+// Request rebuilt from the decoded fields of a header block
+struct request_builder {
+    struct h2_stream* stream;
+    const char* method;
+    size_t method_len;
+    const char* path;
+    size_t path_len;
+    const char* authority;
+    size_t authority_len;
+    char pseudo[REQUEST_MAX];       // Values of the pseudo-headers, the fields they came in go away
+    size_t pseudo_len;
+    size_t headers_len;             // Regular headers, written to the stream's request buffer
+    int regular_seen;
+    int has_host;
+    int has_content_length;
+    int status;                     // 400 or 431 when the request cannot be answered, 0 otherwise
+};
+
+// Helper to check that a field cannot break out of the HTTP/1.1 text it is written into
+static int valid_field(const char* name, size_t name_len, const char* value, size_t value_len) {
+    for (size_t i = 0; i < name_len; i++) {
+        unsigned char c = name[i];
+        if (c <= ' ' || c >= 0x7f || c == ':' || (c >= 'A' && c <= 'Z')) {
+            return 0;
+        }
+    }
+    for (size_t i = 0; i < value_len; i++) {
+        if (value[i] == '\r' || value[i] == '\n' || value[i] == '\0') {
+            return 0;
+        }
+    }
+    return name_len > 0;
+}
+
+// Helper to copy a pseudo-header value out of the header block
+static const char* keep_pseudo(struct request_builder* b, const char* value, size_t len) {
+    if (len > sizeof(b->pseudo) - b->pseudo_len) {
+        b->status = 431;
+        return NULL;
+    }
+    char* kept = b->pseudo + b->pseudo_len;
+    memcpy(kept, value, len);
+    b->pseudo_len += len;
+    return kept;
+}
+
+// Function called for every field of a request header block
+static int build_request(void* ctx, const char* name, size_t name_len, const char* value, size_t value_len) {
+    struct request_builder* b = ctx;
+    if (b->status != 0) {
+        // Still decoded to the end, the dynamic table has to follow every field
+        return 0;
+    }
+
+    if (name_len > 0 && name[0] == ':') {
+        if (b->regular_seen || !valid_field(name + 1, name_len - 1, value, value_len)) {
+            b->status = 400;
+        } else if (name_len == 7 && memcmp(name, ":method", 7) == 0 && b->method == NULL) {
+            b->method = keep_pseudo(b, value, value_len);
+            b->method_len = value_len;
+        } else if (name_len == 5 && memcmp(name, ":path", 5) == 0 && b->path == NULL) {
+            b->path = keep_pseudo(b, value, value_len);
+            b->path_len = value_len;
+        } else if (name_len == 10 && memcmp(name, ":authority", 10) == 0 && b->authority == NULL) {
+            b->authority = keep_pseudo(b, value, value_len);
+            b->authority_len = value_len;
+        } else if (!(name_len == 7 && memcmp(name, ":scheme", 7) == 0)) {
+            b->status = 400;
+        }
+        return 0;
+    }
+
+    b->regular_seen = 1;
+    if (!valid_field(name, name_len, value, value_len)) {
+        b->status = 400;
+        return 0;
+    }
+    if (connection_specific(name, name_len) || (name_len == 2 && memcmp(name, "te", 2) == 0)) {
+        return 0;
+    }
+    b->has_host |= name_len == 4 && memcmp(name, "host", 4) == 0;
+    b->has_content_length |= name_len == 14 && memcmp(name, "content-length", 14) == 0;
+
+    char* out = b->stream->request + b->headers_len;
+    size_t line_len = name_len + 2 + value_len + 2;
+    if (line_len > REQUEST_MAX - b->headers_len) {
+        b->status = 431;
+        return 0;
+    }
+    memcpy(out, name, name_len);
+    memcpy(out + name_len, ": ", 2);
+    memcpy(out + name_len + 2, value, value_len);
+    memcpy(out + name_len + 2 + value_len, "\r\n", 2);
+    b->headers_len += line_len;
+    return 0;
+}
+
+// Function to put the request line in front of the rebuilt headers and end them
+// Returns 0, or the status to answer with when the request is malformed or too large
+static int finish_request(struct request_builder* b) {
+    struct h2_stream* st = b->stream;
+    if (b->status != 0) {
+        return b->status;
+    }
+    if (b->method == NULL || b->path == NULL || b->method_len == 0 || b->path_len == 0
+        || memchr(b->method, ' ', b->method_len) != NULL || memchr(b->path, ' ', b->path_len) != NULL) {
+        return 400;
+    }
+
+    char prefix[REQUEST_MAX];
+    int prefix_len = snprintf(prefix, sizeof(prefix), "%.*s %.*s HTTP/1.1\r\n", (int)b->method_len, b->method,
+                              (int)b->path_len, b->path);
+    if (b->authority != NULL && !b->has_host && prefix_len < (int)sizeof(prefix)) {
+        prefix_len += snprintf(prefix + prefix_len, sizeof(prefix) - prefix_len, "Host: %.*s\r\n",
+                               (int)b->authority_len, b->authority);
+    }
+
+    // A body of unannounced length reaches the upload decoder as chunks, HTTP/2 frames it itself
+    const char* suffix = "\r\n";
+    if (!st->remote_closed && !b->has_content_length) {
+        suffix = "Transfer-Encoding: chunked\r\n\r\n";
+        st->body_chunked = 1;
+    }
+    size_t suffix_len = strlen(suffix);
+    if (prefix_len >= (int)sizeof(prefix) || prefix_len + b->headers_len + suffix_len > REQUEST_MAX) {
+        return 431;
+    }
+
+    memmove(st->request + prefix_len, st->request, b->headers_len);
+    memcpy(st->request, prefix, prefix_len);
+    memcpy(st->request + prefix_len + b->headers_len, suffix, suffix_len);
+    st->request_len = prefix_len + b->headers_len + suffix_len;
+    return 0;
+}
+
+// Function to publish an upload once its body is complete (or the stream ended early) and answer it
+static void finish_stream_upload(struct h2_session* s, struct h2_stream* st) {
+    int keep_alive = 1;
+    finish_upload(st->upload, &keep_alive, &st->res);
+    st->upload = NULL;
+    metrics_handled(&st->metrics);
+    send_response(s, st);
+}
+
+// Function to note the end of the request body, the upload is complete or short
+static void end_of_body(struct h2_session* s, struct h2_stream* st) {
+    st->remote_closed = 1;
+    if (st->upload == NULL) {
+        return;
+    }
+    if (st->body_chunked) {
+        upload_feed(st->upload, "0\r\n\r\n", 5);
+    }
+    finish_stream_upload(s, st);
+}
+
+// Function to answer the request of a stream, or start receiving its upload
+// status is 0 when the request is rebuilt, otherwise the error to answer with
+static void dispatch_stream(struct h2_session* s, struct h2_stream* st, int status) {
+    worker_stats->requests_handled++;
+    worker_stats->http2_streams++;
+    metrics_request_started(&st->metrics);
+
+    http_parser_init(&st->req);
+    int parsed = status == 0 && http_parse_request(&st->req, st->request, st->request_len) == HTTP_PARSE_DONE;
+    struct http_slice method = st->req.method;
+    struct http_slice path = st->req.path;
+    access_log_begin(&st->log, st->request + method.offset, parsed ? method.length : 0,
+                     st->request + path.offset, parsed ? path.length : 0);
+    metrics_dispatched(&st->metrics, st->request, &st->req, parsed);
+
+    if (!parsed) {
+        handle_request_error(status != 0 ? status : 400, &st->res);
+        metrics_handled(&st->metrics);
+        send_response(s, st);
+        return;
+    }
+
+    if (request_is_upload(st->request, &st->req)) {
+        int send_continue;
+        st->upload = start_upload(st->request, &st->req, &send_continue, &st->res);
+        if (st->upload == NULL) {
+            metrics_handled(&st->metrics);
+            send_response(s, st);
+            return;
+        }
+        if (st->remote_closed) {
+            // Nothing follows the headers, the body is empty or short
+            end_of_body(s, st);
+        } else if (send_continue) {
+            static const char interim[] = "HTTP/1.1 100 Continue\r\n\r\n";
+            queue_headers(s, st, interim, sizeof(interim) - 1, 0);
+        }
+        return;
+    }
+
+    // Keep-alive does not apply, the stream ends with the response either way
+    int keep_alive;
+    respond_to_request(st->request, st->request_len, &st->req, 0, &keep_alive, &st->res);
+    metrics_handled(&st->metrics);
+    send_response(s, st);
+}
+
+// Helper to give the client back what it used of a receive window once half of it is gone
+static void replenish(struct h2_session* s, uint32_t stream_id, int64_t* window, int64_t size) {
+    if (*window < size / 2) {
+        queue_u32_frame(s, FRAME_WINDOW_UPDATE, stream_id, size - *window);
+        *window = size;
+    }
+}
+
+// Helper to strip the padding of DATA and HEADERS frames, returns -1 when it is longer than the frame
+static int strip_padding(int flags, const uint8_t** payload, size_t* len) {
+    if (!(flags & FLAG_PADDED)) {
+        return 0;
+    }
+    if (*len < 1 || (*payload)[0] >= *len) {
+        return -1;
+    }
+    *len -= 1 + (*payload)[0];
+    (*payload)++;
+    return 0;
+}
+
+static void handle_data(struct h2_session* s, int flags, uint32_t stream_id, const uint8_t* payload, size_t len) {
+    if (stream_id == 0 || stream_id > s->last_stream_id) {
+        connection_error(s, PROTOCOL_ERROR);
+        return;
+    }
+
+    // Flow control counts the whole payload, padding included
+    s->recv_window -= len;
+    if (s->recv_window < 0) {
+        connection_error(s, FLOW_CONTROL_ERROR);
+        return;
+    }
+    replenish(s, 0, &s->recv_window, CONNECTION_WINDOW);
+
+    struct h2_stream* st = find_stream(s, stream_id);
+    if (st == NULL) {
+        // Reset or answered and closed already, the data still counted against the connection
+        return;
+    }
+    if (st->remote_closed) {
+        reset_stream(s, st, STREAM_CLOSED);
+        return;
+    }
+    st->recv_window -= len;
+    if (st->recv_window < 0) {
+        reset_stream(s, st, FLOW_CONTROL_ERROR);
+        return;
+    }
+    if (strip_padding(flags, &payload, &len) == -1) {
+        connection_error(s, PROTOCOL_ERROR);
+        return;
+    }
+    if (!(flags & FLAG_END_STREAM)) {
+        replenish(s, stream_id, &st->recv_window, STREAM_WINDOW);
+    }
+
+    // Only uploads read a body, any other request was answered when its headers arrived
+    if (st->upload != NULL && len > 0) {
+        if (st->body_chunked) {
+            char size_line[32];
+            int size_len = snprintf(size_line, sizeof(size_line), "%zx\r\n", len);
+            upload_feed(st->upload, size_line, size_len);
+            upload_feed(st->upload, (const char*)payload, len);
+            upload_feed(st->upload, "\r\n", 2);
+        } else if (upload_feed(st->upload, (const char*)payload, len) < len) {
+            // More data than content-length announced
+            st->upload->status = 400;
+        }
+        if (st->upload->done && !(flags & FLAG_END_STREAM)) {
+            finish_stream_upload(s, st);
+            return;
+        }
+    }
+    if (flags & FLAG_END_STREAM) {
+        end_of_body(s, st);
+    }
+}
+
+// Function called for the fields of a header block that opens no request, only the table matters
+static int discard_field(void* ctx, const char* name, size_t name_len, const char* value, size_t value_len) {
+    (void)ctx;
+    (void)name;
+    (void)name_len;
+    (void)value;
+    (void)value_len;
+    return 0;
+}
+
+// Function to act on a complete header block: a new request, or trailers of one being received
+static void handle_header_block(struct h2_session* s, uint32_t stream_id, int flags, int new_stream,
+                                const uint8_t* block, size_t len) {
+    struct h2_stream* st = new_stream ? NULL : find_stream(s, stream_id);
+    if (!new_stream || s->stream_count >= MAX_STREAMS || s->goaway_received
+        || (st = open_stream(s, stream_id)) == NULL) {
+        if (hpack_decode(&s->decoder, block, len, discard_field, NULL) == -1) {
+            connection_error(s, COMPRESSION_ERROR);
+            return;
+        }
+        if (new_stream) {
+            worker_stats->http2_streams_refused++;
+            queue_u32_frame(s, FRAME_RST_STREAM, stream_id, REFUSED_STREAM);
+        } else if (st != NULL && !st->remote_closed) {
+            // Trailers end the body
+            if (flags & FLAG_END_STREAM) {
+                end_of_body(s, st);
+            } else {
+                reset_stream(s, st, PROTOCOL_ERROR);
+            }
+        }
+        return;
+    }
+
+    st->remote_closed = flags & FLAG_END_STREAM;
+    struct request_builder* b = calloc(1, sizeof(*b));
+    if (b == NULL) {
+        connection_error(s, INTERNAL_ERROR);
+        return;
+    }
+    b->stream = st;
+    if (hpack_decode(&s->decoder, block, len, build_request, b) == -1) {
+        free(b);
+        connection_error(s, COMPRESSION_ERROR);
+        return;
+    }
+    int status = finish_request(b);
+    free(b);
+    dispatch_stream(s, st, status);
+}
+
+static void handle_headers(struct h2_session* s, int flags, uint32_t stream_id, const uint8_t* payload,
+                           size_t len) {
+    if (stream_id == 0 || (stream_id & 1) == 0) {
+        connection_error(s, PROTOCOL_ERROR);
+        return;
+    }
+    if (strip_padding(flags, &payload, &len) == -1) {
+        connection_error(s, PROTOCOL_ERROR);
+        return;
+    }
+    if (flags & FLAG_PRIORITY) {
+        // Dependencies and weights are not acted on, streams are served in turn
+        if (len < 5) {
+            connection_error(s, FRAME_SIZE_ERROR);
+            return;
+        }
+        payload += 5;
+        len -= 5;
+    }
+
+    int new_stream = stream_id > s->last_stream_id;
+    if (new_stream) {
+        s->last_stream_id = stream_id;
+    }
+
+    // A complete block is decoded in place, a split one is collected first
+    if (flags & FLAG_END_HEADERS) {
+        handle_header_block(s, stream_id, flags, new_stream, payload, len);
+        return;
+    }
+    s->header_block = malloc(HEADER_BLOCK_MAX);
+    if (s->header_block == NULL) {
+        connection_error(s, INTERNAL_ERROR);
+        return;
+    }
+    memcpy(s->header_block, payload, len);
+    s->header_block_len = len;
+    s->header_stream = stream_id;
+    s->header_flags = flags;
+    s->header_new_stream = new_stream;
+}
+
+static void handle_continuation(struct h2_session* s, int flags, uint32_t stream_id, const uint8_t* payload,
+                                size_t len) {
+    if (s->header_stream == 0 || stream_id != s->header_stream) {
+        connection_error(s, PROTOCOL_ERROR);
+        return;
+    }
+    if (len > HEADER_BLOCK_MAX - s->header_block_len) {
+        connection_error(s, ENHANCE_YOUR_CALM);
+        return;
+    }
+    memcpy(s->header_block + s->header_block_len, payload, len);
+    s->header_block_len += len;
+    if (!(flags & FLAG_END_HEADERS)) {
+        return;
+    }
+
+    uint8_t* block = s->header_block;
+    s->header_block = NULL;
+    s->header_stream = 0;
+    handle_header_block(s, stream_id, s->header_flags, s->header_new_stream, block, s->header_block_len);
+    free(block);
+}
+
+// Function to apply settings from a SETTINGS frame or the HTTP2-Settings header
+// Returns 0, or the error code of an invalid value
+static int apply_settings(struct h2_session* s, const uint8_t* p, size_t len) {
+    for (size_t i = 0; i + 6 <= len; i += 6) {
+        int id = p[i] << 8 | p[i + 1];
+        uint32_t value = read_u32(p + i + 2);
+        switch (id) {
+        case SETTINGS_HEADER_TABLE_SIZE:
+            hpack_encoder_set_max(&s->encoder, value);
+            break;
+        case SETTINGS_ENABLE_PUSH:
+            // The server never pushes
+            if (value > 1) {
+                return PROTOCOL_ERROR;
+            }
+            break;
+        case SETTINGS_INITIAL_WINDOW_SIZE: {
+            if (value > MAX_WINDOW) {
+                return FLOW_CONTROL_ERROR;
+            }
+            // Open streams move by the difference, which may leave a window negative
+            int64_t delta = (int64_t)value - s->peer_initial_window;
+            for (struct h2_stream* st = s->streams; st != NULL; st = st->next) {
+                st->send_window += delta;
+                if (st->send_window > MAX_WINDOW) {
+                    return FLOW_CONTROL_ERROR;
+                }
+            }
+            s->peer_initial_window = value;
+            break;
+        }
+        case SETTINGS_MAX_FRAME_SIZE:
+            if (value < MAX_FRAME_SIZE || value > 0xffffff) {
+                return PROTOCOL_ERROR;
+            }
+            s->peer_max_frame = value;
+            break;
+        default:
+            // Unknown settings are ignored, as are limits on what the client accepts that we never reach
+            break;
+        }
+    }
+    return 0;
+}
+
+static void handle_settings(struct h2_session* s, int flags, uint32_t stream_id, const uint8_t* payload,
+                            size_t len) {
+    if (stream_id != 0) {
+        connection_error(s, PROTOCOL_ERROR);
+        return;
+    }
+    if (flags & FLAG_ACK) {
+        if (len != 0) {
+            connection_error(s, FRAME_SIZE_ERROR);
+        }
+        return;
+    }
+    if (len % 6 != 0) {
+        connection_error(s, FRAME_SIZE_ERROR);
+        return;
+    }
+    int error = apply_settings(s, payload, len);
+    if (error != 0) {
+        connection_error(s, error);
+        return;
+    }
+    queue_frame(s, FRAME_SETTINGS, FLAG_ACK, 0, NULL, 0);
+}
+
+static void handle_window_update(struct h2_session* s, uint32_t stream_id, const uint8_t* payload, size_t len) {
+    if (len != 4) {
+        connection_error(s, FRAME_SIZE_ERROR);
+        return;
+    }
+    uint32_t increment = read_u32(payload) & 0x7fffffff;
+    if (stream_id == 0) {
+        s->send_window += increment;
+        if (increment == 0 || s->send_window > MAX_WINDOW) {
+            connection_error(s, increment == 0 ? PROTOCOL_ERROR : FLOW_CONTROL_ERROR);
+        }
+        return;
+    }
+
+    struct h2_stream* st = find_stream(s, stream_id);
+    if (st == NULL) {
+        if (stream_id > s->last_stream_id) {
+            connection_error(s, PROTOCOL_ERROR);
+        }
+        return;
+    }
+    st->send_window += increment;
+    if (increment == 0 || st->send_window > MAX_WINDOW) {
+        reset_stream(s, st, increment == 0 ? PROTOCOL_ERROR : FLOW_CONTROL_ERROR);
+    }
+}
+
+// Function to act on one complete frame
+static void handle_frame(struct h2_session* s, int type, int flags, uint32_t stream_id, const uint8_t* payload,
+                         size_t len) {
+    // Nothing may come between the frames of a header block
+    if (s->header_stream != 0 && type != FRAME_CONTINUATION) {
+        connection_error(s, PROTOCOL_ERROR);
+        return;
+    }
+
+    switch (type) {
+    case FRAME_DATA:
+        handle_data(s, flags, stream_id, payload, len);
+        break;
+    case FRAME_HEADERS:
+        handle_headers(s, flags, stream_id, payload, len);
+        break;
+    case FRAME_PRIORITY:
+        if (stream_id == 0) {
+            connection_error(s, PROTOCOL_ERROR);
+        }
+        break;
+    case FRAME_RST_STREAM: {
+        if (len != 4 || stream_id == 0 || stream_id > s->last_stream_id) {
+            connection_error(s, len != 4 ? FRAME_SIZE_ERROR : PROTOCOL_ERROR);
+            break;
+        }
+        struct h2_stream* st = find_stream(s, stream_id);
+        if (st != NULL) {
+            close_stream(s, st);
+        }
+        break;
+    }
+    case FRAME_SETTINGS:
+        handle_settings(s, flags, stream_id, payload, len);
+        break;
+    case FRAME_PING:
+        if (len != 8 || stream_id != 0) {
+            connection_error(s, len != 8 ? FRAME_SIZE_ERROR : PROTOCOL_ERROR);
+        } else if (!(flags & FLAG_ACK)) {
+            queue_frame(s, FRAME_PING, FLAG_ACK, 0, payload, len);
+        }
+        break;
+    case FRAME_GOAWAY:
+        // Streams already open are still answered, the connection closes after them
+        s->goaway_received = 1;
+        break;
+    case FRAME_WINDOW_UPDATE:
+        handle_window_update(s, stream_id, payload, len);
+        break;
+    case FRAME_CONTINUATION:
+        handle_continuation(s, flags, stream_id, payload, len);
+        break;
+    case FRAME_PUSH_PROMISE:
+        connection_error(s, PROTOCOL_ERROR);
+        break;
+    default:
+        // Unknown frame types are ignored
+        break;
+    }
+}
+
+// Function to process the complete frames at the start of buf, returns the bytes used
+static size_t process_input(struct h2_session* s, const char* buf, size_t len) {
+    size_t pos = 0;
+    if (!s->preface_received) {
+        size_t compared = len < H2_PREFACE_LEN ? len : H2_PREFACE_LEN;
+        if (memcmp(buf, preface, compared) != 0) {
+            connection_error(s, PROTOCOL_ERROR);
+            return len;
+        }
+        if (len < H2_PREFACE_LEN) {
+            return 0;
+        }
+        s->preface_received = 1;
+        pos = H2_PREFACE_LEN;
+    }
+
+    while (!s->goaway_sent && len - pos >= FRAME_HEADER_SIZE) {
+        const uint8_t* header = (const uint8_t*)buf + pos;
+        size_t frame_len = header[0] << 16 | header[1] << 8 | header[2];
+        if (frame_len > MAX_FRAME_SIZE) {
+            connection_error(s, FRAME_SIZE_ERROR);
+            break;
+        }
+        if (len - pos - FRAME_HEADER_SIZE < frame_len) {
+            break;
+        }
+        handle_frame(s, header[3], header[4], read_u32(header + 5) & 0x7fffffff, header + FRAME_HEADER_SIZE,
+                     frame_len);
+        pos += FRAME_HEADER_SIZE + frame_len;
+    }
+    return s->goaway_sent ? len : pos;
+}
+
+// Function to take received bytes, straight from the caller's buffer while no partial frame is kept
+void h2_session_feed(struct h2_session* s, const char* data, size_t len) {
+    while (len > 0 && !s->goaway_sent) {
+        if (s->input_len == 0) {
+            size_t used = process_input(s, data, len);
+            data += used;
+            len -= used;
+            if (!s->goaway_sent) {
+                // Less than a frame is left, it fits the input buffer
+                memcpy(s->input, data, len);
+                s->input_len = len;
+            }
+            return;
+        }
+
+        size_t take = sizeof(s->input) - s->input_len;
+        take = take < len ? take : len;
+        memcpy(s->input + s->input_len, data, take);
+        s->input_len += take;
+        data += take;
+        len -= take;
+        size_t used = process_input(s, s->input, s->input_len);
+        s->input_len -= used;
+        memmove(s->input, s->input + used, s->input_len);
+    }
+}
+
+// Function to hand out the pending output, topped up with DATA frames in turn across the streams
+const char* h2_session_output(struct h2_session* s, size_t* len) {
+    if (s->output_sent == s->output_len) {
+        s->output_sent = 0;
+        s->output_len = 0;
+    }
+
+    // Every stream with a window gets a frame per pass, the one served moves to the back
+    int queued = 1;
+    while (queued && !s->goaway_sent && !s->failed && s->output_len - s->output_sent < OUTPUT_HIGH_WATER) {
+        queued = 0;
+        int count = s->stream_count;
+        for (int i = 0; i < count && s->streams != NULL; i++) {
+            struct h2_stream* st = s->streams;
+            unlink_stream(s, st);
+            append_stream(s, st);
+            if (st->responding) {
+                queued |= queue_stream_data(s, st);
+            }
+            if (s->output_len - s->output_sent >= OUTPUT_HIGH_WATER) {
+                break;
+            }
+        }
+    }
+
+    if (s->output_sent == s->output_len) {
+        return NULL;
+    }
+    *len = s->output_len - s->output_sent;
+    return s->output + s->output_sent;
+}
+
+void h2_session_sent(struct h2_session* s, size_t sent) {
+    s->output_sent += sent;
+}
+
+int h2_session_wants_input(const struct h2_session* s) {
+    return !s->goaway_sent && s->output_len - s->output_sent < OUTPUT_INPUT_LIMIT;
+}
+
+int h2_session_active(const struct h2_session* s) {
+    return s->stream_count > 0;
+}
+
+int h2_session_finished(const struct h2_session* s) {
+    if (s->failed) {
+        return 1;
+    }
+    if (s->output_sent != s->output_len) {
+        return 0;
+    }
+    return s->goaway_sent || (s->goaway_received && s->stream_count == 0);
+}
+
+// Helper to decode the base64url HTTP2-Settings value, returns its length or -1 when invalid
+static long decode_settings(const char* in, size_t len, uint8_t* out, size_t space) {
+    uint32_t bits = 0;
+    int count = 0;
+    size_t n = 0;
+    for (size_t i = 0; i < len; i++) {
+        char c = in[i];
+        int v;
+        if (c >= 'A' && c <= 'Z') {
+            v = c - 'A';
+        } else if (c >= 'a' && c <= 'z') {
+            v = c - 'a' + 26;
+        } else if (c >= '0' && c <= '9') {
+            v = c - '0' + 52;
+        } else if (c == '-' || c == '+') {
+            v = 62;
+        } else if (c == '_' || c == '/') {
+            v = 63;
+        } else if (c == '=') {
+            break;
+        } else {
+            return -1;
+        }
+        bits = bits << 6 | v;
+        count += 6;
+        if (count >= 8) {
+            count -= 8;
+            if (n == space) {
+                return -1;
+            }
+            out[n++] = bits >> count;
+        }
+    }
+    return n % 6 == 0 ? (long)n : -1;
+}
+
+// Helper to get the decoded HTTP2-Settings of a request, returns the length or -1
+static long request_settings(const char* buffer, const struct http_request* req, uint8_t* out, size_t space) {
+    const struct http_slice* settings = http_get_header(req, HTTP_HEADER_HTTP2_SETTINGS);
+    if (settings == NULL) {
+        return -1;
+    }
+    return decode_settings(buffer + settings->offset, settings->length, out, space);
+}
+
+int h2_preface_match(const char* buf, size_t len) {
+    size_t compared = len < H2_PREFACE_LEN ? len : H2_PREFACE_LEN;
+    if (memcmp(buf, preface, compared) != 0) {
+        return -1;
+    }
+    return len >= H2_PREFACE_LEN;
+}
+
+int h2_upgrade_requested(const char* buffer, const struct http_request* req) {
+    if (!http2_enabled) {
+        return 0;
+    }
+    const struct http_slice* upgrade = http_get_header(req, HTTP_HEADER_UPGRADE);
+    if (upgrade == NULL || !http_slice_contains(buffer, *upgrade, "h2c")) {
+        return 0;
+    }
+    if (req->content_length > 0 || req->chunked) {
+        return 0;
+    }
+    uint8_t settings[256];
+    return request_settings(buffer, req, settings, sizeof(settings)) >= 0;
+}
+
+// Function to start a session, announcing our settings and opening the connection window
+struct h2_session* h2_session_new(const char* upgrade_request, size_t request_len) {
+    struct h2_session* s = calloc(1, sizeof(*s));
+    if (s == NULL) {
+        return NULL;
+    }
+    s->output_cap = 2 * OUTPUT_HIGH_WATER;
+    s->output = malloc(s->output_cap);
+    if (s->output == NULL) {
+        free(s);
+        return NULL;
+    }
+    hpack_decoder_init(&s->decoder);
+    hpack_encoder_init(&s->encoder);
+    s->peer_initial_window = DEFAULT_WINDOW;
+    s->peer_max_frame = MAX_FRAME_SIZE;
+    s->send_window = DEFAULT_WINDOW;
+    s->recv_window = CONNECTION_WINDOW;
+    worker_stats->http2_connections++;
+
+    uint8_t settings[12];
+    settings[0] = 0;
+    settings[1] = SETTINGS_MAX_CONCURRENT_STREAMS;
+    write_u32(settings + 2, MAX_STREAMS);
+    settings[6] = 0;
+    settings[7] = SETTINGS_INITIAL_WINDOW_SIZE;
+    write_u32(settings + 8, STREAM_WINDOW);
+    queue_frame(s, FRAME_SETTINGS, 0, 0, settings, sizeof(settings));
+    queue_u32_frame(s, FRAME_WINDOW_UPDATE, 0, CONNECTION_WINDOW - DEFAULT_WINDOW);
+
+    if (upgrade_request == NULL) {
+        return s;
+    }
+
+    // The upgraded request is stream 1, half-closed as its body (none) is complete
+    // Its HTTP2-Settings stand in for the client's first SETTINGS frame and are not acknowledged
+    struct h2_stream* st = open_stream(s, 1);
+    if (st == NULL || request_len > sizeof(st->request)) {
+        h2_session_free(s);
+        return NULL;
+    }
+    s->last_stream_id = 1;
+    st->remote_closed = 1;
+    memcpy(st->request, upgrade_request, request_len);
+    st->request_len = request_len;
+
+    http_parser_init(&st->req);
+    uint8_t client_settings[256];
+    long settings_len = -1;
+    if (http_parse_request(&st->req, st->request, st->request_len) == HTTP_PARSE_DONE) {
+        settings_len = request_settings(st->request, &st->req, client_settings, sizeof(client_settings));
+    }
+    if (settings_len >= 0) {
+        int error = apply_settings(s, client_settings, settings_len);
+        if (error != 0) {
+            connection_error(s, error);
+            return s;
+        }
+    }
+    st->send_window = s->peer_initial_window;
+    dispatch_stream(s, st, 0);
+    return s;
+}
+
+void h2_session_free(struct h2_session* s) {
+    while (s->streams != NULL) {
+        close_stream(s, s->streams);
+    }
+    hpack_decoder_free(&s->decoder);
+    hpack_encoder_free(&s->encoder);
+    free(s->header_block);
+    free(s->output);
+    free(s);
+}
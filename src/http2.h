@@ -0,0 +1,50 @@
+#ifndef HTTP2_H
+#define HTTP2_H
+
+#include <stddef.h>
+
+// Whether clients may switch to HTTP/2 cleartext, turned off with --no-http2
+extern int http2_enabled;
+
+// Length of the client connection preface "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n"
+#define H2_PREFACE_LEN 24
+
+struct http_request;
+struct h2_session;
+
+// Compare the start of a connection with the preface
+// Returns 1 when it is there, 0 while the bytes so far are a prefix of it and -1 otherwise
+int h2_preface_match(const char* buf, size_t len);
+
+// Whether a parsed HTTP/1.1 request asks to upgrade to h2c and can be upgraded
+// It needs one valid HTTP2-Settings header and no body, the body would have to be read first
+int h2_upgrade_requested(const char* buffer, const struct http_request* req);
+
+// Start the HTTP/2 session of a connection, returns NULL when out of memory
+// With upgrade_request NULL the client sent the preface (prior knowledge), otherwise upgrade_request
+// is the HTTP/1.1 request that asked for h2c, answered as stream 1
+struct h2_session* h2_session_new(const char* upgrade_request, size_t request_len);
+
+// Process bytes received from the client, a partial frame is kept for the next call
+void h2_session_feed(struct h2_session* s, const char* data, size_t len);
+
+// Next bytes to send, or NULL when nothing can go out until more input arrives
+// DATA frames of the open streams are queued in turn, as far as the flow-control windows allow
+const char* h2_session_output(struct h2_session* s, size_t* len);
+
+// Note that the first sent bytes of the output went out
+void h2_session_sent(struct h2_session* s, size_t sent);
+
+// Whether to keep reading while the output cannot be sent, false once too much of it is queued
+int h2_session_wants_input(const struct h2_session* s);
+
+// Whether streams are open, as opposed to the connection waiting for the next request
+int h2_session_active(const struct h2_session* s);
+
+// Whether the session is over (GOAWAY either way) and its output is flushed, the connection can close
+int h2_session_finished(const struct h2_session* s);
+
+// Release the session and every open stream
+void h2_session_free(struct h2_session* s);
+
+#endif
@@ -0,0 +1,308 @@
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+
+#include "http_parser.h"
+#include "http_scan.h"
+
+// Parser states
+#define PARSE_REQUEST_LINE 0
+#define PARSE_HEADERS 1
+#define PARSE_DONE 2
+#define PARSE_ERROR 3
+
+// Names of the known headers, matched case-insensitively while parsing
+// Padded so the vector comparison can load a whole register from them
+static const struct {
+    char name[HTTP_NAME_PAD];
+    size_t length;
+} known_header_names[HTTP_HEADER_COUNT] = {
+    [HTTP_HEADER_HOST] = { "host", 4 },
+    [HTTP_HEADER_USER_AGENT] = { "user-agent", 10 },
+    [HTTP_HEADER_ACCEPT_ENCODING] = { "accept-encoding", 15 },
+    [HTTP_HEADER_CONTENT_LENGTH] = { "content-length", 14 },
+    [HTTP_HEADER_CONNECTION] = { "connection", 10 },
+    [HTTP_HEADER_TRANSFER_ENCODING] = { "transfer-encoding", 17 },
+    [HTTP_HEADER_EXPECT] = { "expect", 6 },
+    [HTTP_HEADER_RANGE] = { "range", 5 },
+    [HTTP_HEADER_IF_RANGE] = { "if-range", 8 },
+    [HTTP_HEADER_IF_NONE_MATCH] = { "if-none-match", 13 },
+    [HTTP_HEADER_IF_MODIFIED_SINCE] = { "if-modified-since", 17 },
+    [HTTP_HEADER_UPGRADE] = { "upgrade", 7 },
+    [HTTP_HEADER_HTTP2_SETTINGS] = { "http2-settings", 14 },
+};
+
+// Function to reset the parser
+void http_parser_init(struct http_request *req) {
+    req->state = PARSE_REQUEST_LINE;
+    req->pos = 0;
+    req->version_minor = 1;
+    req->header_count = 0;
+    req->header_length = 0;
+    req->content_length = 0;
+    req->chunked = 0;
+    for (int i = 0; i < HTTP_HEADER_COUNT; i++) {
+        req->known_headers[i] = -1;
+    }
+}
+
+// Helper to build a view from two pointers into the buffer
+static struct http_slice make_slice(const char *buf, const char *start, const char *end) {
+    struct http_slice slice = { (uint32_t)(start - buf), (uint32_t)(end - start) };
+    return slice;
+}
+
+// Function to parse "METHOD SP TARGET SP HTTP/1.x"
+static int parse_request_line(struct http_request *req, const char *buf, const char *line, const char *end) {
+    const char *method_end = line + http_find_delimiter(line, end - line, ' ', ' ');
+    if (method_end == end || method_end == line) {
+        return -1;
+    }
+
+    const char *path_start = method_end + 1;
+    const char *path_end = path_start + http_find_delimiter(path_start, end - path_start, ' ', ' ');
+    if (path_end == end || path_end == path_start) {
+        return -1;
+    }
+
+    const char *version_start = path_end + 1;
+    if (end - version_start != 8 || memcmp(version_start, "HTTP/1.", 7) != 0 || !isdigit((unsigned char)version_start[7])) {
+        return -1;
+    }
+
+    req->method = make_slice(buf, line, method_end);
+    req->path = make_slice(buf, path_start, path_end);
+    req->version = make_slice(buf, version_start, end);
+    req->version_minor = version_start[7] - '0';
+    return 0;
+}
+
+// Function to parse a Content-Length value, rejecting anything but digits
+static int parse_content_length(const char *value, size_t length, size_t *result) {
+    size_t number = 0;
+    if (length == 0) {
+        return -1;
+    }
+    for (size_t i = 0; i < length; i++) {
+        if (!isdigit((unsigned char)value[i]) || number > (SIZE_MAX - 9) / 10) {
+            return -1;
+        }
+        number = number * 10 + (value[i] - '0');
+    }
+    *result = number;
+    return 0;
+}
+
+// Function to parse "Name: value" and index it when it is a known header
+// colon was found by the scan for the end of the line, limit is the end of the buffer
+static int parse_header_line(struct http_request *req, const char *buf, const char *line, const char *colon,
+                             const char *end, const char *limit) {
+    // Obsolete line folding is not supported
+    if (*line == ' ' || *line == '\t') {
+        return -1;
+    }
+
+    if (colon == line || req->header_count == HTTP_MAX_HEADERS) {
+        return -1;
+    }
+
+    // Trim optional whitespace around the value
+    const char *value_start = colon + 1;
+    const char *value_end = end;
+    while (value_start < value_end && (*value_start == ' ' || *value_start == '\t')) {
+        value_start++;
+    }
+    while (value_end > value_start && (value_end[-1] == ' ' || value_end[-1] == '\t')) {
+        value_end--;
+    }
+
+    int index = req->header_count++;
+    struct http_header *header = &req->headers[index];
+    header->name = make_slice(buf, line, colon);
+    header->value = make_slice(buf, value_start, value_end);
+
+    size_t name_length = colon - line;
+    for (int id = 0; id < HTTP_HEADER_COUNT; id++) {
+        if (known_header_names[id].length != name_length
+            || !http_name_equals(line, name_length, known_header_names[id].name, limit)) {
+            continue;
+        }
+
+        if (id == HTTP_HEADER_CONTENT_LENGTH) {
+            size_t content_length;
+            if (parse_content_length(value_start, value_end - value_start, &content_length) != 0) {
+                return -1;
+            }
+            // Conflicting duplicates would let a proxy and us frame the body differently
+            if (req->known_headers[id] != -1 && content_length != req->content_length) {
+                return -1;
+            }
+            req->content_length = content_length;
+        }
+
+        if (id == HTTP_HEADER_TRANSFER_ENCODING) {
+            // Bodies are only ever decoded from plain chunked framing
+            if (req->known_headers[id] != -1 || value_end - value_start != 7
+                || strncasecmp(value_start, "chunked", 7) != 0) {
+                return -1;
+            }
+            req->chunked = 1;
+        }
+
+        // The first occurrence wins for lookups
+        if (req->known_headers[id] == -1) {
+            req->known_headers[id] = index;
+        }
+        break;
+    }
+
+    return 0;
+}
+
+// Delimiter bitmaps of the block the parser is reading, consecutive lines share a block
+struct line_scanner {
+    const char *limit;
+    const char *block;
+    size_t block_len;
+    struct http_delimiters found;
+};
+
+// Helper to find the end of the line starting at line, and the first colon on it (NULL when there is none)
+// Returns limit while the line is incomplete
+static const char *scan_line(struct line_scanner *scanner, const char *line, const char **colon) {
+    *colon = NULL;
+    const char *limit = scanner->limit;
+    if (line == limit) {
+        return limit;
+    }
+    if (line < scanner->block || line >= scanner->block + scanner->block_len) {
+        size_t left = limit - line;
+        scanner->block = line;
+        scanner->block_len = left < HTTP_SCAN_BLOCK ? left : HTTP_SCAN_BLOCK;
+        http_scan_block(line, scanner->block_len, &scanner->found);
+    }
+
+    unsigned shift = line - scanner->block;
+    uint64_t newlines = scanner->found.newlines >> shift;
+    uint64_t colons = scanner->found.colons >> shift;
+    if (newlines != 0) {
+        // Only colons before the line feed belong to this line
+        colons &= (newlines & -newlines) - 1;
+    }
+    if (colons != 0) {
+        *colon = line + __builtin_ctzll(colons);
+    }
+    if (newlines != 0) {
+        return line + __builtin_ctzll(newlines);
+    }
+
+    // The line runs past the block, a long one (a cookie, say) is finished with a plain search
+    const char *rest = scanner->block + scanner->block_len;
+    const char *newline = rest + http_find_delimiter(rest, limit - rest, '\n', '\n');
+    if (*colon == NULL) {
+        *colon = rest + http_find_delimiter(rest, newline - rest, ':', ':');
+        if (*colon == newline) {
+            *colon = NULL;
+        }
+    }
+    return newline;
+}
+
+// Function to parse the request incrementally
+int http_parse_request(struct http_request *req, const char *buf, size_t len) {
+    struct line_scanner scanner = { buf + len, buf, 0, { 0, 0 } };
+    const char *limit = scanner.limit;
+    while (req->state == PARSE_REQUEST_LINE || req->state == PARSE_HEADERS) {
+        // Only complete lines are consumed, a partial line is parsed again on the next call
+        // Line feeds and colons are classified a block at a time instead of searched for line by line
+        const char *line = buf + req->pos;
+        const char *colon;
+        const char *newline = scan_line(&scanner, line, &colon);
+        if (newline == limit) {
+            return HTTP_PARSE_INCOMPLETE;
+        }
+
+        const char *end = newline;
+        if (end > line && end[-1] == '\r') {
+            end--;
+        }
+        req->pos = newline + 1 - buf;
+
+        if (req->state == PARSE_REQUEST_LINE) {
+            // Tolerate empty lines before the request line
+            if (end == line) {
+                continue;
+            }
+            if (parse_request_line(req, buf, line, end) != 0) {
+                req->state = PARSE_ERROR;
+                break;
+            }
+            req->state = PARSE_HEADERS;
+        } else if (end == line) {
+            // Blank line ends the headers
+            req->header_length = req->pos;
+            req->state = PARSE_DONE;
+
+            // The whole request has to stay measurable, a length that wraps would frame the body
+            // as the next pipelined request
+            if (req->content_length > SIZE_MAX - req->header_length) {
+                req->state = PARSE_ERROR;
+                break;
+            }
+
+            // Both framings at once is how requests get smuggled past proxies
+            if (req->chunked && (req->known_headers[HTTP_HEADER_CONTENT_LENGTH] != -1 || req->version_minor == 0)) {
+                req->state = PARSE_ERROR;
+            }
+        } else if (colon == NULL || parse_header_line(req, buf, line, colon, end, limit) != 0) {
+            req->state = PARSE_ERROR;
+        }
+    }
+
+    return req->state == PARSE_DONE ? HTTP_PARSE_DONE : HTTP_PARSE_ERROR;
+}
+
+// Function to get the full length of a parsed request
+size_t http_request_length(const struct http_request *req) {
+    if (req->content_length > SIZE_MAX - req->header_length) {
+        return SIZE_MAX;
+    }
+    return req->header_length + req->content_length;
+}
+
+// Function to look up a known header
+const struct http_slice *http_get_header(const struct http_request *req, enum http_header_id id) {
+    int index = req->known_headers[id];
+    return index == -1 ? NULL : &req->headers[index].value;
+}
+
+// Function to compare a view with a string
+int http_slice_equals(const char *buf, struct http_slice slice, const char *str) {
+    size_t length = strlen(str);
+    return slice.length == length && memcmp(buf + slice.offset, str, length) == 0;
+}
+
+// Function to check whether a view starts with a prefix
+int http_slice_starts_with(const char *buf, struct http_slice slice, const char *prefix) {
+    size_t length = strlen(prefix);
+    return slice.length >= length && memcmp(buf + slice.offset, prefix, length) == 0;
+}
+
+// Function to search a view for a token, ignoring case
+// Candidates are found by scanning for either case of the token's first letter
+int http_slice_contains(const char *buf, struct http_slice slice, const char *token) {
+    size_t length = strlen(token);
+    if (length == 0 || length > slice.length) {
+        return length == 0;
+    }
+    const char *value = buf + slice.offset;
+    size_t last = slice.length - length;
+    char first = token[0];
+    for (size_t i = 0; i <= last; i++) {
+        i += http_find_delimiter(value + i, last + 1 - i, tolower((unsigned char)first), toupper((unsigned char)first));
+        if (i <= last && strncasecmp(value + i, token, length) == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,85 @@
+#ifndef HTTP_PARSER_H
+#define HTTP_PARSER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define HTTP_MAX_HEADERS 64
+
+// Result of http_parse_request()
+#define HTTP_PARSE_DONE 1
+#define HTTP_PARSE_INCOMPLETE 0
+#define HTTP_PARSE_ERROR -1
+
+// (offset, length) view into the receive buffer
+struct http_slice {
+    uint32_t offset;
+    uint32_t length;
+};
+
+// Headers the server looks up, indexed once while parsing
+enum http_header_id {
+    HTTP_HEADER_HOST,
+    HTTP_HEADER_USER_AGENT,
+    HTTP_HEADER_ACCEPT_ENCODING,
+    HTTP_HEADER_CONTENT_LENGTH,
+    HTTP_HEADER_CONNECTION,
+    HTTP_HEADER_TRANSFER_ENCODING,
+    HTTP_HEADER_EXPECT,
+    HTTP_HEADER_RANGE,
+    HTTP_HEADER_IF_RANGE,
+    HTTP_HEADER_IF_NONE_MATCH,
+    HTTP_HEADER_IF_MODIFIED_SINCE,
+    HTTP_HEADER_UPGRADE,
+    HTTP_HEADER_HTTP2_SETTINGS,
+    HTTP_HEADER_COUNT
+};
+
+struct http_header {
+    struct http_slice name;
+    struct http_slice value;
+};
+
+// Parsed request, every field is a view into the buffer handed to the parser
+struct http_request {
+    // Parse progress, a request split across reads resumes at pos
+    int state;
+    size_t pos;
+
+    struct http_slice method;
+    struct http_slice path;
+    struct http_slice version;
+    int version_minor;              // 0 for HTTP/1.0, 1 for HTTP/1.1
+
+    struct http_header headers[HTTP_MAX_HEADERS];
+    int header_count;
+    int known_headers[HTTP_HEADER_COUNT];   // Index into headers, or -1
+
+    size_t header_length;           // Request line and headers, including the blank line
+    size_t content_length;
+    int chunked;                    // Body uses Transfer-Encoding: chunked, its length is unknown
+};
+
+// Reset the parser for a new request at the start of the buffer
+void http_parser_init(struct http_request *req);
+
+// Parse as much of the request as the buffer holds, resuming where the last call stopped
+// Returns HTTP_PARSE_DONE once the blank line after the headers has been seen
+int http_parse_request(struct http_request *req, const char *buf, size_t len);
+
+// Total length of the request (headers plus Content-Length body), valid once parsed
+// A chunked body is not included, it has to be decoded to find its end
+// Saturates at SIZE_MAX instead of wrapping, such a request never fits a buffer
+size_t http_request_length(const struct http_request *req);
+
+// Look up a known header, returns NULL when the request does not carry it
+const struct http_slice *http_get_header(const struct http_request *req, enum http_header_id id);
+
+// Compare a view with a string, exactly or as a prefix
+int http_slice_equals(const char *buf, struct http_slice slice, const char *str);
+int http_slice_starts_with(const char *buf, struct http_slice slice, const char *prefix);
+
+// Case-insensitive search for a token inside a view
+int http_slice_contains(const char *buf, struct http_slice slice, const char *token);
+
+#endif
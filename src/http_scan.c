@@ -0,0 +1,329 @@
+#include <string.h>
+#include <stdint.h>
+
+#include "http_scan.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HTTP_SCAN_HAVE_SIMD 1
+#endif
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define HTTP_SCAN_LITTLE_ENDIAN 1
+#endif
+
+#define ONES 0x0101010101010101ULL
+#define HIGHS 0x8080808080808080ULL
+#define LOWS 0x7F7F7F7F7F7F7F7FULL
+
+// Helper to flag the zero bytes of a word, the lowest flag is exact (higher ones may be spurious)
+static uint64_t zero_bytes(uint64_t word) {
+    return (word - ONES) & ~word & HIGHS;
+}
+
+// Helper to gather one bit per byte of a word, set for exactly the bytes equal to the pattern
+static unsigned byte_mask(uint64_t word, uint64_t pattern) {
+    uint64_t x = word ^ pattern;
+    uint64_t zero = ~(((x & LOWS) + LOWS) | x | LOWS);
+    // Multiplying moves the flag of byte i to bit 56 + i
+    return ((zero >> 7) * 0x0102040810204080ULL) >> 56;
+}
+
+// Helper to fold an ASCII letter to lowercase, leaving every other byte alone
+static unsigned char fold(unsigned char c) {
+    return (unsigned)(c - 'A') < 26 ? c + ('a' - 'A') : c;
+}
+
+// Function to find a delimiter eight bytes at a time in a general-purpose register
+static size_t find_delimiter_scalar(const char *buf, size_t len, char a, char b) {
+    size_t i = 0;
+#ifdef HTTP_SCAN_LITTLE_ENDIAN
+    const uint64_t pattern_a = ONES * (unsigned char)a;
+    const uint64_t pattern_b = ONES * (unsigned char)b;
+    for (; i + 8 <= len; i += 8) {
+        uint64_t word;
+        memcpy(&word, buf + i, sizeof(word));
+        uint64_t found = zero_bytes(word ^ pattern_a) | zero_bytes(word ^ pattern_b);
+        if (found != 0) {
+            return i + __builtin_ctzll(found) / 8;
+        }
+    }
+#endif
+    for (; i < len; i++) {
+        if (buf[i] == a || buf[i] == b) {
+            return i;
+        }
+    }
+    return len;
+}
+
+// Function to classify a block eight bytes at a time in a general-purpose register
+static void scan_block_scalar(const char *block, struct http_delimiters *found) {
+    found->newlines = 0;
+    found->colons = 0;
+    for (int i = 0; i < HTTP_SCAN_BLOCK; i += 8) {
+        uint64_t word;
+        memcpy(&word, block + i, sizeof(word));
+#ifndef HTTP_SCAN_LITTLE_ENDIAN
+        word = __builtin_bswap64(word);
+#endif
+        found->newlines |= (uint64_t)byte_mask(word, ONES * '\n') << i;
+        found->colons |= (uint64_t)byte_mask(word, ONES * ':') << i;
+    }
+}
+
+// Function to compare a header name one byte at a time
+static int name_equals_scalar(const char *name, size_t len, const char *lowercase, const char *limit) {
+    (void)limit;
+    for (size_t i = 0; i < len; i++) {
+        if (fold(name[i]) != (unsigned char)lowercase[i]) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+#ifdef HTTP_SCAN_HAVE_SIMD
+
+// Helper to fold the uppercase letters of 16 bytes, bytes >= 0x80 compare as negative and stay as they are
+__attribute__((target("sse4.2")))
+static __m128i fold_sse(__m128i chunk) {
+    __m128i upper = _mm_and_si128(_mm_cmpgt_epi8(chunk, _mm_set1_epi8('A' - 1)),
+                                  _mm_cmplt_epi8(chunk, _mm_set1_epi8('Z' + 1)));
+    return _mm_or_si128(chunk, _mm_and_si128(upper, _mm_set1_epi8(0x20)));
+}
+
+// Function to classify a block 16 bytes at a time
+__attribute__((target("sse4.2")))
+static void scan_block_sse42(const char *block, struct http_delimiters *found) {
+    const __m128i newline = _mm_set1_epi8('\n');
+    const __m128i colon = _mm_set1_epi8(':');
+    found->newlines = 0;
+    found->colons = 0;
+    for (int i = 0; i < HTTP_SCAN_BLOCK; i += 16) {
+        __m128i chunk = _mm_loadu_si128((const __m128i *)(block + i));
+        found->newlines |= (uint64_t)(unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, newline)) << i;
+        found->colons |= (uint64_t)(unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, colon)) << i;
+    }
+}
+
+// Function to find a delimiter 16 bytes at a time with the SSE4.2 string instructions
+__attribute__((target("sse4.2")))
+static size_t find_delimiter_sse42(const char *buf, size_t len, char a, char b) {
+    const __m128i set = _mm_setr_epi8(a, b, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16) {
+        __m128i chunk = _mm_loadu_si128((const __m128i *)(buf + i));
+        int index = _mm_cmpestri(set, 2, chunk, 16, _SIDD_UBYTE_OPS | _SIDD_CMP_EQUAL_ANY | _SIDD_LEAST_SIGNIFICANT);
+        if (index < 16) {
+            return i + index;
+        }
+    }
+    return i + find_delimiter_scalar(buf + i, len - i, a, b);
+}
+
+// Function to compare a header name 16 bytes at a time
+__attribute__((target("sse4.2")))
+static int name_equals_sse42(const char *name, size_t len, const char *lowercase, const char *limit) {
+    if (len > HTTP_NAME_PAD || (size_t)(limit - name) < HTTP_NAME_PAD) {
+        return name_equals_scalar(name, len, lowercase, limit);
+    }
+    for (size_t i = 0; i < len; i += 16) {
+        __m128i chunk = fold_sse(_mm_loadu_si128((const __m128i *)(name + i)));
+        unsigned equal = _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, _mm_loadu_si128((const __m128i *)(lowercase + i))));
+        unsigned wanted = len - i >= 16 ? 0xFFFF : (1u << (len - i)) - 1;
+        if ((equal & wanted) != wanted) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Function to classify a block in two 32-byte halves
+__attribute__((target("avx2")))
+static void scan_block_avx2(const char *block, struct http_delimiters *found) {
+    const __m256i newline = _mm256_set1_epi8('\n');
+    const __m256i colon = _mm256_set1_epi8(':');
+    __m256i low = _mm256_loadu_si256((const __m256i *)block);
+    __m256i high = _mm256_loadu_si256((const __m256i *)(block + 32));
+    found->newlines = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(low, newline))
+                      | (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(high, newline)) << 32;
+    found->colons = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(low, colon))
+                    | (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(high, colon)) << 32;
+}
+
+// Function to find a delimiter 64 bytes at a time with AVX2
+// Short lines never touch the upper halves of the registers
+__attribute__((target("avx2")))
+static size_t find_delimiter_avx2(const char *buf, size_t len, char a, char b) {
+    size_t i = 0;
+    if (len >= 32) {
+        const __m256i pattern_a = _mm256_set1_epi8(a);
+        const __m256i pattern_b = _mm256_set1_epi8(b);
+        for (; i + 64 <= len; i += 64) {
+            __m256i low = _mm256_loadu_si256((const __m256i *)(buf + i));
+            __m256i high = _mm256_loadu_si256((const __m256i *)(buf + i + 32));
+            uint64_t found = (uint32_t)_mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(low, pattern_a),
+                                                                            _mm256_cmpeq_epi8(low, pattern_b)))
+                             | (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(high, pattern_a),
+                                                                                        _mm256_cmpeq_epi8(high, pattern_b))) << 32;
+            if (found != 0) {
+                return i + __builtin_ctzll(found);
+            }
+        }
+        if (i + 32 <= len) {
+            __m256i chunk = _mm256_loadu_si256((const __m256i *)(buf + i));
+            unsigned found = _mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(chunk, pattern_a),
+                                                                  _mm256_cmpeq_epi8(chunk, pattern_b)));
+            if (found != 0) {
+                return i + __builtin_ctz(found);
+            }
+            i += 32;
+        }
+        // The compiler misses this on the way to the tail, and SSE code running with dirty upper
+        // halves stalls on every instruction, costing more than the whole scan
+        _mm256_zeroupper();
+    }
+    if (i + 16 <= len) {
+        __m128i chunk = _mm_loadu_si128((const __m128i *)(buf + i));
+        unsigned found = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(chunk, _mm_set1_epi8(a)),
+                                                        _mm_cmpeq_epi8(chunk, _mm_set1_epi8(b))));
+        if (found != 0) {
+            return i + __builtin_ctz(found);
+        }
+        i += 16;
+    }
+    return i + find_delimiter_scalar(buf + i, len - i, a, b);
+}
+
+// Function to compare a header name of up to 32 bytes in one step
+__attribute__((target("avx2")))
+static int name_equals_avx2(const char *name, size_t len, const char *lowercase, const char *limit) {
+    if (len > HTTP_NAME_PAD || (size_t)(limit - name) < HTTP_NAME_PAD) {
+        return name_equals_scalar(name, len, lowercase, limit);
+    }
+    __m256i chunk = _mm256_loadu_si256((const __m256i *)name);
+    __m256i upper = _mm256_and_si256(_mm256_cmpgt_epi8(chunk, _mm256_set1_epi8('A' - 1)),
+                                     _mm256_cmpgt_epi8(_mm256_set1_epi8('Z' + 1), chunk));
+    chunk = _mm256_or_si256(chunk, _mm256_and_si256(upper, _mm256_set1_epi8(0x20)));
+    unsigned equal = _mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, _mm256_loadu_si256((const __m256i *)lowercase)));
+    unsigned wanted = len == 32 ? 0xFFFFFFFFu : (1u << len) - 1;
+    return (equal & wanted) == wanted;
+}
+
+#endif
+
+// Kernels used together, one set per instruction set
+struct scan_implementation {
+    const char *name;
+    void (*scan_block)(const char *, struct http_delimiters *);
+    size_t (*find_delimiter)(const char *, size_t, char, char);
+    int (*name_equals)(const char *, size_t, const char *, const char *);
+};
+
+// Ordered from the least to the most demanding
+static const struct scan_implementation implementations[] = {
+    { "scalar", scan_block_scalar, find_delimiter_scalar, name_equals_scalar },
+#ifdef HTTP_SCAN_HAVE_SIMD
+    { "sse42", scan_block_sse42, find_delimiter_sse42, name_equals_sse42 },
+    { "avx2", scan_block_avx2, find_delimiter_avx2, name_equals_avx2 },
+#endif
+};
+
+#define IMPLEMENTATION_COUNT (sizeof(implementations) / sizeof(implementations[0]))
+
+static void scan_block_resolve(const char *block, struct http_delimiters *found);
+static size_t find_delimiter_resolve(const char *buf, size_t len, char a, char b);
+static int name_equals_resolve(const char *name, size_t len, const char *lowercase, const char *limit);
+
+// Kernels picked by http_scan_init(), resolved on first use if init was skipped
+static void (*scan_block_impl)(const char *, struct http_delimiters *) = scan_block_resolve;
+static size_t (*find_delimiter_impl)(const char *, size_t, char, char) = find_delimiter_resolve;
+static int (*name_equals_impl)(const char *, size_t, const char *, const char *) = name_equals_resolve;
+static const char *scan_impl_name = "none";
+
+// Helper to check whether the CPU can run an implementation
+static int implementation_supported(const struct scan_implementation *impl) {
+#ifdef HTTP_SCAN_HAVE_SIMD
+    __builtin_cpu_init();
+    if (strcmp(impl->name, "sse42") == 0) {
+        return __builtin_cpu_supports("sse4.2");
+    }
+    if (strcmp(impl->name, "avx2") == 0) {
+        return __builtin_cpu_supports("avx2");
+    }
+#endif
+    return strcmp(impl->name, "scalar") == 0;
+}
+
+// Helper to switch to an implementation
+static void use_implementation(const struct scan_implementation *impl) {
+    scan_block_impl = impl->scan_block;
+    find_delimiter_impl = impl->find_delimiter;
+    name_equals_impl = impl->name_equals;
+    scan_impl_name = impl->name;
+}
+
+// Function to pick the widest implementation this CPU supports
+void http_scan_init() {
+    for (size_t i = IMPLEMENTATION_COUNT; i-- > 0;) {
+        if (implementation_supported(&implementations[i])) {
+            use_implementation(&implementations[i]);
+            return;
+        }
+    }
+}
+
+// Function to select an implementation by name
+int http_scan_select(const char *name) {
+    for (size_t i = 0; i < IMPLEMENTATION_COUNT; i++) {
+        if (strcmp(implementations[i].name, name) == 0 && implementation_supported(&implementations[i])) {
+            use_implementation(&implementations[i]);
+            return 0;
+        }
+    }
+    return -1;
+}
+
+// Function to get the name of the selected implementation
+const char *http_scan_implementation() {
+    return scan_impl_name;
+}
+
+// Helpers to pick the implementation on first use
+static void scan_block_resolve(const char *block, struct http_delimiters *found) {
+    http_scan_init();
+    scan_block_impl(block, found);
+}
+
+static size_t find_delimiter_resolve(const char *buf, size_t len, char a, char b) {
+    http_scan_init();
+    return find_delimiter_impl(buf, len, a, b);
+}
+
+static int name_equals_resolve(const char *name, size_t len, const char *lowercase, const char *limit) {
+    http_scan_init();
+    return name_equals_impl(name, len, lowercase, limit);
+}
+
+// Function to classify the delimiters of a block
+// Kernels always read a whole block, a short one is copied into a zero-padded block first
+void http_scan_block(const char *block, size_t len, struct http_delimiters *found) {
+    if (len >= HTTP_SCAN_BLOCK) {
+        scan_block_impl(block, found);
+        return;
+    }
+    char padded[HTTP_SCAN_BLOCK] = {0};
+    memcpy(padded, block, len);
+    scan_block_impl(padded, found);
+}
+
+// Function to find the first of two delimiters
+size_t http_find_delimiter(const char *buf, size_t len, char a, char b) {
+    return find_delimiter_impl(buf, len, a, b);
+}
+
+// Function to compare a header name, ignoring case
+int http_name_equals(const char *name, size_t len, const char *lowercase, const char *limit) {
+    return name_equals_impl(name, len, lowercase, limit);
+}
@@ -0,0 +1,40 @@
+#ifndef HTTP_SCAN_H
+#define HTTP_SCAN_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Longest header name http_name_equals() compares with vector loads, lowercase names are padded to it
+#define HTTP_NAME_PAD 32
+
+// Bytes http_scan_block() classifies in one call
+#define HTTP_SCAN_BLOCK 64
+
+// Delimiters of a block as bitmaps, bit i is set when byte i is one
+struct http_delimiters {
+    uint64_t newlines;
+    uint64_t colons;
+};
+
+// Find the line feeds and colons of block[0..len), len at most HTTP_SCAN_BLOCK
+void http_scan_block(const char *block, size_t len, struct http_delimiters *found);
+
+// Index of the first byte in buf[0..len) equal to a or b, len when there is none
+// Pass the same byte twice to search for one
+size_t http_find_delimiter(const char *buf, size_t len, char a, char b);
+
+// Case-insensitive comparison of name[0..len) with lowercase, which is lowercase ASCII
+// readable for HTTP_NAME_PAD bytes; limit is the end of the buffer name points into,
+// vector loads never go past it
+int http_name_equals(const char *name, size_t len, const char *lowercase, const char *limit);
+
+// Pick the implementation from the CPU features, called once at startup
+void http_scan_init();
+
+// Name of the implementation in use
+const char *http_scan_implementation();
+
+// Use the named implementation (scalar, sse42 or avx2), returns -1 when this CPU cannot run it
+int http_scan_select(const char *name);
+
+#endif
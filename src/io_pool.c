@@ -0,0 +1,214 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <sys/eventfd.h>
+
+#include "io_pool.h"
+#include "metrics.h"
+#include "workers.h"
+
+// Pool settings, configured from the command line
+int io_pool_threads = 4;
+int io_pool_queue_size = 256;
+
+// Jobs submitted to one thread, a ring its owner takes from the front of and idle threads steal from the back of
+// Each ring has its own lock, so the loop and the threads only meet when one of them runs dry
+struct job_deque {
+    pthread_mutex_t lock;
+    struct io_job** jobs;
+    int capacity;
+    int head;
+    int count;
+} __attribute__((aligned(64)));
+
+static struct job_deque* deques;
+static int deque_count;
+static int next_deque;              // Round-robin target of the next submission, loop thread only
+
+// Posted once per queued job, a thread that takes a post is owed exactly one job from some deque
+static sem_t jobs_queued;
+
+// Finished jobs, newest first, waiting for the loop thread
+static pthread_mutex_t done_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct io_job* done_jobs;
+static int done_fd = -1;
+
+// Helper to take the oldest job of a deque
+static struct io_job* take_front(struct job_deque* d) {
+    struct io_job* job = NULL;
+    pthread_mutex_lock(&d->lock);
+    if (d->count > 0) {
+        job = d->jobs[d->head];
+        d->head = (d->head + 1) % d->capacity;
+        d->count--;
+    }
+    pthread_mutex_unlock(&d->lock);
+    return job;
+}
+
+// Helper to steal the newest job of another thread's deque
+static struct io_job* take_back(struct job_deque* d) {
+    struct io_job* job = NULL;
+    pthread_mutex_lock(&d->lock);
+    if (d->count > 0) {
+        d->count--;
+        job = d->jobs[(d->head + d->count) % d->capacity];
+    }
+    pthread_mutex_unlock(&d->lock);
+    return job;
+}
+
+// Helper to hand a finished job back to the loop
+static void finish_job(struct io_job* job) {
+    pthread_mutex_lock(&done_lock);
+    job->next = done_jobs;
+    done_jobs = job;
+    pthread_mutex_unlock(&done_lock);
+
+    uint64_t one = 1;
+    if (write(done_fd, &one, sizeof(one)) < 0) {
+        // Counter is already non-zero, the loop wakes up anyway
+    }
+}
+
+// Function run by every pool thread
+static void* pool_thread(void* arg) {
+    int self = (int)(intptr_t)arg;
+    while (1) {
+        if (sem_wait(&jobs_queued) == -1) {
+            continue;
+        }
+
+        // The job this post stands for is in some deque, our own first, then the others in turn
+        struct io_job* job = take_front(&deques[self]);
+        for (int i = 1; job == NULL; i++) {
+            job = take_back(&deques[(self + i) % deque_count]);
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &job->started);
+        job->run(job);
+        finish_job(job);
+    }
+    return NULL;
+}
+
+// Function to start the pool threads of this event loop
+int io_pool_start() {
+    if (io_pool_threads <= 0) {
+        return -1;
+    }
+
+    done_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (done_fd == -1) {
+        printf("Failed to create I/O pool eventfd: %s\n", strerror(errno));
+        return -1;
+    }
+    sem_init(&jobs_queued, 0, 0);
+
+    int capacity = (io_pool_queue_size + io_pool_threads - 1) / io_pool_threads;
+    if (capacity < 1) {
+        capacity = 1;
+    }
+    deques = calloc(io_pool_threads, sizeof(*deques));
+    if (deques == NULL) {
+        printf("Failed to allocate the I/O pool\n");
+        close(done_fd);
+        done_fd = -1;
+        return -1;
+    }
+    for (int i = 0; i < io_pool_threads; i++) {
+        pthread_mutex_init(&deques[i].lock, NULL);
+        deques[i].capacity = capacity;
+        deques[i].jobs = calloc(capacity, sizeof(*deques[i].jobs));
+        if (deques[i].jobs == NULL) {
+            printf("Failed to allocate the I/O pool\n");
+            return -1;
+        }
+    }
+
+    // Threads are only counted once they run, a pool short of threads still drains every deque
+    for (int i = 0; i < io_pool_threads; i++) {
+        pthread_t thread;
+        int error = pthread_create(&thread, NULL, pool_thread, (void*)(intptr_t)i);
+        if (error != 0) {
+            printf("Failed to start I/O pool thread: %s\n", strerror(error));
+            if (deque_count == 0) {
+                return -1;
+            }
+            break;
+        }
+        pthread_detach(thread);
+        deque_count = i + 1;
+    }
+    return done_fd;
+}
+
+// Function to queue a job, on the next deque in turn or the first one with room after it
+int io_pool_submit(struct io_job* job) {
+    if (deque_count == 0) {
+        return -1;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &job->queued);
+    for (int i = 0; i < deque_count; i++) {
+        int target = (next_deque + i) % deque_count;
+        struct job_deque* d = &deques[target];
+        pthread_mutex_lock(&d->lock);
+        if (d->count == d->capacity) {
+            pthread_mutex_unlock(&d->lock);
+            continue;
+        }
+        d->jobs[(d->head + d->count) % d->capacity] = job;
+        d->count++;
+        pthread_mutex_unlock(&d->lock);
+        sem_post(&jobs_queued);
+
+        next_deque = (target + 1) % deque_count;
+        worker_stats->io_pool_queue_depth++;
+        if (worker_stats->io_pool_queue_depth > worker_stats->io_pool_queue_max) {
+            worker_stats->io_pool_queue_max = worker_stats->io_pool_queue_depth;
+        }
+        return 0;
+    }
+
+    // Every deque is full, the disk is not keeping up
+    worker_stats->io_pool_saturated++;
+    return -1;
+}
+
+// Function to complete the finished jobs in the order they finished
+void io_pool_complete() {
+    uint64_t wakeups;
+    if (read(done_fd, &wakeups, sizeof(wakeups)) < 0) {
+        // Nothing to clear, the list is drained either way
+    }
+
+    pthread_mutex_lock(&done_lock);
+    struct io_job* newest = done_jobs;
+    done_jobs = NULL;
+    pthread_mutex_unlock(&done_lock);
+
+    struct io_job* oldest = NULL;
+    while (newest != NULL) {
+        struct io_job* next = newest->next;
+        newest->next = oldest;
+        oldest = newest;
+        newest = next;
+    }
+
+    // A completion may queue the connection's next job, the list is already detached
+    while (oldest != NULL) {
+        struct io_job* job = oldest;
+        oldest = job->next;
+        worker_stats->io_pool_queue_depth--;
+        worker_stats->io_pool_jobs++;
+        metrics_io_job_done(&job->queued, &job->started);
+        job->complete(job);
+    }
+}
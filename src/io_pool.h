@@ -0,0 +1,33 @@
+#ifndef IO_POOL_H
+#define IO_POOL_H
+
+#include <time.h>
+
+// Threads per event loop that run blocking file-system steps and gzip compression, 0 keeps them on the loop
+extern int io_pool_threads;
+
+// Jobs queued across the pool before submissions are turned away
+extern int io_pool_queue_size;
+
+// A blocking step handed to the pool, embedded in the connection it belongs to
+// The loop must leave everything the job touches alone until complete() runs
+struct io_job {
+    void (*run)(struct io_job* job);        // On a pool thread
+    void (*complete)(struct io_job* job);   // Back on the loop thread, from io_pool_complete()
+    struct timespec queued;
+    struct timespec started;
+    struct io_job* next;
+};
+
+// Start the pool of the calling event loop, after fork() as threads do not survive it
+// Returns an eventfd that becomes readable when jobs complete, or -1 when the pool is off or failed to start
+int io_pool_start();
+
+// Queue a job on the pool, loop thread only
+// Returns -1 when the pool is off or its queue is full, the caller then does the step itself
+int io_pool_submit(struct io_job* job);
+
+// Run the completion of every finished job, called when the eventfd is readable
+void io_pool_complete();
+
+#endif
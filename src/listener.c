@@ -0,0 +1,177 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include "listener.h"
+
+struct listener_config listener_config = {
+    .port = 4221,
+    .bind_address = NULL,
+    .ipv6_only = 0,
+    .backlog = 4096,
+    .defer_accept = 1,
+    .fastopen = 256,
+    .nodelay = 1,
+    .accept_batch = 0,
+};
+
+// Helper to fill in the address to bind, every interface is the dual-stack "::" when IPv6 is available
+// Returns the address family, or -1 when the bind address is not an IP address
+static int listen_address(struct sockaddr_storage* addr, socklen_t* addr_len) {
+    memset(addr, 0, sizeof(*addr));
+    const char* bind_address = listener_config.bind_address;
+    
+    struct sockaddr_in6* a6 = (struct sockaddr_in6*)addr;
+    if (bind_address == NULL || inet_pton(AF_INET6, bind_address, &a6->sin6_addr) == 1) {
+        if (bind_address == NULL) {
+            a6->sin6_addr = in6addr_any;
+        }
+        a6->sin6_family = AF_INET6;
+        a6->sin6_port = htons(listener_config.port);
+        *addr_len = sizeof(*a6);
+        return AF_INET6;
+    }
+    
+    struct sockaddr_in* a4 = (struct sockaddr_in*)addr;
+    if (inet_pton(AF_INET, bind_address, &a4->sin_addr) == 1) {
+        a4->sin_family = AF_INET;
+        a4->sin_port = htons(listener_config.port);
+        *addr_len = sizeof(*a4);
+        return AF_INET;
+    }
+    return -1;
+}
+
+// Helper to set an integer socket option, a failure is only reported as the socket still works without it
+static void set_option(int fd, int level, int option, int value, const char* name) {
+    if (setsockopt(fd, level, option, &value, sizeof(value)) < 0) {
+        printf("%s failed: %s \n", name, strerror(errno));
+    }
+}
+
+// Function to create the listening socket
+int create_listener(int reuse_port) {
+    struct sockaddr_storage serv_addr;
+    socklen_t serv_addr_len;
+    int family = listen_address(&serv_addr, &serv_addr_len);
+    if (family == -1) {
+        printf("Invalid bind address: %s\n", listener_config.bind_address);
+        return -1;
+    }
+    
+    int server_fd = socket(family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (server_fd == -1 && family == AF_INET6 && listener_config.bind_address == NULL && errno == EAFNOSUPPORT) {
+        // No IPv6 on this host, listen on every IPv4 interface instead
+        struct sockaddr_in* a4 = (struct sockaddr_in*)&serv_addr;
+        memset(&serv_addr, 0, sizeof(serv_addr));
+        a4->sin_family = AF_INET;
+        a4->sin_port = htons(listener_config.port);
+        a4->sin_addr.s_addr = htonl(INADDR_ANY);
+        serv_addr_len = sizeof(*a4);
+        family = AF_INET;
+        server_fd = socket(family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    }
+    if (server_fd == -1) {
+        printf("Socket creation failed: %s...\n", strerror(errno));
+        return -1;
+    }
+    
+    // Since the tester restarts your program quite often, setting SO_REUSEADDR
+    // ensures that we don't run into 'Address already in use' errors
+    int reuse = 1;
+    if (setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse)) < 0) {
+        printf("SO_REUSEADDR failed: %s \n", strerror(errno));
+        close(server_fd);
+        return -1;
+    }
+    
+    // Each worker binds its own socket, the kernel spreads connections across them
+    if (reuse_port && setsockopt(server_fd, SOL_SOCKET, SO_REUSEPORT, &reuse, sizeof(reuse)) < 0) {
+        printf("SO_REUSEPORT failed: %s \n", strerror(errno));
+        close(server_fd);
+        return -1;
+    }
+    
+    // Dual-stack unless asked otherwise, IPv4 clients then show up as ::ffff:a.b.c.d
+    if (family == AF_INET6) {
+        set_option(server_fd, IPPROTO_IPV6, IPV6_V6ONLY, listener_config.ipv6_only, "IPV6_V6ONLY");
+    }
+    
+    // Responses are coalesced with sendmsg()/MSG_MORE, so Nagle would only delay their last segment
+    // Accepted sockets inherit the option
+    if (listener_config.nodelay) {
+        set_option(server_fd, IPPROTO_TCP, TCP_NODELAY, 1, "TCP_NODELAY");
+    }
+    
+    // Connections are only handed over once the request arrives, so accept() never yields a socket
+    // that would just sit idle, and connections that send nothing never reach the server
+    if (listener_config.defer_accept > 0) {
+        set_option(server_fd, IPPROTO_TCP, TCP_DEFER_ACCEPT, listener_config.defer_accept, "TCP_DEFER_ACCEPT");
+    }
+    
+    // Returning clients may send the request in the SYN, saving a round trip
+    // Takes effect when net.ipv4.tcp_fastopen has the server bit (2) set
+    if (listener_config.fastopen > 0) {
+        set_option(server_fd, IPPROTO_TCP, TCP_FASTOPEN, listener_config.fastopen, "TCP_FASTOPEN");
+    }
+    
+    if (bind(server_fd, (struct sockaddr *) &serv_addr, serv_addr_len) != 0) {
+        printf("Bind failed: %s \n", strerror(errno));
+        close(server_fd);
+        return -1;
+    }
+    
+    if (listen(server_fd, listener_config.backlog) != 0) {
+        printf("Listen failed: %s \n", strerror(errno));
+        close(server_fd);
+        return -1;
+    }
+    
+    return server_fd;
+}
+
+// Function to accept a connection with its flags set in the same system call
+int accept_client(int server_fd, struct sockaddr_storage* addr, socklen_t* addr_len, int flags) {
+    *addr_len = sizeof(*addr);
+    return accept4(server_fd, (struct sockaddr *) addr, addr_len, flags);
+}
+
+// Helper to read a number from /proc/sys, -1 when it cannot be read
+static long read_sysctl(const char* path) {
+    FILE* f = fopen(path, "r");
+    if (f == NULL) {
+        return -1;
+    }
+    long value = -1;
+    if (fscanf(f, "%ld", &value) != 1) {
+        value = -1;
+    }
+    fclose(f);
+    return value;
+}
+
+// Function to print the listener settings
+void print_listener_config() {
+    const char* address = listener_config.bind_address;
+    printf("Listening on %s port %d%s, backlog %d, defer accept %ds, fast open queue %d, TCP_NODELAY %s\n",
+           address != NULL ? address : "all interfaces", listener_config.port,
+           listener_config.ipv6_only ? " (IPv6 only)" : "", listener_config.backlog,
+           listener_config.defer_accept, listener_config.fastopen, listener_config.nodelay ? "on" : "off");
+    
+    // Both limits are applied silently by the kernel
+    long somaxconn = read_sysctl("/proc/sys/net/core/somaxconn");
+    if (somaxconn > 0 && listener_config.backlog > somaxconn) {
+        printf("Backlog %d is capped at net.core.somaxconn = %ld\n", listener_config.backlog, somaxconn);
+    }
+    long fastopen = read_sysctl("/proc/sys/net/ipv4/tcp_fastopen");
+    if (listener_config.fastopen > 0 && fastopen >= 0 && !(fastopen & 2)) {
+        printf("TCP Fast Open is off for servers (net.ipv4.tcp_fastopen = %ld)\n", fastopen);
+    }
+}
@@ -0,0 +1,31 @@
+#ifndef LISTENER_H
+#define LISTENER_H
+
+#include <sys/socket.h>
+
+// Listening socket settings, filled in from the command line before any listener is created
+struct listener_config {
+    int port;                   // --port
+    const char* bind_address;   // --bind, NULL for every interface
+    int ipv6_only;              // --ipv6-only: an IPv6 socket does not also accept IPv4 (no dual-stack)
+    int backlog;                // --backlog, capped by the kernel at net.core.somaxconn
+    int defer_accept;           // --defer-accept: seconds the kernel holds a connection until data arrives, 0 disables
+    int fastopen;               // --fastopen: queue length for TCP Fast Open, 0 disables
+    int nodelay;                // --no-nodelay clears it
+    int accept_batch;           // --accept-batch: connections accepted per wakeup before serving others, 0 drains the queue
+};
+
+extern struct listener_config listener_config;
+
+// Create, bind and listen on the server socket, returns the socket or -1
+// With reuse_port set, SO_REUSEPORT lets several workers bind the same port
+int create_listener(int reuse_port);
+
+// Accept a connection with accept4(), flags are SOCK_NONBLOCK and/or SOCK_CLOEXEC
+// addr and addr_len receive the client address, returns the socket or -1 with errno set
+int accept_client(int server_fd, struct sockaddr_storage* addr, socklen_t* addr_len, int flags);
+
+// Print the address and settings the server listens with
+void print_listener_config();
+
+#endif
@@ -12,555 +12,348 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <stdint.h>
+#include <sys/time.h>
+#include <poll.h>
 
-// Global variable to store the directory path
-char *files_directory = NULL;
+#include "http.h"
+#include "http_parser.h"
+#include "gzip.h"
+#include "gzip_cache.h"
+#include "file_cache.h"
+#include "upload.h"
+#include "conditional.h"
+#include "access_log.h"
+#include "metrics.h"
+#include "router.h"
+#include "arena.h"
+#include "admission.h"
+#include "timer_wheel.h"
+#include "crc32.h"
+#include "http_scan.h"
+#include "event_loop.h"
+#include "uring_loop.h"
+#include "listener.h"
+#include "io_pool.h"
+#include "http2.h"
+#include "hpack.h"
+#include "workers.h"
 
-// CRC32 table for gzip footer
-static uint32_t crc_table[256];
-
-// Initialize CRC32 table
-void init_crc_table() {
-    for (int i = 0; i < 256; i++) {
-        uint32_t c = i;
-        for (int j = 0; j < 8; j++) {
-            if (c & 1)
-                c = 0xEDB88320 ^ (c >> 1);
-            else
-                c = c >> 1;
-        }
-        crc_table[i] = c;
-    }
-}
-
-// Calculate CRC32 for a buffer
-uint32_t calc_crc32(uint32_t crc, const unsigned char *buf, size_t len) {
-    crc = ~crc;
-    while (len--) {
-        crc = crc_table[(crc ^ *buf) & 0xFF] ^ (crc >> 8);
-        buf++;
-    }
-    return ~crc;
+// Handler for SIGCHLD to reap child processes
+void handle_sigchld(int sig) {
+    (void)sig;
+    // Reap all dead processes
+    while (waitpid(-1, NULL, WNOHANG) > 0);
 }
 
-// Function to create a basic gzip file in memory
-// This creates the simplest possible gzip format without compression
-// Returns the size of the gzipped data
-unsigned long simple_gzip(char* dest, const char* source, unsigned long source_len) {
-    unsigned char *d = (unsigned char*)dest;
-    const unsigned char *s = (const unsigned char*)source;
-    
-    // Initialize CRC table if not done yet
-    static int crc_initialized = 0;
-    if (!crc_initialized) {
-        init_crc_table();
-        crc_initialized = 1;
-    }
-    
-    // Calculate CRC32 and length
-    uint32_t crc = calc_crc32(0, s, source_len);
-    uint32_t len = source_len;
-    
-    // Gzip header (10 bytes)
-    // Magic number (ID1, ID2)
-    *d++ = 0x1f;
-    *d++ = 0x8b;
-    // Compression method (8 = deflate)
-    *d++ = 8;
-    // Flags (0 = no extra fields)
-    *d++ = 0;
-    // Modification time (4 bytes, set to 0)
-    *d++ = 0;
-    *d++ = 0;
-    *d++ = 0;
-    *d++ = 0;
-    // Extra flags (2 = max compression)
-    *d++ = 2;
-    // Operating system (255 = unknown)
-    *d++ = 255;
-    
-    // Store uncompressed data
-    // In a real implementation, this is where deflate compressed data would go
-    // For this simple implementation, we're storing uncompressed data with minimal headers
-    
-    // Add a stored block header
-    // 1 byte: last block (1) + type (00 = stored)
-    *d++ = 0x01;
-    // 2 bytes: length
-    *d++ = len & 0xff;
-    *d++ = (len >> 8) & 0xff;
-    // 2 bytes: one's complement of length
-    *d++ = (~len) & 0xff;
-    *d++ = (~len >> 8) & 0xff;
-    
-    // Copy the data
-    memcpy(d, s, len);
-    d += len;
-    
-    // Gzip footer (8 bytes)
-    // CRC32 (4 bytes)
-    *d++ = crc & 0xff;
-    *d++ = (crc >> 8) & 0xff;
-    *d++ = (crc >> 16) & 0xff;
-    *d++ = (crc >> 24) & 0xff;
-    
-    // Input size modulo 2^32 (4 bytes)
-    *d++ = len & 0xff;
-    *d++ = (len >> 8) & 0xff;
-    *d++ = (len >> 16) & 0xff;
-    *d++ = (len >> 24) & 0xff;
-    
-    // Return total size
-    return (d - (unsigned char*)dest);
+// Helper to count what a blocking send() managed to queue
+static uint64_t sent_bytes(ssize_t sent) {
+    return sent > 0 ? (uint64_t)sent : 0;
 }
 
-// Function to extract the path from an HTTP request
-char* extract_path(char* request) {
-    static char path[1024];
-    
-    // Initialize path buffer
-    memset(path, 0, sizeof(path));
-    
-    // Check if this is a GET or POST request
-    if (strncmp(request, "GET ", 4) == 0) {
-        // Find the end of the path (marked by space before HTTP version)
-        char* path_end = strchr(request + 4, ' ');
-        if (path_end) {
-            // Calculate the path length
-            int path_length = path_end - (request + 4);
-            // Extract the path
-            strncpy(path, request + 4, path_length);
-            path[path_length] = '\0';
+// Helper to send a whole buffer on a blocking socket, returns -1 when the client stopped taking it
+// SO_SNDTIMEO makes a send() that waited out the write timeout come back short or with EAGAIN
+static int send_all(int client_fd, const char* buf, size_t len, uint64_t* total) {
+    size_t done = 0;
+    while (done < len) {
+        ssize_t sent = send(client_fd, buf + done, len - done, MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR) {
+            continue;
         }
-    } else if (strncmp(request, "POST ", 5) == 0) {
-        // Find the end of the path (marked by space before HTTP version)
-        char* path_end = strchr(request + 5, ' ');
-        if (path_end) {
-            // Calculate the path length
-            int path_length = path_end - (request + 5);
-            // Extract the path
-            strncpy(path, request + 5, path_length);
-            path[path_length] = '\0';
+        if (sent <= 0) {
+            return -1;
         }
+        done += sent;
+        *total += sent;
     }
-    
-    return path;
-}
-
-// Function to determine if the request is a POST request
-int is_post_request(char* request) {
-    return strncmp(request, "POST ", 5) == 0;
-}
-
-// Function to check if a path starts with a specific prefix
-int path_starts_with(const char* path, const char* prefix) {
-    return strncmp(path, prefix, strlen(prefix)) == 0;
-}
-
-// Function to extract the echo string from path
-char* extract_echo_string(const char* path) {
-    static char echo_str[1024];
-    
-    // Skip "/echo/" prefix
-    const char* start = path + 6; // 6 is the length of "/echo/"
-    
-    // Copy the rest of the path
-    strcpy(echo_str, start);
-    
-    return echo_str;
-}
-
-// Function to extract the filename from a /files/ path
-char* extract_filename(const char* path) {
-    static char filename[1024];
-    
-    // Skip "/files/" prefix
-    const char* start = path + 7; // 7 is the length of "/files/"
-    
-    // Copy the rest of the path
-    strcpy(filename, start);
-    
-    return filename;
+    return 0;
 }
 
-// Function to extract a header value from an HTTP request
-char* extract_header_value(const char* request, const char* header_name) {
-    static char value[1024];
-    memset(value, 0, sizeof(value));
-    
-    // Create the header string to search for (case-insensitive)
-    char search_header[1024];
-    sprintf(search_header, "\r\n%s: ", header_name);
-    
-    // Convert search header to lowercase for case-insensitive search
-    for (int i = 0; search_header[i]; i++) {
-        search_header[i] = tolower(search_header[i]);
+// Function to send a response on a blocking socket, adding the bytes sent to total
+// Returns 0 once the response is complete and -1 when it was cut short, the connection must then close
+int send_response(int client_fd, struct http_response* res, uint64_t* total) {
+    // Send headers and in-memory body together, held back briefly when a file follows so they share a packet
+    uint64_t head_sent = 0;
+    while (head_sent < res->headers_len + res->body_len) {
+        struct iovec iov[2];
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = response_iovec(res, head_sent, iov);
+        ssize_t sent = sendmsg(client_fd, &msg, MSG_NOSIGNAL | (res->file_fd != -1 ? MSG_MORE : 0));
+        if (sent < 0 && errno == EINTR) {
+            continue;
+        }
+        if (sent <= 0) {
+            *total += head_sent;
+            return -1;
+        }
+        head_sent += sent;
     }
+    *total += head_sent;
     
-    // Create lowercase version of request for searching
-    char* lower_request = strdup(request);
-    for (int i = 0; lower_request[i]; i++) {
-        lower_request[i] = tolower(lower_request[i]);
+    // Send the file without copying it through user space, sendfile() blocks until it is queued
+    if (response_is_zero_copy(res)) {
+        ssize_t sent;
+        while ((sent = response_send_file(res, client_fd)) > 0 || (sent < 0 && errno == EINTR)) {
+            *total += sent_bytes(sent);
+        }
+        return sent == 0 ? 0 : -1;
     }
     
-    // Look for the header
-    char* header_pos = strstr(lower_request, search_header);
-    if (header_pos) {
-        // Calculate the position in the original request
-        int offset = header_pos - lower_request;
-        
-        // Get position after the header name and colon
-        const char* value_start = request + offset + strlen(search_header);
+    // Send the streamed body (compressed chunks, or file content when zero-copy is disabled)
+    // A chunk that does not go out whole would corrupt the framing, the rest is not even read
+    if (res->file_fd != -1) {
+        char body_buffer[16384];
+        ssize_t bytes_read;
         
-        // Find the end of the value (marked by CRLF)
-        const char* value_end = strstr(value_start, "\r\n");
-        if (value_end) {
-            // Calculate the value length
-            int value_length = value_end - value_start;
-            
-            // Extract the value
-            strncpy(value, value_start, value_length);
-            value[value_length] = '\0';
+        while ((bytes_read = response_read_body(res, body_buffer, sizeof(body_buffer))) > 0) {
+            if (send_all(client_fd, body_buffer, bytes_read, total) == -1) {
+                return -1;
+            }
         }
+        return bytes_read == 0 ? 0 : -1;
     }
-    
-    // Free the temporary lowercase request
-    free(lower_request);
-    
-    return value;
-}
-
-// Function to check if client supports gzip encoding
-int client_supports_gzip(const char* request) {
-    char* accept_encoding = extract_header_value(request, "Accept-Encoding");
-    
-    // Check if gzip is in the Accept-Encoding header
-    if (strstr(accept_encoding, "gzip") != NULL) {
-        return 1;
-    }
-    
     return 0;
 }
 
-// Function to extract the request body from an HTTP request
-char* extract_request_body(char* request, int* body_length) {
-    char* body_start = strstr(request, "\r\n\r\n");
-    if (body_start) {
-        body_start += 4; // Skip the \r\n\r\n
+// Function to receive an upload body on a blocking socket
+// buffer holds the body bytes read with the headers, bytes of the next request are left in it
+// Returns 0 once the body is complete and -1 when the client went away
+static int receive_upload(int client_fd, struct upload* up, char* buffer, size_t buffer_size, size_t* buffer_len) {
+    size_t used = upload_feed(up, buffer, *buffer_len);
+    *buffer_len -= used;
+    memmove(buffer, buffer + used, *buffer_len);
+    
+    while (!up->done) {
+        uint64_t started = monotonic_ms();
+        ssize_t received;
+        if (upload_wants_socket(up)) {
+            received = upload_receive(up, client_fd);
+        } else {
+            // Chunked bodies are decoded from the request buffer
+            received = read(client_fd, buffer, buffer_size);
+            if (received > 0) {
+                used = upload_feed(up, buffer, received);
+                *buffer_len = received - used;
+                memmove(buffer, buffer + used, *buffer_len);
+            }
+        }
         
-        // Get the Content-Length header
-        char* content_length_str = extract_header_value(request, "Content-Length");
-        if (content_length_str[0] != '\0') {
-            *body_length = atoi(content_length_str);
-            return body_start;
+        if (received == 0) {
+            return -1;
+        }
+        if (received > 0) {
+            __atomic_fetch_add(&worker_stats->bytes_received, received, __ATOMIC_RELAXED);
+        }
+        if (received < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            // splice() may not wait on the socket, wait here for what is left of the body timeout
+            struct pollfd pfd = { .fd = client_fd, .events = POLLIN };
+            if (errno != EAGAIN) {
+                return -1;
+            }
+            int64_t left_ms = body_timeout * 1000LL - (int64_t)(monotonic_ms() - started);
+            if (left_ms <= 0 || poll(&pfd, 1, left_ms) <= 0) {
+                __atomic_fetch_add(&worker_stats->timeouts[TIMEOUT_BODY], 1, __ATOMIC_RELAXED);
+                return -1;
+            }
         }
     }
-    
-    *body_length = 0;
-    return NULL;
+    return 0;
 }
 
-// Handler for SIGCHLD to reap child processes
-void handle_sigchld(int sig) {
-    // Reap all dead processes
-    while (waitpid(-1, NULL, WNOHANG) > 0);
+// Helper to bound the next blocking read on a client socket by a timeout
+// The header timeout runs until a deadline set on the first read of a request, returns -1 once it has passed
+static int set_read_timeout(int client_fd, int timeout, uint64_t* header_deadline) {
+    uint64_t timeout_ms = timeout_seconds(timeout) * 1000ULL;
+    if (timeout == TIMEOUT_HEADER) {
+        uint64_t now = monotonic_ms();
+        if (*header_deadline == 0) {
+            *header_deadline = now + timeout_ms;
+        }
+        if (now >= *header_deadline) {
+            return -1;
+        }
+        timeout_ms = *header_deadline - now;
+    }
+    struct timeval tv = { .tv_sec = timeout_ms / 1000, .tv_usec = (timeout_ms % 1000) * 1000 };
+    setsockopt(client_fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    return 0;
 }
 
 // Function to handle a client connection
-void handle_client(int client_fd) {
+// Every child counts into its parent's one stats slot, so its counters are updated atomically
+void handle_client(int client_fd, uint32_t admission_slot) {
     // Buffer to store the received HTTP request
     char buffer[4096] = {0};
+    size_t buffer_len = 0;
+    int requests_served = 0;
     
-    // Read the HTTP request
-    read(client_fd, buffer, sizeof(buffer) - 1);
-    printf("Received request:\n%s\n", buffer);
-    
-    // Extract the path from the request
-    char* path = extract_path(buffer);
-    printf("Extracted path: %s\n", path);
-    
-    // Check if client supports gzip
-    int supports_gzip = client_supports_gzip(buffer);
-    printf("Client supports gzip: %s\n", supports_gzip ? "Yes" : "No");
+    // A client that stops reading the response is dropped after the write timeout
+    struct timeval send_timeout = { .tv_sec = write_timeout, .tv_usec = 0 };
+    setsockopt(client_fd, SOL_SOCKET, SO_SNDTIMEO, &send_timeout, sizeof(send_timeout));
+    uint64_t header_deadline = 0;
     
-    // Check if it's a POST request
-    int is_post = is_post_request(buffer);
+    struct http_request req;
+    http_parser_init(&req);
+    struct request_metrics metrics;
+    memset(&metrics, 0, sizeof(metrics));
+    struct arena arena;
+    arena_init(&arena);
     
-    // Determine the appropriate response based on the path
-    if (strcmp(path, "/") == 0) {
-        // Root path - return 200 OK
-        const char *response = "HTTP/1.1 200 OK\r\n\r\n";
-        send(client_fd, response, strlen(response), 0);
-        printf("PID %d: Sent 200 OK response for root path\n", getpid());
-    } else if (path_starts_with(path, "/echo/")) {
-        // Echo endpoint
-        char* echo_str = extract_echo_string(path);
-        int echo_len = strlen(echo_str);
-        
-        if (supports_gzip) {
-            // Prepare buffers for compression - allocate enough space
-            // Simple gzip adds about 20 bytes of overhead
-            char* compressed_data = malloc(echo_len + 32);
-            
-            if (compressed_data == NULL) {
-                // Failed to allocate memory
-                const char *response = "HTTP/1.1 500 Internal Server Error\r\n\r\n";
-                send(client_fd, response, strlen(response), 0);
-                printf("PID %d: Failed to allocate memory for compression\n", getpid());
-            } else {
-                // Compress the echo string
-                unsigned long compressed_size = simple_gzip(compressed_data, echo_str, echo_len);
-                
-                if (compressed_size > 0) {
-                    // Create response with Content-Type, Content-Encoding, and correct Content-Length headers
-                    char response_headers[1024];
-                    sprintf(response_headers, 
-                            "HTTP/1.1 200 OK\r\nContent-Type: text/plain\r\nContent-Encoding: gzip\r\nContent-Length: %lu\r\n\r\n", 
-                            compressed_size);
-                    
-                    // Send headers
-                    send(client_fd, response_headers, strlen(response_headers), 0);
-                    
-                    // Send compressed data
-                    send(client_fd, compressed_data, compressed_size, 0);
-                    
-                    printf("PID %d: Sent gzip-compressed echo response with string: %s (original size: %d, compressed: %lu)\n", 
-                           getpid(), echo_str, echo_len, compressed_size);
-                } else {
-                    // Compression failed, fallback to uncompressed
-                    char response[2048];
-                    sprintf(response, "HTTP/1.1 200 OK\r\nContent-Type: text/plain\r\nContent-Length: %d\r\n\r\n%s", 
-                            echo_len, echo_str);
-                    send(client_fd, response, strlen(response), 0);
-                    printf("PID %d: Compression failed, sent uncompressed echo response: %s\n", getpid(), echo_str);
-                }
-                
-                // Free the compressed data buffer
-                free(compressed_data);
-            }
-        } else {
-            // Standard response without compression
-            char response[2048];
-            sprintf(response, "HTTP/1.1 200 OK\r\nContent-Type: text/plain\r\nContent-Length: %d\r\n\r\n%s", 
-                    echo_len, echo_str);
-            send(client_fd, response, strlen(response), 0);
-            printf("PID %d: Sent uncompressed echo response: %s\n", getpid(), echo_str);
+    while (1) {
+        if (buffer_len > 0) {
+            metrics_request_started(&metrics);
         }
-    } else if (strcmp(path, "/user-agent") == 0) {
-        // User-Agent endpoint
-        char* user_agent = extract_header_value(buffer, "User-Agent");
-        int user_agent_len = strlen(user_agent);
         
-        if (supports_gzip) {
-            // Prepare buffers for compression
-            char* compressed_data = malloc(user_agent_len + 32);
-            
-            if (compressed_data == NULL) {
-                // Failed to allocate memory
-                const char *response = "HTTP/1.1 500 Internal Server Error\r\n\r\n";
-                send(client_fd, response, strlen(response), 0);
-                printf("PID %d: Failed to allocate memory for compression\n", getpid());
-            } else {
-                // Compress the user agent string
-                unsigned long compressed_size = simple_gzip(compressed_data, user_agent, user_agent_len);
-                
-                if (compressed_size > 0) {
-                    // Create response with Content-Type, Content-Encoding, and correct Content-Length headers
-                    char response_headers[1024];
-                    sprintf(response_headers, 
-                            "HTTP/1.1 200 OK\r\nContent-Type: text/plain\r\nContent-Encoding: gzip\r\nContent-Length: %lu\r\n\r\n", 
-                            compressed_size);
-                    
-                    // Send headers
-                    send(client_fd, response_headers, strlen(response_headers), 0);
-                    
-                    // Send compressed data
-                    send(client_fd, compressed_data, compressed_size, 0);
-                    
-                    printf("PID %d: Sent gzip-compressed user-agent response: %s (original size: %d, compressed: %lu)\n", 
-                           getpid(), user_agent, user_agent_len, compressed_size);
-                } else {
-                    // Compression failed, fallback to uncompressed
-                    char response[2048];
-                    sprintf(response, "HTTP/1.1 200 OK\r\nContent-Type: text/plain\r\nContent-Length: %d\r\n\r\n%s", 
-                            user_agent_len, user_agent);
-                    send(client_fd, response, strlen(response), 0);
-                    printf("PID %d: Compression failed, sent uncompressed user-agent response: %s\n", getpid(), user_agent);
-                }
-                
-                // Free the compressed data buffer
-                free(compressed_data);
+        // Read until a complete request is buffered, the parser resumes where it stopped
+        int status = http_parse_request(&req, buffer, buffer_len);
+        int upload = status == HTTP_PARSE_DONE && request_is_upload(buffer, &req);
+        int ready = status == HTTP_PARSE_ERROR || upload
+                    || (status == HTTP_PARSE_DONE && (buffer_len >= http_request_length(&req) || req.chunked))
+                    || buffer_len == sizeof(buffer);
+        if (!ready) {
+            // Waiting for the next request is bounded by the keep-alive timeout, receiving it by the header timeout
+            int timeout = buffer_len == 0 && requests_served > 0 ? TIMEOUT_IDLE : TIMEOUT_HEADER;
+            if (set_read_timeout(client_fd, timeout, &header_deadline) == -1) {
+                __atomic_fetch_add(&worker_stats->timeouts[TIMEOUT_HEADER], 1, __ATOMIC_RELAXED);
+                break;
             }
-        } else {
-            // Standard response without compression
-            char response[2048];
-            sprintf(response, "HTTP/1.1 200 OK\r\nContent-Type: text/plain\r\nContent-Length: %d\r\n\r\n%s", 
-                    user_agent_len, user_agent);
-            send(client_fd, response, strlen(response), 0);
-            printf("PID %d: Sent user-agent response: %s\n", getpid(), user_agent);
+            ssize_t bytes_read = read(client_fd, buffer + buffer_len, sizeof(buffer) - buffer_len);
+            if (bytes_read < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                __atomic_fetch_add(&worker_stats->timeouts[timeout], 1, __ATOMIC_RELAXED);
+            }
+            if (bytes_read <= 0) {
+                break;
+            }
+            buffer_len += bytes_read;
+            __atomic_fetch_add(&worker_stats->bytes_received, bytes_read, __ATOMIC_RELAXED);
+            continue;
         }
-    } else if (path_starts_with(path, "/files/") && files_directory != NULL) {
-        // Files endpoint
-        char* filename = extract_filename(path);
         
-        // Create the full file path
-        char filepath[2048];
-        sprintf(filepath, "%s/%s", files_directory, filename);
+        // Build and send the response
+        struct http_response res;
+        res.arena = &arena;
+        int keep_alive;
+        requests_served++;
+        __atomic_fetch_add(&worker_stats->requests_handled, 1, __ATOMIC_RELAXED);
         
-        if (is_post) {
-            // POST request - create a new file
-            int body_length = 0;
-            char* body = extract_request_body(buffer, &body_length);
-            
-            if (body && body_length > 0) {
-                // Open file for writing
-                int fd = open(filepath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
-                if (fd == -1) {
-                    // Failed to create file
-                    const char *response = "HTTP/1.1 500 Internal Server Error\r\n\r\n";
-                    send(client_fd, response, strlen(response), 0);
-                    printf("PID %d: Failed to create file: %s\n", getpid(), filename);
-                } else {
-                    // Write the request body to the file
-                    write(fd, body, body_length);
-                    close(fd);
-                    
-                    // Return 201 Created
-                    const char *response = "HTTP/1.1 201 Created\r\n\r\n";
-                    send(client_fd, response, strlen(response), 0);
-                    printf("PID %d: Created file: %s (size: %d bytes)\n", getpid(), filename, body_length);
-                }
+        struct access_log_entry log;
+        int parsed = status == HTTP_PARSE_DONE;
+        access_log_begin(&log, buffer + req.method.offset, parsed ? req.method.length : 0,
+                         buffer + req.path.offset, parsed ? req.path.length : 0);
+        metrics_dispatched(&metrics, buffer, &req, parsed);
+        size_t request_len;
+        if (upload) {
+            // Stream the body to disk, only bytes of the next request are left in the buffer afterwards
+            keep_alive = request_wants_keep_alive(buffer, &req) && requests_served < max_keep_alive_requests;
+            int send_continue;
+            struct upload* up = start_upload(buffer, &req, &send_continue, &res);
+            if (up == NULL) {
+                keep_alive = 0;
+                request_len = buffer_len;
             } else {
-                // Bad request - missing or empty body
-                const char *response = "HTTP/1.1 400 Bad Request\r\n\r\n";
-                send(client_fd, response, strlen(response), 0);
-                printf("PID %d: Bad request - missing or empty body\n", getpid());
+                if (send_continue && buffer_len == req.header_length) {
+                    send(client_fd, "HTTP/1.1 100 Continue\r\n\r\n", 25, 0);
+                }
+                buffer_len -= req.header_length;
+                memmove(buffer, buffer + req.header_length, buffer_len);
+                struct timeval body_wait = { .tv_sec = body_timeout, .tv_usec = 0 };
+                setsockopt(client_fd, SOL_SOCKET, SO_RCVTIMEO, &body_wait, sizeof(body_wait));
+                if (receive_upload(client_fd, up, buffer, sizeof(buffer), &buffer_len) != 0) {
+                    upload_abort(up);
+                    break;
+                }
+                finish_upload(up, &keep_alive, &res);
+                request_len = 0;
             }
         } else {
-            // GET request - read file
-            int fd = open(filepath, O_RDONLY);
-            if (fd == -1) {
-                // File not found - return 404
-                const char *response = "HTTP/1.1 404 Not Found\r\n\r\n";
-                send(client_fd, response, strlen(response), 0);
-                printf("PID %d: Sent 404 Not Found response for file: %s\n", getpid(), filename);
-            } else {
-                // Get file size
-                struct stat file_stat;
-                fstat(fd, &file_stat);
-                off_t file_size = file_stat.st_size;
-                
-                if (supports_gzip && file_size > 0) {
-                    // Read the file content into memory
-                    char* file_content = malloc(file_size);
-                    if (file_content == NULL) {
-                        // Failed to allocate memory
-                        const char *response = "HTTP/1.1 500 Internal Server Error\r\n\r\n";
-                        send(client_fd, response, strlen(response), 0);
-                        printf("PID %d: Failed to allocate memory for file: %s\n", getpid(), filename);
-                        close(fd);
-                        return;
-                    }
-                    
-                    // Read file content
-                    ssize_t bytes_read = read(fd, file_content, file_size);
-                    close(fd);
-                    
-                    if (bytes_read != file_size) {
-                        // Failed to read the entire file
-                        const char *response = "HTTP/1.1 500 Internal Server Error\r\n\r\n";
-                        send(client_fd, response, strlen(response), 0);
-                        printf("PID %d: Failed to read entire file: %s\n", getpid(), filename);
-                        free(file_content);
-                        return;
-                    }
-                    
-                    // Prepare buffers for compression
-                    char* compressed_data = malloc(file_size + 32);
-                    
-                    if (compressed_data == NULL) {
-                        // Failed to allocate memory for compression
-                        const char *response = "HTTP/1.1 500 Internal Server Error\r\n\r\n";
-                        send(client_fd, response, strlen(response), 0);
-                        printf("PID %d: Failed to allocate memory for compression\n", getpid());
-                        free(file_content);
-                        return;
-                    }
-                    
-                    // Compress the file content
-                    unsigned long compressed_size = simple_gzip(compressed_data, file_content, file_size);
-                    
-                    if (compressed_size > 0) {
-                        // Create response with Content-Type, Content-Encoding, and correct Content-Length headers
-                        char response_headers[1024];
-                        sprintf(response_headers, 
-                                "HTTP/1.1 200 OK\r\nContent-Type: application/octet-stream\r\nContent-Encoding: gzip\r\nContent-Length: %lu\r\n\r\n", 
-                                compressed_size);
-                        
-                        // Send headers
-                        send(client_fd, response_headers, strlen(response_headers), 0);
-                        
-                        // Send compressed data
-                        send(client_fd, compressed_data, compressed_size, 0);
-                        
-                        printf("PID %d: Sent gzip-compressed file: %s (original size: %ld, compressed: %lu)\n", 
-                               getpid(), filename, file_size, compressed_size);
-                    } else {
-                        // Compression failed, fallback to uncompressed
-                        char response_headers[1024];
-                        sprintf(response_headers, 
-                                "HTTP/1.1 200 OK\r\nContent-Type: application/octet-stream\r\nContent-Length: %ld\r\n\r\n", 
-                                file_size);
-                        
-                        // Send headers
-                        send(client_fd, response_headers, strlen(response_headers), 0);
-                        
-                        // Send file content
-                        send(client_fd, file_content, file_size, 0);
-                        
-                        printf("PID %d: Compression failed, sent uncompressed file: %s (size: %ld bytes)\n", 
-                               getpid(), filename, file_size);
-                    }
-                    
-                    // Free memory
-                    free(file_content);
-                    free(compressed_data);
-                } else {
-                    // Standard response without compression
-                    char headers[1024];
-                    sprintf(headers, "HTTP/1.1 200 OK\r\nContent-Type: application/octet-stream\r\nContent-Length: %ld\r\n\r\n", 
-                            file_size);
-                    
-                    // Send headers
-                    send(client_fd, headers, strlen(headers), 0);
-                    
-                    // Send file content
-                    char file_buffer[4096];
-                    ssize_t bytes_read;
-                    
-                    while ((bytes_read = read(fd, file_buffer, sizeof(file_buffer))) > 0) {
-                        send(client_fd, file_buffer, bytes_read, 0);
-                    }
-                    
-                    // Close file
-                    close(fd);
-                    
-                    printf("PID %d: Sent file: %s (size: %ld bytes)\n", getpid(), filename, file_size);
-                }
+            request_len = respond_to_request(buffer, buffer_len, &req, requests_served, &keep_alive, &res);
+        }
+        metrics_handled(&metrics);
+        uint64_t bytes = 0;
+        if (send_response(client_fd, &res, &bytes) == -1) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                __atomic_fetch_add(&worker_stats->timeouts[TIMEOUT_WRITE], 1, __ATOMIC_RELAXED);
             }
+            keep_alive = 0;
         }
-    } else {
-        // Any other path - return 404 Not Found
-        const char *response = "HTTP/1.1 404 Not Found\r\n\r\n";
-        send(client_fd, response, strlen(response), 0);
-        printf("PID %d: Sent 404 Not Found response\n", getpid());
+        __atomic_fetch_add(&worker_stats->bytes_sent, bytes, __ATOMIC_RELAXED);
+        access_log_end(&log, response_status(&res), bytes);
+        metrics_request_done(&metrics, response_status(&res));
+        free_response(&res);
+        arena_reset(&arena);
+        
+        if (!keep_alive) {
+            break;
+        }
+        
+        // Keep pipelined bytes that arrived behind the request
+        buffer_len -= request_len;
+        memmove(buffer, buffer + request_len, buffer_len);
+        http_parser_init(&req);
+        header_deadline = 0;
     }
     
     // Close the client socket
     close(client_fd);
+    admission_release(admission_slot);
+    __atomic_fetch_sub(&worker_stats->active_connections, 1, __ATOMIC_RELAXED);
+    access_log_flush();
     exit(0);  // Child process exits after handling the request
 }
 
+// Function to accept connections and fork a child process for each one
+int run_fork_server(int server_fd) {
+    int client_fd;
+    socklen_t client_addr_len;
+    struct sockaddr_storage client_addr;
+    
+    while (1) {
+        // The child inherits the socket, CLOEXEC keeps it out of anything the child would exec
+        client_fd = accept_client(server_fd, &client_addr, &client_addr_len, SOCK_CLOEXEC);
+        if (client_fd < 0) {
+            printf("Accept failed: %s \n", strerror(errno));
+            continue;
+        }
+        
+        // Shed load in the parent, before a child is forked for the connection
+        uint32_t admission_slot;
+        if (admission_admit(client_fd, (struct sockaddr *) &client_addr, client_addr_len, &admission_slot) == -1) {
+            continue;
+        }
+        
+        log_debug("Client connected - spawning child process\n");
+        __atomic_fetch_add(&worker_stats->connections_accepted, 1, __ATOMIC_RELAXED);
+        
+        // Fork a child process to handle the client
+        pid_t pid = fork();
+        
+        if (pid < 0) {
+            // Fork failed
+            printf("Fork failed: %s\n", strerror(errno));
+            admission_release(admission_slot);
+            close(client_fd);
+            continue;
+        } else if (pid == 0) {
+            // Child process
+            close(server_fd);  // Child doesn't need the server socket
+            __atomic_fetch_add(&worker_stats->active_connections, 1, __ATOMIC_RELAXED);
+            handle_client(client_fd, admission_slot);
+            // Child process exits in handle_client function
+        } else {
+            // Parent process
+            close(client_fd);  // Parent doesn't need the client socket
+            log_debug("Created child process with PID: %d\n", pid);
+            // Parent continues to accept new connections
+        }
+    }
+    
+    return 0;
+}
+
 int main(int argc, char *argv[]) {
     // Disable output buffering
     setbuf(stdout, NULL);
@@ -569,15 +362,216 @@ int main(int argc, char *argv[]) {
     // You can use print statements as follows for debugging, they'll be visible when running tests.
     printf("Logs from your program will appear here!\n");
     
-    // Parse command line arguments for --directory flag
+    // Parse command line arguments
+    int use_fork_model = 0;
+    int worker_count = 1;
+    int pin_cpus = 0;
+    int stats_interval = 10;
     for (int i = 1; i < argc; i++) {
         if (strcmp(argv[i], "--directory") == 0 && i + 1 < argc) {
-            files_directory = argv[i + 1];
+            files_directory = argv[++i];
             printf("Directory for files set to: %s\n", files_directory);
-            break;
+        } else if (strncmp(argv[i], "--model=", 8) == 0) {
+            const char *model = argv[i] + 8;
+            if (strcmp(model, "fork") == 0) {
+                use_fork_model = 1;
+            } else if (strcmp(model, "epoll") == 0) {
+                use_fork_model = 0;
+                use_io_uring = 0;
+            } else if (strcmp(model, "uring") == 0) {
+                use_fork_model = 0;
+                use_io_uring = 1;
+            } else {
+                printf("Unknown server model: %s (expected fork, epoll or uring)\n", model);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--port") == 0 && i + 1 < argc) {
+            listener_config.port = atoi(argv[++i]);
+            if (listener_config.port < 1 || listener_config.port > 65535) {
+                printf("Invalid port: %s\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--bind") == 0 && i + 1 < argc) {
+            listener_config.bind_address = argv[++i];
+        } else if (strcmp(argv[i], "--ipv6-only") == 0) {
+            listener_config.ipv6_only = 1;
+        } else if (strcmp(argv[i], "--backlog") == 0 && i + 1 < argc) {
+            listener_config.backlog = atoi(argv[++i]);
+            if (listener_config.backlog < 1) {
+                printf("Invalid backlog: %s\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--defer-accept") == 0 && i + 1 < argc) {
+            listener_config.defer_accept = atoi(argv[++i]);
+            if (listener_config.defer_accept < 0) {
+                printf("Invalid defer accept timeout: %s\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--fastopen") == 0 && i + 1 < argc) {
+            listener_config.fastopen = atoi(argv[++i]);
+            if (listener_config.fastopen < 0) {
+                printf("Invalid fast open queue length: %s\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--no-nodelay") == 0) {
+            listener_config.nodelay = 0;
+        } else if (strcmp(argv[i], "--accept-batch") == 0 && i + 1 < argc) {
+            listener_config.accept_batch = atoi(argv[++i]);
+            if (listener_config.accept_batch < 0) {
+                printf("Invalid accept batch: %s\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--workers") == 0 && i + 1 < argc) {
+            worker_count = atoi(argv[++i]);
+            if (worker_count < 1) {
+                printf("Invalid worker count: %s\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--keep-alive-timeout") == 0 && i + 1 < argc) {
+            keep_alive_timeout = atoi(argv[++i]);
+            if (keep_alive_timeout < 1) {
+                printf("Invalid keep-alive timeout: %s\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--header-timeout") == 0 && i + 1 < argc) {
+            header_timeout = atoi(argv[++i]);
+            if (header_timeout < 1) {
+                printf("Invalid header timeout: %s\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--body-timeout") == 0 && i + 1 < argc) {
+            body_timeout = atoi(argv[++i]);
+            if (body_timeout < 1) {
+                printf("Invalid body timeout: %s\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--write-timeout") == 0 && i + 1 < argc) {
+            write_timeout = atoi(argv[++i]);
+            if (write_timeout < 1) {
+                printf("Invalid write timeout: %s\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--max-connections") == 0 && i + 1 < argc) {
+            max_connections = atoi(argv[++i]);
+            if (max_connections < 0) {
+                printf("Invalid connection limit: %s\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--max-connections-per-ip") == 0 && i + 1 < argc) {
+            max_connections_per_ip = atoi(argv[++i]);
+            if (max_connections_per_ip < 0) {
+                printf("Invalid per-IP connection limit: %s\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--max-requests") == 0 && i + 1 < argc) {
+            max_keep_alive_requests = atoi(argv[++i]);
+            if (max_keep_alive_requests < 1) {
+                printf("Invalid max requests per connection: %s\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--gzip-level") == 0 && i + 1 < argc) {
+            gzip_level = atoi(argv[++i]);
+            if (gzip_level < 0 || gzip_level > 9) {
+                printf("Invalid gzip level: %s (expected 0-9)\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--gzip-min-size") == 0 && i + 1 < argc) {
+            gzip_min_size = strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--gzip-cache-size") == 0 && i + 1 < argc) {
+            gzip_cache_budget = strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--gzip-static") == 0) {
+            gzip_static = 1;
+        } else if (strcmp(argv[i], "--file-cache-ttl") == 0 && i + 1 < argc) {
+            file_cache_ttl = atoi(argv[++i]);
+            if (file_cache_ttl < 0) {
+                printf("Invalid file cache TTL: %s\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--file-cache-entries") == 0 && i + 1 < argc) {
+            file_cache_max_entries = atoi(argv[++i]);
+            if (file_cache_max_entries < 0) {
+                printf("Invalid file cache size: %s\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--io-threads") == 0 && i + 1 < argc) {
+            io_pool_threads = atoi(argv[++i]);
+            if (io_pool_threads < 0) {
+                printf("Invalid I/O thread count: %s\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--io-queue") == 0 && i + 1 < argc) {
+            io_pool_queue_size = atoi(argv[++i]);
+            if (io_pool_queue_size < 1) {
+                printf("Invalid I/O queue size: %s\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--no-http2") == 0) {
+            http2_enabled = 0;
+        } else if (strcmp(argv[i], "--max-body-size") == 0 && i + 1 < argc) {
+            max_upload_size = strtoull(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--cache-control") == 0 && i + 1 < argc) {
+            if (add_cache_control_rule(argv[++i]) == -1) {
+                printf("Invalid Cache-Control rule: %s (expected <path prefix>=<value>)\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--log-level") == 0 && i + 1 < argc) {
+            const char *level = argv[++i];
+            if (strcmp(level, "error") == 0) {
+                log_level = LOG_ERROR;
+            } else if (strcmp(level, "info") == 0) {
+                log_level = LOG_INFO;
+            } else if (strcmp(level, "debug") == 0) {
+                log_level = LOG_DEBUG;
+            } else {
+                printf("Unknown log level: %s (expected error, info or debug)\n", level);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--access-log") == 0 && i + 1 < argc) {
+            access_log_path = argv[++i];
+        } else if (strcmp(argv[i], "--no-sendfile") == 0) {
+            zero_copy_files = 0;
+        } else if (strcmp(argv[i], "--pin-cpus") == 0) {
+            pin_cpus = 1;
+        } else if (strcmp(argv[i], "--stats-interval") == 0 && i + 1 < argc) {
+            stats_interval = atoi(argv[++i]);
+            if (stats_interval < 1) {
+                printf("Invalid stats interval: %s\n", argv[i]);
+                return 1;
+            }
         }
     }
     
+    if (use_fork_model && worker_count > 1) {
+        printf("--workers requires --model=epoll or --model=uring\n");
+        return 1;
+    }
+    
+    // Detected once here, workers inherit the decision
+    const char *uring_reason;
+    if (use_io_uring && !io_uring_available(&uring_reason)) {
+        printf("io_uring unavailable (%s), falling back to epoll\n", uring_reason);
+        use_io_uring = 0;
+    }
+    
+    // Pick the CRC32 implementation for gzip footers once, before any worker starts
+    crc32_init();
+    printf("CRC32 implementation: %s\n", crc32_implementation());
+    
+    // Same for the delimiter and header-name kernels of the request parser
+    http_scan_init();
+    printf("Header scanning: %s\n", http_scan_implementation());
+    
+    // Routes are matched through a trie built once from the route table
+    router_init();
+    
+    // Canonical Huffman code of HPACK, derived from the code lengths
+    hpack_init();
+    
+    // Open connections are counted in memory shared by every worker and fork-model child
+    if (admission_init() == -1) {
+        return 1;
+    }
+    
     // Set up signal handler for SIGCHLD to reap zombie processes
     struct sigaction sa;
     sa.sa_handler = handle_sigchld;
@@ -588,75 +582,58 @@ int main(int argc, char *argv[]) {
         exit(1);
     }
     
-    int server_fd, client_fd, client_addr_len;
-    struct sockaddr_in client_addr;
+    // sendfile()/splice() to a client that reset the connection raise SIGPIPE, handle EPIPE instead
+    signal(SIGPIPE, SIG_IGN);
     
-    server_fd = socket(AF_INET, SOCK_STREAM, 0);
-    if (server_fd == -1) {
-        printf("Socket creation failed: %s...\n", strerror(errno));
-        return 1;
+    // Every worker creates its listener from the same settings
+    print_listener_config();
+    
+    // Each epoll worker starts its own pool, io_uring already submits file operations asynchronously
+    // HTTP/2 is only spoken by the epoll engine, the others answer every request as HTTP/1.x
+    if (!use_fork_model && !use_io_uring) {
+        if (io_pool_threads > 0) {
+            printf("I/O pool: %d threads per worker, up to %d queued jobs\n", io_pool_threads, io_pool_queue_size);
+        } else {
+            printf("I/O pool: off, file-system calls run on the event loop\n");
+        }
+        printf("HTTP/2: %s\n", http2_enabled ? "h2c by prior knowledge or Upgrade" : "off");
     }
     
-    // Since the tester restarts your program quite often, setting SO_REUSEADDR
-    // ensures that we don't run into 'Address already in use' errors
-    int reuse = 1;
-    if (setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse)) < 0) {
-        printf("SO_REUSEADDR failed: %s \n", strerror(errno));
-        return 1;
+    // Multi-core mode: one event loop per worker, each with its own listener
+    if (worker_count > 1) {
+        printf("Starting %d workers%s. Waiting for connections...\n", worker_count, pin_cpus ? " pinned to CPUs" : "");
+        return run_workers(worker_count, pin_cpus, stats_interval);
     }
     
-    struct sockaddr_in serv_addr = { .sin_family = AF_INET ,
-                                     .sin_port = htons(4221),
-                                     .sin_addr = { htonl(INADDR_ANY) },
-                                    };
+    int server_fd = create_listener(0);
+    if (server_fd == -1) {
+        return 1;
+    }
     
-    if (bind(server_fd, (struct sockaddr *) &serv_addr, sizeof(serv_addr)) != 0) {
-        printf("Bind failed: %s \n", strerror(errno));
+    // Counters live in shared memory so fork-model children report to the process serving /metrics
+    if (map_worker_stats(1) == -1) {
         return 1;
     }
     
-    int connection_backlog = 5;
-    if (listen(server_fd, connection_backlog) != 0) {
-        printf("Listen failed: %s \n", strerror(errno));
+    // The event loop hands its access log to a writer thread, fork-model children write their own
+    if (access_log_start(0, !use_fork_model) == -1) {
         return 1;
     }
     
-    printf("Server started. Waiting for connections...\n");
+    printf("Server started (%s model). Waiting for connections...\n",
+           use_fork_model ? "fork" : use_io_uring ? "uring" : "epoll");
     
-    while (1) {
-        client_addr_len = sizeof(client_addr);
-        
-        client_fd = accept(server_fd, (struct sockaddr *) &client_addr, &client_addr_len);
-        if (client_fd < 0) {
-            printf("Accept failed: %s \n", strerror(errno));
-            continue;
-        }
-        
-        printf("Client connected - spawning child process\n");
-        
-        // Fork a child process to handle the client
-        pid_t pid = fork();
-        
-        if (pid < 0) {
-            // Fork failed
-            printf("Fork failed: %s\n", strerror(errno));
-            close(client_fd);
-            continue;
-        } else if (pid == 0) {
-            // Child process
-            close(server_fd);  // Child doesn't need the server socket
-            handle_client(client_fd);
-            // Child process exits in handle_client function
-        } else {
-            // Parent process
-            close(client_fd);  // Parent doesn't need the client socket
-            printf("Created child process with PID: %d\n", pid);
-            // Parent continues to accept new connections
-        }
+    int status;
+    if (use_fork_model) {
+        status = run_fork_server(server_fd);
+    } else if (use_io_uring) {
+        status = run_uring_loop(server_fd);
+    } else {
+        status = run_event_loop(server_fd);
     }
     
     // Close the server socket
     close(server_fd);
 
-    return 0;
-}
\ No newline at end of file
+    return status;
+}
@@ -0,0 +1,311 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "metrics.h"
+#include "http_parser.h"
+#include "workers.h"
+
+static const char* route_names[ROUTE_COUNT] = {
+    "root", "echo", "user-agent", "files-get", "files-post", "metrics", "other",
+};
+
+// Last slot counts every status not listed
+static const int status_codes[METRICS_STATUS_COUNT - 1] = {
+    200, 201, 206, 304, 400, 404, 405, 413, 416, 417, 431, 500,
+};
+
+static const char* phase_names[PHASE_COUNT] = { "parse", "handler", "send" };
+
+// Helper to map a status code to its counter
+static int status_index(int status) {
+    for (int i = 0; i < METRICS_STATUS_COUNT - 1; i++) {
+        if (status_codes[i] == status) {
+            return i;
+        }
+    }
+    return METRICS_STATUS_COUNT - 1;
+}
+
+// Helper to map a latency to its bucket: exact below 8us, then 8 sub-buckets per power of two
+static int bucket_index(uint64_t us) {
+    if (us < HISTOGRAM_SUB_BUCKETS) {
+        return us;
+    }
+    int exponent = 63 - __builtin_clzll(us);
+    int index = (exponent - 2) * HISTOGRAM_SUB_BUCKETS + ((us >> (exponent - 3)) & (HISTOGRAM_SUB_BUCKETS - 1));
+    return index < HISTOGRAM_BUCKETS ? index : HISTOGRAM_BUCKETS - 1;
+}
+
+// Helper to find the largest latency that lands in a bucket
+static uint64_t bucket_upper_bound(int index) {
+    if (index < HISTOGRAM_SUB_BUCKETS) {
+        return index;
+    }
+    int exponent = index / HISTOGRAM_SUB_BUCKETS + 2;
+    uint64_t sub = index % HISTOGRAM_SUB_BUCKETS;
+    return ((HISTOGRAM_SUB_BUCKETS + sub + 1) << (exponent - 3)) - 1;
+}
+
+// Helper to measure the time between two readings of the monotonic clock
+static uint64_t elapsed_us(const struct timespec* from, const struct timespec* to) {
+    int64_t us = (to->tv_sec - from->tv_sec) * 1000000 + (to->tv_nsec - from->tv_nsec) / 1000;
+    return us > 0 ? us : 0;
+}
+
+// Helper to add one sample to a histogram of the calling worker
+static void record_latency(struct latency_histogram* h, uint64_t us) {
+    h->buckets[bucket_index(us)]++;
+    h->count++;
+    h->sum_us += us;
+    if (us > h->max_us) {
+        h->max_us = us;
+    }
+}
+
+// Function to note the first byte of a request
+void metrics_request_started(struct request_metrics* m) {
+    if (m->started.tv_sec == 0 && m->started.tv_nsec == 0) {
+        clock_gettime(CLOCK_MONOTONIC, &m->started);
+    }
+}
+
+// Function to classify the request and note when it is dispatched
+void metrics_dispatched(struct request_metrics* m, const char* buffer, const struct http_request* req, int parsed) {
+    clock_gettime(CLOCK_MONOTONIC, &m->dispatched);
+    if (m->started.tv_sec == 0 && m->started.tv_nsec == 0) {
+        m->started = m->dispatched;
+    }
+    m->handled = m->dispatched;
+
+    m->route = ROUTE_OTHER;
+    if (parsed) {
+        struct route_match match;
+        route_request(buffer, req, &match);
+        m->route = match.route;
+    }
+}
+
+// Function to note that the response is ready to send
+void metrics_handled(struct request_metrics* m) {
+    clock_gettime(CLOCK_MONOTONIC, &m->handled);
+}
+
+// Function to count a completed request in the worker's own slot
+// Fork-model children all count into the one slot of their parent: the response counter is atomic, the latency
+// histograms are not and so approximate under the fork model
+void metrics_request_done(struct request_metrics* m, int status) {
+    struct timespec done;
+    clock_gettime(CLOCK_MONOTONIC, &done);
+
+    __atomic_fetch_add(&worker_stats->responses[m->route][status_index(status)], 1, __ATOMIC_RELAXED);
+    record_latency(&worker_stats->phases[PHASE_PARSE], elapsed_us(&m->started, &m->dispatched));
+    record_latency(&worker_stats->phases[PHASE_HANDLER], elapsed_us(&m->dispatched, &m->handled));
+    record_latency(&worker_stats->phases[PHASE_SEND], elapsed_us(&m->handled, &done));
+    memset(m, 0, sizeof(*m));
+}
+
+// Function to count how long an I/O pool job waited for a thread
+void metrics_io_job_done(const struct timespec* queued, const struct timespec* started) {
+    record_latency(&worker_stats->io_pool_wait, elapsed_us(queued, started));
+}
+
+// Helper to sum one counter over every worker slot
+#define SUM_SLOTS(field) ({ \
+    uint64_t total_ = 0; \
+    for (int w_ = 0; w_ < worker_stats_count; w_++) { \
+        total_ += __atomic_load_n(&all_worker_stats[w_].field, __ATOMIC_RELAXED); \
+    } \
+    total_; \
+})
+
+// Helper to write a counter or gauge with its help text
+static void write_metric(FILE* out, const char* name, const char* type, const char* help, double value) {
+    fprintf(out, "# HELP %s %s\n# TYPE %s %s\n%s %.17g\n", name, help, name, type, name, value);
+}
+
+// Helper to find the smallest bucket bound at or above a quantile of the merged histogram
+static uint64_t histogram_quantile(const struct latency_histogram* h, double q) {
+    uint64_t rank = (uint64_t)(q * h->count + 0.999999);
+    if (rank == 0) {
+        rank = 1;
+    }
+    uint64_t seen = 0;
+    for (int i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        seen += h->buckets[i];
+        if (seen >= rank) {
+            uint64_t bound = bucket_upper_bound(i);
+            return bound < h->max_us ? bound : h->max_us;
+        }
+    }
+    return h->max_us;
+}
+
+// Helper to add a worker's histogram to the merged one
+static void merge_histogram(struct latency_histogram* merged, const struct latency_histogram* h) {
+    for (int i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        merged->buckets[i] += __atomic_load_n(&h->buckets[i], __ATOMIC_RELAXED);
+    }
+    merged->count += __atomic_load_n(&h->count, __ATOMIC_RELAXED);
+    merged->sum_us += __atomic_load_n(&h->sum_us, __ATOMIC_RELAXED);
+    uint64_t max_us = __atomic_load_n(&h->max_us, __ATOMIC_RELAXED);
+    if (max_us > merged->max_us) {
+        merged->max_us = max_us;
+    }
+}
+
+// Function to render the counters of every worker, merged at scrape time
+char* metrics_render(size_t* len) {
+    char* body = NULL;
+    FILE* out = open_memstream(&body, len);
+    if (out == NULL) {
+        return NULL;
+    }
+
+    fprintf(out, "# HELP http_requests_total Requests answered, by route and status\n");
+    fprintf(out, "# TYPE http_requests_total counter\n");
+    for (int route = 0; route < ROUTE_COUNT; route++) {
+        for (int status = 0; status < METRICS_STATUS_COUNT; status++) {
+            uint64_t count = SUM_SLOTS(responses[route][status]);
+            if (count == 0) {
+                continue;
+            }
+            if (status < METRICS_STATUS_COUNT - 1) {
+                fprintf(out, "http_requests_total{route=\"%s\",status=\"%d\"} %lu\n",
+                        route_names[route], status_codes[status], (unsigned long)count);
+            } else {
+                fprintf(out, "http_requests_total{route=\"%s\",status=\"other\"} %lu\n",
+                        route_names[route], (unsigned long)count);
+            }
+        }
+    }
+
+    write_metric(out, "http_connections_accepted_total", "counter", "Connections accepted",
+                 SUM_SLOTS(connections_accepted));
+    write_metric(out, "http_active_connections", "gauge", "Connections currently open",
+                 SUM_SLOTS(active_connections));
+    write_metric(out, "http_received_bytes_total", "counter", "Request bytes read, upload bodies included",
+                 SUM_SLOTS(bytes_received));
+    write_metric(out, "http_sent_bytes_total", "counter", "Response bytes sent, headers included",
+                 SUM_SLOTS(bytes_sent));
+
+    static const char* limit_names[LIMIT_COUNT] = { "global", "per_ip" };
+    fprintf(out, "# HELP http_connections_rejected_total Connections answered with 503 at accept, by limit\n");
+    fprintf(out, "# TYPE http_connections_rejected_total counter\n");
+    for (int limit = 0; limit < LIMIT_COUNT; limit++) {
+        fprintf(out, "http_connections_rejected_total{limit=\"%s\"} %lu\n", limit_names[limit],
+                (unsigned long)SUM_SLOTS(connections_rejected[limit]));
+    }
+    static const char* timeout_names[TIMEOUT_COUNT] = { "idle", "header", "body", "write" };
+    fprintf(out, "# HELP http_timeouts_total Connections closed by a timeout, by phase\n");
+    fprintf(out, "# TYPE http_timeouts_total counter\n");
+    for (int timeout = 0; timeout < TIMEOUT_COUNT; timeout++) {
+        fprintf(out, "http_timeouts_total{phase=\"%s\"} %lu\n", timeout_names[timeout],
+                (unsigned long)SUM_SLOTS(timeouts[timeout]));
+    }
+
+    uint64_t file_hits = SUM_SLOTS(file_cache_hits);
+    uint64_t file_misses = SUM_SLOTS(file_cache_misses);
+    write_metric(out, "file_cache_hits_total", "counter", "File opens answered from the file cache", file_hits);
+    write_metric(out, "file_cache_misses_total", "counter", "File opens that went to the filesystem", file_misses);
+    write_metric(out, "file_cache_hit_ratio", "gauge", "Share of file opens answered from the cache",
+                 file_hits + file_misses ? (double)file_hits / (file_hits + file_misses) : 0);
+
+    uint64_t gzip_hits = SUM_SLOTS(gzip_cache_hits);
+    uint64_t gzip_misses = SUM_SLOTS(gzip_cache_misses);
+    write_metric(out, "gzip_cache_hits_total", "counter", "Compressed files served from the gzip cache", gzip_hits);
+    write_metric(out, "gzip_cache_misses_total", "counter", "Compressed files not in the gzip cache", gzip_misses);
+    write_metric(out, "gzip_cache_hit_ratio", "gauge", "Share of compressed files served from the cache",
+                 gzip_hits + gzip_misses ? (double)gzip_hits / (gzip_hits + gzip_misses) : 0);
+    write_metric(out, "gzip_cache_evictions_total", "counter", "Entries evicted from the gzip cache",
+                 SUM_SLOTS(gzip_cache_evictions));
+    write_metric(out, "gzip_cache_bytes", "gauge", "Memory held by the gzip caches", SUM_SLOTS(gzip_cache_bytes));
+    write_metric(out, "gzip_static_hits_total", "counter", "Responses served from a precompressed .gz sidecar",
+                 SUM_SLOTS(gzip_static_hits));
+
+    uint64_t gzip_in = SUM_SLOTS(gzip_input_bytes);
+    uint64_t gzip_out = SUM_SLOTS(gzip_output_bytes);
+    write_metric(out, "gzip_input_bytes_total", "counter", "Bytes fed to the compressor", gzip_in);
+    write_metric(out, "gzip_output_bytes_total", "counter", "Bytes produced by the compressor", gzip_out);
+    write_metric(out, "gzip_compression_ratio", "gauge", "Compressor input bytes per output byte",
+                 gzip_out ? (double)gzip_in / gzip_out : 0);
+
+    write_metric(out, "io_buffer_slabs", "gauge", "Slabs carved for the I/O buffer pools",
+                 SUM_SLOTS(io_buffer_slabs));
+    write_metric(out, "arena_large_allocations_total", "counter", "Request allocations too big for an arena block",
+                 SUM_SLOTS(arena_large_allocations));
+
+    // Histograms are merged bucket by bucket, then reported as quantiles
+    static const double quantiles[] = { 0.5, 0.9, 0.99, 0.999 };
+    fprintf(out, "# HELP http_request_phase_seconds Time spent in each phase of a request\n");
+    fprintf(out, "# TYPE http_request_phase_seconds summary\n");
+    for (int phase = 0; phase < PHASE_COUNT; phase++) {
+        struct latency_histogram merged;
+        memset(&merged, 0, sizeof(merged));
+        for (int w = 0; w < worker_stats_count; w++) {
+            merge_histogram(&merged, &all_worker_stats[w].phases[phase]);
+        }
+
+        for (size_t q = 0; q < sizeof(quantiles) / sizeof(quantiles[0]); q++) {
+            fprintf(out, "http_request_phase_seconds{phase=\"%s\",quantile=\"%g\"} %.6f\n", phase_names[phase],
+                    quantiles[q], merged.count ? histogram_quantile(&merged, quantiles[q]) / 1e6 : 0);
+        }
+        fprintf(out, "http_request_phase_seconds_sum{phase=\"%s\"} %.6f\n", phase_names[phase], merged.sum_us / 1e6);
+        fprintf(out, "http_request_phase_seconds_count{phase=\"%s\"} %lu\n", phase_names[phase],
+                (unsigned long)merged.count);
+        fprintf(out, "http_request_phase_seconds_max{phase=\"%s\"} %.6f\n", phase_names[phase],
+                merged.max_us / 1e6);
+    }
+
+    // Saturation of the I/O pools: depth near the queue size, a growing wait and saturated steps
+    write_metric(out, "io_pool_jobs_total", "counter", "Blocking steps completed by the I/O pools",
+                 SUM_SLOTS(io_pool_jobs));
+    write_metric(out, "io_pool_saturated_total", "counter", "Blocking steps run on the event loop as the pool was full",
+                 SUM_SLOTS(io_pool_saturated));
+    write_metric(out, "io_pool_queue_depth", "gauge", "Blocking steps queued or running in the I/O pools",
+                 SUM_SLOTS(io_pool_queue_depth));
+    uint64_t deepest = 0;
+    for (int w = 0; w < worker_stats_count; w++) {
+        uint64_t depth = __atomic_load_n(&all_worker_stats[w].io_pool_queue_max, __ATOMIC_RELAXED);
+        deepest = depth > deepest ? depth : deepest;
+    }
+    write_metric(out, "io_pool_queue_depth_max", "gauge", "Deepest any worker's I/O pool has been", deepest);
+
+    struct latency_histogram wait;
+    memset(&wait, 0, sizeof(wait));
+    for (int w = 0; w < worker_stats_count; w++) {
+        merge_histogram(&wait, &all_worker_stats[w].io_pool_wait);
+    }
+    fprintf(out, "# HELP io_pool_wait_seconds Time a blocking step waited for an I/O pool thread\n");
+    fprintf(out, "# TYPE io_pool_wait_seconds summary\n");
+    for (size_t q = 0; q < sizeof(quantiles) / sizeof(quantiles[0]); q++) {
+        fprintf(out, "io_pool_wait_seconds{quantile=\"%g\"} %.6f\n", quantiles[q],
+                wait.count ? histogram_quantile(&wait, quantiles[q]) / 1e6 : 0);
+    }
+    fprintf(out, "io_pool_wait_seconds_sum %.6f\n", wait.sum_us / 1e6);
+    fprintf(out, "io_pool_wait_seconds_count %lu\n", (unsigned long)wait.count);
+    fprintf(out, "io_pool_wait_seconds_max %.6f\n", wait.max_us / 1e6);
+
+    // HTTP/2: streams per connection show how much multiplexing the clients do
+    write_metric(out, "http2_connections_total", "counter", "Connections served over HTTP/2 cleartext",
+                 SUM_SLOTS(http2_connections));
+    write_metric(out, "http2_streams_total", "counter", "Requests received as HTTP/2 streams",
+                 SUM_SLOTS(http2_streams));
+    write_metric(out, "http2_streams_refused_total", "counter", "HTTP/2 streams refused above the concurrency limit",
+                 SUM_SLOTS(http2_streams_refused));
+
+    // Per-worker load, to spot an unbalanced SO_REUSEPORT spread
+    fprintf(out, "# HELP worker_requests_total Requests handled by each worker\n");
+    fprintf(out, "# TYPE worker_requests_total counter\n");
+    for (int w = 0; w < worker_stats_count; w++) {
+        fprintf(out, "worker_requests_total{worker=\"%d\",pid=\"%d\"} %lu\n", w, all_worker_stats[w].pid,
+                (unsigned long)__atomic_load_n(&all_worker_stats[w].requests_handled, __ATOMIC_RELAXED));
+    }
+
+    if (fclose(out) != 0) {
+        free(body);
+        return NULL;
+    }
+    return body;
+}
@@ -0,0 +1,61 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "router.h"
+
+// Status codes the server answers with, anything else is counted as "other"
+#define METRICS_STATUS_COUNT 13
+
+// Request phases with a latency histogram
+enum metrics_phase {
+    PHASE_PARSE,                    // First byte of the request read -> request dispatched
+    PHASE_HANDLER,                  // Dispatched -> response built (upload bodies included)
+    PHASE_SEND,                     // Response built -> last byte handed to the kernel
+    PHASE_COUNT
+};
+
+// Log-linear buckets in microseconds, 8 per power of two (about 12% precision) up to hours
+#define HISTOGRAM_SUB_BUCKETS 8
+#define HISTOGRAM_BUCKETS 256
+
+struct latency_histogram {
+    uint64_t buckets[HISTOGRAM_BUCKETS];
+    uint64_t count;
+    uint64_t sum_us;
+    uint64_t max_us;
+};
+
+// Timestamps of the request a connection is working on
+struct request_metrics {
+    struct timespec started;        // Zero until the first byte of the request is buffered
+    struct timespec dispatched;
+    struct timespec handled;
+    int route;
+};
+
+struct http_request;
+
+// Note that bytes of a new request are buffered, only the first call per request counts
+void metrics_request_started(struct request_metrics* m);
+
+// Record the route of a request about to be answered, parsed is 0 when the request could not be parsed
+void metrics_dispatched(struct request_metrics* m, const char* buffer, const struct http_request* req, int parsed);
+
+// Note that the response is built and sending starts
+void metrics_handled(struct request_metrics* m);
+
+// Count the answered request and its phases in the worker's slot, and reset m for the next request
+void metrics_request_done(struct request_metrics* m, int status);
+
+// Count the time an I/O pool job waited in the queue, loop thread only
+void metrics_io_job_done(const struct timespec* queued, const struct timespec* started);
+
+// Render every worker's counters, aggregated, in the Prometheus text format
+// Returns a malloc'd body and its length in *len, or NULL when out of memory
+char* metrics_render(size_t* len);
+
+#endif
@@ -0,0 +1,138 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+
+#include "range.h"
+
+// Helper to skip optional whitespace
+static const char* skip_ows(const char* p, const char* end) {
+    while (p < end && (*p == ' ' || *p == '\t')) {
+        p++;
+    }
+    return p;
+}
+
+// Helper to parse a decimal position, returns -1 when there are no digits or it overflows
+static off_t parse_position(const char** p, const char* end) {
+    off_t value = 0;
+    const char* start = *p;
+    while (*p < end && **p >= '0' && **p <= '9') {
+        if (value > INT64_MAX / 10 - 1) {
+            return -1;
+        }
+        value = value * 10 + (**p - '0');
+        (*p)++;
+    }
+    return *p == start ? -1 : value;
+}
+
+// Helper to order ranges by their first byte
+static int compare_ranges(const void* a, const void* b) {
+    off_t start_a = ((const struct byte_range*)a)->start;
+    off_t start_b = ((const struct byte_range*)b)->start;
+    return (start_a > start_b) - (start_a < start_b);
+}
+
+// Helper to merge overlapping and adjacent ranges, which would send the same bytes twice
+static int coalesce_ranges(struct byte_range* ranges, int count) {
+    int overlap = 0;
+    for (int i = 0; i < count && !overlap; i++) {
+        for (int j = i + 1; j < count; j++) {
+            if (ranges[i].start <= ranges[j].end && ranges[j].start <= ranges[i].end) {
+                overlap = 1;
+                break;
+            }
+        }
+    }
+    if (!overlap) {
+        return count;
+    }
+
+    qsort(ranges, count, sizeof(ranges[0]), compare_ranges);
+    int merged = 0;
+    for (int i = 1; i < count; i++) {
+        if (ranges[i].start <= ranges[merged].end) {
+            if (ranges[i].end > ranges[merged].end) {
+                ranges[merged].end = ranges[i].end;
+            }
+        } else {
+            ranges[++merged] = ranges[i];
+        }
+    }
+    return merged + 1;
+}
+
+// Function to parse "bytes=first-last, first-, -suffix, ..."
+int parse_byte_ranges(const char* value, size_t len, off_t size, struct byte_range* ranges, int max) {
+    const char* p = value;
+    const char* end = value + len;
+
+    if (len < 6 || strncasecmp(p, "bytes=", 6) != 0) {
+        return -1;
+    }
+    p += 6;
+
+    int count = 0;
+    int specs = 0;
+    while (p < end) {
+        p = skip_ows(p, end);
+        if (p < end && *p == ',') {
+            // Empty list elements are allowed
+            p++;
+            continue;
+        }
+        if (p == end) {
+            break;
+        }
+
+        off_t first;
+        off_t last;
+        if (*p == '-') {
+            // Suffix range: the last N bytes
+            p++;
+            off_t suffix = parse_position(&p, end);
+            if (suffix < 0) {
+                return -1;
+            }
+            first = suffix < size ? size - suffix : 0;
+            last = suffix > 0 ? size - 1 : -1;
+        } else {
+            first = parse_position(&p, end);
+            if (first < 0 || p == end || *p != '-') {
+                return -1;
+            }
+            p++;
+            if (p < end && *p >= '0' && *p <= '9') {
+                last = parse_position(&p, end);
+                if (last < 0 || last < first) {
+                    return -1;
+                }
+            } else {
+                last = size - 1;
+            }
+        }
+
+        p = skip_ows(p, end);
+        if (p < end && *p != ',') {
+            return -1;
+        }
+
+        // Too many ranges is not worth the framing, the whole file is cheaper
+        if (++specs > max) {
+            return -1;
+        }
+
+        // Unsatisfiable ranges are dropped, the request fails only when none is left
+        if (first < size && last >= first) {
+            ranges[count].start = first;
+            ranges[count].end = (last < size ? last : size - 1) + 1;
+            count++;
+        }
+    }
+
+    if (specs == 0) {
+        return -1;
+    }
+    return coalesce_ranges(ranges, count);
+}
@@ -0,0 +1,22 @@
+#ifndef RANGE_H
+#define RANGE_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+// Ranges served in one multipart/byteranges response, longer range sets get the whole file
+#define MAX_BYTE_RANGES 16
+
+// Satisfiable byte range of a file, end is exclusive
+struct byte_range {
+    off_t start;
+    off_t end;
+};
+
+// Parse the value of a Range header for a file of the given size
+// Overlapping and adjacent ranges are merged, the rest keep the order they were asked in
+// Returns the number of ranges stored, 0 when none is satisfiable (416), and -1 when the
+// header is not a byte range set the server honours, the whole file is then sent
+int parse_byte_ranges(const char* value, size_t len, off_t size, struct byte_range* ranges, int max);
+
+#endif
@@ -0,0 +1,178 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "router.h"
+
+// Methods a route can be registered for, any other method gets 405 on a known path
+#define METHOD(name) { name, sizeof(name) - 1 }
+
+static const struct {
+    const char* name;
+    size_t len;
+} methods[] = {
+    METHOD("GET"), METHOD("HEAD"), METHOD("POST"), METHOD("PUT"), METHOD("DELETE"), METHOD("OPTIONS"), METHOD("PATCH"),
+};
+
+#define METHOD_COUNT (int)(sizeof(methods) / sizeof(methods[0]))
+
+// Registered routes: a pattern ending in "{name}" is parameterized and matches any rest of the path,
+// including an empty one, any other pattern matches exactly
+static const struct {
+    const char* method;
+    const char* pattern;
+    int route;
+} route_table[] = {
+    { "GET",  "/",              ROUTE_ROOT },
+    { "GET",  "/echo/{text}",   ROUTE_ECHO },
+    { "GET",  "/user-agent",    ROUTE_USER_AGENT },
+    { "GET",  "/metrics",       ROUTE_METRICS },
+    { "GET",  "/files/{name}",  ROUTE_FILES_GET },
+    { "POST", "/files/{name}",  ROUTE_FILES_POST },
+};
+
+#define ROUTE_TABLE_SIZE (sizeof(route_table) / sizeof(route_table[0]))
+
+// Routes reachable at one point of the trie, per method
+struct route_endpoint {
+    int8_t routes[METHOD_COUNT];    // -1 when the method is not allowed
+    char allow[48];                 // Allowed methods for the Allow header, empty when no route ends here
+};
+
+// One path byte, children are a linked list as the fan-out is a handful of bytes at most
+struct trie_node {
+    char c;
+    uint16_t child;                 // First child, 0 for none (the root is never a child)
+    uint16_t sibling;
+    struct route_endpoint exact;    // The path ends at this byte
+    struct route_endpoint param;    // The path goes on, the rest is the parameter
+};
+
+#define MAX_TRIE_NODES 256
+
+static struct trie_node nodes[MAX_TRIE_NODES];
+static int node_count = 0;
+
+// Helper to look up the index of a method, -1 for one no route can be registered for
+static int method_index(const char* method, size_t len) {
+    for (int i = 0; i < METHOD_COUNT; i++) {
+        if (methods[i].len == len && memcmp(methods[i].name, method, len) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// Helper to reset an endpoint to "no route"
+static void init_endpoint(struct route_endpoint* endpoint) {
+    memset(endpoint->routes, -1, sizeof(endpoint->routes));
+    endpoint->allow[0] = '\0';
+}
+
+// Helper to allocate a trie node
+static uint16_t new_node(char c) {
+    if (node_count == MAX_TRIE_NODES) {
+        printf("Route table too large for %d trie nodes\n", MAX_TRIE_NODES);
+        exit(1);
+    }
+    struct trie_node* node = &nodes[node_count];
+    node->c = c;
+    node->child = 0;
+    node->sibling = 0;
+    init_endpoint(&node->exact);
+    init_endpoint(&node->param);
+    return node_count++;
+}
+
+// Helper to find or add the child of a node for a byte
+static uint16_t child_for(uint16_t parent, char c) {
+    for (uint16_t child = nodes[parent].child; child != 0; child = nodes[child].sibling) {
+        if (nodes[child].c == c) {
+            return child;
+        }
+    }
+    uint16_t child = new_node(c);
+    nodes[child].sibling = nodes[parent].child;
+    nodes[parent].child = child;
+    return child;
+}
+
+// Helper to register a method on an endpoint and list it in the Allow value
+static void add_to_endpoint(struct route_endpoint* endpoint, int method, int route) {
+    endpoint->routes[method] = route;
+    size_t used = strlen(endpoint->allow);
+    snprintf(endpoint->allow + used, sizeof(endpoint->allow) - used, "%s%s", used > 0 ? ", " : "",
+             methods[method].name);
+}
+
+// Function to build the trie from the route table
+void router_init() {
+    node_count = 0;
+    new_node('\0');
+
+    for (size_t i = 0; i < ROUTE_TABLE_SIZE; i++) {
+        const char* pattern = route_table[i].pattern;
+        const char* param = strchr(pattern, '{');
+        size_t literal_len = param != NULL ? (size_t)(param - pattern) : strlen(pattern);
+
+        uint16_t node = 0;
+        for (size_t j = 0; j < literal_len; j++) {
+            node = child_for(node, pattern[j]);
+        }
+        int method = method_index(route_table[i].method, strlen(route_table[i].method));
+        add_to_endpoint(param != NULL ? &nodes[node].param : &nodes[node].exact, method, route_table[i].route);
+    }
+}
+
+// Function to match a request, the longest matching route wins and an exact match beats a parameter
+void route_request(const char* buffer, const struct http_request* req, struct route_match* match) {
+    match->route = ROUTE_OTHER;
+    match->status = 404;
+    match->allow = NULL;
+    match->param.offset = req->path.offset + req->path.length;
+    match->param.length = 0;
+
+    const char* path = buffer + req->path.offset;
+    size_t len = req->path.length;
+    const struct route_endpoint* found = NULL;
+    size_t param_start = 0;
+
+    uint16_t node = 0;
+    for (size_t i = 0; ; i++) {
+        if (nodes[node].param.allow[0] != '\0') {
+            found = &nodes[node].param;
+            param_start = i;
+        }
+        if (i == len) {
+            if (nodes[node].exact.allow[0] != '\0') {
+                found = &nodes[node].exact;
+                param_start = len;
+            }
+            break;
+        }
+
+        uint16_t child = nodes[node].child;
+        while (child != 0 && nodes[child].c != path[i]) {
+            child = nodes[child].sibling;
+        }
+        if (child == 0) {
+            break;
+        }
+        node = child;
+    }
+    if (found == NULL) {
+        return;
+    }
+
+    match->param.offset = req->path.offset + param_start;
+    match->param.length = len - param_start;
+    int method = method_index(buffer + req->method.offset, req->method.length);
+    if (method == -1 || found->routes[method] == -1) {
+        match->status = 405;
+        match->allow = found->allow;
+        return;
+    }
+    match->route = found->routes[method];
+    match->status = 0;
+}
@@ -0,0 +1,32 @@
+#ifndef ROUTER_H
+#define ROUTER_H
+
+#include "http_parser.h"
+
+// Endpoints of the server, requests are also counted under these in the metrics
+enum route {
+    ROUTE_ROOT,
+    ROUTE_ECHO,
+    ROUTE_USER_AGENT,
+    ROUTE_FILES_GET,
+    ROUTE_FILES_POST,
+    ROUTE_METRICS,
+    ROUTE_OTHER,                    // Unknown paths, methods a path does not allow and unparsable requests
+    ROUTE_COUNT
+};
+
+// What a request matched
+struct route_match {
+    int route;                      // ROUTE_OTHER when nothing matched
+    int status;                     // 0 on a match, 404 for an unknown path, 405 for a method it does not allow
+    const char* allow;              // Methods the path allows, for the Allow header of a 405
+    struct http_slice param;        // Rest of the path behind a parameterized route, e.g. <text> of /echo/<text>
+};
+
+// Build the route trie from the route table, called once at startup
+void router_init();
+
+// Match the method and path of a parsed request, one walk down the trie
+void route_request(const char* buffer, const struct http_request* req, struct route_match* match);
+
+#endif
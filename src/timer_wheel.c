@@ -0,0 +1,170 @@
+#include <stddef.h>
+#include <time.h>
+
+#include "timer_wheel.h"
+
+#define SLOT_MASK (TIMER_WHEEL_SLOTS - 1)
+
+// Longest delay the wheel can hold, in ticks
+#define MAX_DELAY (((uint64_t)1 << (TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS)) - 1)
+
+// Helper to empty a list head
+static void list_init(struct timer* head) {
+    head->prev = head;
+    head->next = head;
+}
+
+// Helper to unlink a timer from whatever list it is in
+static void list_unlink(struct timer* timer) {
+    timer->prev->next = timer->next;
+    timer->next->prev = timer->prev;
+    timer->prev = NULL;
+    timer->next = NULL;
+}
+
+// Helper to append a timer to a list
+static void list_append(struct timer* head, struct timer* timer) {
+    timer->prev = head->prev;
+    timer->next = head;
+    head->prev->next = timer;
+    head->prev = timer;
+}
+
+// Helper to move every timer of a list to another, empty one
+static void list_move(struct timer* from, struct timer* to) {
+    list_init(to);
+    if (from->next == from) {
+        return;
+    }
+    to->next = from->next;
+    to->prev = from->prev;
+    to->next->prev = to;
+    to->prev->next = to;
+    list_init(from);
+}
+
+// Helper to put a timer in the slot of the lowest level whose range covers its deadline
+static void place_timer(struct timer_wheel* wheel, struct timer* timer) {
+    if (timer->expires < wheel->next_tick) {
+        timer->expires = wheel->next_tick;
+    }
+    uint64_t delay = timer->expires - wheel->next_tick;
+    if (delay > MAX_DELAY) {
+        delay = MAX_DELAY;
+        timer->expires = wheel->next_tick + MAX_DELAY;
+    }
+
+    int level = 0;
+    while (level < TIMER_WHEEL_LEVELS - 1 && delay >= (uint64_t)1 << (TIMER_WHEEL_BITS * (level + 1))) {
+        level++;
+    }
+    int slot = (timer->expires >> (TIMER_WHEEL_BITS * level)) & SLOT_MASK;
+    list_append(&wheel->slots[level][slot], timer);
+}
+
+// Helper to spread the timers of a higher-level slot over the levels below, returns the slot index
+static int cascade(struct timer_wheel* wheel, int level) {
+    int slot = (wheel->next_tick >> (TIMER_WHEEL_BITS * level)) & SLOT_MASK;
+    struct timer moved;
+    list_move(&wheel->slots[level][slot], &moved);
+    while (moved.next != &moved) {
+        struct timer* timer = moved.next;
+        list_unlink(timer);
+        place_timer(wheel, timer);
+    }
+    return slot;
+}
+
+// Function to start an empty wheel
+void timer_wheel_init(struct timer_wheel* wheel, uint64_t now_ms) {
+    wheel->next_tick = 0;
+    wheel->start_ms = now_ms;
+    wheel->pending = 0;
+    for (int level = 0; level < TIMER_WHEEL_LEVELS; level++) {
+        for (int slot = 0; slot < TIMER_WHEEL_SLOTS; slot++) {
+            list_init(&wheel->slots[level][slot]);
+        }
+    }
+}
+
+// Function to prepare a timer
+void timer_init(struct timer* timer) {
+    timer->prev = NULL;
+    timer->next = NULL;
+    timer->expires = 0;
+    timer->kind = 0;
+}
+
+// Function to check whether a timer is pending
+int timer_pending(const struct timer* timer) {
+    return timer->next != NULL;
+}
+
+// Function to (re)start a timer
+void timer_set(struct timer_wheel* wheel, struct timer* timer, uint64_t timeout_ms, int kind) {
+    if (timer_pending(timer)) {
+        list_unlink(timer);
+    } else {
+        wheel->pending++;
+    }
+    timer->expires = wheel->next_tick + (timeout_ms + TIMER_TICK_MS - 1) / TIMER_TICK_MS;
+    timer->kind = kind;
+    place_timer(wheel, timer);
+}
+
+// Function to stop a timer
+void timer_cancel(struct timer_wheel* wheel, struct timer* timer) {
+    if (timer_pending(timer)) {
+        list_unlink(timer);
+        wheel->pending--;
+    }
+}
+
+// Function to process the ticks up to now, firing the timers that are due
+void timer_wheel_advance(struct timer_wheel* wheel, uint64_t now_ms, void (*expire)(struct timer* timer)) {
+    uint64_t target = (now_ms - wheel->start_ms) / TIMER_TICK_MS;
+
+    while (wheel->next_tick <= target) {
+        if (wheel->pending == 0) {
+            // Nothing to cascade or fire, skip the idle ticks at once
+            wheel->next_tick = target + 1;
+            return;
+        }
+
+        // When a level wraps, the next slot of the level above comes down first
+        int slot = wheel->next_tick & SLOT_MASK;
+        if (slot == 0) {
+            for (int level = 1; level < TIMER_WHEEL_LEVELS; level++) {
+                if (cascade(wheel, level) != 0) {
+                    break;
+                }
+            }
+        }
+
+        struct timer due;
+        list_move(&wheel->slots[0][slot], &due);
+        wheel->next_tick++;
+        while (due.next != &due) {
+            struct timer* timer = due.next;
+            list_unlink(timer);
+            wheel->pending--;
+            expire(timer);
+        }
+    }
+}
+
+// Function to compute how long to sleep until the next tick
+int timer_wheel_wait_ms(const struct timer_wheel* wheel, uint64_t now_ms) {
+    if (wheel->pending == 0) {
+        return -1;
+    }
+    uint64_t next_ms = wheel->start_ms + wheel->next_tick * TIMER_TICK_MS;
+    return next_ms > now_ms ? (int)(next_ms - now_ms) : 0;
+}
+
+// Function to read the monotonic clock in milliseconds
+uint64_t monotonic_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
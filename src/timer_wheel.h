@@ -0,0 +1,57 @@
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+#include <stdint.h>
+
+// Resolution of the wheel, timers fire on the first tick at or after their deadline
+#define TIMER_TICK_MS 100
+
+// Slots per level and number of levels: 64^4 ticks cover about 19 days, longer timers are clamped
+#define TIMER_WHEEL_BITS 6
+#define TIMER_WHEEL_SLOTS (1 << TIMER_WHEEL_BITS)
+#define TIMER_WHEEL_LEVELS 4
+
+// Timer embedded in the object it times out, linked into one wheel slot while pending
+struct timer {
+    struct timer* prev;
+    struct timer* next;
+    uint64_t expires;       // Tick it fires at
+    int kind;               // Free for the owner, e.g. which timeout is running
+};
+
+// Hierarchical timing wheel: level 0 holds the next 64 ticks one slot each, every further level
+// holds 64 times the range of the one below and cascades a slot down when the level below wraps
+// Setting, resetting and cancelling a timer are O(1), whatever the number of pending timers
+struct timer_wheel {
+    uint64_t next_tick;     // First tick not processed yet
+    uint64_t start_ms;      // Clock reading of tick 0
+    int pending;
+    struct timer slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];  // List heads
+};
+
+// Start an empty wheel at the given monotonic time
+void timer_wheel_init(struct timer_wheel* wheel, uint64_t now_ms);
+
+// Prepare a timer that is not pending, it can then be set and cancelled any number of times
+void timer_init(struct timer* timer);
+
+// (Re)start a timer to fire timeout_ms after the last processed tick
+void timer_set(struct timer_wheel* wheel, struct timer* timer, uint64_t timeout_ms, int kind);
+
+// Stop a timer if it is pending
+void timer_cancel(struct timer_wheel* wheel, struct timer* timer);
+
+// Check whether a timer is pending
+int timer_pending(const struct timer* timer);
+
+// Process every tick up to now_ms, calling expire for each timer that is due
+// A timer is no longer pending when expire runs, expire may set or cancel any timer
+void timer_wheel_advance(struct timer_wheel* wheel, uint64_t now_ms, void (*expire)(struct timer* timer));
+
+// Milliseconds until the next tick, or -1 when no timer is pending, for epoll_wait()
+int timer_wheel_wait_ms(const struct timer_wheel* wheel, uint64_t now_ms);
+
+// Read the monotonic clock in milliseconds
+uint64_t monotonic_ms();
+
+#endif
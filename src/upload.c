@@ -0,0 +1,352 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "upload.h"
+
+// Uploads larger than this are refused, configured from the command line
+size_t max_upload_size = 100 * 1024 * 1024;
+
+// Bytes moved per splice() call
+#define UPLOAD_SPLICE_CHUNK 65536
+
+// A chunk-size line, or the last one and the trailers, may not exceed this
+#define MAX_CHUNK_FRAMING 8192
+
+// Chunked body decoder states
+enum chunk_state {
+    CHUNK_SIZE,             // Hex digits of the chunk size
+    CHUNK_EXTENSION,        // ";name=value" after the size, ignored
+    CHUNK_SIZE_LF,
+    CHUNK_DATA,
+    CHUNK_DATA_CR,
+    CHUNK_DATA_LF,
+    CHUNK_TRAILER,          // Start of a trailer line, or the final blank line
+    CHUNK_TRAILER_LINE,     // Trailer fields are ignored
+    CHUNK_END_LF,
+};
+
+// Helper to mark the upload as failed, nothing more is read from the body
+static void fail_upload(struct upload* up, int status) {
+    if (up->status == 0) {
+        up->status = status;
+    }
+    up->done = 1;
+}
+
+// Helper to write all of a block to the temporary file
+static void write_all(struct upload* up, const char* data, size_t len) {
+    while (len > 0 && up->status == 0) {
+        ssize_t written = write(up->fd, data, len);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            printf("PID %d: Failed to write upload %s: %s\n", getpid(), up->temp_path, strerror(errno));
+            fail_upload(up, 500);
+            return;
+        }
+        data += written;
+        len -= written;
+    }
+}
+
+// Helper to write the decoded chunk data collected so far
+static void flush_write_buffer(struct upload* up) {
+    write_all(up, up->write_buffer, up->write_len);
+    up->write_len = 0;
+}
+
+// Helper to collect decoded chunk data, written in large blocks
+static void buffer_chunk_data(struct upload* up, const char* data, size_t len) {
+    while (len > 0 && up->status == 0) {
+        size_t space = UPLOAD_WRITE_BUFFER - up->write_len;
+        size_t take = len < space ? len : space;
+        memcpy(up->write_buffer + up->write_len, data, take);
+        up->write_len += take;
+        data += take;
+        len -= take;
+        if (up->write_len == UPLOAD_WRITE_BUFFER) {
+            flush_write_buffer(up);
+        }
+    }
+}
+
+// Helper to decode a chunked body, returns the bytes that belonged to it
+static size_t feed_chunked(struct upload* up, const char* data, size_t len) {
+    size_t pos = 0;
+    while (pos < len && !up->done) {
+        if (up->chunk_state == CHUNK_DATA) {
+            size_t take = len - pos < up->remaining ? len - pos : up->remaining;
+            buffer_chunk_data(up, data + pos, take);
+            up->received += take;
+            up->remaining -= take;
+            pos += take;
+            if (up->remaining == 0) {
+                up->chunk_state = CHUNK_DATA_CR;
+            }
+            continue;
+        }
+
+        char c = data[pos++];
+        if (++up->chunk_line_len > MAX_CHUNK_FRAMING) {
+            fail_upload(up, 400);
+            break;
+        }
+
+        switch (up->chunk_state) {
+        case CHUNK_SIZE:
+            if (isxdigit((unsigned char)c)) {
+                int digit = c <= '9' ? c - '0' : (c | 0x20) - 'a' + 10;
+                if (up->remaining > (max_upload_size - up->received) / 16) {
+                    // The chunk alone would exceed the limit
+                    fail_upload(up, 413);
+                    break;
+                }
+                up->remaining = up->remaining * 16 + digit;
+                up->chunk_size_digits++;
+            } else if (up->chunk_size_digits == 0) {
+                fail_upload(up, 400);
+            } else if (c == ';' || c == ' ' || c == '\t') {
+                up->chunk_state = CHUNK_EXTENSION;
+            } else if (c == '\r') {
+                up->chunk_state = CHUNK_SIZE_LF;
+            } else if (c == '\n') {
+                pos--;
+                up->chunk_state = CHUNK_SIZE_LF;
+            } else {
+                fail_upload(up, 400);
+            }
+            break;
+        case CHUNK_EXTENSION:
+            if (c == '\r') {
+                up->chunk_state = CHUNK_SIZE_LF;
+            } else if (c == '\n') {
+                pos--;
+                up->chunk_state = CHUNK_SIZE_LF;
+            }
+            break;
+        case CHUNK_SIZE_LF:
+            if (c != '\n') {
+                fail_upload(up, 400);
+            } else if (up->received + up->remaining > max_upload_size) {
+                fail_upload(up, 413);
+            } else if (up->remaining == 0) {
+                up->chunk_state = CHUNK_TRAILER;
+            } else {
+                up->chunk_state = CHUNK_DATA;
+                up->chunk_size_digits = 0;
+                up->chunk_line_len = 0;
+            }
+            break;
+        case CHUNK_DATA_CR:
+            if (c == '\r') {
+                up->chunk_state = CHUNK_DATA_LF;
+            } else if (c == '\n') {
+                up->chunk_state = CHUNK_SIZE;
+            } else {
+                fail_upload(up, 400);
+            }
+            break;
+        case CHUNK_DATA_LF:
+            if (c == '\n') {
+                up->chunk_state = CHUNK_SIZE;
+            } else {
+                fail_upload(up, 400);
+            }
+            break;
+        case CHUNK_TRAILER:
+            if (c == '\r') {
+                up->chunk_state = CHUNK_END_LF;
+            } else if (c == '\n') {
+                up->done = 1;
+            } else {
+                up->chunk_state = CHUNK_TRAILER_LINE;
+            }
+            break;
+        case CHUNK_TRAILER_LINE:
+            if (c == '\n') {
+                up->chunk_state = CHUNK_TRAILER;
+            }
+            break;
+        case CHUNK_END_LF:
+            if (c == '\n') {
+                up->done = 1;
+            } else {
+                fail_upload(up, 400);
+            }
+            break;
+        }
+    }
+
+    if (up->done) {
+        flush_write_buffer(up);
+    }
+    return pos;
+}
+
+// Helper to release everything but the temporary file itself
+static void free_upload(struct upload* up) {
+    if (up->splice_pipe[0] != -1) {
+        close(up->splice_pipe[0]);
+        close(up->splice_pipe[1]);
+    }
+    free(up->write_buffer);
+    free(up->temp_path);
+    free(up->path);
+    free(up);
+}
+
+// Function to start an upload into a temporary file next to path
+struct upload* upload_begin(const char* path, int chunked, size_t content_length, int* status) {
+    if (!chunked && content_length > max_upload_size) {
+        *status = 413;
+        return NULL;
+    }
+
+    struct upload* up = calloc(1, sizeof(*up));
+    if (up == NULL) {
+        *status = 500;
+        return NULL;
+    }
+    up->splice_pipe[0] = -1;
+    up->splice_pipe[1] = -1;
+
+    size_t path_len = strlen(path);
+    up->path = strdup(path);
+    up->temp_path = malloc(path_len + 16);
+    up->write_buffer = chunked ? malloc(UPLOAD_WRITE_BUFFER) : NULL;
+    if (up->path == NULL || up->temp_path == NULL || (chunked && up->write_buffer == NULL)) {
+        free_upload(up);
+        *status = 500;
+        return NULL;
+    }
+
+    // Same directory as the destination so rename() stays atomic, hidden from directory listings
+    const char* slash = strrchr(path, '/');
+    size_t dir_len = slash != NULL ? (size_t)(slash + 1 - path) : 0;
+    sprintf(up->temp_path, "%.*s.%s.XXXXXX", (int)dir_len, path, path + dir_len);
+
+    up->fd = mkostemp(up->temp_path, O_CLOEXEC);
+    if (up->fd == -1) {
+        printf("PID %d: Failed to create upload file for %s: %s\n", getpid(), path, strerror(errno));
+        free_upload(up);
+        *status = 500;
+        return NULL;
+    }
+    fchmod(up->fd, 0644);
+
+    up->chunked = chunked;
+    up->chunk_state = CHUNK_SIZE;
+    up->remaining = chunked ? 0 : content_length;
+    up->done = !chunked && content_length == 0;
+    return up;
+}
+
+// Function to consume body bytes that are already in memory
+size_t upload_feed(struct upload* up, const char* data, size_t len) {
+    if (up->done) {
+        return 0;
+    }
+    if (up->chunked) {
+        return feed_chunked(up, data, len);
+    }
+
+    size_t take = len < up->remaining ? len : up->remaining;
+    write_all(up, data, take);
+    up->received += take;
+    up->remaining -= take;
+    if (up->remaining == 0) {
+        up->done = 1;
+    }
+    return take;
+}
+
+// Function to check whether the body can be spliced from the socket
+int upload_wants_socket(const struct upload* up) {
+    return !up->done && !up->chunked;
+}
+
+// Helper to receive through a stack buffer when the socket cannot be spliced
+static ssize_t receive_copy(struct upload* up, int socket_fd) {
+    char buffer[16384];
+    size_t want = up->remaining < sizeof(buffer) ? up->remaining : sizeof(buffer);
+    ssize_t bytes_read = read(socket_fd, buffer, want);
+    if (bytes_read > 0) {
+        upload_feed(up, buffer, bytes_read);
+    }
+    return bytes_read;
+}
+
+// Function to splice body bytes from the socket into the file
+ssize_t upload_receive(struct upload* up, int socket_fd) {
+    if (up->splice_pipe[0] == -1 && pipe2(up->splice_pipe, O_CLOEXEC | O_NONBLOCK) == -1) {
+        return receive_copy(up, socket_fd);
+    }
+
+    size_t want = up->remaining < UPLOAD_SPLICE_CHUNK ? up->remaining : UPLOAD_SPLICE_CHUNK;
+    ssize_t moved = splice(socket_fd, NULL, up->splice_pipe[1], NULL, want, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+    if (moved < 0 && errno == EINVAL) {
+        return receive_copy(up, socket_fd);
+    }
+    if (moved <= 0) {
+        return moved;
+    }
+
+    // Drain the pipe into the file, regular files never block
+    size_t pending = moved;
+    while (pending > 0) {
+        ssize_t written = splice(up->splice_pipe[0], NULL, up->fd, NULL, pending, SPLICE_F_MOVE);
+        if (written <= 0) {
+            if (written < 0 && errno == EINTR) {
+                continue;
+            }
+            printf("PID %d: Failed to write upload %s: %s\n", getpid(), up->temp_path, strerror(errno));
+            fail_upload(up, 500);
+            return moved;
+        }
+        pending -= written;
+    }
+
+    up->received += moved;
+    up->remaining -= moved;
+    if (up->remaining == 0) {
+        up->done = 1;
+    }
+    return moved;
+}
+
+// Function to publish a complete upload under its final name
+int upload_finish(struct upload* up) {
+    if (up->status == 0 && !up->done) {
+        up->status = 400;
+    }
+    if (close(up->fd) == -1 && up->status == 0) {
+        up->status = 500;
+    }
+
+    if (up->status == 0 && rename(up->temp_path, up->path) == -1) {
+        printf("PID %d: Failed to rename upload to %s: %s\n", getpid(), up->path, strerror(errno));
+        up->status = 500;
+    }
+    if (up->status != 0) {
+        unlink(up->temp_path);
+    }
+
+    int status = up->status;
+    free_upload(up);
+    return status;
+}
+
+// Function to throw away an unfinished upload
+void upload_abort(struct upload* up) {
+    close(up->fd);
+    unlink(up->temp_path);
+    free_upload(up);
+}
@@ -0,0 +1,57 @@
+#ifndef UPLOAD_H
+#define UPLOAD_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+// Largest request body accepted for an upload
+extern size_t max_upload_size;
+
+// Decoded body bytes collected before each write() of a chunked upload
+#define UPLOAD_WRITE_BUFFER 65536
+
+// Request body being written to a temporary file next to its destination
+// The file only appears under its final name once the whole body has arrived
+struct upload {
+    int fd;
+    char* path;
+    char* temp_path;
+
+    int chunked;
+    size_t remaining;               // Content-Length bytes left, or bytes left in the current chunk
+    size_t received;                // Body bytes written so far
+    int chunk_state;
+    int chunk_size_digits;
+    size_t chunk_line_len;          // Bytes of the current chunk-size line (or of the trailers), bounded
+
+    int status;                     // HTTP status of a failure, 0 while the upload is fine
+    int done;                       // Body complete (or failed), nothing more to receive
+
+    int splice_pipe[2];             // Socket to file without a user-space copy, or -1
+    char* write_buffer;             // Decoded chunk data waiting for write(), chunked bodies only
+    size_t write_len;
+};
+
+// Create the temporary file for path, returns NULL with *status set (413, 500) on failure
+struct upload* upload_begin(const char* path, int chunked, size_t content_length, int* status);
+
+// Consume body bytes that were read along with the request
+// Returns the number of bytes that belonged to the body, the rest is the next request
+size_t upload_feed(struct upload* up, const char* data, size_t len);
+
+// Whether the rest of the body can be moved straight from the socket with upload_receive()
+// Chunked bodies must be read by the caller and passed to upload_feed() instead
+int upload_wants_socket(const struct upload* up);
+
+// Move body bytes from the socket to the file with splice(), never reading past the body
+// Returns the number of bytes moved, 0 when the peer closed and -1 with errno set
+ssize_t upload_receive(struct upload* up, int socket_fd);
+
+// Move the temporary file to its final name, or remove it when the upload failed
+// Returns 0 on success, otherwise the HTTP status to answer with, and frees the upload
+int upload_finish(struct upload* up);
+
+// Drop an unfinished upload and its temporary file
+void upload_abort(struct upload* up);
+
+#endif
@@ -0,0 +1,869 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/sysmacros.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+#include <linux/time_types.h>
+
+#include "uring_loop.h"
+#include "http.h"
+#include "file_cache.h"
+#include "upload.h"
+#include "http_parser.h"
+#include "workers.h"
+#include "access_log.h"
+#include "metrics.h"
+#include "arena.h"
+#include "buffer_pool.h"
+#include "timer_wheel.h"
+#include "admission.h"
+
+int use_io_uring = 0;
+
+// Submission queue entries, the completion queue gets twice as many
+#define RING_ENTRIES 1024
+#define CONN_BUFFER_SIZE 4096
+
+// Pipe between the file and the socket for spliced bodies, one splice in and one out per refill
+#define SPLICE_PIPE_SIZE (256 * 1024)
+
+// Operations a connection can have in flight, kept in the low bits of user_data
+// Connections are at least 8-byte aligned, so the pointer keeps the rest
+enum uring_op {
+    OP_RECV = 1,
+    OP_SEND,            // Headers and in-memory body (sendmsg), or a piece of the streamed body (send)
+    OP_SPLICE_IN,       // File to pipe
+    OP_SPLICE_OUT,      // Pipe to socket
+    OP_READ,            // File to body buffer when zero-copy is disabled
+    OP_OPEN,
+    OP_STATX,
+};
+#define OP_MASK 7
+
+// user_data of the operations that do not belong to a connection
+#define DATA_ACCEPT 1
+#define DATA_TIMEOUT 2
+#define DATA_WATCH 3
+
+// Same state machine as the epoll engine, with a step for opening the requested file
+enum conn_state {
+    CONN_READING,
+    CONN_OPENING,
+    CONN_UPLOADING,
+    CONN_WRITING,
+};
+
+// Every connection has at most one operation in flight, its buffers stay put until it completes
+struct connection {
+    int fd;
+    enum conn_state state;
+    int in_flight;
+    int closing;                    // Closed while an operation was in flight, freed on its completion
+
+    char buffer[CONN_BUFFER_SIZE];
+    size_t buffer_len;
+    struct http_request req;
+    size_t request_len;
+
+    struct upload *upload;
+    int keep_alive;
+    int requests_served;
+
+    struct http_response res;
+    struct arena arena;             // Memory of the response, released once it is sent
+    size_t bytes_sent;
+    uint64_t response_bytes;
+    struct access_log_entry log;
+    struct request_metrics metrics;
+    struct iovec iov[2];
+    struct msghdr msg;
+
+    // Streamed body pieces and upload reads, taken from the buffer pool when first needed
+    char *body_buffer;
+    size_t body_buffer_len;
+    size_t body_buffer_sent;
+
+    // Blocking pipe for spliced bodies, the response's own pipe is non-blocking
+    int pipe[2];
+    size_t pipe_pending;
+
+    // File looked up on behalf of the request, before it is answered from the file cache
+    char file_path[1024];
+    int file_fd;
+    struct statx stx;
+
+    // Timeout of the phase the connection waits in, its kind is the enum connection_timeout
+    struct timer timer;
+    uint32_t admission_slot;
+};
+
+// Shared rings mapped from the kernel
+struct ring {
+    int fd;
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned sq_mask;
+    unsigned *sq_array;
+    struct io_uring_sqe *sqes;
+    unsigned sq_entries;
+    unsigned sq_local_tail;         // Entries filled in so far, published before each io_uring_enter()
+    unsigned to_submit;
+
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned cq_mask;
+    struct io_uring_cqe *cqes;
+};
+
+static struct ring ring;
+static int accept_multishot = 1;
+static int poll_multishot = 1;
+static int server_socket = -1;
+static int watch_fd = -1;
+static struct __kernel_timespec tick = { .tv_sec = 0, .tv_nsec = TIMER_TICK_MS * 1000000L };
+
+// Timeouts of every connection of this worker
+static struct timer_wheel timers;
+
+// Helpers for the io_uring system calls, glibc has no wrappers
+static int sys_io_uring_setup(unsigned entries, struct io_uring_params *params) {
+    return syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int sys_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+    return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static int sys_io_uring_register(int fd, unsigned opcode, void *arg, unsigned nr_args) {
+    return syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+// Helper to create a ring, trying the cheaper task-work modes first (Linux 6.0+)
+static int setup_ring(unsigned entries, struct io_uring_params *params) {
+    memset(params, 0, sizeof(*params));
+    params->flags = IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_COOP_TASKRUN;
+    int fd = sys_io_uring_setup(entries, params);
+    if (fd == -1 && errno == EINVAL) {
+        memset(params, 0, sizeof(*params));
+        fd = sys_io_uring_setup(entries, params);
+    }
+    return fd;
+}
+
+// Function to check that the kernel supports every operation the engine submits
+int io_uring_available(const char **reason) {
+    struct io_uring_params params;
+    int fd = setup_ring(4, &params);
+    if (fd == -1) {
+        // ENOSYS without io_uring, EPERM when disabled by sysctl or seccomp
+        *reason = strerror(errno);
+        return 0;
+    }
+
+    int available = 0;
+    unsigned required_features = IORING_FEAT_SINGLE_MMAP | IORING_FEAT_NODROP | IORING_FEAT_FAST_POLL;
+    size_t probe_size = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+    struct io_uring_probe *probe = calloc(1, probe_size);
+    if ((params.features & required_features) != required_features) {
+        *reason = "kernel too old (needs Linux 5.7 or later)";
+    } else if (probe == NULL || sys_io_uring_register(fd, IORING_REGISTER_PROBE, probe, 256) == -1) {
+        *reason = "cannot probe supported operations";
+    } else {
+        static const int ops[] = {
+            IORING_OP_ACCEPT, IORING_OP_RECV, IORING_OP_SEND, IORING_OP_SENDMSG, IORING_OP_OPENAT,
+            IORING_OP_STATX, IORING_OP_READ, IORING_OP_SPLICE, IORING_OP_TIMEOUT, IORING_OP_POLL_ADD,
+        };
+        available = 1;
+        for (size_t i = 0; i < sizeof(ops) / sizeof(ops[0]); i++) {
+            if (ops[i] > probe->last_op || !(probe->ops[ops[i]].flags & IO_URING_OP_SUPPORTED)) {
+                *reason = "kernel lacks a required operation";
+                available = 0;
+            }
+        }
+    }
+    free(probe);
+    close(fd);
+    return available;
+}
+
+// Function to create the ring and map its queues
+static int ring_init(unsigned entries) {
+    struct io_uring_params params;
+    ring.fd = setup_ring(entries, &params);
+    if (ring.fd == -1) {
+        printf("io_uring_setup failed: %s\n", strerror(errno));
+        return -1;
+    }
+
+    // Both queues share one mapping (IORING_FEAT_SINGLE_MMAP, checked at startup)
+    size_t sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    size_t cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    size_t ring_size = sq_size > cq_size ? sq_size : cq_size;
+    char *rings = mmap(NULL, ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring.fd,
+                       IORING_OFF_SQ_RING);
+    if (rings == MAP_FAILED) {
+        printf("Failed to map io_uring queues: %s\n", strerror(errno));
+        return -1;
+    }
+    ring.sqes = mmap(NULL, params.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE, ring.fd, IORING_OFF_SQES);
+    if (ring.sqes == MAP_FAILED) {
+        printf("Failed to map io_uring entries: %s\n", strerror(errno));
+        return -1;
+    }
+
+    ring.sq_head = (unsigned *)(rings + params.sq_off.head);
+    ring.sq_tail = (unsigned *)(rings + params.sq_off.tail);
+    ring.sq_mask = *(unsigned *)(rings + params.sq_off.ring_mask);
+    ring.sq_array = (unsigned *)(rings + params.sq_off.array);
+    ring.sq_entries = params.sq_entries;
+    ring.sq_local_tail = *ring.sq_tail;
+    ring.cq_head = (unsigned *)(rings + params.cq_off.head);
+    ring.cq_tail = (unsigned *)(rings + params.cq_off.tail);
+    ring.cq_mask = *(unsigned *)(rings + params.cq_off.ring_mask);
+    ring.cqes = (struct io_uring_cqe *)(rings + params.cq_off.cqes);
+    return 0;
+}
+
+// Function to hand the queued entries to the kernel and wait for min_complete completions
+static int ring_submit(unsigned min_complete) {
+    atomic_store_explicit((_Atomic unsigned *)ring.sq_tail, ring.sq_local_tail, memory_order_release);
+    while (1) {
+        int submitted = sys_io_uring_enter(ring.fd, ring.to_submit, min_complete,
+                                           min_complete > 0 ? IORING_ENTER_GETEVENTS : 0);
+        if (submitted >= 0) {
+            ring.to_submit -= submitted;
+            return 0;
+        }
+        if (errno == EINTR) {
+            continue;
+        }
+        // EBUSY: completions must be reaped before more can be submitted
+        if (errno == EBUSY || errno == EAGAIN) {
+            return 0;
+        }
+        printf("io_uring_enter failed: %s\n", strerror(errno));
+        return -1;
+    }
+}
+
+// Function to get a blank submission entry, submitting the queued ones when the queue is full
+static struct io_uring_sqe *get_sqe(int opcode, int fd, uint64_t user_data) {
+    unsigned head = atomic_load_explicit((_Atomic unsigned *)ring.sq_head, memory_order_acquire);
+    while (ring.sq_local_tail - head == ring.sq_entries) {
+        ring_submit(0);
+        head = atomic_load_explicit((_Atomic unsigned *)ring.sq_head, memory_order_acquire);
+    }
+
+    unsigned index = ring.sq_local_tail & ring.sq_mask;
+    struct io_uring_sqe *sqe = &ring.sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = opcode;
+    sqe->fd = fd;
+    sqe->user_data = user_data;
+    ring.sq_array[index] = index;
+    ring.sq_local_tail++;
+    ring.to_submit++;
+    return sqe;
+}
+
+// Helper to queue an operation on behalf of a connection
+static struct io_uring_sqe *conn_sqe(struct connection *conn, enum uring_op op, int opcode, int fd) {
+    conn->in_flight = 1;
+    return get_sqe(opcode, fd, (uint64_t)(uintptr_t)conn | op);
+}
+
+// Function to (re)start the timeout of the phase a connection waits in
+// The header timeout runs from the first byte of a request, further reads do not extend it
+static void arm_timeout(struct connection *conn) {
+    int timeout;
+    if (conn->state == CONN_READING) {
+        timeout = conn->buffer_len == 0 && conn->requests_served > 0 ? TIMEOUT_IDLE : TIMEOUT_HEADER;
+    } else {
+        timeout = conn->state == CONN_UPLOADING ? TIMEOUT_BODY : TIMEOUT_WRITE;
+    }
+    if (timeout == TIMEOUT_HEADER && timer_pending(&conn->timer) && conn->timer.kind == TIMEOUT_HEADER) {
+        return;
+    }
+    timer_set(&timers, &conn->timer, timeout_seconds(timeout) * 1000ULL, timeout);
+}
+
+// Function to close a connection and release its state
+// An operation still in flight is interrupted by shutting the socket down, the state goes once it completes
+static void close_connection(struct connection *conn) {
+    timer_cancel(&timers, &conn->timer);
+    if (conn->in_flight) {
+        if (!conn->closing) {
+            conn->closing = 1;
+            shutdown(conn->fd, SHUT_RDWR);
+        }
+        return;
+    }
+
+    admission_release(conn->admission_slot);
+    worker_stats->active_connections--;
+    free_response(&conn->res);
+    arena_reset(&conn->arena);
+    io_buffer_put(conn->body_buffer);
+    if (conn->upload != NULL) {
+        upload_abort(conn->upload);
+    }
+    if (conn->file_fd != -1) {
+        close(conn->file_fd);
+    }
+    if (conn->pipe[0] != -1) {
+        close(conn->pipe[0]);
+        close(conn->pipe[1]);
+    }
+    close(conn->fd);
+    free(conn);
+}
+
+// Function to check whether the buffered request can be dispatched
+static int request_ready(struct connection *conn) {
+    if (conn->buffer_len > 0) {
+        metrics_request_started(&conn->metrics);
+    }
+    int status = http_parse_request(&conn->req, conn->buffer, conn->buffer_len);
+    if (status == HTTP_PARSE_ERROR) {
+        return 1;
+    }
+    if (status == HTTP_PARSE_DONE && conn->buffer_len >= http_request_length(&conn->req)) {
+        return 1;
+    }
+    if (status == HTTP_PARSE_DONE && (conn->req.chunked || request_is_upload(conn->buffer, &conn->req))) {
+        return 1;
+    }
+    return conn->buffer_len == sizeof(conn->buffer);
+}
+
+// Function to start receiving an upload, the body bytes read with the headers go first
+static void begin_upload(struct connection *conn) {
+    conn->keep_alive = request_wants_keep_alive(conn->buffer, &conn->req)
+                       && conn->requests_served < max_keep_alive_requests;
+
+    int send_continue;
+    conn->upload = start_upload(conn->buffer, &conn->req, &send_continue, &conn->res);
+    if (conn->upload == NULL) {
+        conn->keep_alive = 0;
+        conn->request_len = conn->buffer_len;
+        conn->state = CONN_WRITING;
+        metrics_handled(&conn->metrics);
+        return;
+    }
+
+    size_t header_length = conn->req.header_length;
+    if (send_continue && conn->buffer_len == header_length) {
+        // Nothing else is in flight on the socket, the interim response fits its buffer
+        send(conn->fd, "HTTP/1.1 100 Continue\r\n\r\n", 25, MSG_NOSIGNAL | MSG_DONTWAIT);
+    }
+
+    size_t used = header_length + upload_feed(conn->upload, conn->buffer + header_length,
+                                              conn->buffer_len - header_length);
+    conn->buffer_len -= used;
+    memmove(conn->buffer, conn->buffer + used, conn->buffer_len);
+    conn->request_len = 0;
+    conn->state = CONN_UPLOADING;
+}
+
+// Function to answer the request at the start of the buffer
+static void respond(struct connection *conn) {
+    conn->request_len = respond_to_request(conn->buffer, conn->buffer_len, &conn->req, conn->requests_served,
+                                           &conn->keep_alive, &conn->res);
+    metrics_handled(&conn->metrics);
+    conn->state = CONN_WRITING;
+}
+
+// Function to dispatch the request at the start of the buffer
+static void dispatch_request(struct connection *conn) {
+    // The headers are in, the header timeout is over
+    timer_cancel(&timers, &conn->timer);
+    conn->requests_served++;
+    worker_stats->requests_handled++;
+
+    conn->bytes_sent = 0;
+    conn->response_bytes = 0;
+    conn->body_buffer_len = 0;
+    conn->body_buffer_sent = 0;
+
+    int parsed = http_parse_request(&conn->req, conn->buffer, conn->buffer_len) == HTTP_PARSE_DONE;
+    struct http_slice method = conn->req.method;
+    struct http_slice path = conn->req.path;
+    access_log_begin(&conn->log, conn->buffer + method.offset, parsed ? method.length : 0,
+                     conn->buffer + path.offset, parsed ? path.length : 0);
+    metrics_dispatched(&conn->metrics, conn->buffer, &conn->req, parsed);
+
+    if (parsed && request_is_upload(conn->buffer, &conn->req)) {
+        begin_upload(conn);
+        return;
+    }
+
+    // A file missing from the cache is opened and stat'ed through the ring, the response then finds it cached
+    if (parsed && file_cache_ttl > 0 && file_cache_max_entries > 0
+        && request_file_path(conn->buffer, &conn->req, conn->file_path, sizeof(conn->file_path))
+        && !file_cache_contains(conn->file_path)) {
+        struct io_uring_sqe *sqe = conn_sqe(conn, OP_OPEN, IORING_OP_OPENAT, AT_FDCWD);
+        sqe->addr = (uintptr_t)conn->file_path;
+        sqe->open_flags = O_RDONLY | O_CLOEXEC;
+        conn->state = CONN_OPENING;
+        return;
+    }
+
+    respond(conn);
+}
+
+// Helper to check whether the file body goes out with the ring's own file operations
+// Compressed and multipart bodies are produced by response_read_body() instead
+static int plain_file_body(const struct http_response *res) {
+    return res->file_fd != -1 && res->gzip_file == NULL && res->ranges == NULL;
+}
+
+// Helper to give the connection a body buffer from the pool, kept until the request is finished
+static int take_body_buffer(struct connection *conn) {
+    if (conn->body_buffer == NULL) {
+        conn->body_buffer = io_buffer_get();
+    }
+    return conn->body_buffer != NULL ? 0 : -1;
+}
+
+// Function to queue the next piece of the response
+// Returns 1 when an operation was queued, 0 when the response is complete and -1 on error
+static int queue_write(struct connection *conn) {
+    struct http_response *res = &conn->res;
+
+    // Headers and in-memory body in one sendmsg()
+    size_t head_len = res->headers_len + res->body_len;
+    if (conn->bytes_sent < head_len) {
+        memset(&conn->msg, 0, sizeof(conn->msg));
+        conn->msg.msg_iov = conn->iov;
+        conn->msg.msg_iovlen = response_iovec(res, conn->bytes_sent, conn->iov);
+
+        struct io_uring_sqe *sqe = conn_sqe(conn, OP_SEND, IORING_OP_SENDMSG, conn->fd);
+        sqe->addr = (uintptr_t)&conn->msg;
+        sqe->msg_flags = MSG_NOSIGNAL | (res->file_fd != -1 ? MSG_MORE : 0);
+        return 1;
+    }
+    if (res->file_fd == -1) {
+        return 0;
+    }
+
+    // Identity file: file -> pipe -> socket, the pipe is emptied before it is refilled
+    if (zero_copy_files && plain_file_body(res)) {
+        if (conn->pipe_pending > 0) {
+            struct io_uring_sqe *sqe = conn_sqe(conn, OP_SPLICE_OUT, IORING_OP_SPLICE, conn->fd);
+            sqe->off = (uint64_t)-1;
+            sqe->splice_fd_in = conn->pipe[0];
+            sqe->splice_off_in = (uint64_t)-1;
+            sqe->len = conn->pipe_pending;
+            sqe->splice_flags = SPLICE_F_MOVE | (res->file_offset < res->file_size ? SPLICE_F_MORE : 0);
+            return 1;
+        }
+        if (res->file_offset == res->file_size) {
+            free_response(res);
+            return 0;
+        }
+        if (conn->pipe[0] == -1) {
+            if (pipe2(conn->pipe, O_CLOEXEC) == -1) {
+                return -1;
+            }
+            fcntl(conn->pipe[1], F_SETPIPE_SZ, SPLICE_PIPE_SIZE);
+        }
+        off_t remaining = res->file_size - res->file_offset;
+        struct io_uring_sqe *sqe = conn_sqe(conn, OP_SPLICE_IN, IORING_OP_SPLICE, conn->pipe[1]);
+        sqe->splice_fd_in = res->file_fd;
+        sqe->splice_off_in = res->file_offset;
+        sqe->off = (uint64_t)-1;
+        sqe->len = remaining < SPLICE_PIPE_SIZE ? remaining : SPLICE_PIPE_SIZE;
+        sqe->splice_flags = SPLICE_F_MOVE;
+        return 1;
+    }
+
+    // Everything else goes through the body buffer
+    if (conn->body_buffer_sent == conn->body_buffer_len) {
+        if (take_body_buffer(conn) == -1) {
+            return -1;
+        }
+        if (plain_file_body(res)) {
+            if (res->file_offset == res->file_size) {
+                free_response(res);
+                return 0;
+            }
+            off_t remaining = res->file_size - res->file_offset;
+            struct io_uring_sqe *sqe = conn_sqe(conn, OP_READ, IORING_OP_READ, res->file_fd);
+            sqe->addr = (uintptr_t)conn->body_buffer;
+            sqe->len = remaining < IO_BUFFER_SIZE ? remaining : IO_BUFFER_SIZE;
+            sqe->off = res->file_offset;
+            return 1;
+        }
+
+        ssize_t bytes_read = response_read_body(res, conn->body_buffer, IO_BUFFER_SIZE);
+        if (bytes_read < 0) {
+            return -1;
+        }
+        if (bytes_read == 0) {
+            free_response(res);
+            return 0;
+        }
+        conn->body_buffer_len = bytes_read;
+        conn->body_buffer_sent = 0;
+    }
+
+    struct io_uring_sqe *sqe = conn_sqe(conn, OP_SEND, IORING_OP_SEND, conn->fd);
+    sqe->addr = (uintptr_t)(conn->body_buffer + conn->body_buffer_sent);
+    sqe->len = conn->body_buffer_len - conn->body_buffer_sent;
+    sqe->msg_flags = MSG_NOSIGNAL;
+    return 1;
+}
+
+// Function to queue the next receive of an upload body, or finish the upload once it is complete
+// Returns 1 when a receive was queued, 0 when the upload is finished and -1 on error
+static int queue_upload_receive(struct connection *conn) {
+    struct upload *up = conn->upload;
+    if (up->done) {
+        finish_upload(up, &conn->keep_alive, &conn->res);
+        metrics_handled(&conn->metrics);
+        conn->upload = NULL;
+        conn->state = CONN_WRITING;
+        return 0;
+    }
+
+    // Content-Length bodies never read past their end, chunked ones are decoded from the connection buffer
+    if (upload_wants_socket(up) && take_body_buffer(conn) == -1) {
+        return -1;
+    }
+    struct io_uring_sqe *sqe = conn_sqe(conn, OP_RECV, IORING_OP_RECV, conn->fd);
+    if (upload_wants_socket(up)) {
+        sqe->addr = (uintptr_t)conn->body_buffer;
+        sqe->len = up->remaining < IO_BUFFER_SIZE ? up->remaining : IO_BUFFER_SIZE;
+    } else {
+        sqe->addr = (uintptr_t)conn->buffer;
+        sqe->len = sizeof(conn->buffer);
+    }
+    return 1;
+}
+
+// Function to drop the answered request and get ready for the next one
+static void finish_request(struct connection *conn) {
+    free_response(&conn->res);
+    arena_reset(&conn->arena);
+    io_buffer_put(conn->body_buffer);
+    conn->body_buffer = NULL;
+    conn->buffer_len -= conn->request_len;
+    memmove(conn->buffer, conn->buffer + conn->request_len, conn->buffer_len);
+    conn->request_len = 0;
+    http_parser_init(&conn->req);
+    conn->state = CONN_READING;
+}
+
+// Function to drive a connection until it waits for an operation
+// Returns -1 when the connection should be closed
+static int advance_connection(struct connection *conn) {
+    while (1) {
+        if (conn->state == CONN_READING) {
+            // Pipelined requests may already be buffered
+            if (!request_ready(conn)) {
+                struct io_uring_sqe *sqe = conn_sqe(conn, OP_RECV, IORING_OP_RECV, conn->fd);
+                sqe->addr = (uintptr_t)(conn->buffer + conn->buffer_len);
+                sqe->len = sizeof(conn->buffer) - conn->buffer_len;
+                return 0;
+            }
+            dispatch_request(conn);
+        }
+
+        if (conn->state == CONN_OPENING) {
+            return 0;
+        }
+        if (conn->state == CONN_UPLOADING) {
+            int status = queue_upload_receive(conn);
+            if (status != 0) {
+                return status > 0 ? 0 : -1;
+            }
+        }
+
+        int status = queue_write(conn);
+        if (status > 0) {
+            return 0;
+        }
+        access_log_end(&conn->log, response_status(&conn->res), conn->response_bytes);
+        metrics_request_done(&conn->metrics, response_status(&conn->res));
+        if (status < 0 || !conn->keep_alive) {
+            return -1;
+        }
+        finish_request(conn);
+    }
+}
+
+// Helper to account for bytes that reached the socket
+static void count_sent(struct connection *conn, size_t sent) {
+    conn->response_bytes += sent;
+    worker_stats->bytes_sent += sent;
+}
+
+// Function to apply a completed operation to its connection
+// Returns -1 when the connection should be closed
+static int complete_operation(struct connection *conn, enum uring_op op, int result) {
+    struct http_response *res = &conn->res;
+    if ((result == -EINTR || result == -EAGAIN) && op != OP_OPEN && op != OP_STATX) {
+        // Interrupted before doing anything, go through the state machine again
+        return 0;
+    }
+
+    switch (op) {
+    case OP_RECV:
+        if (result <= 0) {
+            return -1;
+        }
+        worker_stats->bytes_received += result;
+        if (conn->state == CONN_READING) {
+            conn->buffer_len += result;
+        } else if (upload_wants_socket(conn->upload)) {
+            upload_feed(conn->upload, conn->body_buffer, result);
+        } else {
+            size_t used = upload_feed(conn->upload, conn->buffer, result);
+            conn->buffer_len = result - used;
+            memmove(conn->buffer, conn->buffer + used, conn->buffer_len);
+        }
+        return 0;
+    case OP_SEND:
+        if (result < 0) {
+            return -1;
+        }
+        if (conn->bytes_sent < res->headers_len + res->body_len) {
+            conn->bytes_sent += result;
+        } else {
+            conn->body_buffer_sent += result;
+        }
+        count_sent(conn, result);
+        return 0;
+    case OP_SPLICE_IN:
+    case OP_READ:
+        // A short file cannot keep the Content-Length promise, give up on the connection
+        if (result <= 0) {
+            return -1;
+        }
+        res->file_offset += result;
+        if (op == OP_READ) {
+            conn->body_buffer_len = result;
+            conn->body_buffer_sent = 0;
+        } else {
+            conn->pipe_pending = result;
+        }
+        return 0;
+    case OP_SPLICE_OUT:
+        if (result <= 0) {
+            return -1;
+        }
+        conn->pipe_pending -= result;
+        count_sent(conn, result);
+        return 0;
+    case OP_OPEN:
+        if (result < 0) {
+            file_cache_insert(conn->file_path, -1, -result, NULL);
+            respond(conn);
+        } else {
+            conn->file_fd = result;
+            struct io_uring_sqe *sqe = conn_sqe(conn, OP_STATX, IORING_OP_STATX, conn->file_fd);
+            sqe->addr = (uintptr_t)"";
+            sqe->statx_flags = AT_EMPTY_PATH;
+            sqe->len = STATX_BASIC_STATS;
+            sqe->off = (uintptr_t)&conn->stx;
+        }
+        return 0;
+    case OP_STATX:
+        if (result == 0) {
+            struct statx *stx = &conn->stx;
+            struct stat st = {
+                .st_dev = makedev(stx->stx_dev_major, stx->stx_dev_minor),
+                .st_ino = stx->stx_ino,
+                .st_mode = stx->stx_mode,
+                .st_nlink = stx->stx_nlink,
+                .st_uid = stx->stx_uid,
+                .st_gid = stx->stx_gid,
+                .st_rdev = makedev(stx->stx_rdev_major, stx->stx_rdev_minor),
+                .st_size = stx->stx_size,
+                .st_blksize = stx->stx_blksize,
+                .st_blocks = stx->stx_blocks,
+                .st_atim = { stx->stx_atime.tv_sec, stx->stx_atime.tv_nsec },
+                .st_mtim = { stx->stx_mtime.tv_sec, stx->stx_mtime.tv_nsec },
+                .st_ctim = { stx->stx_ctime.tv_sec, stx->stx_ctime.tv_nsec },
+            };
+            file_cache_insert(conn->file_path, conn->file_fd, 0, &st);
+        } else {
+            close(conn->file_fd);
+        }
+        conn->file_fd = -1;
+        respond(conn);
+        return 0;
+    }
+    return 0;
+}
+
+// Function to queue an accept, multishot when the kernel supports it (Linux 5.19+)
+static void queue_accept() {
+    struct io_uring_sqe *sqe = get_sqe(IORING_OP_ACCEPT, server_socket, DATA_ACCEPT);
+    sqe->accept_flags = SOCK_CLOEXEC;
+    if (accept_multishot) {
+        sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    }
+}
+
+// Function to queue a poll for change notifications on the files directory
+static void queue_watch() {
+    struct io_uring_sqe *sqe = get_sqe(IORING_OP_POLL_ADD, watch_fd, DATA_WATCH);
+    sqe->poll32_events = POLLIN;
+    if (poll_multishot) {
+        sqe->len = IORING_POLL_ADD_MULTI;
+    }
+}
+
+// Function to queue the tick that drives the timer wheel
+static void queue_timeout() {
+    struct io_uring_sqe *sqe = get_sqe(IORING_OP_TIMEOUT, -1, DATA_TIMEOUT);
+    sqe->addr = (uintptr_t)&tick;
+    sqe->len = 1;
+}
+
+// Function to set up a newly accepted connection and queue its first receive
+static void accept_connection(int client_fd) {
+    // Shed load before anything is allocated, the address is only looked up for the per-IP limit
+    uint32_t admission_slot;
+    if (admission_admit(client_fd, NULL, 0, &admission_slot) == -1) {
+        return;
+    }
+    
+    struct connection *conn = calloc(1, sizeof(*conn));
+    if (conn == NULL) {
+        printf("Failed to allocate connection state\n");
+        admission_release(admission_slot);
+        close(client_fd);
+        return;
+    }
+    conn->fd = client_fd;
+    conn->admission_slot = admission_slot;
+    conn->state = CONN_READING;
+    conn->res.file_fd = -1;
+    conn->res.splice_pipe[0] = -1;
+    conn->res.splice_pipe[1] = -1;
+    arena_init(&conn->arena);
+    conn->res.arena = &conn->arena;
+    conn->pipe[0] = -1;
+    conn->pipe[1] = -1;
+    conn->file_fd = -1;
+    http_parser_init(&conn->req);
+    timer_init(&conn->timer);
+    worker_stats->connections_accepted++;
+    worker_stats->active_connections++;
+
+    log_debug("Client connected - fd %d\n", client_fd);
+    if (advance_connection(conn) < 0) {
+        close_connection(conn);
+        return;
+    }
+    arm_timeout(conn);
+}
+
+// Function to close a connection whose timeout fired
+static void expire_connection(struct timer *timer) {
+    struct connection *conn = (struct connection *)((char *)timer - offsetof(struct connection, timer));
+    log_debug("Closing connection after timeout %d - fd %d\n", timer->kind, conn->fd);
+    worker_stats->timeouts[timer->kind]++;
+    close_connection(conn);
+}
+
+// Function to handle one completion
+static void handle_completion(const struct io_uring_cqe *cqe) {
+    switch (cqe->user_data) {
+    case DATA_ACCEPT:
+        if (cqe->res >= 0) {
+            accept_connection(cqe->res);
+        } else if (cqe->res == -EINVAL && accept_multishot) {
+            accept_multishot = 0;
+        } else if (cqe->res != -EINTR && cqe->res != -ECONNABORTED) {
+            printf("Accept failed: %s \n", strerror(-cqe->res));
+        }
+        if (!(cqe->flags & IORING_CQE_F_MORE)) {
+            queue_accept();
+        }
+        return;
+    case DATA_WATCH:
+        if (cqe->res == -EINVAL && poll_multishot) {
+            poll_multishot = 0;
+        } else {
+            file_cache_handle_events();
+        }
+        if (!(cqe->flags & IORING_CQE_F_MORE)) {
+            queue_watch();
+        }
+        return;
+    case DATA_TIMEOUT:
+        timer_wheel_advance(&timers, monotonic_ms(), expire_connection);
+        queue_timeout();
+        return;
+    }
+
+    struct connection *conn = (struct connection *)(uintptr_t)(cqe->user_data & ~(uint64_t)OP_MASK);
+    conn->in_flight = 0;
+    if (conn->closing) {
+        if ((cqe->user_data & OP_MASK) == OP_OPEN && cqe->res >= 0) {
+            close(cqe->res);
+        }
+        close_connection(conn);
+        return;
+    }
+
+    if (complete_operation(conn, cqe->user_data & OP_MASK, cqe->res) < 0
+        || (!conn->in_flight && advance_connection(conn) < 0)) {
+        close_connection(conn);
+    } else {
+        arm_timeout(conn);
+    }
+}
+
+// Function to run the io_uring engine on the listening socket
+int run_uring_loop(int server_fd) {
+    if (ring_init(RING_ENTRIES) == -1) {
+        return 1;
+    }
+    server_socket = server_fd;
+    timer_wheel_init(&timers, monotonic_ms());
+
+    queue_accept();
+    queue_timeout();
+    watch_fd = file_cache_watch(files_directory);
+    if (watch_fd != -1) {
+        queue_watch();
+    }
+
+    while (1) {
+        // One system call submits everything queued by the previous batch and waits for the next
+        if (ring_submit(1) == -1) {
+            return 1;
+        }
+
+        unsigned head = *ring.cq_head;
+        unsigned tail = atomic_load_explicit((_Atomic unsigned *)ring.cq_tail, memory_order_acquire);
+        while (head != tail) {
+            handle_completion(&ring.cqes[head & ring.cq_mask]);
+            head++;
+
+            // Hand slots back as they are consumed, handlers may wait for room in the queue
+            atomic_store_explicit((_Atomic unsigned *)ring.cq_head, head, memory_order_release);
+            if (head == tail) {
+                tail = atomic_load_explicit((_Atomic unsigned *)ring.cq_tail, memory_order_acquire);
+            }
+        }
+    }
+}
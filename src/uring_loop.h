@@ -0,0 +1,13 @@
+#ifndef URING_LOOP_H
+#define URING_LOOP_H
+
+// Serve with the io_uring engine instead of epoll, set by --model=uring
+extern int use_io_uring;
+
+// Check that the kernel can run the io_uring engine, reason explains why not
+int io_uring_available(const char** reason);
+
+// Run the io_uring engine on a blocking listening socket, never returns on success
+int run_uring_loop(int server_fd);
+
+#endif
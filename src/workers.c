@@ -0,0 +1,239 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#include "workers.h"
+#include "listener.h"
+#include "event_loop.h"
+#include "uring_loop.h"
+#include "access_log.h"
+
+// Counters used until the shared slots are mapped
+static struct worker_stats single_worker_stats = { .cpu = -1 };
+struct worker_stats *worker_stats = &single_worker_stats;
+
+// Shared counters of all workers, mapped before forking
+struct worker_stats *all_worker_stats = &single_worker_stats;
+int worker_stats_count = 1;
+
+static volatile sig_atomic_t shutdown_requested = 0;
+static volatile sig_atomic_t dump_requested = 0;
+
+// Handler for SIGINT/SIGTERM in the supervisor
+static void handle_shutdown(int sig) {
+    (void)sig;
+    shutdown_requested = 1;
+}
+
+// Handler for SIGUSR1 in the supervisor, prints the counters right away
+static void handle_dump(int sig) {
+    (void)sig;
+    dump_requested = 1;
+}
+
+// Function to pin the calling process to a single CPU
+static int pin_to_cpu(int cpu) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return sched_setaffinity(0, sizeof(set), &set);
+}
+
+// Function to run one worker, never returns
+static void worker_main(int worker_id, int pin_cpus, const sigset_t *old_mask) {
+    // Restore default signal handling inherited from the supervisor
+    signal(SIGINT, SIG_DFL);
+    signal(SIGTERM, SIG_DFL);
+    signal(SIGUSR1, SIG_DFL);
+    sigprocmask(SIG_SETMASK, old_mask, NULL);
+    
+    worker_stats = &all_worker_stats[worker_id];
+    worker_stats->pid = getpid();
+    worker_stats->cpu = -1;
+    
+    if (pin_cpus) {
+        long cpu_count = sysconf(_SC_NPROCESSORS_ONLN);
+        int cpu = worker_id % (cpu_count > 0 ? cpu_count : 1);
+        if (pin_to_cpu(cpu) == 0) {
+            worker_stats->cpu = cpu;
+        } else {
+            printf("Worker %d: failed to pin to CPU %d: %s\n", worker_id, cpu, strerror(errno));
+        }
+    }
+    
+    int server_fd = create_listener(1);
+    if (server_fd == -1) {
+        exit(1);
+    }
+    
+    // Threads do not survive fork(), every worker starts its own log writer
+    if (access_log_start(worker_id, 1) == -1) {
+        exit(1);
+    }
+    
+    printf("Worker %d started (PID %d, CPU %d)\n", worker_id, getpid(), worker_stats->cpu);
+    exit(use_io_uring ? run_uring_loop(server_fd) : run_event_loop(server_fd));
+}
+
+// Function to fork a worker, returns its PID or -1
+static pid_t spawn_worker(int worker_id, int pin_cpus) {
+    // Reset the slot so a respawned worker starts from zero
+    memset(&all_worker_stats[worker_id], 0, sizeof(struct worker_stats));
+    all_worker_stats[worker_id].cpu = -1;
+    
+    // Block signals until the child has restored its default handlers
+    sigset_t block_mask, old_mask;
+    sigemptyset(&block_mask);
+    sigaddset(&block_mask, SIGINT);
+    sigaddset(&block_mask, SIGTERM);
+    sigaddset(&block_mask, SIGUSR1);
+    sigprocmask(SIG_BLOCK, &block_mask, &old_mask);
+    
+    pid_t pid = fork();
+    if (pid == 0) {
+        worker_main(worker_id, pin_cpus, &old_mask);
+    }
+    
+    sigprocmask(SIG_SETMASK, &old_mask, NULL);
+    if (pid < 0) {
+        printf("Fork failed for worker %d: %s\n", worker_id, strerror(errno));
+        return -1;
+    }
+    
+    all_worker_stats[worker_id].pid = pid;
+    return pid;
+}
+
+// Function to print the counters of every worker and their share of the load
+static void print_worker_stats(int worker_count) {
+    uint64_t total_requests = 0;
+    for (int i = 0; i < worker_count; i++) {
+        total_requests += __atomic_load_n(&all_worker_stats[i].requests_handled, __ATOMIC_RELAXED);
+    }
+    
+    printf("Worker stats (%d workers, %lu requests):\n", worker_count, (unsigned long)total_requests);
+    for (int i = 0; i < worker_count; i++) {
+        struct worker_stats *stats = &all_worker_stats[i];
+        uint64_t requests = __atomic_load_n(&stats->requests_handled, __ATOMIC_RELAXED);
+        printf("  worker %d (PID %d, CPU %d): %lu accepted, %lu active, %lu requests (%.1f%%), %lu bytes sent\n",
+               i, stats->pid, stats->cpu,
+               (unsigned long)__atomic_load_n(&stats->connections_accepted, __ATOMIC_RELAXED),
+               (unsigned long)__atomic_load_n(&stats->active_connections, __ATOMIC_RELAXED),
+               (unsigned long)requests,
+               total_requests ? 100.0 * requests / total_requests : 0.0,
+               (unsigned long)__atomic_load_n(&stats->bytes_sent, __ATOMIC_RELAXED));
+        printf("    gzip cache: %lu hits, %lu misses, %lu evictions, %lu bytes; %lu .gz sidecars\n",
+               (unsigned long)__atomic_load_n(&stats->gzip_cache_hits, __ATOMIC_RELAXED),
+               (unsigned long)__atomic_load_n(&stats->gzip_cache_misses, __ATOMIC_RELAXED),
+               (unsigned long)__atomic_load_n(&stats->gzip_cache_evictions, __ATOMIC_RELAXED),
+               (unsigned long)__atomic_load_n(&stats->gzip_cache_bytes, __ATOMIC_RELAXED),
+               (unsigned long)__atomic_load_n(&stats->gzip_static_hits, __ATOMIC_RELAXED));
+        printf("    file cache: %lu hits, %lu misses\n",
+               (unsigned long)__atomic_load_n(&stats->file_cache_hits, __ATOMIC_RELAXED),
+               (unsigned long)__atomic_load_n(&stats->file_cache_misses, __ATOMIC_RELAXED));
+        printf("    I/O pool: %lu jobs, %lu saturated, queue depth %lu (max %lu)\n",
+               (unsigned long)__atomic_load_n(&stats->io_pool_jobs, __ATOMIC_RELAXED),
+               (unsigned long)__atomic_load_n(&stats->io_pool_saturated, __ATOMIC_RELAXED),
+               (unsigned long)__atomic_load_n(&stats->io_pool_queue_depth, __ATOMIC_RELAXED),
+               (unsigned long)__atomic_load_n(&stats->io_pool_queue_max, __ATOMIC_RELAXED));
+        printf("    HTTP/2: %lu connections, %lu streams, %lu refused\n",
+               (unsigned long)__atomic_load_n(&stats->http2_connections, __ATOMIC_RELAXED),
+               (unsigned long)__atomic_load_n(&stats->http2_streams, __ATOMIC_RELAXED),
+               (unsigned long)__atomic_load_n(&stats->http2_streams_refused, __ATOMIC_RELAXED));
+    }
+}
+
+// Function to map the counters of every worker in memory shared across fork()
+int map_worker_stats(int count) {
+    struct worker_stats *slots = mmap(NULL, count * sizeof(struct worker_stats), PROT_READ | PROT_WRITE,
+                                      MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (slots == MAP_FAILED) {
+        printf("Failed to map worker stats: %s\n", strerror(errno));
+        return -1;
+    }
+    for (int i = 0; i < count; i++) {
+        slots[i].pid = getpid();
+        slots[i].cpu = -1;
+    }
+    all_worker_stats = slots;
+    worker_stats_count = count;
+    worker_stats = &slots[0];
+    return 0;
+}
+
+// Function to start the workers and supervise them
+int run_workers(int worker_count, int pin_cpus, int stats_interval) {
+    if (map_worker_stats(worker_count) == -1) {
+        return 1;
+    }
+    
+    // The supervisor waits for its workers itself instead of reaping them in SIGCHLD
+    signal(SIGCHLD, SIG_DFL);
+    
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sigemptyset(&sa.sa_mask);
+    sa.sa_handler = handle_shutdown;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    sa.sa_handler = handle_dump;
+    sigaction(SIGUSR1, &sa, NULL);
+    
+    for (int i = 0; i < worker_count; i++) {
+        if (spawn_worker(i, pin_cpus) == -1) {
+            shutdown_requested = 1;
+            break;
+        }
+    }
+    
+    int status = 0;
+    while (!shutdown_requested) {
+        // Interrupted early by SIGUSR1 or a shutdown signal
+        unsigned int remaining = sleep(stats_interval);
+        
+        // Respawn workers that crashed, stop if one failed on its own
+        int wstatus;
+        pid_t pid;
+        while ((pid = waitpid(-1, &wstatus, WNOHANG)) > 0) {
+            for (int i = 0; i < worker_count; i++) {
+                if (all_worker_stats[i].pid != pid) {
+                    continue;
+                }
+                if (WIFSIGNALED(wstatus) && !shutdown_requested) {
+                    printf("Worker %d (PID %d) killed by signal %d, respawning\n", i, pid, WTERMSIG(wstatus));
+                    spawn_worker(i, pin_cpus);
+                } else if (!shutdown_requested) {
+                    printf("Worker %d (PID %d) exited with status %d, shutting down\n", i, pid, WEXITSTATUS(wstatus));
+                    all_worker_stats[i].pid = 0;
+                    status = 1;
+                    shutdown_requested = 1;
+                } else {
+                    all_worker_stats[i].pid = 0;
+                }
+            }
+        }
+        
+        if (remaining == 0 || dump_requested) {
+            dump_requested = 0;
+            print_worker_stats(worker_count);
+        }
+    }
+    
+    // Stop the remaining workers
+    for (int i = 0; i < worker_count; i++) {
+        if (all_worker_stats[i].pid > 0) {
+            kill(all_worker_stats[i].pid, SIGTERM);
+        }
+    }
+    while (wait(NULL) > 0);
+    
+    print_worker_stats(worker_count);
+    return status;
+}
@@ -0,0 +1,60 @@
+#ifndef WORKERS_H
+#define WORKERS_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "metrics.h"
+#include "admission.h"
+
+// Per-worker counters, cache-line aligned so workers never share a line
+// Each worker only writes its own slot, /metrics and the supervisor sum the slots when they read them
+struct worker_stats {
+    pid_t pid;
+    int cpu;                        // Pinned CPU, or -1
+    uint64_t connections_accepted;
+    uint64_t active_connections;
+    uint64_t requests_handled;
+    uint64_t bytes_sent;
+    uint64_t bytes_received;
+    uint64_t gzip_cache_hits;
+    uint64_t gzip_cache_misses;
+    uint64_t gzip_cache_evictions;
+    uint64_t gzip_cache_bytes;      // Bytes currently held by the cache
+    uint64_t gzip_static_hits;      // Responses served from a precompressed .gz sidecar
+    uint64_t file_cache_hits;       // Opens answered without touching the filesystem
+    uint64_t file_cache_misses;
+    uint64_t gzip_input_bytes;      // Bytes fed to the compressor
+    uint64_t gzip_output_bytes;     // Bytes it produced, headers and footers included
+    uint64_t io_buffer_slabs;       // Slabs carved for the I/O buffer pool, never given back
+    uint64_t arena_large_allocations; // Request allocations too big for an arena block
+    uint64_t io_pool_jobs;          // Blocking steps completed by the I/O pool
+    uint64_t io_pool_saturated;     // Steps done on the loop because every pool queue was full
+    uint64_t io_pool_queue_depth;   // Steps queued or running right now
+    uint64_t io_pool_queue_max;     // Deepest the pool has been
+    uint64_t http2_connections;     // Connections switched to HTTP/2, by prior knowledge or Upgrade: h2c
+    uint64_t http2_streams;         // Requests received as HTTP/2 streams
+    uint64_t http2_streams_refused; // Streams reset with REFUSED_STREAM above the concurrency limit
+    uint64_t connections_rejected[LIMIT_COUNT];  // Turned away with 503 at accept
+    uint64_t timeouts[TIMEOUT_COUNT];               // Connections closed by a timeout
+    uint64_t responses[ROUTE_COUNT][METRICS_STATUS_COUNT];
+    struct latency_histogram phases[PHASE_COUNT];
+    struct latency_histogram io_pool_wait;  // Step queued -> picked up by a pool thread
+} __attribute__((aligned(64)));
+
+// Counters of the current process
+extern struct worker_stats *worker_stats;
+
+// Slots of every worker, in memory shared with the processes forked afterwards
+extern struct worker_stats *all_worker_stats;
+extern int worker_stats_count;
+
+// Map count shared slots and point worker_stats at the first, returns -1 on failure
+// A single-process server maps one slot so that fork-model children count into it too
+int map_worker_stats(int count);
+
+// Fork worker_count event-loop workers, each with its own SO_REUSEPORT listener
+// The calling process supervises them and prints their counters every stats_interval seconds
+int run_workers(int worker_count, int pin_cpus, int stats_interval);
+
+#endif